@@ -23,6 +23,18 @@ struct bin_file_data {
     uint32_t cdw13;
 };
 
+/*
+ * tpoint_name of the records:
+ *   NVME_IO_SUBMIT    command dwords of a submitted I/O
+ *   NVME_IO_COMPLETE  cid / cpl and tsc_sc_time of its completion
+ *   NVME_DSM_RANGE    one range of the next dataset management command the
+ *                     lcore submits: slba in cdw10 / cdw11, length in blocks
+ *                     in cdw12, context attributes in cdw13. The range list
+ *                     is not part of the command, so these only exist when the
+ *                     application logs them; a single record may carry the
+ *                     aggregate span.
+ */
+
 /* in spdk/nvme_spec.h
 
 // NVM command set opcodes
@@ -7,8 +7,13 @@
 #include "spdk/vmd.h"
 #include "spdk/nvme_zns.h"
 #include "spdk/nvme_spec.h"
+#include "spdk/histogram_data.h"
 #include "../include/trace_io.h"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 struct ctrlr_entry {
     struct spdk_nvme_ctrlr *ctrlr;
     TAILQ_ENTRY(ctrlr_entry) link;
@@ -28,6 +33,8 @@ static struct spdk_nvme_transport_id g_trid = {};
 static bool g_print_tsc = false;
 static bool g_print_trace = false;
 static bool g_input_file = false;
+static bool g_qd_report = false;
+static bool g_group_report = false;
 
 static float
 get_us_from_tsc(uint64_t tsc, uint64_t tsc_rate)
@@ -45,6 +52,401 @@ print_uline(char marker, int line_len)
     putchar('\n');
 }
 
+/* trace table start */
+/*
+ * The trace is held column by column: one pass over the file turns the
+ * tracepoint name into a kind byte and the command dwords into typed
+ * columns, and every analysis afterwards walks plain arrays.
+ */
+enum trace_kind {
+    TRACE_KIND_OTHER,
+    TRACE_KIND_SUBMIT,
+    TRACE_KIND_COMPLETE,
+    TRACE_KIND_DSM_RANGE,
+};
+
+static const char *g_trace_kind_name[] = {"UNKNOWN", "NVME_IO_SUBMIT", "NVME_IO_COMPLETE", "NVME_DSM_RANGE"};
+
+#define TRACE_OPC_NONE 0xFF /* opc column of records that carry no command */
+#define TRACE_LOAD_CHUNK 65536
+
+struct trace_table {
+    uint64_t cnt;
+    uint64_t tsc_rate;
+    uint8_t  *kind;
+    uint8_t  *opc;
+    uint32_t *lcore;
+    uint32_t *nsid;
+    uint16_t *cid;
+    uint32_t *cpl;
+    uint64_t *tsc;
+    uint64_t *slba;         /* cdw10 | cdw11 << 32 */
+    uint32_t *nlb;          /* (cdw12 & 0xFFFF) + 1 */
+    uint32_t *cdw12;        /* DSM ranges: length in blocks */
+    uint32_t *cdw13;
+    uint64_t *lat;          /* submit to complete, completions only */
+    uint64_t *obj_id;
+    uint64_t *obj_start;
+    /* row numbers of every submit / completion, in trace order */
+    uint32_t *sub;
+    uint64_t sub_cnt;
+    uint32_t *cmp;
+    uint64_t cmp_cnt;
+};
+
+/* Aggregate of a u64 column over the rows of one kind */
+struct trace_agg {
+    uint64_t cnt;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+};
+
+static uint64_t
+trace_count_u8_scalar(const uint8_t *col, uint64_t n, uint8_t val)
+{
+    uint64_t cnt = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        cnt += col[i] == val;
+    }
+    return cnt;
+}
+
+/* Row numbers in [from, n) whose value matches, branch free: always store, advance on a match */
+static uint64_t
+trace_select_u8_tail(const uint8_t *col, uint64_t from, uint64_t n, uint8_t val, uint32_t *out)
+{
+    uint64_t cnt = 0;
+
+    for (uint64_t i = from; i < n; i++) {
+        out[cnt] = (uint32_t)i;
+        cnt += col[i] == val;
+    }
+    return cnt;
+}
+
+static uint64_t
+trace_select_u8_scalar(const uint8_t *col, uint64_t n, uint8_t val, uint32_t *out)
+{
+    return trace_select_u8_tail(col, 0, n, val, out);
+}
+
+static void
+trace_agg_u64_scalar(const uint8_t *kind, const uint64_t *col, uint64_t n, uint8_t k,
+                     struct trace_agg *agg)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        if (kind[i] != k) {
+            continue;
+        }
+        agg->cnt++;
+        agg->min = spdk_min(agg->min, col[i]);
+        agg->max = spdk_max(agg->max, col[i]);
+        agg->sum += col[i];
+    }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2"))) static uint64_t
+trace_count_u8_avx2(const uint8_t *col, uint64_t n, uint8_t val)
+{
+    __m256i v = _mm256_set1_epi8((char)val);
+    uint64_t cnt = 0, i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(col + i));
+        cnt += __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, v)));
+    }
+    return cnt + trace_count_u8_scalar(col + i, n - i, val);
+}
+
+__attribute__((target("avx2,bmi"))) static uint64_t
+trace_select_u8_avx2(const uint8_t *col, uint64_t n, uint8_t val, uint32_t *out)
+{
+    __m256i v = _mm256_set1_epi8((char)val);
+    uint64_t cnt = 0, i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(col + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, v));
+
+        while (m) {
+            out[cnt++] = (uint32_t)(i + __builtin_ctz(m));
+            m &= m - 1;
+        }
+    }
+    return cnt + trace_select_u8_tail(col, i, n, val, out + cnt);
+}
+
+/* AVX2 has no unsigned 64-bit compare: flip the sign bit and compare signed */
+__attribute__((target("avx2"))) static void
+trace_agg_u64_avx2(const uint8_t *kind, const uint64_t *col, uint64_t n, uint8_t k,
+                   struct trace_agg *agg)
+{
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m256i kv = _mm256_set1_epi64x(k);
+    __m256i vmin = _mm256_set1_epi64x(-1), vmax = _mm256_setzero_si256();
+    __m256i vsum = _mm256_setzero_si256(), vcnt = _mm256_setzero_si256();
+    uint64_t i = 0, lane[4];
+
+    for (; i + 4 <= n; i += 4) {
+        uint32_t kinds;
+        memcpy(&kinds, kind + i, sizeof(kinds));
+        __m256i sel = _mm256_cmpeq_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128((int)kinds)), kv);
+        __m256i c = _mm256_loadu_si256((const __m256i *)(col + i));
+        __m256i cs = _mm256_xor_si256(c, sign);
+
+        __m256i lt = _mm256_and_si256(sel, _mm256_cmpgt_epi64(_mm256_xor_si256(vmin, sign), cs));
+        vmin = _mm256_blendv_epi8(vmin, c, lt);
+        __m256i gt = _mm256_and_si256(sel, _mm256_cmpgt_epi64(cs, _mm256_xor_si256(vmax, sign)));
+        vmax = _mm256_blendv_epi8(vmax, c, gt);
+        vsum = _mm256_add_epi64(vsum, _mm256_and_si256(c, sel));
+        vcnt = _mm256_sub_epi64(vcnt, sel);
+    }
+
+    _mm256_storeu_si256((__m256i *)lane, vcnt);
+    for (int l = 0; l < 4; l++) {
+        agg->cnt += lane[l];
+    }
+    _mm256_storeu_si256((__m256i *)lane, vsum);
+    for (int l = 0; l < 4; l++) {
+        agg->sum += lane[l];
+    }
+    _mm256_storeu_si256((__m256i *)lane, vmin);
+    for (int l = 0; l < 4; l++) {
+        agg->min = spdk_min(agg->min, lane[l]);
+    }
+    _mm256_storeu_si256((__m256i *)lane, vmax);
+    for (int l = 0; l < 4; l++) {
+        agg->max = spdk_max(agg->max, lane[l]);
+    }
+    trace_agg_u64_scalar(kind + i, col + i, n - i, k, agg);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static uint64_t
+trace_count_u8_avx512(const uint8_t *col, uint64_t n, uint8_t val)
+{
+    __m512i v = _mm512_set1_epi8((char)val);
+    uint64_t cnt = 0, i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        cnt += __builtin_popcountll(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512(col + i), v));
+    }
+    return cnt + trace_count_u8_scalar(col + i, n - i, val);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static uint64_t
+trace_select_u8_avx512(const uint8_t *col, uint64_t n, uint8_t val, uint32_t *out)
+{
+    __m512i v = _mm512_set1_epi8((char)val);
+    const __m512i step = _mm512_set1_epi32(16);
+    uint64_t cnt = 0, i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        uint64_t m = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(col + i), v);
+        __m512i idx = _mm512_add_epi32(_mm512_set1_epi32((int)i),
+                _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+        /* compress the matching row numbers out 16 at a time */
+        for (int q = 0; q < 4; q++, m >>= 16, idx = _mm512_add_epi32(idx, step)) {
+            __mmask16 mq = (__mmask16)(m & 0xFFFF);
+            _mm512_mask_compressstoreu_epi32(out + cnt, mq, idx);
+            cnt += __builtin_popcount(mq);
+        }
+    }
+    return cnt + trace_select_u8_tail(col, i, n, val, out + cnt);
+}
+
+__attribute__((target("avx512f"))) static void
+trace_agg_u64_avx512(const uint8_t *kind, const uint64_t *col, uint64_t n, uint8_t k,
+                     struct trace_agg *agg)
+{
+    const __m512i kv = _mm512_set1_epi64(k);
+    __m512i vmin = _mm512_set1_epi64(-1), vmax = _mm512_setzero_si512(), vsum = _mm512_setzero_si512();
+    uint64_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t kinds;
+        memcpy(&kinds, kind + i, sizeof(kinds));
+        __mmask8 sel = _mm512_cmpeq_epi64_mask(_mm512_cvtepu8_epi64(_mm_cvtsi64_si128((long long)kinds)), kv);
+        __m512i c = _mm512_loadu_si512(col + i);
+
+        vmin = _mm512_mask_min_epu64(vmin, sel, vmin, c);
+        vmax = _mm512_mask_max_epu64(vmax, sel, vmax, c);
+        vsum = _mm512_mask_add_epi64(vsum, sel, vsum, c);
+        agg->cnt += __builtin_popcount(sel);
+    }
+
+    agg->min = spdk_min(agg->min, (uint64_t)_mm512_reduce_min_epu64(vmin));
+    agg->max = spdk_max(agg->max, (uint64_t)_mm512_reduce_max_epu64(vmax));
+    agg->sum += (uint64_t)_mm512_reduce_add_epi64(vsum);
+    trace_agg_u64_scalar(kind + i, col + i, n - i, k, agg);
+}
+#endif
+
+static uint64_t (*trace_count_u8)(const uint8_t *, uint64_t, uint8_t) = trace_count_u8_scalar;
+static uint64_t (*trace_select_u8)(const uint8_t *, uint64_t, uint8_t, uint32_t *) = trace_select_u8_scalar;
+static void (*trace_agg_u64_fn)(const uint8_t *, const uint64_t *, uint64_t, uint8_t,
+                                struct trace_agg *) = trace_agg_u64_scalar;
+
+/* Pick the widest kernels the CPU runs */
+static void
+trace_kernels_init(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        trace_count_u8 = trace_count_u8_avx512;
+        trace_select_u8 = trace_select_u8_avx512;
+        trace_agg_u64_fn = trace_agg_u64_avx512;
+        return;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi")) {
+        trace_count_u8 = trace_count_u8_avx2;
+        trace_select_u8 = trace_select_u8_avx2;
+        trace_agg_u64_fn = trace_agg_u64_avx2;
+        return;
+    }
+#endif
+}
+
+static void
+trace_agg_u64(const struct trace_table *t, const uint64_t *col, enum trace_kind k, struct trace_agg *agg)
+{
+    agg->cnt = 0;
+    agg->min = UINT64_MAX;
+    agg->max = 0;
+    agg->sum = 0;
+    trace_agg_u64_fn(t->kind, col, t->cnt, (uint8_t)k, agg);
+    if (agg->cnt == 0) {
+        agg->min = 0;
+    }
+}
+
+static void
+trace_table_free(struct trace_table *t)
+{
+    free(t->kind);
+    free(t->opc);
+    free(t->lcore);
+    free(t->nsid);
+    free(t->cid);
+    free(t->cpl);
+    free(t->tsc);
+    free(t->slba);
+    free(t->nlb);
+    free(t->cdw12);
+    free(t->cdw13);
+    free(t->lat);
+    free(t->obj_id);
+    free(t->obj_start);
+    free(t->sub);
+    free(t->cmp);
+    memset(t, 0, sizeof(*t));
+}
+
+static int
+trace_table_alloc(struct trace_table *t, uint64_t cnt)
+{
+    uint64_t n = spdk_max(cnt, 1);
+
+    memset(t, 0, sizeof(*t));
+    t->kind = (uint8_t *)malloc(n);
+    t->opc = (uint8_t *)malloc(n);
+    t->lcore = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->nsid = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->cid = (uint16_t *)malloc(n * sizeof(uint16_t));
+    t->cpl = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->tsc = (uint64_t *)malloc(n * sizeof(uint64_t));
+    t->slba = (uint64_t *)malloc(n * sizeof(uint64_t));
+    t->nlb = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->cdw12 = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->cdw13 = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->lat = (uint64_t *)malloc(n * sizeof(uint64_t));
+    t->obj_id = (uint64_t *)malloc(n * sizeof(uint64_t));
+    t->obj_start = (uint64_t *)malloc(n * sizeof(uint64_t));
+    t->sub = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->cmp = (uint32_t *)malloc(n * sizeof(uint32_t));
+    if (!t->kind || !t->opc || !t->lcore || !t->nsid || !t->cid || !t->cpl || !t->tsc || !t->slba ||
+        !t->nlb || !t->cdw12 || !t->cdw13 || !t->lat || !t->obj_id || !t->obj_start || !t->sub || !t->cmp) {
+        trace_table_free(t);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void
+trace_table_set(struct trace_table *t, uint64_t i, const struct bin_file_data *d)
+{
+    if (strcmp(d->tpoint_name, "NVME_IO_SUBMIT") == 0) {
+        t->kind[i] = TRACE_KIND_SUBMIT;
+    } else if (strcmp(d->tpoint_name, "NVME_IO_COMPLETE") == 0) {
+        t->kind[i] = TRACE_KIND_COMPLETE;
+    } else if (strcmp(d->tpoint_name, "NVME_DSM_RANGE") == 0) {
+        t->kind[i] = TRACE_KIND_DSM_RANGE;
+    } else {
+        t->kind[i] = TRACE_KIND_OTHER;
+    }
+    t->opc[i] = t->kind[i] == TRACE_KIND_SUBMIT ? (uint8_t)d->opc : TRACE_OPC_NONE;
+    t->lcore[i] = d->lcore;
+    t->nsid[i] = d->nsid;
+    t->cid[i] = d->cid;
+    t->cpl[i] = d->cpl;
+    t->tsc[i] = d->tsc_timestamp;
+    t->slba[i] = (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32;
+    t->nlb[i] = (d->cdw12 & UINT16BIT_MASK) + 1;
+    t->cdw12[i] = d->cdw12;
+    t->cdw13[i] = d->cdw13;
+    t->lat[i] = t->kind[i] == TRACE_KIND_COMPLETE ? d->tsc_sc_time : 0;
+    t->obj_id[i] = d->obj_id;
+    t->obj_start[i] = d->obj_start;
+}
+
+/* Stream the file in chunks straight into the columns */
+static int
+trace_table_load(struct trace_table *t, FILE *fptr, uint64_t cnt)
+{
+    struct bin_file_data *chunk;
+    uint64_t done = 0;
+
+    if (cnt > UINT32_MAX) {
+        fprintf(stderr, "Trace has more than %u records\n", UINT32_MAX);
+        return -E2BIG;
+    }
+    chunk = (struct bin_file_data *)malloc(TRACE_LOAD_CHUNK * sizeof(struct bin_file_data));
+    if (chunk == NULL || trace_table_alloc(t, cnt)) {
+        fprintf(stderr, "Fail to allocate memory for trace table\n");
+        free(chunk);
+        return -ENOMEM;
+    }
+
+    while (done < cnt) {
+        size_t want = (size_t)spdk_min(cnt - done, TRACE_LOAD_CHUNK);
+
+        if (fread(chunk, sizeof(struct bin_file_data), want, fptr) != want) {
+            fprintf(stderr, "Fail to read input file\n");
+            free(chunk);
+            trace_table_free(t);
+            return -EIO;
+        }
+        if (done == 0) {
+            t->tsc_rate = chunk[0].tsc_rate;
+        }
+        for (size_t i = 0; i < want; i++) {
+            trace_table_set(t, done + i, &chunk[i]);
+        }
+        done += want;
+    }
+    free(chunk);
+
+    t->cnt = cnt;
+    t->sub_cnt = trace_select_u8(t->kind, cnt, TRACE_KIND_SUBMIT, t->sub);
+    t->cmp_cnt = trace_select_u8(t->kind, cnt, TRACE_KIND_COMPLETE, t->cmp);
+    return 0;
+}
+/* trace table end */
+
 /* initialize NVMe controllers start */
 static void
 register_ns(struct spdk_nvme_ctrlr *ctrlr, struct spdk_nvme_ns *ns)
@@ -156,13 +558,11 @@ iosize_rw_counter(uint8_t opc, uint32_t nlb, uint32_t *r_iosize, uint32_t *w_ios
     switch (opc) {
     case SPDK_NVME_OPC_READ:
     case SPDK_NVME_OPC_COMPARE: 
-        g_read_cnt++;
         r_iosize[nlb]++;
         break;
     case SPDK_NVME_OPC_WRITE:
     case SPDK_NVME_OPC_ZONE_APPEND:
     case SPDK_NVME_OPC_WRITE_ZEROES:
-        g_write_cnt++;
         w_iosize[nlb]++;
         break;
     case SPDK_NVME_OPC_WRITE_UNCORRECTABLE:
@@ -183,81 +583,11 @@ iosize_rw_counter(uint8_t opc, uint32_t nlb, uint32_t *r_iosize, uint32_t *w_ios
     return 0;
 }
 
-struct latency {
-	uint64_t val;
-	TAILQ_ENTRY(latency) link;
-};
-
-static TAILQ_HEAD(latency_list, latency) g_latency_sum = TAILQ_HEAD_INITIALIZER(g_latency_sum);
 static uint64_t g_tsc_rate = 0;
 static uint64_t g_latency_tsc_min = 0, g_latency_tsc_max = 0, g_latency_tsc_avg = 0;
+static uint64_t g_latency_tsc_sum = 0, g_latency_cnt = 0;
 static float g_latency_us_min = 0.0, g_latency_us_max = 0.0, g_latency_us_avg = 0.0;
 
-static void
-latency_min_max(uint64_t tsc_sc_time, uint64_t tsc_rate)
-{
-    g_latency_tsc_max = (tsc_sc_time > g_latency_tsc_max) ? tsc_sc_time : g_latency_tsc_max;
-
-    if (!g_latency_tsc_min || tsc_sc_time < g_latency_tsc_min) {
-        g_latency_tsc_min = tsc_sc_time;
-    } else {
-        g_latency_tsc_min = g_latency_tsc_min;
-    }
-    g_latency_us_max = get_us_from_tsc(g_latency_tsc_max, tsc_rate);
-    g_latency_us_min = get_us_from_tsc(g_latency_tsc_min, tsc_rate);
-}
-
-static void
-latency_total(uint64_t tsc_sc_time)
-{
-    if (TAILQ_EMPTY(&g_latency_sum)) {
-        struct latency *latency_entry = (struct latency *)malloc(sizeof(struct latency));
-        if (latency_entry == NULL) {
-            fprintf(stderr, "Fail to allocate memory for latency entry\n");
-            return;
-        }
-        TAILQ_INSERT_TAIL(&g_latency_sum, latency_entry, link);
-        TAILQ_LAST(&g_latency_sum, latency_list)->val = 0;
-    }
-    if (tsc_sc_time < UINT64_MAX - TAILQ_LAST(&g_latency_sum, latency_list)->val) {
-        TAILQ_LAST(&g_latency_sum, latency_list)->val += tsc_sc_time;
-    } else {
-        struct latency *latency_entry = (struct latency *)malloc(sizeof(struct latency));
-        if (latency_entry == NULL) {
-            fprintf(stderr, "Fail to allocate memory for latency entry\n");
-            struct latency *cur, *tmp;
-            TAILQ_FOREACH_SAFE(cur, &g_latency_sum, link, tmp) {
-                TAILQ_REMOVE(&g_latency_sum, cur, link);
-                free(cur);
-            }
-            return;
-        }
-        TAILQ_INSERT_TAIL(&g_latency_sum, latency_entry, link);
-        TAILQ_LAST(&g_latency_sum, latency_list)->val += tsc_sc_time;
-    }
-}
-
-static void
-latency_avg(int number_of_io)
-{
-    if (number_of_io == 0) 
-        return;
-    
-    if (TAILQ_EMPTY(&g_latency_sum)) {
-        fprintf(stderr, "No latency entry\n");
-        return;
-    }
-
-    struct latency *cur, *tmp;
-    TAILQ_FOREACH_SAFE(cur, &g_latency_sum, link, tmp) {
-        g_latency_tsc_avg += (float)cur->val / number_of_io;
-        TAILQ_REMOVE(&g_latency_sum, cur, link);
-        free(cur);
-    }
-    
-    g_latency_us_avg = get_us_from_tsc(g_latency_tsc_avg, g_tsc_rate);
-}
-
 static int
 blk_counter(uint8_t opc, uint64_t slba, uint16_t nlb, uint16_t *r_blk, uint16_t *w_blk)
 {
@@ -298,42 +628,52 @@ blk_counter(uint8_t opc, uint64_t slba, uint16_t nlb, uint16_t *r_blk, uint16_t
 }
 
 static int
-process_latency_iosize(struct bin_file_data *d, uint32_t *r_iosize, uint32_t *w_iosize)
+process_latency_iosize(const struct trace_table *trace, uint32_t *r_iosize, uint32_t *w_iosize)
 {
-    if (!g_tsc_rate) { /* for calculate g_latency_us_avg */
-        g_tsc_rate = d->tsc_rate;
-    }
+    struct trace_agg lat;
+    int rc = 0;
 
-    int rc;
-    uint32_t nlb = d->cdw12 & UINT16BIT_MASK;
-    if (strcmp(d->tpoint_name, "NVME_IO_SUBMIT") == 0) {
-        rc = iosize_rw_counter(d->opc, nlb, r_iosize, w_iosize);
+    g_tsc_rate = trace->tsc_rate;
+    g_read_cnt = trace_count_u8(trace->opc, trace->cnt, SPDK_NVME_OPC_READ) +
+                 trace_count_u8(trace->opc, trace->cnt, SPDK_NVME_OPC_COMPARE);
+    g_write_cnt = trace_count_u8(trace->opc, trace->cnt, SPDK_NVME_OPC_WRITE) +
+                  trace_count_u8(trace->opc, trace->cnt, SPDK_NVME_OPC_ZONE_APPEND) +
+                  trace_count_u8(trace->opc, trace->cnt, SPDK_NVME_OPC_WRITE_ZEROES);
+
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        uint32_t i = trace->sub[j];
+
+        rc = iosize_rw_counter(trace->opc[i], trace->nlb[i] - 1, r_iosize, w_iosize);
         if (rc) {
             printf("Unknown Opcode\n");
             return rc;
         }
     }
 
-    if (strcmp(d->tpoint_name, "NVME_IO_COMPLETE") == 0) {
-        latency_min_max(d->tsc_sc_time, d->tsc_rate);
-        latency_total(d->tsc_sc_time);
+    trace_agg_u64(trace, trace->lat, TRACE_KIND_COMPLETE, &lat);
+    g_latency_tsc_min = lat.min;
+    g_latency_tsc_max = lat.max;
+    g_latency_tsc_avg = lat.cnt ? lat.sum / lat.cnt : 0;
+    g_latency_tsc_sum = lat.sum;
+    g_latency_cnt = lat.cnt;
+    if (g_tsc_rate) {
+        g_latency_us_min = get_us_from_tsc(g_latency_tsc_min, g_tsc_rate);
+        g_latency_us_max = get_us_from_tsc(g_latency_tsc_max, g_tsc_rate);
+        g_latency_us_avg = get_us_from_tsc(g_latency_tsc_avg, g_tsc_rate);
     }
 
     return rc;
 }
 
 static int
-process_num_rw(struct bin_file_data *d, uint16_t *r_blk, uint16_t *w_blk)
+process_num_rw(const struct trace_table *trace, uint32_t i, uint16_t *r_blk, uint16_t *w_blk)
 {
-    int rc;
-    uint64_t slba = 0;    
-    if (strcmp(d->tpoint_name, "NVME_IO_SUBMIT") == 0 && d->opc != SPDK_NVME_OPC_DATASET_MANAGEMENT) {
-        slba = (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32;
+    int rc = 0;
+    uint8_t opc = trace->opc[i];
 
-        if (d->opc != SPDK_NVME_OPC_ZONE_MGMT_RECV && d->opc != SPDK_NVME_OPC_COPY) {
-            uint32_t nlb = (d->cdw12 & UINT16BIT_MASK) + 1;
-            rc = blk_counter(d->opc, slba, nlb, r_blk, w_blk);
-        }
+    if (opc != SPDK_NVME_OPC_DATASET_MANAGEMENT && opc != SPDK_NVME_OPC_ZONE_MGMT_RECV &&
+        opc != SPDK_NVME_OPC_COPY) {
+        rc = blk_counter(opc, trace->slba[i], trace->nlb[i], r_blk, w_blk);
     }
     if (rc) {
         printf("Count block read / write fail\n");
@@ -344,87 +684,383 @@ process_num_rw(struct bin_file_data *d, uint16_t *r_blk, uint16_t *w_blk)
 }
 /* trace analysis end */
 
-/* print trace start */
-static const char *
-format_argname(const char *name)
+/* queue depth start */
+#define QD_LAT_BUCKETS 32 /* latency by QD at submit, log2 QD buckets: 1, 2, 3-4, 5-8, ... */
+
+struct qd_event {
+    uint64_t tsc;
+    uint64_t lat;   /* tsc_sc_time of the I/O, carried by the submit event */
+    uint32_t lcore;
+    int32_t  delta; /* +1 on submit, -1 on complete */
+};
+
+struct qd_stat {
+    uint64_t *time_at_qd; /* tsc spent at each queue depth */
+    uint64_t size;        /* number of entries in time_at_qd */
+    uint64_t cur;
+    uint64_t peak;
+    uint64_t last_tsc;
+};
+
+static struct spdk_histogram_data *g_qd_lat[QD_LAT_BUCKETS];
+static uint64_t g_qd_lat_cnt[QD_LAT_BUCKETS];
+
+struct percentile_ctx {
+    double   cutoff;
+    uint64_t val;
+    bool     found;
+};
+
+static void
+check_cutoff(void *ctx, uint64_t start, uint64_t end, uint64_t count,
+             uint64_t total, uint64_t so_far)
 {
-    static char namebuf[16];
+    struct percentile_ctx *p = (struct percentile_ctx *)ctx;
 
-    snprintf(namebuf, sizeof(namebuf), "%s: ", name);
-    return namebuf;
+    if (p->found || count == 0) {
+        return;
+    }
+    if ((double)so_far / total >= p->cutoff) {
+        p->val = end;
+        p->found = true;
+    }
 }
 
-static void
-print_ptr(const char *arg_string, uint64_t arg)
+/* Upper bound of the histogram bucket holding the given percentile (0 - 100) */
+static uint64_t
+histogram_percentile(const struct spdk_histogram_data *h, double pct)
 {
-    printf("%-7.7s0x%-16jx ", format_argname(arg_string), arg);
+    struct percentile_ctx ctx = { .cutoff = pct / 100, .val = 0, .found = false };
+
+    spdk_histogram_data_iterate(h, check_cutoff, &ctx);
+    return ctx.val;
 }
 
-static void
-print_uint64(const char *arg_string, uint64_t arg)
+static int
+qd_event_cmp(const void *a, const void *b)
+{
+    const struct qd_event *x = (const struct qd_event *)a;
+    const struct qd_event *y = (const struct qd_event *)b;
+
+    if (x->tsc != y->tsc) {
+        return x->tsc < y->tsc ? -1 : 1;
+    }
+    /* retire completions before new submissions at the same tick */
+    return x->delta - y->delta;
+}
+
+/* Log2 bucket of v: 0 for v <= 1, then (2^(idx-1), 2^idx], clamped to the last bucket */
+static uint32_t
+log2_bucket(uint64_t v, uint32_t buckets)
 {
-	printf("%-7.7s%-16jd ", format_argname(arg_string), arg);
+    uint32_t idx = v > 1 ? 64 - __builtin_clzll(v - 1) : 0;
+
+    return spdk_min(idx, buckets - 1);
 }
 
 static void
-print_float(const char *arg_string, float arg)
+format_range(uint64_t lo, uint64_t hi, char *buf, size_t len)
 {
-    printf("%-7.7s%-13.3f ", format_argname(arg_string), arg);
+    if (lo == hi) {
+        snprintf(buf, len, "%ju", lo);
+    } else {
+        snprintf(buf, len, "%ju-%ju", lo, hi);
+    }
 }
 
 static void
-set_zone_act_name (uint8_t opc, uint64_t zone_act, const char **zone_act_name) 
+format_log2_bucket(uint32_t idx, char *buf, size_t len)
 {
-    if (opc ==  SPDK_NVME_OPC_ZONE_MGMT_SEND) {
-        switch (zone_act) {
-        case SPDK_NVME_ZONE_CLOSE:
-            *zone_act_name = "CLOSE ZONE";
-            break;
-        case SPDK_NVME_ZONE_FINISH:
-            *zone_act_name = "FINISH ZONE";
-            break;
-        case SPDK_NVME_ZONE_OPEN:
-            *zone_act_name = "OPEN ZONE";
-            break;
-        case SPDK_NVME_ZONE_RESET:
-            *zone_act_name = "RESET ZONE";
-            break;
-        case SPDK_NVME_ZONE_OFFLINE:
-            *zone_act_name = "OFFLINE ZONE";
-            break;
-        case SPDK_NVME_ZONE_SET_ZDE:
-            *zone_act_name = "SET ZONE DESC";
-            break;
-        default:
-            break;
+    format_range(idx ? (1ULL << (idx - 1)) + 1 : 1, 1ULL << idx, buf, len);
+}
+
+/* Charge the time since the last event to the current queue depth */
+static int
+qd_stat_account(struct qd_stat *s, uint64_t tsc)
+{
+    if (s->cur >= s->size) {
+        uint64_t size = spdk_max(s->size * 2, s->cur + 1);
+        uint64_t *t = (uint64_t *)realloc(s->time_at_qd, size * sizeof(uint64_t));
+        if (t == NULL) {
+            fprintf(stderr, "Fail to allocate memory for queue depth histogram\n");
+            return -ENOMEM;
         }
-    } else if (opc == SPDK_NVME_OPC_ZONE_MGMT_RECV){
-        switch (zone_act) {
-        case SPDK_NVME_ZONE_REPORT:
-            *zone_act_name = "REPORT ZONE";
-            break;
-        case SPDK_NVME_ZONE_EXTENDED_REPORT:
-            *zone_act_name = "EXT REPORT ZONE";
-            break;
-        default:
-            break;
+        memset(t + s->size, 0, (size - s->size) * sizeof(uint64_t));
+        s->time_at_qd = t;
+        s->size = size;
+    }
+
+    s->time_at_qd[s->cur] += tsc - s->last_tsc;
+    s->last_tsc = tsc;
+    return 0;
+}
+
+static int
+qd_stat_update(struct qd_stat *s, uint64_t tsc, int32_t delta)
+{
+    int rc = qd_stat_account(s, tsc);
+    if (rc) {
+        return rc;
+    }
+
+    if (delta > 0) {
+        s->cur++;
+        s->peak = spdk_max(s->peak, s->cur);
+    } else if (s->cur) {
+        s->cur--;
+    }
+    return 0;
+}
+
+/* Time-weighted QD percentile (0 - 100) */
+static uint64_t
+qd_stat_percentile(const struct qd_stat *s, uint64_t span, double pct)
+{
+    uint64_t so_far = 0;
+
+    for (uint64_t qd = 0; qd < s->size; qd++) {
+        so_far += s->time_at_qd[qd];
+        if (so_far && (double)so_far / span * 100 >= pct) {
+            return qd;
         }
-    } else {
-        *zone_act_name = "unknown";
     }
+    return s->peak;
+}
+
+static double
+qd_stat_avg(const struct qd_stat *s, uint64_t span)
+{
+    double area = 0;
+
+    if (!span) {
+        return 0;
+    }
+    for (uint64_t qd = 0; qd < s->size; qd++) {
+        area += (double)qd * s->time_at_qd[qd];
+    }
+    return area / span;
 }
 
 static void
-set_opc_name(uint64_t opc, const char **opc_name)
+print_qd_stat(const char *name, const struct qd_stat *s, uint64_t span)
 {
-    switch (opc) {
-    case SPDK_NVME_OPC_FLUSH:
-        *opc_name = "FLUSH";
-        break;
-    case SPDK_NVME_OPC_WRITE:
-        *opc_name = "WRITE";
-        break;
-    case SPDK_NVME_OPC_READ:
+    printf("%-15s  PEAK: %-8ju AVG: %-10.3f P50: %-8ju P90: %-8ju P99: %-8ju P99.9: %-8ju\n",
+            name, s->peak, qd_stat_avg(s, span), qd_stat_percentile(s, span, 50),
+            qd_stat_percentile(s, span, 90), qd_stat_percentile(s, span, 99),
+            qd_stat_percentile(s, span, 99.9));
+}
+
+static int
+process_queue_depth(const struct trace_table *trace)
+{
+    int rc = 0;
+    uint64_t io_cnt = 0;
+    uint32_t max_lcore = 0;
+    struct qd_stat total = {};
+    struct qd_stat *lcore_qd = NULL;
+
+    if (!g_tsc_rate) {
+        g_tsc_rate = trace->tsc_rate;
+    }
+
+    /* each completion carries both ends of its I/O: obj_start and obj_start + tsc_sc_time */
+    struct qd_event *ev = (struct qd_event *)malloc((trace->cmp_cnt + 1) * 2 * sizeof(struct qd_event));
+    if (ev == NULL) {
+        fprintf(stderr, "Fail to allocate memory for queue depth events\n");
+        return -ENOMEM;
+    }
+
+    for (uint64_t j = 0; j < trace->cmp_cnt; j++) {
+        uint32_t i = trace->cmp[j];
+
+        ev[io_cnt * 2] = (struct qd_event) { trace->obj_start[i], trace->lat[i], trace->lcore[i], 1 };
+        ev[io_cnt * 2 + 1] = (struct qd_event) { trace->obj_start[i] + trace->lat[i], 0, trace->lcore[i], -1 };
+        max_lcore = spdk_max(max_lcore, trace->lcore[i]);
+        io_cnt++;
+    }
+
+    print_uline('=', printf("\nQueue Depth\n"));
+    if (!io_cnt) {
+        printf("No completed I/O\n");
+        goto out;
+    }
+
+    qsort(ev, io_cnt * 2, sizeof(struct qd_event), qd_event_cmp);
+
+    lcore_qd = (struct qd_stat *)calloc(max_lcore + 1, sizeof(struct qd_stat));
+    if (lcore_qd == NULL) {
+        fprintf(stderr, "Fail to allocate memory for lcore queue depth\n");
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    /* every lcore is accounted over the whole capture so averages are comparable */
+    uint64_t first_tsc = ev[0].tsc;
+    uint64_t last_tsc = ev[io_cnt * 2 - 1].tsc;
+    uint64_t span = last_tsc - first_tsc;
+    total.last_tsc = first_tsc;
+    for (uint32_t lcore = 0; lcore <= max_lcore; lcore++) {
+        lcore_qd[lcore].last_tsc = first_tsc;
+    }
+
+    double lat_sum = 0;
+    for (uint64_t i = 0; i < io_cnt * 2; i++) {
+        struct qd_event *e = &ev[i];
+
+        if (e->delta > 0) {
+            /* QD seen by this I/O, itself included */
+            uint32_t idx = log2_bucket(total.cur + 1, QD_LAT_BUCKETS);
+            if (!g_qd_lat[idx]) {
+                g_qd_lat[idx] = spdk_histogram_data_alloc();
+                if (!g_qd_lat[idx]) {
+                    fprintf(stderr, "Fail to allocate memory for latency histogram\n");
+                    rc = -ENOMEM;
+                    goto out;
+                }
+            }
+            spdk_histogram_data_tally(g_qd_lat[idx], e->lat);
+            g_qd_lat_cnt[idx]++;
+            lat_sum += e->lat;
+        }
+
+        rc = qd_stat_update(&total, e->tsc, e->delta);
+        if (!rc) {
+            rc = qd_stat_update(&lcore_qd[e->lcore], e->tsc, e->delta);
+        }
+        if (rc) {
+            goto out;
+        }
+    }
+
+    printf("Completed I/O: %ju  Span: %.3f (us)\n", io_cnt, get_us_from_tsc(span, g_tsc_rate));
+    print_qd_stat("overall", &total, span);
+    for (uint32_t lcore = 0; lcore <= max_lcore; lcore++) {
+        char name[16];
+
+        if (!lcore_qd[lcore].peak) {
+            continue;
+        }
+        rc = qd_stat_account(&lcore_qd[lcore], last_tsc);
+        if (rc) {
+            goto out;
+        }
+        snprintf(name, sizeof(name), "lcore %u", lcore);
+        print_qd_stat(name, &lcore_qd[lcore], span);
+    }
+
+    /* Little's law: L = lambda * W */
+    if (span) {
+        double lambda = (double)io_cnt * g_tsc_rate / span;
+        double w_us = get_us_from_tsc(lat_sum / io_cnt, g_tsc_rate);
+        printf("%-15s  IOPS: %-14.1f AVG LAT (us): %-12.3f L = IOPS * LAT: %-10.3f MEASURED: %.3f\n",
+                "Little's law", lambda, w_us, lambda * w_us / 1000 / 1000, qd_stat_avg(&total, span));
+    }
+
+    print_uline('=', printf("\nQueue depth histogram (time-weighted)\n"));
+    for (uint64_t lo = 0, hi = 0; lo < total.size; lo = hi + 1, hi = hi ? hi * 2 : 1) {
+        uint64_t t = 0;
+        char range[32];
+
+        for (uint64_t qd = lo; qd <= hi && qd < total.size; qd++) {
+            t += total.time_at_qd[qd];
+        }
+        if (!t) {
+            continue;
+        }
+        format_range(lo, hi, range, sizeof(range));
+        printf("QD %-12s time %7.3f %%  %16.3f (us)\n", range, span ? (double)t * 100 / span : 0.0,
+                get_us_from_tsc(t, g_tsc_rate));
+    }
+
+    print_uline('=', printf("\nLatency (us) by QD at submit\n"));
+    for (uint32_t idx = 0; idx < QD_LAT_BUCKETS; idx++) {
+        struct spdk_histogram_data *h = g_qd_lat[idx];
+        char range[32];
+
+        if (!h) {
+            continue;
+        }
+        format_log2_bucket(idx, range, sizeof(range));
+        printf("QD %-12s I/O: %-10ju P50: %-12.3f P90: %-12.3f P99: %-12.3f P99.9: %-12.3f\n",
+                range, g_qd_lat_cnt[idx],
+                get_us_from_tsc(histogram_percentile(h, 50), g_tsc_rate),
+                get_us_from_tsc(histogram_percentile(h, 90), g_tsc_rate),
+                get_us_from_tsc(histogram_percentile(h, 99), g_tsc_rate),
+                get_us_from_tsc(histogram_percentile(h, 99.9), g_tsc_rate));
+    }
+
+out:
+    for (uint32_t idx = 0; idx < QD_LAT_BUCKETS; idx++) {
+        spdk_histogram_data_free(g_qd_lat[idx]);
+        g_qd_lat[idx] = NULL;
+        g_qd_lat_cnt[idx] = 0;
+    }
+    if (lcore_qd) {
+        for (uint32_t lcore = 0; lcore <= max_lcore; lcore++) {
+            free(lcore_qd[lcore].time_at_qd);
+        }
+        free(lcore_qd);
+    }
+    free(total.time_at_qd);
+    free(ev);
+    return rc;
+}
+/* queue depth end */
+
+/* print trace start */
+static void
+set_zone_act_name (uint8_t opc, uint64_t zone_act, const char **zone_act_name) 
+{
+    if (opc ==  SPDK_NVME_OPC_ZONE_MGMT_SEND) {
+        switch (zone_act) {
+        case SPDK_NVME_ZONE_CLOSE:
+            *zone_act_name = "CLOSE ZONE";
+            break;
+        case SPDK_NVME_ZONE_FINISH:
+            *zone_act_name = "FINISH ZONE";
+            break;
+        case SPDK_NVME_ZONE_OPEN:
+            *zone_act_name = "OPEN ZONE";
+            break;
+        case SPDK_NVME_ZONE_RESET:
+            *zone_act_name = "RESET ZONE";
+            break;
+        case SPDK_NVME_ZONE_OFFLINE:
+            *zone_act_name = "OFFLINE ZONE";
+            break;
+        case SPDK_NVME_ZONE_SET_ZDE:
+            *zone_act_name = "SET ZONE DESC";
+            break;
+        default:
+            break;
+        }
+    } else if (opc == SPDK_NVME_OPC_ZONE_MGMT_RECV){
+        switch (zone_act) {
+        case SPDK_NVME_ZONE_REPORT:
+            *zone_act_name = "REPORT ZONE";
+            break;
+        case SPDK_NVME_ZONE_EXTENDED_REPORT:
+            *zone_act_name = "EXT REPORT ZONE";
+            break;
+        default:
+            break;
+        }
+    } else {
+        *zone_act_name = "unknown";
+    }
+}
+
+static void
+set_opc_name(uint64_t opc, const char **opc_name)
+{
+    switch (opc) {
+    case SPDK_NVME_OPC_FLUSH:
+        *opc_name = "FLUSH";
+        break;
+    case SPDK_NVME_OPC_WRITE:
+        *opc_name = "WRITE";
+        break;
+    case SPDK_NVME_OPC_READ:
         *opc_name = "READ";
         break;
     case SPDK_NVME_OPC_WRITE_UNCORRECTABLE:
@@ -472,158 +1108,5410 @@ set_opc_name(uint64_t opc, const char **opc_name)
     }
 }
 
-static void
-set_opc_flags(uint8_t opc, bool *cdw10, bool *cdw11, bool *cdw12, bool *cdw13)
+static void
+set_opc_flags(uint8_t opc, bool *cdw10, bool *cdw11, bool *cdw12, bool *cdw13)
+{
+    switch (opc) {
+    case SPDK_NVME_OPC_ZONE_MGMT_RECV:
+        *cdw10 = true;
+        *cdw11 = true;
+        *cdw12 = true;
+        *cdw13 = true; 
+        break;
+    case SPDK_NVME_OPC_WRITE:
+    case SPDK_NVME_OPC_READ:
+    case SPDK_NVME_OPC_WRITE_UNCORRECTABLE:
+    case SPDK_NVME_OPC_COMPARE:
+    case SPDK_NVME_OPC_WRITE_ZEROES:
+    case SPDK_NVME_OPC_VERIFY:
+    case SPDK_NVME_OPC_COPY:
+    case SPDK_NVME_OPC_ZONE_APPEND:
+        *cdw10 = true;
+        *cdw11 = true;
+        *cdw12 = true;
+        break;
+    case SPDK_NVME_OPC_DATASET_MANAGEMENT:
+        *cdw10 = true;
+        break;
+    case SPDK_NVME_OPC_ZONE_MGMT_SEND:
+        *cdw10 = true;
+        *cdw11 = true;
+        *cdw13 = true;
+        break;
+    case SPDK_NVME_OPC_FLUSH:
+    case SPDK_NVME_OPC_RESERVATION_REGISTER: 
+    case SPDK_NVME_OPC_RESERVATION_REPORT:
+    case SPDK_NVME_OPC_RESERVATION_ACQUIRE:
+    case SPDK_NVME_OPC_RESERVATION_RELEASE:
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * The -d dump formats records straight into large buffers instead of a
+ * printf per field.  Worker threads each format a chunk of records and the
+ * chunks are written to stdout in trace order, so the dump keeps up with
+ * the disk or the pipe it feeds.  Fields keep the layout of the printf
+ * version: "name:" cut / padded to 7 characters, then a padded value.
+ */
+#define DUMP_CHUNK 16384
+#define DUMP_LINE_MAX 320   /* longest line with every field, with room to spare */
+#define DUMP_MAX_THREADS 16
+
+enum dump_field {
+    DUMP_CORE,
+    DUMP_TIME,
+    DUMP_TSC,
+    DUMP_EVENT,
+    DUMP_OBJECT,
+    DUMP_OPC,
+    DUMP_CID,
+    DUMP_NSID,
+    DUMP_LBA,       /* slba / zslba, or the range count of a DSM */
+    DUMP_NLB,       /* block / range / dword */
+    DUMP_ZONE_ACT,
+    DUMP_LAT,       /* submit to complete time of a completion */
+    DUMP_COMP,
+    DUMP_STATUS,
+    DUMP_FIELDS,
+};
+
+static const char *g_dump_field_name[DUMP_FIELDS] = {
+    "core", "time", "tsc", "event", "object", "opc", "cid", "nsid",
+    "lba", "nlb", "zone_action", "latency", "comp", "status",
+};
+
+/* everything but the raw TSC, which -t adds */
+static uint32_t g_dump_fields = ((1u << DUMP_FIELDS) - 1) & ~(1u << DUMP_TSC);
+static bool g_dump_fields_set = false;
+
+static int
+parse_dump_fields(const char *list)
+{
+    char buf[256], *tok, *save = NULL;
+    uint32_t fields = 0;
+
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        int f;
+
+        if (strcmp(tok, "all") == 0) {
+            fields |= (1u << DUMP_FIELDS) - 1;
+            continue;
+        }
+        for (f = 0; f < DUMP_FIELDS; f++) {
+            if (strcmp(tok, g_dump_field_name[f]) == 0) {
+                break;
+            }
+        }
+        if (f == DUMP_FIELDS) {
+            fprintf(stderr, "Unknown field '%s'\n", tok);
+            return -EINVAL;
+        }
+        fields |= 1u << f;
+    }
+    g_dump_fields = fields;
+    return 0;
+}
+
+static inline bool
+dump_has(enum dump_field f)
+{
+    return g_dump_fields & (1u << f);
+}
+
+static inline char *
+dump_pad(char *p, const char *start, int width)
+{
+    while (p - start < width) {
+        *p++ = ' ';
+    }
+    return p;
+}
+
+static inline char *
+dump_str(char *p, const char *s, int width)
+{
+    char *start = p;
+
+    while (*s) {
+        *p++ = *s++;
+    }
+    return dump_pad(p, start, width);
+}
+
+/* Digits of v in the given base at the end of tmp, returns the first one */
+static inline char *
+dump_digits(char *end, uint64_t v, unsigned base)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    do {
+        *--end = digits[v % base];
+        v /= base;
+    } while (v);
+    return end;
+}
+
+/* %-<width>ju or, when right, %<width>ju */
+static inline char *
+dump_uint(char *p, uint64_t v, int width, bool right)
+{
+    char tmp[24], *d = dump_digits(tmp + sizeof(tmp), v, 10);
+    int len = (int)(tmp + sizeof(tmp) - d);
+    char *start = p;
+
+    if (right) {
+        for (int i = len; i < width; i++) {
+            *p++ = ' ';
+        }
+    }
+    memcpy(p, d, len);
+    p += len;
+    return dump_pad(p, start, width);
+}
+
+/* %<width>.3f or %-<width>.3f of a float, with printf's rounding */
+static inline char *
+dump_fixed3(char *p, float f, int width, bool right)
+{
+    /* a float has a 24 bit mantissa, so f * 1000 is exact in a double */
+    double milli = (double)f * 1000.0;
+    char tmp[48], *d;
+    uint64_t v;
+    int len;
+    char *start = p;
+
+    if (!(milli >= 0 && milli < 9e15)) {
+        len = snprintf(tmp, sizeof(tmp), right ? "%*.3f" : "%-*.3f", width, f);
+        memcpy(p, tmp, len);
+        return p + len;
+    }
+    v = (uint64_t)llrint(milli);    /* round half to even, as printf does */
+    d = tmp + sizeof(tmp);
+    for (int i = 0; i < 3; i++) {
+        *--d = (char)('0' + v % 10);
+        v /= 10;
+    }
+    *--d = '.';
+    d = dump_digits(d, v, 10);
+    len = (int)(tmp + sizeof(tmp) - d);
+    if (right) {
+        for (int i = len; i < width; i++) {
+            *p++ = ' ';
+        }
+    }
+    memcpy(p, d, len);
+    p += len;
+    return dump_pad(p, start, width);
+}
+
+/* "name:" in 7 columns then the value, as print_ptr / print_uint64 / print_float did */
+static inline char *
+dump_arg_name(char *p, const char *name)
+{
+    char *start = p;
+
+    while (*name && p - start < 6) {
+        *p++ = *name++;
+    }
+    *p++ = ':';
+    return dump_pad(p, start, 7);
+}
+
+static inline char *
+dump_ptr(char *p, const char *name, uint64_t v)
+{
+    char tmp[16], *d = dump_digits(tmp + sizeof(tmp), v, 16);
+    int len = (int)(tmp + sizeof(tmp) - d);
+    char *start;
+
+    p = dump_arg_name(p, name);
+    *p++ = '0';
+    *p++ = 'x';
+    start = p;
+    memcpy(p, d, len);
+    p = dump_pad(p + len, start, 16);
+    *p++ = ' ';
+    return p;
+}
+
+static inline char *
+dump_u64(char *p, const char *name, uint64_t v)
+{
+    p = dump_uint(dump_arg_name(p, name), v, 16, false);
+    *p++ = ' ';
+    return p;
+}
+
+/*
+ * Format record i, returns the end of the line or NULL for a record that
+ * is neither a submit nor a complete; its prefix is still written to *end.
+ */
+static char *
+dump_record(const struct trace_table *trace, uint64_t i, char *p, char **end)
+{
+    uint8_t opc = trace->opc[i];
+
+    if (dump_has(DUMP_CORE)) {
+        memcpy(p, "core", 4);
+        p = dump_uint(p + 4, trace->lcore[i], 2, true);
+        *p++ = ':';
+        *p++ = ' ';
+    }
+    if (dump_has(DUMP_TIME)) {
+        p = dump_fixed3(p, get_us_from_tsc(trace->tsc[i], trace->tsc_rate), 16, true);
+        *p++ = ' ';
+        *p++ = ' ';
+    }
+    if (dump_has(DUMP_TSC) || g_print_tsc) {
+        *p++ = '(';
+        p = dump_uint(p, trace->tsc[i], 10, true);
+        memcpy(p, ")  ", 3);
+        p += 3;
+    }
+    if (dump_has(DUMP_EVENT)) {
+        p = dump_str(p, g_trace_kind_name[trace->kind[i]], 20);
+        *p++ = ' ';
+    }
+    if (dump_has(DUMP_OBJECT)) {
+        p = dump_ptr(p, "object", trace->obj_id[i]);
+    }
+
+    if (trace->kind[i] == TRACE_KIND_SUBMIT) {
+        const char *name;
+        bool cdw10 = false, cdw11 = false, cdw12 = false, cdw13 = false;
+
+        set_opc_flags(opc, &cdw10, &cdw11, &cdw12, &cdw13);
+        if (dump_has(DUMP_OPC)) {
+            set_opc_name(opc, &name);
+            p = dump_str(p, name, 20);
+            *p++ = ' ';
+        }
+        if (dump_has(DUMP_CID)) {
+            p = dump_u64(p, "cid", trace->cid[i]);
+        }
+        if (dump_has(DUMP_NSID)) {
+            p = dump_ptr(p, "nsid", trace->nsid[i]);
+        }
+        if (dump_has(DUMP_LBA)) {
+            if (cdw10 && opc == SPDK_NVME_OPC_DATASET_MANAGEMENT) {
+                p = dump_ptr(p, "nr", trace->slba[i] & UINT8BIT_MASK);
+            }
+            if (cdw11) {
+                p = dump_ptr(p, opc == SPDK_NVME_OPC_ZONE_APPEND ? "zslba" : "slba", trace->slba[i]);
+            }
+        }
+        if (dump_has(DUMP_NLB) && cdw12) {
+            if (opc == SPDK_NVME_OPC_COPY) {
+                p = dump_u64(p, "range", (trace->cdw12[i] & UINT8BIT_MASK) + 1);
+            } else if (opc == SPDK_NVME_OPC_ZONE_MGMT_RECV) {
+                p = dump_u64(p, "dword", (trace->cdw12[i] & UINT32BIT_MASK) + 1);
+            } else {
+                p = dump_u64(p, "block", (trace->cdw12[i] & UINT16BIT_MASK) + 1);
+            }
+        }
+        if (dump_has(DUMP_ZONE_ACT) && cdw13) {
+            name = "";
+            set_zone_act_name(opc, trace->cdw13[i] & UINT8BIT_MASK, &name);
+            p = dump_str(p, name, 20);
+            *p++ = ' ';
+        }
+    } else if (trace->kind[i] == TRACE_KIND_COMPLETE) {
+        if (dump_has(DUMP_LAT) && trace->lat[i]) {
+            p = dump_fixed3(dump_arg_name(p, "time"), get_us_from_tsc(trace->lat[i], trace->tsc_rate), 13, false);
+            *p++ = ' ';
+        }
+        if (dump_has(DUMP_CID)) {
+            p = dump_u64(p, "cid", trace->cid[i]);
+        }
+        if (dump_has(DUMP_COMP)) {
+            p = dump_ptr(p, "comp", trace->cpl[i] & (uint64_t)0x1);
+        }
+        if (dump_has(DUMP_STATUS)) {
+            p = dump_ptr(p, "status", (trace->cpl[i] >> 1) & (uint64_t)0x7FFF);
+        }
+    } else if (trace->kind[i] == TRACE_KIND_DSM_RANGE) {
+        if (dump_has(DUMP_NSID)) {
+            p = dump_ptr(p, "nsid", trace->nsid[i]);
+        }
+        if (dump_has(DUMP_LBA)) {
+            p = dump_ptr(p, "slba", trace->slba[i]);
+        }
+        if (dump_has(DUMP_NLB)) {
+            p = dump_u64(p, "block", trace->cdw12[i]);
+        }
+        if (dump_has(DUMP_OPC)) {
+            p = dump_ptr(p, "cattr", trace->cdw13[i]);
+        }
+    } else {
+        *end = p;
+        return NULL;
+    }
+    *p++ = '\n';
+    *end = p;
+    return p;
+}
+
+struct dump_slot {
+    char *buf;
+    size_t len;
+    uint64_t chunk;     /* chunk held by the slot, UINT64_MAX while empty */
+    bool bad;           /* chunk stops at a record that is of an unknown tracepoint */
+};
+
+struct dump_ctx {
+    const struct trace_table *trace;
+    struct dump_slot *slot;
+    uint32_t slot_cnt;
+    uint32_t thread_cnt;
+    uint64_t chunk_cnt;
+    uint64_t written;   /* chunks written out so far */
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct dump_worker {
+    struct dump_ctx *ctx;
+    uint32_t id;
+};
+
+static void *
+dump_worker_fn(void *arg)
+{
+    struct dump_worker *w = (struct dump_worker *)arg;
+    struct dump_ctx *ctx = w->ctx;
+
+    for (uint64_t c = w->id; c < ctx->chunk_cnt; c += ctx->thread_cnt) {
+        struct dump_slot *s = &ctx->slot[c % ctx->slot_cnt];
+        uint64_t first = c * DUMP_CHUNK, last = spdk_min(first + DUMP_CHUNK, ctx->trace->cnt);
+        char *p;
+        bool bad = false;
+
+        /* the slot is free once the chunk slot_cnt before this one is out */
+        pthread_mutex_lock(&ctx->lock);
+        while (!ctx->stop && c >= ctx->written + ctx->slot_cnt) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+        if (ctx->stop) {
+            break;
+        }
+
+        p = s->buf;
+        for (uint64_t i = first; i < last; i++) {
+            if (dump_record(ctx->trace, i, p, &p) == NULL) {
+                bad = true;
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+        s->len = (size_t)(p - s->buf);
+        s->bad = bad;
+        s->chunk = c;
+        pthread_cond_broadcast(&ctx->cond);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    return NULL;
+}
+
+static int
+dump_write(int fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int
+process_dump_trace(const struct trace_table *trace)
+{
+    struct dump_ctx ctx = {};
+    struct dump_worker worker[DUMP_MAX_THREADS];
+    pthread_t tid[DUMP_MAX_THREADS];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t started = 0;
+    int rc = 0;
+
+    ctx.trace = trace;
+    ctx.chunk_cnt = (trace->cnt + DUMP_CHUNK - 1) / DUMP_CHUNK;
+    ctx.thread_cnt = (uint32_t)spdk_max(1, spdk_min(cpus, DUMP_MAX_THREADS));
+    ctx.thread_cnt = (uint32_t)spdk_min(ctx.thread_cnt, spdk_max(ctx.chunk_cnt, 1));
+    ctx.slot_cnt = ctx.thread_cnt * 2;
+    ctx.slot = (struct dump_slot *)calloc(ctx.slot_cnt, sizeof(struct dump_slot));
+    if (ctx.slot == NULL) {
+        fprintf(stderr, "Fail to allocate memory for dump buffers\n");
+        return -ENOMEM;
+    }
+    for (uint32_t s = 0; s < ctx.slot_cnt; s++) {
+        ctx.slot[s].chunk = UINT64_MAX;
+        ctx.slot[s].buf = (char *)malloc((size_t)DUMP_CHUNK * DUMP_LINE_MAX);
+        if (ctx.slot[s].buf == NULL) {
+            fprintf(stderr, "Fail to allocate memory for dump buffers\n");
+            rc = -ENOMEM;
+            goto out;
+        }
+    }
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+
+    for (uint32_t t = 0; t < ctx.thread_cnt; t++) {
+        worker[t] = (struct dump_worker) { &ctx, t };
+        if (pthread_create(&tid[t], NULL, dump_worker_fn, &worker[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started < ctx.thread_cnt) {
+        /* workers own every thread_cnt-th chunk, so all of them are needed */
+        fprintf(stderr, "Failed to start dump threads\n");
+        rc = -EAGAIN;
+    }
+
+    /* everything printed so far must come out before the raw writes */
+    fflush(stdout);
+    for (uint64_t c = 0; rc == 0 && c < ctx.chunk_cnt; c++) {
+        struct dump_slot *s = &ctx.slot[c % ctx.slot_cnt];
+
+        pthread_mutex_lock(&ctx.lock);
+        while (s->chunk != c) {
+            pthread_cond_wait(&ctx.cond, &ctx.lock);
+        }
+        pthread_mutex_unlock(&ctx.lock);
+
+        rc = dump_write(STDOUT_FILENO, s->buf, s->len);
+        if (rc == 0 && s->bad) {
+            rc = 1;
+        }
+
+        pthread_mutex_lock(&ctx.lock);
+        ctx.written++;
+        pthread_cond_broadcast(&ctx.cond);
+        pthread_mutex_unlock(&ctx.lock);
+    }
+
+    if (rc) {
+        pthread_mutex_lock(&ctx.lock);
+        ctx.stop = true;
+        pthread_cond_broadcast(&ctx.cond);
+        pthread_mutex_unlock(&ctx.lock);
+    }
+    for (uint32_t t = 0; t < started; t++) {
+        pthread_join(tid[t], NULL);
+    }
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+
+out:
+    for (uint32_t s = 0; s < ctx.slot_cnt; s++) {
+        free(ctx.slot[s].buf);
+    }
+    free(ctx.slot);
+    return rc;
+}
+/* print trace end */
+
+/* io pairing start */
+static uint32_t g_sector_size = 512; /* updated from the namespace in get_ns_info() */
+
+/* One submitted command, joined with its completion when the trace has it */
+struct io_info {
+    uint64_t submit_tsc;
+    uint64_t lat;       /* tsc_sc_time of the completion */
+    uint64_t slba;
+    uint32_t nlb;       /* number of blocks, 1-based */
+    uint32_t lcore;
+    uint32_t nsid;
+    uint16_t opc;
+    uint16_t status;
+    bool     completed;
+    uint32_t row;       /* of the submit in the trace table */
+};
+
+struct io_key {
+    uint64_t obj_id;
+    uint64_t obj_start;
+    uint64_t idx;
+};
+
+static int
+io_key_cmp(const void *a, const void *b)
+{
+    const struct io_key *x = (const struct io_key *)a;
+    const struct io_key *y = (const struct io_key *)b;
+
+    if (x->obj_id != y->obj_id) {
+        return x->obj_id < y->obj_id ? -1 : 1;
+    }
+    if (x->obj_start != y->obj_start) {
+        return x->obj_start < y->obj_start ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Opcodes whose cdw10-12 carry slba / nlb */
+static bool
+opc_has_lba_range(uint16_t opc)
+{
+    switch (opc) {
+    case SPDK_NVME_OPC_READ:
+    case SPDK_NVME_OPC_COMPARE:
+    case SPDK_NVME_OPC_WRITE:
+    case SPDK_NVME_OPC_ZONE_APPEND:
+    case SPDK_NVME_OPC_WRITE_ZEROES:
+    case SPDK_NVME_OPC_WRITE_UNCORRECTABLE:
+    case SPDK_NVME_OPC_VERIFY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Row filter applied to submits before the join, NULL keeps all */
+typedef bool (*io_filter_fn)(const struct trace_table *trace, uint32_t row, void *ctx);
+
+/*
+ * Build one io_info per NVME_IO_SUBMIT in trace order. Completions only carry
+ * cid / cpl, so they are joined back to their submit by (obj_id, obj_start).
+ */
+static int
+build_io_info_filter(const struct trace_table *trace, io_filter_fn keep, void *ctx,
+                     struct io_info **ios, uint64_t *io_cnt)
+{
+    uint64_t cnt = 0;
+    struct io_info *io = (struct io_info *)calloc(trace->sub_cnt + 1, sizeof(struct io_info));
+    struct io_key *keys = (struct io_key *)calloc(trace->sub_cnt + 1, sizeof(struct io_key));
+
+    if (io == NULL || keys == NULL) {
+        fprintf(stderr, "Fail to allocate memory for io info\n");
+        free(io);
+        free(keys);
+        return -ENOMEM;
+    }
+
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        uint32_t i = trace->sub[j];
+
+        if (keep && !keep(trace, i, ctx)) {
+            continue;
+        }
+        io[cnt].submit_tsc = trace->obj_start[i];
+        io[cnt].row = i;
+        io[cnt].lcore = trace->lcore[i];
+        io[cnt].nsid = trace->nsid[i];
+        io[cnt].opc = trace->opc[i];
+        if (opc_has_lba_range(trace->opc[i])) {
+            io[cnt].slba = trace->slba[i];
+            io[cnt].nlb = trace->nlb[i];
+        }
+        keys[cnt] = (struct io_key) { trace->obj_id[i], trace->obj_start[i], cnt };
+        cnt++;
+    }
+
+    qsort(keys, cnt, sizeof(struct io_key), io_key_cmp);
+
+    for (uint64_t j = 0; j < trace->cmp_cnt; j++) {
+        uint32_t i = trace->cmp[j];
+        struct io_key key, *found;
+
+        key.obj_id = trace->obj_id[i];
+        key.obj_start = trace->obj_start[i];
+        found = (struct io_key *)bsearch(&key, keys, cnt, sizeof(struct io_key), io_key_cmp);
+        if (found == NULL) {
+            continue; /* submitted before the capture started */
+        }
+        io[found->idx].lat = trace->lat[i];
+        io[found->idx].status = (trace->cpl[i] >> 1) & 0x7FFF;
+        io[found->idx].completed = true;
+    }
+
+    free(keys);
+    *ios = io;
+    *io_cnt = cnt;
+    return 0;
+}
+
+static int
+build_io_info(const struct trace_table *trace, struct io_info **ios, uint64_t *io_cnt)
+{
+    return build_io_info_filter(trace, NULL, NULL, ios, io_cnt);
+}
+
+#define SIZE_BUCKETS 8
+static const char *g_size_bucket_name[SIZE_BUCKETS] = {
+    "<4K", "4K", "8K", "16K", "32K", "64K", "128K", ">128K"
+};
+
+/* Power of two size class a transfer of the given bytes rounds up to */
+static uint32_t
+size_bucket(uint64_t bytes)
+{
+    if (bytes < 4096) {
+        return 0;
+    }
+    return spdk_min((uint32_t)(64 - __builtin_clzll(bytes - 1)) - 11, (uint32_t)SIZE_BUCKETS - 1);
+}
+/* io pairing end */
+
+/* group by start */
+struct group_stat {
+    uint64_t key;
+    uint64_t ios;
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t blocks;
+    uint64_t lat_max;
+    double   lat_sum;
+    uint64_t size_mix[SIZE_BUCKETS];
+    struct spdk_histogram_data *lat;
+};
+
+struct group_table {
+    const char *title;
+    struct group_stat *g;
+    uint64_t cnt;
+    uint64_t size;
+};
+
+/* Find or insert the group for key, keeping the table sorted by key */
+static struct group_stat *
+group_get(struct group_table *t, uint64_t key)
+{
+    uint64_t lo = 0, hi = t->cnt;
+
+    while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        if (t->g[mid].key == key) {
+            return &t->g[mid];
+        }
+        if (t->g[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (t->cnt == t->size) {
+        uint64_t size = t->size ? t->size * 2 : 16;
+        struct group_stat *g = (struct group_stat *)realloc(t->g, size * sizeof(struct group_stat));
+        if (g == NULL) {
+            return NULL;
+        }
+        t->g = g;
+        t->size = size;
+    }
+
+    struct spdk_histogram_data *lat = spdk_histogram_data_alloc();
+    if (lat == NULL) {
+        return NULL;
+    }
+    memmove(&t->g[lo + 1], &t->g[lo], (t->cnt - lo) * sizeof(struct group_stat));
+    memset(&t->g[lo], 0, sizeof(struct group_stat));
+    t->g[lo].key = key;
+    t->g[lo].lat = lat;
+    t->cnt++;
+    return &t->g[lo];
+}
+
+static int
+group_add(struct group_table *t, uint64_t key, const struct io_info *io)
+{
+    struct group_stat *g = group_get(t, key);
+    if (g == NULL) {
+        fprintf(stderr, "Fail to allocate memory for group %s\n", t->title);
+        return -ENOMEM;
+    }
+
+    g->ios++;
+    g->blocks += io->nlb;
+    if (io->nlb) {
+        g->size_mix[size_bucket((uint64_t)io->nlb * g_sector_size)]++;
+    }
+    if (io->completed) {
+        g->completed++;
+        g->errors += io->status ? 1 : 0;
+        g->lat_sum += io->lat;
+        g->lat_max = spdk_max(g->lat_max, io->lat);
+        spdk_histogram_data_tally(g->lat, io->lat);
+    }
+    return 0;
+}
+
+static void
+group_free(struct group_table *t)
+{
+    for (uint64_t i = 0; i < t->cnt; i++) {
+        spdk_histogram_data_free(t->g[i].lat);
+    }
+    free(t->g);
+    t->g = NULL;
+    t->cnt = t->size = 0;
+}
+
+enum group_dim {
+    GROUP_LCORE,
+    GROUP_NSID,
+    GROUP_OPC,
+};
+
+static void
+format_group_dim(enum group_dim dim, uint32_t val, char *buf, size_t len)
+{
+    const char *opc_name;
+
+    switch (dim) {
+    case GROUP_LCORE:
+        snprintf(buf, len, "core%u", val);
+        break;
+    case GROUP_NSID:
+        snprintf(buf, len, "ns%u", val);
+        break;
+    case GROUP_OPC:
+        set_opc_name(val, &opc_name);
+        snprintf(buf, len, "%s", opc_name);
+        break;
+    }
+}
+
+static void
+print_group_table(struct group_table *t, enum group_dim d1, int d2, uint64_t total_ios,
+                  uint64_t total_blocks, uint64_t span)
+{
+    print_uline('=', printf("\n%s\n", t->title));
+    printf("%-28s %10s %7s %12s %7s %10s %10s %10s %10s %10s %10s %6s ",
+            "group", "I/O", "I/O%", "MiB", "MiB%", "IOPS", "AVG(us)", "P50(us)", "P99(us)",
+            "P99.9(us)", "MAX(us)", "ERR");
+    for (int i = 0; i < SIZE_BUCKETS; i++) {
+        printf("%6s ", g_size_bucket_name[i]);
+    }
+    printf("\n");
+
+    for (uint64_t i = 0; i < t->cnt; i++) {
+        struct group_stat *g = &t->g[i];
+        char name[64], n1[28], n2[28] = "";
+
+        format_group_dim(d1, d2 < 0 ? (uint32_t)g->key : (uint32_t)(g->key >> 32), n1, sizeof(n1));
+        if (d2 >= 0) {
+            format_group_dim((enum group_dim)d2, (uint32_t)g->key, n2, sizeof(n2));
+            snprintf(name, sizeof(name), "%s / %s", n1, n2);
+        } else {
+            snprintf(name, sizeof(name), "%s", n1);
+        }
+
+        double mib = (double)g->blocks * g_sector_size / (1024 * 1024);
+        printf("%-28.28s %10ju %7.2f %12.3f %7.2f %10.1f %10.3f %10.3f %10.3f %10.3f %10.3f %6ju ",
+                name, g->ios, total_ios ? (double)g->ios * 100 / total_ios : 0.0, mib,
+                total_blocks ? (double)g->blocks * 100 / total_blocks : 0.0,
+                span ? (double)g->ios * g_tsc_rate / span : 0.0,
+                g->completed ? get_us_from_tsc(g->lat_sum / g->completed, g_tsc_rate) : 0.0,
+                get_us_from_tsc(spdk_min(histogram_percentile(g->lat, 50), g->lat_max), g_tsc_rate),
+                get_us_from_tsc(spdk_min(histogram_percentile(g->lat, 99), g->lat_max), g_tsc_rate),
+                get_us_from_tsc(spdk_min(histogram_percentile(g->lat, 99.9), g->lat_max), g_tsc_rate),
+                get_us_from_tsc(g->lat_max, g_tsc_rate), g->errors);
+        for (int j = 0; j < SIZE_BUCKETS; j++) {
+            printf("%5.1f%% ", g->ios ? (double)g->size_mix[j] * 100 / g->ios : 0.0);
+        }
+        printf("\n");
+    }
+}
+
+static uint32_t
+group_dim_val(enum group_dim dim, const struct io_info *io)
+{
+    switch (dim) {
+    case GROUP_LCORE:
+        return io->lcore;
+    case GROUP_NSID:
+        return io->nsid;
+    case GROUP_OPC:
+        return io->opc;
+    }
+    return 0;
+}
+
+static int
+process_group_by(const struct trace_table *trace)
+{
+    static const struct {
+        const char *title;
+        enum group_dim d1;
+        int d2; /* -1 for a single dimension */
+    } tables[] = {
+        { "Per lcore", GROUP_LCORE, -1 },
+        { "Per namespace", GROUP_NSID, -1 },
+        { "Per opcode", GROUP_OPC, -1 },
+        { "lcore x namespace", GROUP_LCORE, GROUP_NSID },
+        { "lcore x opcode", GROUP_LCORE, GROUP_OPC },
+        { "namespace x opcode", GROUP_NSID, GROUP_OPC },
+    };
+    struct group_table t[SPDK_COUNTOF(tables)] = {};
+    struct io_info *ios = NULL;
+    uint64_t io_cnt = 0, total_blocks = 0, first_tsc = UINT64_MAX, last_tsc = 0;
+    int rc;
+
+    if (!g_tsc_rate) {
+        g_tsc_rate = trace->tsc_rate;
+    }
+
+    rc = build_io_info(trace, &ios, &io_cnt);
+    if (rc) {
+        return rc;
+    }
+
+    for (size_t j = 0; j < SPDK_COUNTOF(tables); j++) {
+        t[j].title = tables[j].title;
+    }
+
+    for (uint64_t i = 0; i < io_cnt; i++) {
+        struct io_info *io = &ios[i];
+
+        total_blocks += io->nlb;
+        first_tsc = spdk_min(first_tsc, io->submit_tsc);
+        last_tsc = spdk_max(last_tsc, io->submit_tsc + io->lat);
+
+        for (size_t j = 0; j < SPDK_COUNTOF(tables); j++) {
+            uint64_t key = group_dim_val(tables[j].d1, io);
+            if (tables[j].d2 >= 0) {
+                key = key << 32 | group_dim_val((enum group_dim)tables[j].d2, io);
+            }
+            rc = group_add(&t[j], key, io);
+            if (rc) {
+                goto out;
+            }
+        }
+    }
+
+    uint64_t span = io_cnt ? last_tsc - first_tsc : 0;
+    for (size_t j = 0; j < SPDK_COUNTOF(tables); j++) {
+        print_group_table(&t[j], tables[j].d1, tables[j].d2, io_cnt, total_blocks, span);
+    }
+
+out:
+    for (size_t j = 0; j < SPDK_COUNTOF(tables); j++) {
+        group_free(&t[j]);
+    }
+    free(ios);
+    return rc;
+}
+/* group by end */
+
+/* sequentiality start */
+#define SEQ_RUN_BUCKETS 24
+#define SEQ_STRIDES 64
+#define SEQ_STRIDE_WINDOW (1024 * 1024) /* bytes a new access may jump and still be tracked as the same stream */
+
+enum seq_class {
+    SEQ_SEQUENTIAL,
+    SEQ_STRIDED,
+    SEQ_RANDOM,
+    SEQ_CLASSES,
+};
+
+static const char *g_seq_class_name[SEQ_CLASSES] = { "SEQ", "STRIDED", "RANDOM" };
+
+enum seq_dir {
+    SEQ_READ,
+    SEQ_WRITE,
+    SEQ_DIRS,
+};
+
+static const char *g_seq_dir_name[SEQ_DIRS] = { "READ", "WRITE" };
+
+static uint32_t g_seq_streams = 0; /* concurrent streams tracked per lcore / namespace, 0 = disabled */
+
+/* One detected stream: where it is expected to continue and the current sequential run */
+struct seq_stream {
+    uint64_t prev_slba;
+    uint64_t next_lba;
+    int64_t  stride;     /* distance between the last two starts, 0 if unknown */
+    uint64_t last_use;   /* I/O sequence number, for LRU replacement */
+    uint64_t run_ios;
+    uint64_t run_blocks;
+    bool     valid;
+};
+
+struct seq_stat {
+    uint64_t ios[SEQ_CLASSES];
+    uint64_t blocks[SEQ_CLASSES];
+    uint64_t seq_run_blocks; /* blocks of runs with two or more back to back I/Os */
+    uint64_t run_len[SEQ_RUN_BUCKETS];
+};
+
+struct seq_stride {
+    int64_t  stride;
+    uint64_t cnt;
+};
+
+/* Streams of one (lcore, nsid) in one direction */
+struct seq_key {
+    uint64_t key;
+    struct seq_stream *s;
+    struct seq_stat stat;
+};
+
+struct seq_table {
+    struct seq_key *k;
+    uint64_t cnt;
+    uint64_t size;
+    struct seq_stride strides[SEQ_STRIDES];
+    uint32_t stride_cnt;
+    uint64_t stride_other;
+};
+
+static struct seq_key *
+seq_key_get(struct seq_table *t, uint64_t key)
+{
+    uint64_t lo = 0, hi = t->cnt;
+
+    while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        if (t->k[mid].key == key) {
+            return &t->k[mid];
+        }
+        if (t->k[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (t->cnt == t->size) {
+        uint64_t size = t->size ? t->size * 2 : 16;
+        struct seq_key *k = (struct seq_key *)realloc(t->k, size * sizeof(struct seq_key));
+        if (k == NULL) {
+            return NULL;
+        }
+        t->k = k;
+        t->size = size;
+    }
+
+    struct seq_stream *s = (struct seq_stream *)calloc(g_seq_streams, sizeof(struct seq_stream));
+    if (s == NULL) {
+        return NULL;
+    }
+    memmove(&t->k[lo + 1], &t->k[lo], (t->cnt - lo) * sizeof(struct seq_key));
+    memset(&t->k[lo], 0, sizeof(struct seq_key));
+    t->k[lo].key = key;
+    t->k[lo].s = s;
+    t->cnt++;
+    return &t->k[lo];
+}
+
+static void
+seq_stride_add(struct seq_table *t, int64_t stride)
+{
+    for (uint32_t i = 0; i < t->stride_cnt; i++) {
+        if (t->strides[i].stride == stride) {
+            t->strides[i].cnt++;
+            return;
+        }
+    }
+    if (t->stride_cnt < SEQ_STRIDES) {
+        t->strides[t->stride_cnt].stride = stride;
+        t->strides[t->stride_cnt].cnt = 1;
+        t->stride_cnt++;
+    } else {
+        t->stride_other++;
+    }
+}
+
+static void
+seq_run_end(struct seq_stat *st, struct seq_stream *s)
+{
+    if (!s->valid || !s->run_ios) {
+        return;
+    }
+    st->run_len[log2_bucket(s->run_ios, SEQ_RUN_BUCKETS)]++;
+    if (s->run_ios > 1) {
+        st->seq_run_blocks += s->run_blocks;
+    }
+    s->run_ios = 0;
+    s->run_blocks = 0;
+}
+
+static enum seq_class
+seq_classify(struct seq_table *t, struct seq_key *k, const struct io_info *io, uint64_t seq_no)
+{
+    struct seq_stream *best = NULL;
+    enum seq_class cls = SEQ_RANDOM;
+    uint64_t window = SEQ_STRIDE_WINDOW / g_sector_size;
+
+    for (uint32_t i = 0; i < g_seq_streams && !best; i++) {
+        if (k->s[i].valid && io->slba == k->s[i].next_lba) {
+            best = &k->s[i];
+            cls = SEQ_SEQUENTIAL;
+        }
+    }
+    for (uint32_t i = 0; i < g_seq_streams && !best; i++) {
+        if (k->s[i].valid && k->s[i].stride &&
+            (int64_t)(io->slba - k->s[i].prev_slba) == k->s[i].stride) {
+            best = &k->s[i];
+            cls = SEQ_STRIDED;
+        }
+    }
+
+    if (cls == SEQ_SEQUENTIAL) {
+        best->run_ios++;
+        best->run_blocks += io->nlb;
+    } else {
+        if (!best) {
+            /* nearest stream within the window adopts the new stride candidate */
+            uint64_t best_dist = window + 1;
+            for (uint32_t i = 0; i < g_seq_streams; i++) {
+                uint64_t dist;
+                if (!k->s[i].valid) {
+                    continue;
+                }
+                dist = io->slba > k->s[i].next_lba ? io->slba - k->s[i].next_lba :
+                       k->s[i].next_lba - io->slba;
+                if (dist < best_dist) {
+                    best = &k->s[i];
+                    best_dist = dist;
+                }
+            }
+        }
+        if (!best) {
+            /* start a new stream in a free slot, else evict the least recently used one */
+            best = &k->s[0];
+            for (uint32_t i = 0; i < g_seq_streams; i++) {
+                if (!k->s[i].valid) {
+                    best = &k->s[i];
+                    break;
+                }
+                if (k->s[i].last_use < best->last_use) {
+                    best = &k->s[i];
+                }
+            }
+            seq_run_end(&k->stat, best);
+            best->stride = 0;
+        } else {
+            seq_run_end(&k->stat, best);
+            best->stride = (int64_t)(io->slba - best->prev_slba);
+        }
+        if (cls == SEQ_STRIDED) {
+            seq_stride_add(t, best->stride);
+        }
+        best->run_ios = 1;
+        best->run_blocks = io->nlb;
+    }
+
+    best->prev_slba = io->slba;
+    best->next_lba = io->slba + io->nlb;
+    best->last_use = seq_no;
+    best->valid = true;
+    return cls;
+}
+
+static void
+seq_stat_merge(struct seq_stat *dst, const struct seq_stat *src)
+{
+    for (int c = 0; c < SEQ_CLASSES; c++) {
+        dst->ios[c] += src->ios[c];
+        dst->blocks[c] += src->blocks[c];
+    }
+    dst->seq_run_blocks += src->seq_run_blocks;
+    for (int i = 0; i < SEQ_RUN_BUCKETS; i++) {
+        dst->run_len[i] += src->run_len[i];
+    }
+}
+
+static void
+print_seq_stat(const char *name, const struct seq_stat *st)
+{
+    uint64_t ios = 0, blocks = 0;
+
+    for (int c = 0; c < SEQ_CLASSES; c++) {
+        ios += st->ios[c];
+        blocks += st->blocks[c];
+    }
+    printf("%-22s I/O: %-10ju", name, ios);
+    for (int c = 0; c < SEQ_CLASSES; c++) {
+        printf(" %s: %6.2f %%", g_seq_class_name[c], ios ? (double)st->ios[c] * 100 / ios : 0.0);
+    }
+    printf("  bytes in sequential runs: %6.2f %%\n",
+            blocks ? (double)st->seq_run_blocks * 100 / blocks : 0.0);
+}
+
+static int
+seq_stride_cmp(const void *a, const void *b)
+{
+    const struct seq_stride *x = (const struct seq_stride *)a;
+    const struct seq_stride *y = (const struct seq_stride *)b;
+
+    return x->cnt == y->cnt ? 0 : (x->cnt < y->cnt ? 1 : -1);
+}
+
+static int
+process_sequentiality(const struct trace_table *trace)
+{
+    struct seq_table t[SEQ_DIRS] = {};
+    struct seq_stat total[SEQ_DIRS] = {};
+    struct io_info *ios = NULL;
+    uint64_t io_cnt = 0, append_ios = 0, append_blocks = 0;
+    int rc;
+
+    rc = build_io_info(trace, &ios, &io_cnt);
+    if (rc) {
+        return rc;
+    }
+
+    for (uint64_t i = 0; i < io_cnt; i++) {
+        struct io_info *io = &ios[i];
+        enum seq_dir dir;
+
+        switch (io->opc) {
+        case SPDK_NVME_OPC_READ:
+        case SPDK_NVME_OPC_COMPARE:
+            dir = SEQ_READ;
+            break;
+        case SPDK_NVME_OPC_WRITE:
+        case SPDK_NVME_OPC_WRITE_ZEROES:
+            dir = SEQ_WRITE;
+            break;
+        case SPDK_NVME_OPC_ZONE_APPEND:
+            /* the device places appends at the write pointer: sequential by construction */
+            append_ios++;
+            append_blocks += io->nlb;
+            continue;
+        default:
+            continue;
+        }
+
+        struct seq_key *k = seq_key_get(&t[dir], (uint64_t)io->lcore << 32 | io->nsid);
+        if (k == NULL) {
+            fprintf(stderr, "Fail to allocate memory for stream table\n");
+            rc = -ENOMEM;
+            goto out;
+        }
+        enum seq_class cls = seq_classify(&t[dir], k, io, i + 1);
+        k->stat.ios[cls]++;
+        k->stat.blocks[cls] += io->nlb;
+    }
+
+    print_uline('=', printf("\nSequentiality (%u stream%s per lcore / namespace)\n",
+            g_seq_streams, g_seq_streams > 1 ? "s" : ""));
+    for (int dir = 0; dir < SEQ_DIRS; dir++) {
+        for (uint64_t i = 0; i < t[dir].cnt; i++) {
+            struct seq_key *k = &t[dir].k[i];
+            for (uint32_t j = 0; j < g_seq_streams; j++) {
+                seq_run_end(&k->stat, &k->s[j]);
+            }
+            seq_stat_merge(&total[dir], &k->stat);
+        }
+        print_seq_stat(g_seq_dir_name[dir], &total[dir]);
+    }
+    if (append_ios) {
+        printf("%-22s I/O: %-10ju (sequential at the zone write pointer, %.3f MiB)\n", "ZONE APPEND",
+                append_ios, (double)append_blocks * g_sector_size / (1024 * 1024));
+    }
+
+    print_uline('=', printf("\nSequentiality per lcore / namespace\n"));
+    for (int dir = 0; dir < SEQ_DIRS; dir++) {
+        for (uint64_t i = 0; i < t[dir].cnt; i++) {
+            char name[48];
+            snprintf(name, sizeof(name), "%-5s core%u / ns%u", g_seq_dir_name[dir],
+                    (uint32_t)(t[dir].k[i].key >> 32), (uint32_t)t[dir].k[i].key);
+            print_seq_stat(name, &t[dir].k[i].stat);
+        }
+    }
+
+    print_uline('=', printf("\nSequential run length (I/O per run)\n"));
+    for (uint32_t idx = 0; idx < SEQ_RUN_BUCKETS; idx++) {
+        char range[32];
+
+        if (!total[SEQ_READ].run_len[idx] && !total[SEQ_WRITE].run_len[idx]) {
+            continue;
+        }
+        format_log2_bucket(idx, range, sizeof(range));
+        printf("RUN %-12s r %-10ju w %-10ju\n", range, total[SEQ_READ].run_len[idx],
+                total[SEQ_WRITE].run_len[idx]);
+    }
+
+    print_uline('=', printf("\nDetected strides (blocks)\n"));
+    for (int dir = 0; dir < SEQ_DIRS; dir++) {
+        qsort(t[dir].strides, t[dir].stride_cnt, sizeof(struct seq_stride), seq_stride_cmp);
+        for (uint32_t i = 0; i < t[dir].stride_cnt && i < 8; i++) {
+            printf("%-5s stride %-12jd I/O %-10ju\n", g_seq_dir_name[dir],
+                    t[dir].strides[i].stride, t[dir].strides[i].cnt);
+        }
+        if (t[dir].stride_other) {
+            printf("%-5s other strides       I/O %-10ju\n", g_seq_dir_name[dir], t[dir].stride_other);
+        }
+    }
+
+out:
+    for (int dir = 0; dir < SEQ_DIRS; dir++) {
+        for (uint64_t i = 0; i < t[dir].cnt; i++) {
+            free(t[dir].k[i].s);
+        }
+        free(t[dir].k);
+    }
+    free(ios);
+    return rc;
+}
+/* sequentiality end */
+
+/* latency outliers start */
+#define OUTLIER_CONTEXT_MAX 16 /* preceding I/Os listed per outlier */
+#define OUTLIER_K_MAX 10000    /* outliers listed at most */
+
+struct outlier {
+    uint64_t lat;
+    uint64_t idx;   /* into io_info */
+};
+
+static uint32_t g_outlier_k = 0;
+static uint64_t g_outlier_window_us = 100;
+
+/* Min-heap on latency: the root is the fastest of the K slowest seen so far */
+static void
+outlier_sift_down(struct outlier *h, uint32_t n, uint32_t i)
+{
+    for (;;) {
+        uint32_t l = i * 2 + 1, r = l + 1, m = i;
+
+        if (l < n && h[l].lat < h[m].lat) {
+            m = l;
+        }
+        if (r < n && h[r].lat < h[m].lat) {
+            m = r;
+        }
+        if (m == i) {
+            return;
+        }
+        struct outlier tmp = h[i];
+        h[i] = h[m];
+        h[m] = tmp;
+        i = m;
+    }
+}
+
+static void
+outlier_push(struct outlier *h, uint32_t *n, uint32_t k, uint64_t lat, uint64_t idx)
+{
+    if (*n < k) {
+        uint32_t i = (*n)++;
+
+        h[i] = (struct outlier) { lat, idx };
+        while (i && h[(i - 1) / 2].lat > h[i].lat) {
+            struct outlier tmp = h[i];
+            h[i] = h[(i - 1) / 2];
+            h[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (lat > h[0].lat) {
+        h[0] = (struct outlier) { lat, idx };
+        outlier_sift_down(h, *n, 0);
+    }
+}
+
+static int
+outlier_cmp(const void *a, const void *b)
+{
+    const struct outlier *x = (const struct outlier *)a, *y = (const struct outlier *)b;
+
+    return x->lat == y->lat ? 0 : (x->lat < y->lat ? 1 : -1);
+}
+
+static int
+io_submit_cmp(const void *a, const void *b, void *arg)
+{
+    const struct io_info *ios = (const struct io_info *)arg;
+    uint64_t x = ios[*(const uint64_t *)a].submit_tsc, y = ios[*(const uint64_t *)b].submit_tsc;
+
+    if (x != y) {
+        return x < y ? -1 : 1;
+    }
+    /* submits in the same tick keep trace order */
+    return *(const uint64_t *)a < *(const uint64_t *)b ? -1 : 1;
+}
+
+static int
+io_end_cmp(const void *a, const void *b, void *arg)
+{
+    const struct io_info *ios = (const struct io_info *)arg;
+    const struct io_info *x = &ios[*(const uint64_t *)a], *y = &ios[*(const uint64_t *)b];
+    uint64_t ex = x->submit_tsc + x->lat, ey = y->submit_tsc + y->lat;
+
+    return ex == ey ? 0 : (ex < ey ? -1 : 1);
+}
+
+/*
+ * QD at submit of every I/O, itself included: the earlier submits still in flight, in one
+ * sweep of the submits in order against the completions in order. An I/O of zero latency
+ * is never in flight at a later submit, so it takes no part.
+ */
+static int
+outlier_qd(const struct io_info *ios, const uint64_t *order, uint64_t io_cnt, uint64_t *qd,
+           uint64_t *lcore_qd)
+{
+    uint64_t *done = (uint64_t *)malloc((io_cnt + 1) * sizeof(uint64_t));
+    uint64_t *inflight = NULL, total = 0, done_cnt = 0;
+    uint32_t max_lcore = 0;
+
+    for (uint64_t i = 0; i < io_cnt; i++) {
+        max_lcore = spdk_max(max_lcore, ios[i].lcore);
+    }
+    inflight = (uint64_t *)calloc((uint64_t)max_lcore + 1, sizeof(uint64_t));
+    if (done == NULL || inflight == NULL) {
+        free(done);
+        free(inflight);
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < io_cnt; i++) {
+        if (ios[i].completed && ios[i].lat) {
+            done[done_cnt++] = i;
+        }
+    }
+    qsort_r(done, done_cnt, sizeof(uint64_t), io_end_cmp, (void *)ios);
+
+    for (uint64_t p = 0, d = 0; p < io_cnt; p++) {
+        const struct io_info *io = &ios[order[p]];
+
+        /* completed by the submit: its own submit came earlier, the latency is not zero */
+        while (d < done_cnt && ios[done[d]].submit_tsc + ios[done[d]].lat <= io->submit_tsc) {
+            total--;
+            inflight[ios[done[d]].lcore]--;
+            d++;
+        }
+        qd[order[p]] = total + 1;
+        lcore_qd[order[p]] = inflight[io->lcore] + 1;
+        if (io->completed && io->lat) {
+            total++;
+            inflight[io->lcore]++;
+        }
+    }
+    free(done);
+    free(inflight);
+    return 0;
+}
+
+static void
+print_outlier_io(const struct trace_table *trace, const struct io_info *io)
+{
+    const char *opc_name, *zone_act_name;
+
+    set_opc_name(io->opc, &opc_name);
+    printf("%-20s lcore %-3u nsid %-3u ", opc_name, io->lcore, io->nsid);
+    if (io->opc == SPDK_NVME_OPC_ZONE_MGMT_SEND) {
+        set_zone_act_name(io->opc, trace->cdw13[io->row] & UINT8BIT_MASK, &zone_act_name);
+        printf("%s%s zslba 0x%jx", zone_act_name,
+                (trace->cdw13[io->row] & (uint32_t)1 << 8) ? " (all)" : "", io->slba);
+    } else if (opc_has_lba_range(io->opc)) {
+        printf("slba 0x%-12jx blocks %-6u", io->slba, io->nlb);
+    }
+}
+
+static int
+process_outliers(const struct trace_table *trace)
+{
+    struct io_info *ios = NULL;
+    struct outlier *heap = NULL;
+    uint64_t *order = NULL, *pos = NULL, *qd = NULL, *lcore_qd = NULL, io_cnt = 0;
+    uint64_t window;
+    uint32_t n = 0;
+    int rc;
+
+    g_tsc_rate = trace->tsc_rate;
+    /* a window longer than the tsc counts covers the whole trace */
+    window = trace->tsc_rate && g_outlier_window_us > UINT64_MAX / trace->tsc_rate ? UINT64_MAX :
+             g_outlier_window_us * trace->tsc_rate / (1000 * 1000);
+    rc = build_io_info(trace, &ios, &io_cnt);
+    if (rc) {
+        return rc;
+    }
+
+    heap = (struct outlier *)malloc(g_outlier_k * sizeof(struct outlier));
+    order = (uint64_t *)malloc((io_cnt + 1) * sizeof(uint64_t));
+    pos = (uint64_t *)malloc((io_cnt + 1) * sizeof(uint64_t));
+    qd = (uint64_t *)malloc((io_cnt + 1) * sizeof(uint64_t));
+    lcore_qd = (uint64_t *)malloc((io_cnt + 1) * sizeof(uint64_t));
+    if (heap == NULL || order == NULL || pos == NULL || qd == NULL || lcore_qd == NULL) {
+        fprintf(stderr, "Fail to allocate memory for latency outliers\n");
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    for (uint64_t i = 0; i < io_cnt; i++) {
+        if (ios[i].completed) {
+            outlier_push(heap, &n, g_outlier_k, ios[i].lat, i);
+        }
+        order[i] = i;
+    }
+    qsort(heap, n, sizeof(struct outlier), outlier_cmp);
+    qsort_r(order, io_cnt, sizeof(uint64_t), io_submit_cmp, ios);
+    for (uint64_t i = 0; i < io_cnt; i++) {
+        pos[order[i]] = i;
+    }
+    rc = outlier_qd(ios, order, io_cnt, qd, lcore_qd);
+    if (rc) {
+        fprintf(stderr, "Fail to allocate memory for latency outliers\n");
+        goto out;
+    }
+
+    print_uline('=', printf("\nTop %u latency outliers (context: I/Os submitted in the preceding %ju us)\n",
+            g_outlier_k, g_outlier_window_us));
+    for (uint32_t r = 0; r < n; r++) {
+        const struct io_info *io = &ios[heap[r].idx];
+        uint64_t t = io->submit_tsc, from, ctx_blocks = 0, ctx_busy = 0;
+        uint64_t p = pos[heap[r].idx];
+
+        printf("#%-3u %10.3f (us)  at %14.3f (us)  ", r + 1, get_us_from_tsc(io->lat, g_tsc_rate),
+                get_us_from_tsc(t, g_tsc_rate));
+        print_outlier_io(trace, io);
+        printf("  QD %ju (lcore %ju)%s\n", qd[heap[r].idx], lcore_qd[heap[r].idx], io->status ? "  FAILED" : "");
+
+        for (from = p; from > 0 && t - ios[order[from - 1]].submit_tsc <= window; from--) {
+            const struct io_info *o = &ios[order[from - 1]];
+
+            ctx_blocks += opc_has_lba_range(o->opc) ? o->nlb : 0;
+            ctx_busy += o->completed && o->submit_tsc + o->lat > t;
+        }
+        printf("     preceding: %ju I/Os, %ju blocks, %ju still in flight at submit (*)%s\n", p - from,
+                ctx_blocks, ctx_busy, p - from > OUTLIER_CONTEXT_MAX ? ", latest listed" : "");
+        for (uint64_t j = p - spdk_min(p - from, (uint64_t)OUTLIER_CONTEXT_MAX); j < p; j++) {
+            const struct io_info *o = &ios[order[j]];
+
+            printf("     %c %10.3f (us)  ", (o->completed && o->submit_tsc + o->lat > t) ? '*' : ' ',
+                    -get_us_from_tsc(t - o->submit_tsc, g_tsc_rate));
+            print_outlier_io(trace, o);
+            if (o->completed) {
+                printf("  lat %.3f (us)", get_us_from_tsc(o->lat, g_tsc_rate));
+            }
+            printf("\n");
+        }
+    }
+
+out:
+    free(heap);
+    free(order);
+    free(pos);
+    free(qd);
+    free(lcore_qd);
+    free(ios);
+    return rc;
+}
+/* latency outliers end */
+
+/* trace compare start */
+#define CMP_OPCS 256
+#define CMP_ALL_SIZES SIZE_BUCKETS  /* size index of the per-opcode row */
+#define CMP_MIN_SAMPLES 30          /* below this a row is reported but never gates */
+
+/* Completed latencies (tsc) of one opcode / size bucket, sorted after loading */
+struct cmp_group {
+    uint64_t *lat;
+    uint64_t cnt;
+    uint64_t size;
+};
+
+struct cmp_side {
+    const char *file;
+    uint64_t tsc_rate;
+    uint64_t ios;
+    struct cmp_group g[CMP_OPCS][SIZE_BUCKETS + 1];
+    int rc;
+};
+
+static bool g_compare = false;
+static char g_compare_file[2][PATH_MAX];
+static double g_compare_threshold = 10.0;   /* percent p99 increase that fails the gate */
+static double g_compare_alpha = 0.01;       /* KS significance level */
+
+static int
+cmp_group_add(struct cmp_group *g, uint64_t lat)
+{
+    if (g->cnt == g->size) {
+        uint64_t size = g->size ? g->size * 2 : 64;
+        uint64_t *lat_new = (uint64_t *)realloc(g->lat, size * sizeof(uint64_t));
+
+        if (lat_new == NULL) {
+            return -ENOMEM;
+        }
+        g->lat = lat_new;
+        g->size = size;
+    }
+    g->lat[g->cnt++] = lat;
+    return 0;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x == y ? 0 : (x < y ? -1 : 1);
+}
+
+/* Nearest-rank percentile of a sorted sample */
+static uint64_t
+cmp_percentile(const struct cmp_group *g, double pct)
+{
+    uint64_t rank = (uint64_t)ceil(pct / 100 * g->cnt);
+
+    return g->cnt ? g->lat[rank ? rank - 1 : 0] : 0;
+}
+
+/*
+ * Two-sample Kolmogorov-Smirnov test on sorted samples: returns D, the
+ * largest gap between the empirical CDFs, and its asymptotic p-value.
+ */
+static double
+cmp_ks(const struct cmp_group *a, const struct cmp_group *b, double *p_value)
+{
+    uint64_t i = 0, j = 0;
+    double d = 0, ne, lambda, sum = 0;
+
+    while (i < a->cnt && j < b->cnt) {
+        uint64_t x = spdk_min(a->lat[i], b->lat[j]);
+
+        while (i < a->cnt && a->lat[i] == x) {
+            i++;
+        }
+        while (j < b->cnt && b->lat[j] == x) {
+            j++;
+        }
+        d = spdk_max(d, fabs((double)i / a->cnt - (double)j / b->cnt));
+    }
+
+    ne = (double)a->cnt * b->cnt / (a->cnt + b->cnt);
+    lambda = (sqrt(ne) + 0.12 + 0.11 / sqrt(ne)) * d;
+    for (int k = 1; k <= 100; k++) {
+        double term = 2 * ((k & 1) ? 1 : -1) * exp(-2.0 * k * k * lambda * lambda);
+
+        sum += term;
+        if (fabs(term) < 1e-10) {
+            break;
+        }
+    }
+    *p_value = lambda < 0.2 ? 1.0 : spdk_min(spdk_max(sum, 0.0), 1.0);
+    return d;
+}
+
+/* Load one trace and bucket its completed latencies, run on its own thread */
+static void *
+cmp_side_load(void *arg)
+{
+    struct cmp_side *side = (struct cmp_side *)arg;
+    struct trace_table trace;
+    struct io_info *ios = NULL;
+    uint64_t io_cnt = 0;
+
+    FILE *fptr = fopen(side->file, "rb");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open input file %s\n", side->file);
+        side->rc = -ENOENT;
+        return NULL;
+    }
+    fseeko(fptr, 0, SEEK_END);
+    uint64_t entry_cnt = (uint64_t)ftello(fptr) / sizeof(struct bin_file_data);
+    rewind(fptr);
+    side->rc = trace_table_load(&trace, fptr, entry_cnt);
+    fclose(fptr);
+    if (side->rc) {
+        return NULL;
+    }
+    side->tsc_rate = trace.tsc_rate;
+
+    side->rc = build_io_info(&trace, &ios, &io_cnt);
+    for (uint64_t i = 0; i < io_cnt && !side->rc; i++) {
+        struct io_info *io = &ios[i];
+
+        if (!io->completed || io->status) {
+            continue;
+        }
+        side->ios++;
+        side->rc = cmp_group_add(&side->g[io->opc & UINT8BIT_MASK][CMP_ALL_SIZES], io->lat);
+        if (!side->rc && opc_has_lba_range(io->opc)) {
+            uint32_t s = size_bucket((uint64_t)io->nlb * g_sector_size);
+            side->rc = cmp_group_add(&side->g[io->opc & UINT8BIT_MASK][s], io->lat);
+        }
+    }
+    if (side->rc == -ENOMEM) {
+        fprintf(stderr, "Fail to allocate memory for latency samples\n");
+    }
+
+    for (int o = 0; o < CMP_OPCS; o++) {
+        for (int s = 0; s <= SIZE_BUCKETS; s++) {
+            qsort(side->g[o][s].lat, side->g[o][s].cnt, sizeof(uint64_t), cmp_u64);
+        }
+    }
+    free(ios);
+    trace_table_free(&trace);
+    return NULL;
+}
+
+static double
+cmp_delta(double a, double b)
+{
+    return a ? (b - a) * 100 / a : 0.0;
+}
+
+/* Returns 0, or 2 when a latency regression beyond the threshold is significant */
+static int
+process_compare(void)
+{
+    static const double pcts[] = {50, 90, 99, 99.9};
+    struct cmp_side *side[2];
+    pthread_t tid[2];
+    bool threaded[2];
+    int regressions = 0, rc = 0;
+
+    for (int s = 0; s < 2; s++) {
+        side[s] = (struct cmp_side *)calloc(1, sizeof(struct cmp_side));
+        if (side[s] == NULL) {
+            fprintf(stderr, "Fail to allocate memory for trace compare\n");
+            free(side[0]);
+            return 1;
+        }
+        side[s]->file = g_compare_file[s];
+    }
+
+    trace_kernels_init();
+    for (int s = 0; s < 2; s++) {
+        threaded[s] = pthread_create(&tid[s], NULL, cmp_side_load, side[s]) == 0;
+        if (!threaded[s]) {
+            cmp_side_load(side[s]);
+        }
+    }
+    for (int s = 0; s < 2; s++) {
+        if (threaded[s]) {
+            pthread_join(tid[s], NULL);
+        }
+        if (side[s]->rc) {
+            rc = 1;
+        }
+    }
+    if (rc) {
+        goto out;
+    }
+
+    print_uline('=', printf("\nTrace compare: A %s (%ju I/Os)  B %s (%ju I/Os)\n",
+            g_compare_file[0], side[0]->ios, g_compare_file[1], side[1]->ios));
+    printf("Latency in us, delta in %% of A. Gate: p99 up more than %.1f %% with KS p-value < %g\n\n",
+            g_compare_threshold, g_compare_alpha);
+    printf("%-20s %-6s %9s %9s", "OPCODE", "SIZE", "N(A)", "N(B)");
+    for (size_t p = 0; p < SPDK_COUNTOF(pcts); p++) {
+        char name[16];
+        snprintf(name, sizeof(name), "P%g", pcts[p]);
+        printf(" %10s(A) %10s(B) %8s", name, name, "DELTA");
+    }
+    printf(" %7s %9s  %s\n", "KS-D", "P-VALUE", "VERDICT");
+
+    for (int o = 0; o < CMP_OPCS; o++) {
+        /* the opcode's row over all sizes, then one per size bucket */
+        for (int k = 0; k <= SIZE_BUCKETS; k++) {
+            int s = k ? k - 1 : CMP_ALL_SIZES;
+            struct cmp_group *a = &side[0]->g[o][s], *b = &side[1]->g[o][s];
+            const char *opc_name, *verdict = "";
+            double d = 0, p_value = 1, p99_delta = 0;
+
+            if (!a->cnt && !b->cnt) {
+                continue;
+            }
+            set_opc_name(o, &opc_name);
+            printf("%-20s %-6s %9ju %9ju", opc_name, s == CMP_ALL_SIZES ? "all" : g_size_bucket_name[s],
+                    a->cnt, b->cnt);
+            for (size_t p = 0; p < SPDK_COUNTOF(pcts); p++) {
+                double la = get_us_from_tsc(cmp_percentile(a, pcts[p]), side[0]->tsc_rate);
+                double lb = get_us_from_tsc(cmp_percentile(b, pcts[p]), side[1]->tsc_rate);
+
+                printf(" %13.3f %13.3f %+7.1f%%", la, lb, cmp_delta(la, lb));
+                if (pcts[p] == 99) {
+                    p99_delta = a->cnt && b->cnt ? cmp_delta(la, lb) : 0;
+                }
+            }
+            if (a->cnt && b->cnt) {
+                d = cmp_ks(a, b, &p_value);
+                if (p_value < g_compare_alpha) {
+                    verdict = "changed";
+                    if (p99_delta > g_compare_threshold && a->cnt >= CMP_MIN_SAMPLES &&
+                        b->cnt >= CMP_MIN_SAMPLES) {
+                        verdict = "REGRESSED";
+                        regressions++;
+                    }
+                }
+                printf(" %7.4f %9.2e  %s\n", d, p_value, verdict);
+            } else {
+                printf(" %7s %9s  %s\n", "-", "-", a->cnt ? "only in A" : "only in B");
+            }
+        }
+    }
+
+    printf("\n%d regression(s) beyond the gate\n", regressions);
+    rc = regressions ? 2 : 0;
+
+out:
+    for (int s = 0; s < 2; s++) {
+        for (int o = 0; o < CMP_OPCS; o++) {
+            for (int b = 0; b <= SIZE_BUCKETS; b++) {
+                free(side[s]->g[o][b].lat);
+            }
+        }
+        free(side[s]);
+    }
+    return rc;
+}
+/* trace compare end */
+
+/* cache simulation start */
+#define CACHE_SIZES_MAX 8
+#define CACHE_RD_MAX_PAGES (1ULL << 22) /* pages tracked for reuse distance before the sampling rate halves */
+#define CACHE_RD_SUB_BITS 4
+#define CACHE_RD_BUCKETS ((64 - CACHE_RD_SUB_BITS + 1) << CACHE_RD_SUB_BITS)
+#define CACHE_HASH_SPACE (1ULL << 24)
+#define CACHE_NIL UINT32_MAX
+
+static uint32_t g_cache_page_bytes = 0; /* 0 = cache simulation disabled */
+static uint64_t g_cache_sizes[CACHE_SIZES_MAX]; /* in pages */
+static int g_cache_size_cnt = 0;
+
+static inline uint64_t
+page_hash(uint64_t page)
+{
+    /* murmur3 finalizer */
+    page ^= page >> 33;
+    page *= 0xff51afd7ed558ccdULL;
+    page ^= page >> 33;
+    page *= 0xc4ceb9fe1a85ec53ULL;
+    page ^= page >> 33;
+    return page;
+}
+
+/* Open addressing page -> value map, linear probing with backward shift deletion */
+struct page_map {
+    uint64_t *key;
+    uint64_t *val;
+    uint64_t mask;
+    uint64_t cnt;
+};
+
+#define PAGE_MAP_EMPTY UINT64_MAX
+
+static int
+page_map_init(struct page_map *m, uint64_t entries)
+{
+    uint64_t size = 16;
+
+    while (size < entries * 2) {
+        size <<= 1;
+    }
+    m->key = (uint64_t *)malloc(size * sizeof(uint64_t));
+    m->val = (uint64_t *)malloc(size * sizeof(uint64_t));
+    if (m->key == NULL || m->val == NULL) {
+        free(m->key);
+        free(m->val);
+        return -ENOMEM;
+    }
+    memset(m->key, 0xFF, size * sizeof(uint64_t));
+    m->mask = size - 1;
+    m->cnt = 0;
+    return 0;
+}
+
+static void
+page_map_free(struct page_map *m)
+{
+    free(m->key);
+    free(m->val);
+    m->key = m->val = NULL;
+}
+
+/* Slot of page, or of the empty slot it would be inserted at */
+static inline uint64_t
+page_map_slot(const struct page_map *m, uint64_t page)
+{
+    uint64_t i = page_hash(page) & m->mask;
+
+    while (m->key[i] != PAGE_MAP_EMPTY && m->key[i] != page) {
+        i = (i + 1) & m->mask;
+    }
+    return i;
+}
+
+static inline uint64_t *
+page_map_find(const struct page_map *m, uint64_t page)
+{
+    uint64_t i = page_map_slot(m, page);
+
+    return m->key[i] == page ? &m->val[i] : NULL;
+}
+
+/* Callers size the map so it never fills past half */
+static inline void
+page_map_put(struct page_map *m, uint64_t page, uint64_t val)
+{
+    uint64_t i = page_map_slot(m, page);
+
+    if (m->key[i] == PAGE_MAP_EMPTY) {
+        m->key[i] = page;
+        m->cnt++;
+    }
+    m->val[i] = val;
+}
+
+static void
+page_map_del(struct page_map *m, uint64_t page)
+{
+    uint64_t i = page_map_slot(m, page), j = i;
+
+    if (m->key[i] == PAGE_MAP_EMPTY) {
+        return;
+    }
+    m->key[i] = PAGE_MAP_EMPTY;
+    m->cnt--;
+
+    for (;;) {
+        j = (j + 1) & m->mask;
+        if (m->key[j] == PAGE_MAP_EMPTY) {
+            return;
+        }
+        uint64_t home = page_hash(m->key[j]) & m->mask;
+        /* move j back into the hole unless its home lies cyclically in (i, j] */
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            m->key[i] = m->key[j];
+            m->val[i] = m->val[j];
+            m->key[j] = PAGE_MAP_EMPTY;
+            i = j;
+        }
+    }
+}
+
+/*
+ * Reuse (stack) distance: a Fenwick tree over access time holds a 1 at the
+ * latest access of every tracked page, so the number of distinct pages
+ * touched since page p was last used is live - prefix(last[p]). Pages are
+ * spatially sampled by hash (SHARDS); the rate halves whenever more than
+ * CACHE_RD_MAX_PAGES are tracked, keeping memory bounded on any trace.
+ */
+struct reuse_dist {
+    struct page_map last;   /* page -> time of its latest access */
+    int32_t *tree;
+    uint64_t tree_size;
+    uint64_t now;
+    uint64_t threshold;     /* sample pages with hash < threshold out of CACHE_HASH_SPACE */
+    double   hist[CACHE_RD_BUCKETS];
+    double   read_hist[CACHE_RD_BUCKETS];
+    double   cold, read_cold;
+    double   accesses, read_accesses;
+};
+
+/* Sampling hash of page, from bits the slot index of rd->last (the low 24) does not use */
+static inline uint64_t
+rd_sample_hash(uint64_t page)
+{
+    return (page_hash(page) >> 40) % CACHE_HASH_SPACE;
+}
+
+static inline void
+fenwick_add(int32_t *tree, uint64_t size, uint64_t i, int32_t v)
+{
+    for (i++; i <= size; i += i & (~i + 1)) {
+        tree[i - 1] += v;
+    }
+}
+
+static inline int64_t
+fenwick_prefix(const int32_t *tree, uint64_t i)
+{
+    int64_t sum = 0;
+
+    for (i++; i > 0; i -= i & (~i + 1)) {
+        sum += tree[i - 1];
+    }
+    return sum;
+}
+
+static uint32_t
+rd_bucket(uint64_t d)
+{
+    if (d < (1ULL << CACHE_RD_SUB_BITS)) {
+        return d;
+    }
+    uint32_t e = 63 - __builtin_clzll(d);
+    uint32_t sub = (d >> (e - CACHE_RD_SUB_BITS)) & ((1U << CACHE_RD_SUB_BITS) - 1);
+
+    return ((e - CACHE_RD_SUB_BITS + 1) << CACHE_RD_SUB_BITS) + sub;
+}
+
+/* Largest distance falling in bucket idx */
+static uint64_t
+rd_bucket_max(uint32_t idx)
+{
+    if (idx < (1U << CACHE_RD_SUB_BITS)) {
+        return idx;
+    }
+    uint32_t e = (idx >> CACHE_RD_SUB_BITS) + CACHE_RD_SUB_BITS - 1;
+    uint64_t sub = idx & ((1U << CACHE_RD_SUB_BITS) - 1);
+
+    return (((1ULL << CACHE_RD_SUB_BITS) + sub + 1) << (e - CACHE_RD_SUB_BITS)) - 1;
+}
+
+static int
+reuse_dist_init(struct reuse_dist *rd)
+{
+    memset(rd, 0, sizeof(*rd));
+    if (page_map_init(&rd->last, CACHE_RD_MAX_PAGES + 1)) {
+        return -ENOMEM;
+    }
+    rd->tree_size = CACHE_RD_MAX_PAGES * 2;
+    rd->tree = (int32_t *)calloc(rd->tree_size, sizeof(int32_t));
+    if (rd->tree == NULL) {
+        page_map_free(&rd->last);
+        return -ENOMEM;
+    }
+    rd->threshold = CACHE_HASH_SPACE;
+    return 0;
+}
+
+static void
+reuse_dist_free(struct reuse_dist *rd)
+{
+    page_map_free(&rd->last);
+    free(rd->tree);
+}
+
+struct rd_live {
+    uint64_t time;
+    uint64_t slot;
+};
+
+static int
+rd_live_cmp(const void *a, const void *b)
+{
+    const struct rd_live *x = (const struct rd_live *)a;
+    const struct rd_live *y = (const struct rd_live *)b;
+
+    return x->time == y->time ? 0 : (x->time < y->time ? -1 : 1);
+}
+
+/* Renumber the live access times 0..n-1, dropping pages no longer sampled */
+static int
+reuse_dist_compact(struct reuse_dist *rd)
+{
+    struct page_map *m = &rd->last;
+    struct rd_live *live = (struct rd_live *)malloc((m->cnt + 1) * sizeof(struct rd_live));
+    uint64_t n = 0;
+
+    if (live == NULL) {
+        return -ENOMEM;
+    }
+
+    for (uint64_t i = 0; i <= m->mask; i++) {
+        if (m->key[i] != PAGE_MAP_EMPTY && rd_sample_hash(m->key[i]) < rd->threshold) {
+            live[n++] = (struct rd_live) { m->val[i], m->key[i] };
+        }
+    }
+    qsort(live, n, sizeof(struct rd_live), rd_live_cmp);
+
+    memset(m->key, 0xFF, (m->mask + 1) * sizeof(uint64_t));
+    m->cnt = 0;
+    memset(rd->tree, 0, rd->tree_size * sizeof(int32_t));
+    for (uint64_t i = 0; i < n; i++) {
+        page_map_put(m, live[i].slot, i);
+        fenwick_add(rd->tree, rd->tree_size, i, 1);
+    }
+    rd->now = n;
+    free(live);
+    return 0;
+}
+
+static int
+reuse_dist_access(struct reuse_dist *rd, uint64_t page, bool read)
+{
+    double scale = (double)CACHE_HASH_SPACE / rd->threshold;
+    uint64_t *last;
+    int rc;
+
+    rd->accesses++;
+    if (read) {
+        rd->read_accesses++;
+    }
+    if (rd_sample_hash(page) >= rd->threshold) {
+        return 0;
+    }
+
+    if (rd->now == rd->tree_size) {
+        rc = reuse_dist_compact(rd);
+        if (rc) {
+            return rc;
+        }
+    }
+
+    last = page_map_find(&rd->last, page);
+    if (last == NULL) {
+        rd->cold += scale;
+        if (read) {
+            rd->read_cold += scale;
+        }
+    } else {
+        uint64_t dist = (uint64_t)((rd->last.cnt - fenwick_prefix(rd->tree, *last)) * scale);
+        uint32_t idx = rd_bucket(dist);
+
+        rd->hist[idx] += scale;
+        if (read) {
+            rd->read_hist[idx] += scale;
+        }
+        fenwick_add(rd->tree, rd->tree_size, *last, -1);
+    }
+    page_map_put(&rd->last, page, rd->now);
+    fenwick_add(rd->tree, rd->tree_size, rd->now, 1);
+    rd->now++;
+
+    while (rd->last.cnt > CACHE_RD_MAX_PAGES && rd->threshold > 1) {
+        rd->threshold /= 2;
+        rc = reuse_dist_compact(rd);
+        if (rc) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/* Page lists shared by the LRU, ARC and 2Q simulators */
+struct cache_node {
+    uint64_t page;
+    uint32_t prev;
+    uint32_t next;
+    uint8_t  list;
+};
+
+struct cache_list {
+    uint32_t head; /* MRU */
+    uint32_t tail; /* LRU */
+    uint64_t len;
+};
+
+enum cache_policy {
+    CACHE_LRU,
+    CACHE_ARC,
+    CACHE_2Q,
+    CACHE_POLICIES,
+};
+
+static const char *g_cache_policy_name[CACHE_POLICIES] = { "LRU", "ARC", "2Q" };
+
+/* ARC: T1, T2 resident, B1, B2 ghost. 2Q: A1in, Am resident, A1out ghost. LRU: one list. */
+#define CACHE_LISTS 4
+
+struct cache_sim {
+    enum cache_policy policy;
+    uint64_t size;
+    uint64_t arc_p;
+    struct cache_node *node;
+    uint32_t free_head;
+    struct cache_list l[CACHE_LISTS];
+    struct page_map map;
+    uint64_t hits, read_hits;
+};
+
+static void
+clist_unlink(struct cache_sim *c, uint32_t n)
+{
+    struct cache_node *x = &c->node[n];
+    struct cache_list *l = &c->l[x->list];
+
+    if (x->prev != CACHE_NIL) {
+        c->node[x->prev].next = x->next;
+    } else {
+        l->head = x->next;
+    }
+    if (x->next != CACHE_NIL) {
+        c->node[x->next].prev = x->prev;
+    } else {
+        l->tail = x->prev;
+    }
+    l->len--;
+}
+
+static void
+clist_push_head(struct cache_sim *c, uint8_t list, uint32_t n)
+{
+    struct cache_node *x = &c->node[n];
+    struct cache_list *l = &c->l[list];
+
+    x->list = list;
+    x->prev = CACHE_NIL;
+    x->next = l->head;
+    if (l->head != CACHE_NIL) {
+        c->node[l->head].prev = n;
+    } else {
+        l->tail = n;
+    }
+    l->head = n;
+    l->len++;
+}
+
+static void
+clist_move_head(struct cache_sim *c, uint8_t list, uint32_t n)
+{
+    clist_unlink(c, n);
+    clist_push_head(c, list, n);
+}
+
+/* Drop the LRU page of a list from the directory altogether */
+static void
+clist_drop_tail(struct cache_sim *c, uint8_t list)
+{
+    uint32_t n = c->l[list].tail;
+
+    clist_unlink(c, n);
+    page_map_del(&c->map, c->node[n].page);
+    c->node[n].next = c->free_head;
+    c->free_head = n;
+}
+
+static uint32_t
+cache_node_new(struct cache_sim *c, uint64_t page, uint8_t list)
+{
+    uint32_t n = c->free_head;
+
+    c->free_head = c->node[n].next;
+    c->node[n].page = page;
+    clist_push_head(c, list, n);
+    page_map_put(&c->map, page, n);
+    return n;
+}
+
+static int
+cache_sim_init(struct cache_sim *c, enum cache_policy policy, uint64_t size)
+{
+    uint64_t nodes = size * 2 + 1; /* resident pages plus ghost history */
+
+    memset(c, 0, sizeof(*c));
+    c->policy = policy;
+    c->size = size;
+    c->node = (struct cache_node *)malloc(nodes * sizeof(struct cache_node));
+    if (c->node == NULL || page_map_init(&c->map, nodes)) {
+        free(c->node);
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < nodes; i++) {
+        c->node[i].next = i + 1 < nodes ? i + 1 : CACHE_NIL;
+    }
+    c->free_head = 0;
+    for (int i = 0; i < CACHE_LISTS; i++) {
+        c->l[i].head = c->l[i].tail = CACHE_NIL;
+    }
+    return 0;
+}
+
+static void
+cache_sim_free(struct cache_sim *c)
+{
+    free(c->node);
+    page_map_free(&c->map);
+}
+
+enum { ARC_T1, ARC_T2, ARC_B1, ARC_B2 };
+enum { Q_A1IN, Q_AM, Q_A1OUT };
+
+static void
+arc_replace(struct cache_sim *c, bool in_b2)
+{
+    struct cache_list *t1 = &c->l[ARC_T1];
+
+    if (t1->len && ((in_b2 && t1->len == c->arc_p) || t1->len > c->arc_p || !c->l[ARC_T2].len)) {
+        clist_move_head(c, ARC_B1, t1->tail);
+    } else {
+        clist_move_head(c, ARC_B2, c->l[ARC_T2].tail);
+    }
+}
+
+static bool
+arc_access(struct cache_sim *c, uint64_t page)
+{
+    uint64_t *v = page_map_find(&c->map, page);
+    struct cache_list *l = c->l;
+
+    if (v) {
+        uint32_t n = (uint32_t)*v;
+        uint8_t list = c->node[n].list;
+
+        if (list == ARC_T1 || list == ARC_T2) {
+            clist_move_head(c, ARC_T2, n);
+            return true;
+        }
+        if (list == ARC_B1) {
+            c->arc_p = spdk_min(c->size, c->arc_p + spdk_max(l[ARC_B2].len / l[ARC_B1].len, 1));
+            arc_replace(c, false);
+        } else {
+            uint64_t d = spdk_max(l[ARC_B1].len / l[ARC_B2].len, 1);
+            c->arc_p = c->arc_p > d ? c->arc_p - d : 0;
+            arc_replace(c, true);
+        }
+        clist_move_head(c, ARC_T2, n);
+        return false;
+    }
+
+    uint64_t l1 = l[ARC_T1].len + l[ARC_B1].len;
+    uint64_t total = l1 + l[ARC_T2].len + l[ARC_B2].len;
+    if (l1 == c->size) {
+        if (l[ARC_T1].len < c->size) {
+            clist_drop_tail(c, ARC_B1);
+            arc_replace(c, false);
+        } else {
+            clist_drop_tail(c, ARC_T1);
+        }
+    } else if (total >= c->size) {
+        if (total == c->size * 2) {
+            clist_drop_tail(c, ARC_B2);
+        }
+        arc_replace(c, false);
+    }
+    cache_node_new(c, page, ARC_T1);
+    return false;
+}
+
+/* Full 2Q with Kin = 25% and Kout = 50% of the cache size */
+static void
+twoq_reclaim(struct cache_sim *c)
+{
+    struct cache_list *l = c->l;
+
+    if (l[Q_A1IN].len + l[Q_AM].len < c->size) {
+        return;
+    }
+    if (l[Q_A1IN].len > spdk_max(c->size / 4, 1) || !l[Q_AM].len) {
+        clist_move_head(c, Q_A1OUT, l[Q_A1IN].tail);
+        if (l[Q_A1OUT].len > spdk_max(c->size / 2, 1)) {
+            clist_drop_tail(c, Q_A1OUT);
+        }
+    } else {
+        clist_drop_tail(c, Q_AM);
+    }
+}
+
+static bool
+twoq_access(struct cache_sim *c, uint64_t page)
+{
+    uint64_t *v = page_map_find(&c->map, page);
+
+    if (v) {
+        uint32_t n = (uint32_t)*v;
+
+        switch (c->node[n].list) {
+        case Q_AM:
+            clist_move_head(c, Q_AM, n);
+            return true;
+        case Q_A1IN:
+            return true;
+        default:
+            clist_unlink(c, n);
+            twoq_reclaim(c);
+            clist_push_head(c, Q_AM, n);
+            return false;
+        }
+    }
+
+    twoq_reclaim(c);
+    cache_node_new(c, page, Q_A1IN);
+    return false;
+}
+
+static bool
+lru_access(struct cache_sim *c, uint64_t page)
+{
+    uint64_t *v = page_map_find(&c->map, page);
+
+    if (v) {
+        clist_move_head(c, 0, (uint32_t)*v);
+        return true;
+    }
+    if (c->l[0].len == c->size) {
+        clist_drop_tail(c, 0);
+    }
+    cache_node_new(c, page, 0);
+    return false;
+}
+
+static void
+cache_sim_access(struct cache_sim *c, uint64_t page, bool read)
+{
+    bool hit;
+
+    switch (c->policy) {
+    case CACHE_ARC:
+        hit = arc_access(c, page);
+        break;
+    case CACHE_2Q:
+        hit = twoq_access(c, page);
+        break;
+    default:
+        hit = lru_access(c, page);
+        break;
+    }
+    if (hit) {
+        c->hits++;
+        c->read_hits += read ? 1 : 0;
+    }
+}
+
+static double
+pct(double part, double whole)
+{
+    return whole ? part * 100 / whole : 0.0;
+}
+
+static int
+process_cache_sim(const struct trace_table *trace)
+{
+    struct reuse_dist *rd;
+    struct cache_sim sim[CACHE_SIZES_MAX][CACHE_POLICIES];
+    uint32_t page_blocks = g_cache_page_bytes / g_sector_size;
+    double page_mib = (double)g_cache_page_bytes / (1024 * 1024);
+    int nsim = 0, rc = 0;
+
+    if (page_blocks == 0 || g_cache_page_bytes % g_sector_size) {
+        fprintf(stderr, "Cache page size %u is not a multiple of the %u byte sector\n",
+                g_cache_page_bytes, g_sector_size);
+        return -EINVAL;
+    }
+
+    rd = (struct reuse_dist *)malloc(sizeof(struct reuse_dist));
+    if (rd == NULL || reuse_dist_init(rd)) {
+        fprintf(stderr, "Fail to allocate memory for reuse distance\n");
+        free(rd);
+        return -ENOMEM;
+    }
+    for (nsim = 0; nsim < g_cache_size_cnt; nsim++) {
+        for (int p = 0; p < CACHE_POLICIES; p++) {
+            if (cache_sim_init(&sim[nsim][p], (enum cache_policy)p, g_cache_sizes[nsim])) {
+                fprintf(stderr, "Fail to allocate memory for %ju page cache\n", g_cache_sizes[nsim]);
+                for (int q = 0; q < p; q++) {
+                    cache_sim_free(&sim[nsim][q]);
+                }
+                rc = -ENOMEM;
+                goto out;
+            }
+        }
+    }
+
+    /* one pass: every page touched by a read or write is one access, namespaces kept apart */
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        uint32_t i = trace->sub[j];
+        bool read;
+
+        switch (trace->opc[i]) {
+        case SPDK_NVME_OPC_READ:
+        case SPDK_NVME_OPC_COMPARE:
+            read = true;
+            break;
+        case SPDK_NVME_OPC_WRITE:
+        case SPDK_NVME_OPC_WRITE_ZEROES:
+            read = false;
+            break;
+        default:
+            continue;
+        }
+
+        uint64_t slba = trace->slba[i];
+        uint64_t elba = slba + trace->nlb[i] - 1;
+        for (uint64_t page = slba / page_blocks; page <= elba / page_blocks; page++) {
+            /* namespace id in the top byte keeps tenants' pages distinct */
+            uint64_t key = page | (uint64_t)(trace->nsid[i] & UINT8BIT_MASK) << 56;
+
+            rc = reuse_dist_access(rd, key, read);
+            if (rc) {
+                fprintf(stderr, "Fail to allocate memory for reuse distance\n");
+                goto out;
+            }
+            for (int s = 0; s < nsim; s++) {
+                for (int p = 0; p < CACHE_POLICIES; p++) {
+                    cache_sim_access(&sim[s][p], key, read);
+                }
+            }
+        }
+    }
+
+    print_uline('=', printf("\nCache simulation (page %u bytes, reuse distance sampling rate %.3f %%)\n",
+            g_cache_page_bytes, pct(rd->threshold, CACHE_HASH_SPACE)));
+    printf("Accesses: %.0f  Read: %.0f  Distinct pages: %.0f (%.3f MiB)\n", rd->accesses,
+            rd->read_accesses, rd->cold, rd->cold * page_mib);
+
+    /* sampled counts are scaled back up, so normalize by the scaled total */
+    double sampled = rd->cold, read_sampled = rd->read_cold;
+    for (uint32_t i = 0; i < CACHE_RD_BUCKETS; i++) {
+        sampled += rd->hist[i];
+        read_sampled += rd->read_hist[i];
+    }
+
+    print_uline('=', printf("\nReuse distance (distinct pages between reuses)\n"));
+    printf("%-16s %8s %8s\n", "distance", "%", "cum %");
+    double cum = 0;
+    for (uint32_t idx = 0; idx < 64; idx++) {
+        double w = 0;
+        char range[48];
+
+        for (uint32_t i = 0; i < CACHE_RD_BUCKETS; i++) {
+            if (log2_bucket(rd_bucket_max(i) + 1, 64) == idx) {
+                w += rd->hist[i];
+            }
+        }
+        if (!w) {
+            continue;
+        }
+        cum += w;
+        format_range(idx ? 1ULL << (idx - 1) : 0, (1ULL << idx) - 1, range, sizeof(range));
+        printf("%-16s %8.3f %8.3f\n", range, pct(w, sampled), pct(cum, sampled));
+    }
+    printf("%-16s %8.3f %8.3f\n", "cold", pct(rd->cold, sampled), 100.0);
+
+    print_uline('=', printf("\nLRU hit ratio vs capacity\n"));
+    printf("%-14s %14s %10s %10s\n", "pages", "MiB", "hit %", "read hit %");
+    double hits = 0, read_hits = 0;
+    uint32_t i = 0;
+    for (uint64_t cap = 1; cap <= (uint64_t)rd->cold * 2 && cap; cap <<= 1) {
+        /* distance d hits in a cache of more than d pages */
+        for (; i < CACHE_RD_BUCKETS && rd_bucket_max(i) < cap; i++) {
+            hits += rd->hist[i];
+            read_hits += rd->read_hist[i];
+        }
+        printf("%-14ju %14.3f %10.3f %10.3f\n", cap, cap * page_mib, pct(hits, sampled),
+                pct(read_hits, read_sampled));
+    }
+
+    if (nsim) {
+        print_uline('=', printf("\nCache policies at chosen sizes\n"));
+        printf("%-14s %14s", "pages", "MiB");
+        for (int p = 0; p < CACHE_POLICIES; p++) {
+            printf(" %7s hit %% %7s read %%", g_cache_policy_name[p], "");
+        }
+        printf("\n");
+        for (int s = 0; s < nsim; s++) {
+            printf("%-14ju %14.3f", g_cache_sizes[s], g_cache_sizes[s] * page_mib);
+            for (int p = 0; p < CACHE_POLICIES; p++) {
+                printf(" %13.3f %13.3f", pct(sim[s][p].hits, rd->accesses),
+                        pct(sim[s][p].read_hits, rd->read_accesses));
+            }
+            printf("\n");
+        }
+    }
+
+out:
+    for (int s = 0; s < nsim; s++) {
+        for (int p = 0; p < CACHE_POLICIES; p++) {
+            cache_sim_free(&sim[s][p]);
+        }
+    }
+    reuse_dist_free(rd);
+    free(rd);
+    return rc;
+}
+/* cache simulation end */
+
+/* query start */
+/*
+ * A small query language over completed I/Os, e.g.
+ *   where opc=read and lat>500us group by lcore, size_bucket select count, p99(lat), sum(bytes)
+ * WHERE is predicates joined by AND / OR (AND binds tighter, no parentheses),
+ * GROUP BY takes up to four dimensions, SELECT a list of aggregates.
+ * The query runs as one scan: predicates on submit fields are pushed into the
+ * submit / complete join, the rest and the aggregation run over the joined I/Os.
+ */
+#define Q_MAX_PREDS 16
+#define Q_MAX_CONJS 8
+#define Q_MAX_DIMS 4
+#define Q_MAX_ITEMS 16
+#define Q_TOKEN_LEN 64
+
+enum q_field {
+    Q_OPC,
+    Q_LCORE,
+    Q_NSID,
+    Q_STATUS,
+    Q_SIZE_BUCKET,
+    Q_SLBA,
+    Q_TIME,     /* submit time */
+    Q_NLB,
+    Q_BYTES,
+    Q_LAT,
+    Q_FIELDS,
+};
+
+static const struct {
+    const char *name;
+    bool submit;    /* known before the join, so it can be pushed down */
+    bool dim;       /* usable in GROUP BY */
+    int agg;        /* column of the per-group aggregates, -1 if not aggregatable */
+} g_q_field[Q_FIELDS] = {
+    [Q_OPC] = {"opc", true, true, -1},
+    [Q_LCORE] = {"lcore", true, true, -1},
+    [Q_NSID] = {"nsid", true, true, -1},
+    [Q_STATUS] = {"status", false, true, -1},
+    [Q_SIZE_BUCKET] = {"size_bucket", true, true, -1},
+    [Q_SLBA] = {"slba", true, false, -1},
+    [Q_TIME] = {"time", true, false, -1},
+    [Q_NLB] = {"nlb", true, false, 0},
+    [Q_BYTES] = {"bytes", true, false, 1},
+    [Q_LAT] = {"lat", false, false, 2},
+};
+#define Q_AGG_FIELDS 3
+
+enum q_op {
+    Q_EQ,
+    Q_NE,
+    Q_LT,
+    Q_LE,
+    Q_GT,
+    Q_GE,
+};
+
+enum q_agg {
+    Q_COUNT,
+    Q_SUM,
+    Q_AVG,
+    Q_MIN,
+    Q_MAX,
+    Q_PCT,
+};
+
+struct q_pred {
+    enum q_field field;
+    enum q_op op;
+    double val;     /* ns for lat / time until compiled to tsc */
+};
+
+struct q_conj {
+    struct q_pred pred[Q_MAX_PREDS];
+    int cnt;
+};
+
+struct q_item {
+    enum q_agg agg;
+    enum q_field field;
+    double pct;
+};
+
+struct query {
+    struct q_conj conj[Q_MAX_CONJS];
+    int conj_cnt;
+    enum q_field dim[Q_MAX_DIMS];
+    int dim_cnt;
+    struct q_item item[Q_MAX_ITEMS];
+    int item_cnt;
+    bool hist[Q_AGG_FIELDS];    /* fields with a percentile in the select list */
+};
+
+struct q_group {
+    uint64_t dim[Q_MAX_DIMS];   /* GROUP BY values, in GROUP BY order */
+    uint64_t next;              /* index + 1 of the next group with the same hash, 0 ends */
+    uint64_t cnt;
+    uint64_t sum[Q_AGG_FIELDS];
+    uint64_t min[Q_AGG_FIELDS];
+    uint64_t max[Q_AGG_FIELDS];
+    struct spdk_histogram_data *h[Q_AGG_FIELDS];
+};
+
+static char g_query[1024];
+static bool g_query_csv = false;
+
+struct q_lexer {
+    const char *p;
+    char tok[Q_TOKEN_LEN];
+    char peek[Q_TOKEN_LEN];    /* token returned by q_peek */
+};
+
+/* Next token: a word / number, an operator or a single punctuation char; "" at the end */
+static const char *
+q_next(struct q_lexer *lx)
+{
+    size_t n = 0;
+
+    while (isspace((unsigned char)*lx->p)) {
+        lx->p++;
+    }
+    if (isalnum((unsigned char)*lx->p) || *lx->p == '_' || *lx->p == '.') {
+        while ((isalnum((unsigned char)*lx->p) || *lx->p == '_' || *lx->p == '.') && n < Q_TOKEN_LEN - 1) {
+            lx->tok[n++] = (char)tolower((unsigned char)*lx->p++);
+        }
+    } else if (strchr("<>!=", *lx->p) && *lx->p) {
+        lx->tok[n++] = *lx->p++;
+        if (*lx->p == '=') {
+            lx->tok[n++] = *lx->p++;
+        }
+    } else if (*lx->p) {
+        lx->tok[n++] = *lx->p++;
+    }
+    lx->tok[n] = '\0';
+    return lx->tok;
+}
+
+static const char *
+q_peek(struct q_lexer *lx)
+{
+    struct q_lexer save = { .p = lx->p };
+
+    snprintf(lx->peek, sizeof(lx->peek), "%s", q_next(&save));
+    return lx->peek;
+}
+
+static int
+q_field_parse(const char *tok, enum q_field *f)
+{
+    for (int i = 0; i < Q_FIELDS; i++) {
+        if (strcmp(tok, g_q_field[i].name) == 0) {
+            *f = (enum q_field)i;
+            return 0;
+        }
+    }
+    if (strcmp(tok, "size") == 0) {
+        *f = Q_BYTES;
+        return 0;
+    }
+    fprintf(stderr, "Query: unknown field '%s'\n", tok);
+    return -EINVAL;
+}
+
+static int
+q_opc_parse(const char *tok, double *val)
+{
+    static const struct {
+        const char *name;
+        uint8_t opc;
+    } names[] = {
+        {"flush", SPDK_NVME_OPC_FLUSH}, {"write", SPDK_NVME_OPC_WRITE}, {"read", SPDK_NVME_OPC_READ},
+        {"wu", SPDK_NVME_OPC_WRITE_UNCORRECTABLE}, {"compare", SPDK_NVME_OPC_COMPARE},
+        {"wz", SPDK_NVME_OPC_WRITE_ZEROES}, {"write_zeroes", SPDK_NVME_OPC_WRITE_ZEROES},
+        {"dsm", SPDK_NVME_OPC_DATASET_MANAGEMENT}, {"trim", SPDK_NVME_OPC_DATASET_MANAGEMENT},
+        {"verify", SPDK_NVME_OPC_VERIFY}, {"copy", SPDK_NVME_OPC_COPY},
+        {"zone_send", SPDK_NVME_OPC_ZONE_MGMT_SEND}, {"zone_recv", SPDK_NVME_OPC_ZONE_MGMT_RECV},
+        {"append", SPDK_NVME_OPC_ZONE_APPEND},
+    };
+    char *end;
+
+    for (size_t i = 0; i < SPDK_COUNTOF(names); i++) {
+        if (strcmp(tok, names[i].name) == 0) {
+            *val = names[i].opc;
+            return 0;
+        }
+    }
+    *val = strtod(tok, &end);
+    if (end == tok || *end) {
+        fprintf(stderr, "Query: unknown opcode '%s'\n", tok);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Number with an optional unit: ns/us/ms/s for times, k/m/g (binary) for bytes */
+static int
+q_value_parse(enum q_field f, const char *tok, double *val)
+{
+    static const struct {
+        const char *unit;
+        double scale;
+    } units[] = {
+        {"", 1}, {"ns", 1}, {"us", 1e3}, {"ms", 1e6}, {"s", 1e9},
+        {"k", 1024}, {"kb", 1024}, {"m", 1024 * 1024}, {"mb", 1024 * 1024},
+        {"g", 1024.0 * 1024 * 1024}, {"gb", 1024.0 * 1024 * 1024},
+    };
+    char *end;
+
+    if (f == Q_OPC) {
+        return q_opc_parse(tok, val);
+    }
+    if (f == Q_SIZE_BUCKET) {
+        for (int i = 0; i < SIZE_BUCKETS; i++) {
+            if (strcasecmp(tok, g_size_bucket_name[i]) == 0) {
+                *val = i;
+                return 0;
+            }
+        }
+    }
+
+    *val = strtod(tok, &end);
+    if (end == tok) {
+        fprintf(stderr, "Query: bad value '%s'\n", tok);
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < SPDK_COUNTOF(units); i++) {
+        if (strcmp(end, units[i].unit) == 0) {
+            /* times without a unit are in us, like the rest of the reports */
+            if ((f == Q_LAT || f == Q_TIME) && i == 0) {
+                *val *= 1e3;
+            }
+            *val *= units[i].scale;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Query: bad unit in '%s'\n", tok);
+    return -EINVAL;
+}
+
+static int
+q_parse_where(struct q_lexer *lx, struct query *q)
+{
+    static const char *ops[] = {"=", "!=", "<", "<=", ">", ">="};
+    struct q_conj *c = &q->conj[q->conj_cnt++];
+
+    for (;;) {
+        struct q_pred *p;
+        int rc, op = -1;
+
+        if (c->cnt == Q_MAX_PREDS) {
+            fprintf(stderr, "Query: too many predicates\n");
+            return -EINVAL;
+        }
+        p = &c->pred[c->cnt++];
+        rc = q_field_parse(q_next(lx), &p->field);
+        if (rc) {
+            return rc;
+        }
+        q_next(lx);
+        for (size_t i = 0; i < SPDK_COUNTOF(ops); i++) {
+            if (strcmp(lx->tok, ops[i]) == 0 || (i == Q_EQ && strcmp(lx->tok, "==") == 0)) {
+                op = (int)i;
+            }
+        }
+        if (op < 0) {
+            fprintf(stderr, "Query: expected a comparison after '%s'\n", g_q_field[p->field].name);
+            return -EINVAL;
+        }
+        p->op = (enum q_op)op;
+        rc = q_value_parse(p->field, q_next(lx), &p->val);
+        if (rc) {
+            return rc;
+        }
+
+        if (strcmp(q_peek(lx), "and") == 0) {
+            q_next(lx);
+        } else if (strcmp(q_peek(lx), "or") == 0) {
+            q_next(lx);
+            if (q->conj_cnt == Q_MAX_CONJS) {
+                fprintf(stderr, "Query: too many OR terms\n");
+                return -EINVAL;
+            }
+            c = &q->conj[q->conj_cnt++];
+        } else {
+            return 0;
+        }
+    }
+}
+
+static int
+q_parse_group(struct q_lexer *lx, struct query *q)
+{
+    if (strcmp(q_next(lx), "by") != 0) {
+        fprintf(stderr, "Query: expected 'group by'\n");
+        return -EINVAL;
+    }
+    do {
+        enum q_field f;
+        int rc = q_field_parse(q_next(lx), &f);
+
+        if (rc) {
+            return rc;
+        }
+        if (!g_q_field[f].dim || q->dim_cnt == Q_MAX_DIMS) {
+            fprintf(stderr, "Query: cannot group by '%s'\n", g_q_field[f].name);
+            return -EINVAL;
+        }
+        q->dim[q->dim_cnt++] = f;
+    } while (strcmp(q_peek(lx), ",") == 0 && q_next(lx));
+    return 0;
+}
+
+static int
+q_parse_select(struct q_lexer *lx, struct query *q)
+{
+    do {
+        struct q_item *it;
+        const char *tok = q_next(lx);
+        int rc;
+
+        if (q->item_cnt == Q_MAX_ITEMS) {
+            fprintf(stderr, "Query: too many select items\n");
+            return -EINVAL;
+        }
+        it = &q->item[q->item_cnt++];
+        it->field = Q_LAT;
+        if (strcmp(tok, "count") == 0) {
+            it->agg = Q_COUNT;
+            if (strcmp(q_peek(lx), "(") == 0) {
+                q_next(lx);
+                while (*q_next(lx) && strcmp(lx->tok, ")") != 0) {
+                }
+            }
+            continue;
+        } else if (strcmp(tok, "sum") == 0) {
+            it->agg = Q_SUM;
+        } else if (strcmp(tok, "avg") == 0) {
+            it->agg = Q_AVG;
+        } else if (strcmp(tok, "min") == 0) {
+            it->agg = Q_MIN;
+        } else if (strcmp(tok, "max") == 0) {
+            it->agg = Q_MAX;
+        } else if (tok[0] == 'p' && isdigit((unsigned char)tok[1])) {
+            it->agg = Q_PCT;
+            it->pct = strtod(tok + 1, NULL);
+            if (it->pct <= 0 || it->pct > 100) {
+                fprintf(stderr, "Query: bad percentile '%s'\n", tok);
+                return -EINVAL;
+            }
+        } else {
+            fprintf(stderr, "Query: unknown aggregate '%s'\n", tok);
+            return -EINVAL;
+        }
+
+        if (strcmp(q_next(lx), "(") != 0) {
+            fprintf(stderr, "Query: expected '(' after an aggregate\n");
+            return -EINVAL;
+        }
+        rc = q_field_parse(q_next(lx), &it->field);
+        if (rc) {
+            return rc;
+        }
+        if (g_q_field[it->field].agg < 0) {
+            fprintf(stderr, "Query: cannot aggregate '%s', use lat, bytes or nlb\n", g_q_field[it->field].name);
+            return -EINVAL;
+        }
+        if (strcmp(q_next(lx), ")") != 0) {
+            fprintf(stderr, "Query: expected ')'\n");
+            return -EINVAL;
+        }
+        if (it->agg == Q_PCT) {
+            q->hist[g_q_field[it->field].agg] = true;
+        }
+    } while (strcmp(q_peek(lx), ",") == 0 && q_next(lx));
+    return 0;
+}
+
+static int
+query_parse(const char *text, struct query *q)
+{
+    struct q_lexer lx = { .p = text };
+    int rc = 0;
+
+    memset(q, 0, sizeof(*q));
+    while (!rc && *q_next(&lx)) {
+        if (strcmp(lx.tok, "where") == 0 && q->conj_cnt == 0) {
+            rc = q_parse_where(&lx, q);
+        } else if (strcmp(lx.tok, "group") == 0 && q->dim_cnt == 0) {
+            rc = q_parse_group(&lx, q);
+        } else if (strcmp(lx.tok, "select") == 0 && q->item_cnt == 0) {
+            rc = q_parse_select(&lx, q);
+        } else {
+            fprintf(stderr, "Query: unexpected '%s'\n", lx.tok);
+            rc = -EINVAL;
+        }
+    }
+    if (!rc && q->item_cnt == 0) {
+        q->item[q->item_cnt++].agg = Q_COUNT;
+    }
+    return rc;
+}
+
+/* Times were parsed in ns; predicates compare raw tsc, time from the first submit */
+static void
+query_compile(struct query *q, const struct trace_table *trace)
+{
+    uint64_t start = UINT64_MAX;
+
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        start = spdk_min(start, trace->obj_start[trace->sub[j]]);
+    }
+
+    for (int c = 0; c < q->conj_cnt; c++) {
+        for (int i = 0; i < q->conj[c].cnt; i++) {
+            struct q_pred *p = &q->conj[c].pred[i];
+
+            if (p->field == Q_LAT || p->field == Q_TIME) {
+                p->val = p->val * trace->tsc_rate / 1e9;
+            }
+            if (p->field == Q_TIME) {
+                p->val += start;
+            }
+        }
+    }
+}
+
+static uint64_t
+q_io_value(const struct io_info *io, enum q_field f)
+{
+    switch (f) {
+    case Q_OPC:
+        return io->opc;
+    case Q_LCORE:
+        return io->lcore;
+    case Q_NSID:
+        return io->nsid;
+    case Q_STATUS:
+        return io->status;
+    case Q_SIZE_BUCKET:
+        return size_bucket((uint64_t)io->nlb * g_sector_size);
+    case Q_SLBA:
+        return io->slba;
+    case Q_TIME:
+        return io->submit_tsc;
+    case Q_NLB:
+        return io->nlb;
+    case Q_BYTES:
+        return (uint64_t)io->nlb * g_sector_size;
+    case Q_LAT:
+        return io->lat;
+    default:
+        return 0;
+    }
+}
+
+static uint64_t
+q_row_value(const struct trace_table *trace, uint32_t row, enum q_field f)
+{
+    bool lba = opc_has_lba_range(trace->opc[row]);
+
+    switch (f) {
+    case Q_OPC:
+        return trace->opc[row];
+    case Q_LCORE:
+        return trace->lcore[row];
+    case Q_NSID:
+        return trace->nsid[row];
+    case Q_SIZE_BUCKET:
+        return size_bucket((uint64_t)(lba ? trace->nlb[row] : 0) * g_sector_size);
+    case Q_SLBA:
+        return lba ? trace->slba[row] : 0;
+    case Q_TIME:
+        return trace->obj_start[row];
+    case Q_NLB:
+        return lba ? trace->nlb[row] : 0;
+    case Q_BYTES:
+        return (uint64_t)(lba ? trace->nlb[row] : 0) * g_sector_size;
+    default:
+        return 0;
+    }
+}
+
+static bool
+q_pred_match(const struct q_pred *p, double v)
+{
+    switch (p->op) {
+    case Q_EQ:
+        return v == p->val;
+    case Q_NE:
+        return v != p->val;
+    case Q_LT:
+        return v < p->val;
+    case Q_LE:
+        return v <= p->val;
+    case Q_GT:
+        return v > p->val;
+    case Q_GE:
+        return v >= p->val;
+    default:
+        return false;
+    }
+}
+
+/* Pushed-down part of a single-conjunction WHERE, run on submit rows before the join */
+static bool
+q_row_filter(const struct trace_table *trace, uint32_t row, void *ctx)
+{
+    const struct q_conj *c = &((const struct query *)ctx)->conj[0];
+
+    for (int i = 0; i < c->cnt; i++) {
+        if (g_q_field[c->pred[i].field].submit &&
+            !q_pred_match(&c->pred[i], (double)q_row_value(trace, row, c->pred[i].field))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+q_io_match(const struct query *q, const struct io_info *io)
+{
+    if (q->conj_cnt == 0) {
+        return true;
+    }
+    for (int c = 0; c < q->conj_cnt; c++) {
+        bool match = true;
+
+        for (int i = 0; i < q->conj[c].cnt && match; i++) {
+            match = q_pred_match(&q->conj[c].pred[i], (double)q_io_value(io, q->conj[c].pred[i].field));
+        }
+        if (match) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+q_dim_format(enum q_field f, uint64_t v, char *buf, size_t len)
+{
+    const char *name;
+
+    switch (f) {
+    case Q_OPC:
+        set_opc_name(v, &name);
+        snprintf(buf, len, "%s", name);
+        break;
+    case Q_SIZE_BUCKET:
+        snprintf(buf, len, "%s", g_size_bucket_name[v]);
+        break;
+    default:
+        snprintf(buf, len, "%ju", v);
+        break;
+    }
+}
+
+static void
+q_item_name(const struct q_item *it, char *buf, size_t len)
+{
+    static const char *aggs[] = {"count", "sum", "avg", "min", "max"};
+
+    if (it->agg == Q_COUNT) {
+        snprintf(buf, len, "count");
+    } else if (it->agg == Q_PCT) {
+        snprintf(buf, len, "p%g(%s)", it->pct, g_q_field[it->field].name);
+    } else {
+        snprintf(buf, len, "%s(%s)", aggs[it->agg], g_q_field[it->field].name);
+    }
+    if (it->field == Q_LAT && it->agg != Q_COUNT) {
+        snprintf(buf + strlen(buf), len - strlen(buf), "%s", g_query_csv ? "_us" : " us");
+    }
+}
+
+static double
+q_item_value(const struct q_item *it, const struct q_group *g, uint64_t tsc_rate)
+{
+    int a = g_q_field[it->field].agg;
+    double v;
+
+    if (g->cnt == 0) {
+        return 0;
+    }
+    switch (it->agg) {
+    case Q_COUNT:
+        return (double)g->cnt;
+    case Q_SUM:
+        v = (double)g->sum[a];
+        break;
+    case Q_AVG:
+        v = g->cnt ? (double)g->sum[a] / g->cnt : 0;
+        break;
+    case Q_MIN:
+        v = (double)g->min[a];
+        break;
+    case Q_MAX:
+        v = (double)g->max[a];
+        break;
+    case Q_PCT:
+        /* bucket upper bound, never past what was seen */
+        v = (double)spdk_min(histogram_percentile(g->h[a], it->pct), g->max[a]);
+        break;
+    default:
+        return 0;
+    }
+    return it->field == Q_LAT ? v * 1e6 / tsc_rate : v;
+}
+
+static int
+q_group_cmp(const void *a, const void *b)
+{
+    const struct q_group *x = (const struct q_group *)a, *y = (const struct q_group *)b;
+
+    for (int d = 0; d < Q_MAX_DIMS; d++) {
+        if (x->dim[d] != y->dim[d]) {
+            return x->dim[d] < y->dim[d] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static int
+process_query(const struct trace_table *trace)
+{
+    struct query q;
+    struct io_info *ios = NULL;
+    struct q_group *groups = NULL;
+    struct page_map map = {};
+    struct q_group none = {};
+    uint64_t io_cnt = 0, group_cnt = 0, group_size = 0, matched = 0;
+    int rc;
+
+    rc = query_parse(g_query, &q);
+    if (rc) {
+        return rc;
+    }
+    query_compile(&q, trace);
+
+    /* with OR terms a row failing one term may pass another, so nothing is pushed down */
+    rc = build_io_info_filter(trace, q.conj_cnt == 1 ? q_row_filter : NULL, &q, &ios, &io_cnt);
+    if (rc || page_map_init(&map, 1024)) {
+        rc = rc ? rc : -ENOMEM;
+        goto out;
+    }
+
+    for (uint64_t i = 0; i < io_cnt; i++) {
+        const struct io_info *io = &ios[i];
+        uint64_t dim[Q_MAX_DIMS] = {}, key = 0, head, *slot;
+        struct q_group *g = NULL;
+
+        if (!io->completed || !q_io_match(&q, io)) {
+            continue;
+        }
+        matched++;
+
+        /* the map is keyed by a hash of the values, groups sharing it are chained */
+        for (int d = 0; d < q.dim_cnt; d++) {
+            dim[d] = q_io_value(io, q.dim[d]);
+            key = page_hash(key ^ dim[d]);
+        }
+        key = key == PAGE_MAP_EMPTY ? 0 : key;
+        slot = page_map_find(&map, key);
+        head = slot ? *slot + 1 : 0;
+        for (uint64_t n = head; n; n = groups[n - 1].next) {
+            if (memcmp(groups[n - 1].dim, dim, sizeof(dim)) == 0) {
+                g = &groups[n - 1];
+                break;
+            }
+        }
+        if (g == NULL) {
+            if (group_cnt == group_size) {
+                uint64_t size = group_size ? group_size * 2 : 64;
+                struct q_group *tmp = (struct q_group *)realloc(groups, size * sizeof(struct q_group));
+
+                if (tmp == NULL) {
+                    rc = -ENOMEM;
+                    goto out;
+                }
+                groups = tmp;
+                group_size = size;
+            }
+            if ((map.cnt + 1) * 2 > map.mask + 1) {
+                struct page_map bigger;
+
+                if (page_map_init(&bigger, (map.mask + 1) * 2)) {
+                    rc = -ENOMEM;
+                    goto out;
+                }
+                for (uint64_t s = 0; s <= map.mask; s++) {
+                    if (map.key[s] != PAGE_MAP_EMPTY) {
+                        page_map_put(&bigger, map.key[s], map.val[s]);
+                    }
+                }
+                page_map_free(&map);
+                map = bigger;
+            }
+
+            g = &groups[group_cnt];
+            memset(g, 0, sizeof(*g));
+            memcpy(g->dim, dim, sizeof(dim));
+            g->next = head;
+            for (int a = 0; a < Q_AGG_FIELDS; a++) {
+                g->min[a] = UINT64_MAX;
+                if (q.hist[a]) {
+                    g->h[a] = spdk_histogram_data_alloc();
+                    if (g->h[a] == NULL) {
+                        rc = -ENOMEM;
+                        group_cnt++;
+                        goto out;
+                    }
+                }
+            }
+            page_map_put(&map, key, group_cnt++);
+        }
+
+        g->cnt++;
+        for (int f = Q_NLB; f <= Q_LAT; f++) {
+            int a = g_q_field[f].agg;
+            uint64_t v = q_io_value(io, (enum q_field)f);
+
+            g->sum[a] += v;
+            g->min[a] = spdk_min(g->min[a], v);
+            g->max[a] = spdk_max(g->max[a], v);
+            if (g->h[a]) {
+                spdk_histogram_data_tally(g->h[a], v);
+            }
+        }
+    }
+
+    qsort(groups, group_cnt, sizeof(struct q_group), q_group_cmp);
+
+    if (!g_query_csv) {
+        print_uline('=', printf("\nQuery: %s\n", g_query));
+        printf("Matched %ju I/Os, %ju passed the submit-side filter\n\n", matched, io_cnt);
+    }
+    for (int d = 0; d < q.dim_cnt; d++) {
+        printf(g_query_csv ? "%s," : "%-20s ", g_q_field[q.dim[d]].name);
+    }
+    for (int it = 0; it < q.item_cnt; it++) {
+        char name[48];
+
+        q_item_name(&q.item[it], name, sizeof(name));
+        printf(g_query_csv ? (it + 1 < q.item_cnt ? "%s," : "%s") : "%18s ", name);
+    }
+    printf("\n");
+
+    /* without GROUP BY there is always one row, even when nothing matched */
+    for (uint64_t i = 0; i < group_cnt || (i == 0 && q.dim_cnt == 0); i++) {
+        const struct q_group *g = i < group_cnt ? &groups[i] : &none;
+
+        for (int d = 0; d < q.dim_cnt; d++) {
+            char buf[32];
+
+            q_dim_format(q.dim[d], g->dim[d], buf, sizeof(buf));
+            printf(g_query_csv ? "%s," : "%-20s ", buf);
+        }
+        for (int it = 0; it < q.item_cnt; it++) {
+            double v = q_item_value(&q.item[it], g, trace->tsc_rate);
+            bool frac = q.item[it].agg != Q_COUNT && (q.item[it].field == Q_LAT || q.item[it].agg == Q_AVG);
+
+            if (g_query_csv) {
+                printf(frac ? "%.3f%s" : "%.0f%s", v, it + 1 < q.item_cnt ? "," : "");
+            } else {
+                printf(frac ? "%18.3f " : "%18.0f ", v);
+            }
+        }
+        printf("\n");
+    }
+
+out:
+    if (rc == -ENOMEM) {
+        fprintf(stderr, "Fail to allocate memory for query groups\n");
+    }
+    for (uint64_t i = 0; i < group_cnt; i++) {
+        for (int a = 0; a < Q_AGG_FIELDS; a++) {
+            if (groups[i].h[a]) {
+                spdk_histogram_data_free(groups[i].h[a]);
+            }
+        }
+    }
+    free(groups);
+    page_map_free(&map);
+    free(ios);
+    return rc;
+}
+/* query end */
+
+/* inter-arrival start */
+/*
+ * Arrival process of the submissions: the gap distribution overall and per
+ * lcore, how bursty the counts are when looked at over growing windows
+ * (index of dispersion, 1 for Poisson arrivals), the windows where the rate
+ * runs above k times the mean, and the token bucket depth that lets the
+ * whole trace through at a few multiples of the mean rate.
+ */
+#define IAT_BUCKETS 40          /* log2 buckets of the gap in ns, up to ~550 s */
+#define IAT_HIST_LCORES 8       /* lcores shown next to the overall histogram */
+#define IAT_TOP_BURSTS 10
+
+static bool g_iat_report = false;
+static double g_burst_k = 2.0;
+static uint64_t g_burst_window_us = 1000;
+
+static const uint64_t g_idc_scale_us[] = {10, 100, 1000, 10000, 100000, 1000000};
+static const double g_bucket_rate_mult[] = {1.1, 1.5, 2, 4};
+
+struct iat_stat {
+    uint64_t cnt;               /* arrivals */
+    uint64_t first;
+    uint64_t last;
+    double   sum;               /* of the gaps in ns */
+    double   sum_sq;
+    uint64_t max;
+    uint64_t hist[IAT_BUCKETS];
+    struct spdk_histogram_data *h;  /* gaps in tsc, for percentiles */
+};
+
+struct iat_burst {
+    uint64_t start;             /* window index */
+    uint64_t windows;
+    uint64_t ios;
+};
+
+static int
+tsc_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x == y ? 0 : (x < y ? -1 : 1);
+}
+
+static int
+iat_add(struct iat_stat *s, uint64_t tsc, uint64_t tsc_rate)
+{
+    if (s->cnt++ == 0) {
+        s->first = s->last = tsc;
+        s->h = spdk_histogram_data_alloc();
+        if (s->h == NULL) {
+            fprintf(stderr, "Fail to allocate memory for inter-arrival histogram\n");
+            return -ENOMEM;
+        }
+        return 0;
+    }
+
+    uint64_t gap = tsc - s->last;
+    double ns = (double)gap * 1e9 / tsc_rate;
+
+    s->last = tsc;
+    s->sum += ns;
+    s->sum_sq += ns * ns;
+    s->max = spdk_max(s->max, gap);
+    s->hist[log2_bucket((uint64_t)ns, IAT_BUCKETS)]++;
+    spdk_histogram_data_tally(s->h, gap);
+    return 0;
+}
+
+static void
+print_iat_stat(const char *name, const struct iat_stat *s, uint64_t tsc_rate)
+{
+    uint64_t gaps = s->cnt ? s->cnt - 1 : 0;
+    double mean, sd;
+
+    if (gaps == 0) {
+        printf("%-15s  I/O: %-10ju no gaps\n", name, s->cnt);
+        return;
+    }
+    mean = s->sum / gaps;
+    sd = sqrt(spdk_max(s->sum_sq / gaps - mean * mean, 0.0));
+    printf("%-15s  I/O: %-10ju IOPS: %-12.1f MEAN: %-10.3f CV: %-7.3f P50: %-10.3f P99: %-10.3f "
+           "P99.9: %-10.3f MAX: %.3f\n",
+            name, s->cnt, s->last > s->first ? (double)gaps * tsc_rate / (s->last - s->first) : 0.0,
+            mean / 1000, mean ? sd / mean : 0.0,
+            get_us_from_tsc(histogram_percentile(s->h, 50), tsc_rate),
+            get_us_from_tsc(histogram_percentile(s->h, 99), tsc_rate),
+            get_us_from_tsc(histogram_percentile(s->h, 99.9), tsc_rate),
+            get_us_from_tsc(s->max, tsc_rate));
+}
+
+/*
+ * Index of dispersion of the counts in windows of the given length,
+ * var / mean over every whole window of the span, empty ones included.
+ */
+static double
+iat_idc(const uint64_t *tsc, uint64_t cnt, uint64_t window)
+{
+    uint64_t windows = (tsc[cnt - 1] - tsc[0]) / window;
+    uint64_t cur = 0, in_cur = 0, counted = 0;
+    double sum_sq = 0, mean;
+
+    for (uint64_t i = 0; i < cnt; i++) {
+        uint64_t w = (tsc[i] - tsc[0]) / window;
+
+        if (w >= windows) {
+            break;  /* the last window is cut short */
+        }
+        counted++;
+        if (w != cur) {
+            sum_sq += (double)in_cur * in_cur;
+            cur = w;
+            in_cur = 0;
+        }
+        in_cur++;
+    }
+    sum_sq += (double)in_cur * in_cur;
+
+    mean = (double)counted / windows;
+    return (sum_sq / windows - mean * mean) / mean;
+}
+
+/* Smallest bucket that passes every arrival at the given rate (I/O per tsc) */
+static double
+iat_bucket_depth(const uint64_t *tsc, uint64_t cnt, double rate)
+{
+    double backlog = 0, depth = 0;
+
+    for (uint64_t i = 0; i < cnt; i++) {
+        if (i) {
+            backlog = spdk_max(backlog - rate * (tsc[i] - tsc[i - 1]), 0.0);
+        }
+        backlog += 1;
+        depth = spdk_max(depth, backlog);
+    }
+    return depth;
+}
+
+static int
+iat_burst_cmp(const void *a, const void *b)
+{
+    const struct iat_burst *x = (const struct iat_burst *)a, *y = (const struct iat_burst *)b;
+
+    return x->ios == y->ios ? 0 : (x->ios > y->ios ? -1 : 1);
+}
+
+/*
+ * Submit times grouped by lcore, each lcore's in order from tsc + off[l] to tsc + off[l + 1];
+ * the trace keeps them in submit order only per queue
+ */
+static void
+iat_lcore_times(const struct trace_table *trace, uint32_t max_lcore, uint64_t *off, uint64_t *tsc)
+{
+    memset(off, 0, ((uint64_t)max_lcore + 2) * sizeof(uint64_t));
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        off[trace->lcore[trace->sub[j]] + 1]++;
+    }
+    for (uint64_t l = 0; l <= max_lcore; l++) {
+        off[l + 1] += off[l];
+    }
+    /* place each time at its lcore's next slot, off[l] ends up where lcore l + 1 starts */
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        uint32_t i = trace->sub[j];
+
+        tsc[off[trace->lcore[i]]++] = trace->obj_start[i];
+    }
+    memmove(off + 1, off, ((uint64_t)max_lcore + 1) * sizeof(uint64_t));
+    off[0] = 0;
+    for (uint64_t l = 0; l <= max_lcore; l++) {
+        qsort(tsc + off[l], off[l + 1] - off[l], sizeof(uint64_t), tsc_cmp);
+    }
+}
+
+static int
+process_inter_arrival(const struct trace_table *trace)
+{
+    uint64_t tsc_rate = trace->tsc_rate;
+    uint64_t *tsc = NULL, *lcore_tsc = NULL, *lcore_off = NULL, cnt = trace->sub_cnt;
+    struct iat_stat total = {}, *lcore = NULL;
+    struct iat_burst *burst = NULL;
+    uint32_t max_lcore = 0, shown = 0;
+    uint64_t burst_cnt = 0;
+    int rc = 0;
+
+    print_uline('=', printf("\nInter-arrival time\n"));
+    if (cnt < 2 || !tsc_rate) {
+        printf("Not enough submissions\n");
+        return 0;
+    }
+
+    tsc = (uint64_t *)malloc(cnt * sizeof(uint64_t));
+    lcore_tsc = (uint64_t *)malloc(cnt * sizeof(uint64_t));
+    if (tsc == NULL || lcore_tsc == NULL) {
+        fprintf(stderr, "Fail to allocate memory for arrivals\n");
+        rc = -ENOMEM;
+        goto out;
+    }
+    for (uint64_t j = 0; j < cnt; j++) {
+        uint32_t i = trace->sub[j];
+
+        tsc[j] = trace->obj_start[i];
+        max_lcore = spdk_max(max_lcore, trace->lcore[i]);
+    }
+    qsort(tsc, cnt, sizeof(uint64_t), tsc_cmp);
+
+    lcore = (struct iat_stat *)calloc(max_lcore + 1, sizeof(struct iat_stat));
+    lcore_off = (uint64_t *)malloc(((uint64_t)max_lcore + 2) * sizeof(uint64_t));
+    if (lcore == NULL || lcore_off == NULL) {
+        fprintf(stderr, "Fail to allocate memory for lcore arrivals\n");
+        rc = -ENOMEM;
+        goto out;
+    }
+    iat_lcore_times(trace, max_lcore, lcore_off, lcore_tsc);
+    for (uint64_t j = 0; j < cnt && !rc; j++) {
+        rc = iat_add(&total, tsc[j], tsc_rate);
+    }
+    for (uint32_t l = 0; l <= max_lcore && !rc; l++) {
+        for (uint64_t j = lcore_off[l]; j < lcore_off[l + 1] && !rc; j++) {
+            rc = iat_add(&lcore[l], lcore_tsc[j], tsc_rate);
+        }
+    }
+    if (rc) {
+        goto out;
+    }
+
+    printf("Gaps in us, CV = stddev / mean of the gap (1 for Poisson arrivals)\n");
+    print_iat_stat("overall", &total, tsc_rate);
+    for (uint32_t l = 0; l <= max_lcore; l++) {
+        char name[24];
+
+        if (!lcore[l].cnt) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "lcore %u", l);
+        print_iat_stat(name, &lcore[l], tsc_rate);
+    }
+
+    print_uline('=', printf("\nInter-arrival histogram (ns)\n"));
+    printf("%-24s %10s", "gap (ns)", "overall");
+    for (uint32_t l = 0; l <= max_lcore && shown < IAT_HIST_LCORES; l++) {
+        if (lcore[l].cnt) {
+            char name[24];
+
+            snprintf(name, sizeof(name), "lcore %u", l);
+            printf(" %10s", name);
+            shown++;
+        }
+    }
+    printf("\n");
+    for (uint32_t b = 0; b < IAT_BUCKETS; b++) {
+        char range[32];
+
+        if (!total.hist[b]) {
+            bool any = false;
+
+            for (uint32_t l = 0; l <= max_lcore; l++) {
+                any |= lcore[l].hist[b] != 0;
+            }
+            if (!any) {
+                continue;
+            }
+        }
+        format_log2_bucket(b, range, sizeof(range));
+        printf("%-24s %9.3f%%", range, pct(total.hist[b], total.cnt - 1));
+        shown = 0;
+        for (uint32_t l = 0; l <= max_lcore && shown < IAT_HIST_LCORES; l++) {
+            if (lcore[l].cnt) {
+                printf(" %9.3f%%", lcore[l].cnt > 1 ? pct(lcore[l].hist[b], lcore[l].cnt - 1) : 0.0);
+                shown++;
+            }
+        }
+        printf("\n");
+    }
+
+    print_uline('=', printf("\nIndex of dispersion of arrival counts (1 = Poisson, > 1 = bursty)\n"));
+    printf("%-15s ", "window (us)");
+    for (size_t s = 0; s < SPDK_COUNTOF(g_idc_scale_us); s++) {
+        printf(" %10ju", g_idc_scale_us[s]);
+    }
+    printf("\n");
+    for (int64_t l = -1; l <= (int64_t)max_lcore; l++) {
+        const uint64_t *t = tsc;
+        uint64_t n = cnt;
+        char name[24];
+
+        if (l >= 0) {
+            if (!lcore[l].cnt) {
+                continue;
+            }
+            n = lcore_off[l + 1] - lcore_off[l];
+            t = lcore_tsc + lcore_off[l];
+            snprintf(name, sizeof(name), "lcore %u", (uint32_t)l);
+        } else {
+            snprintf(name, sizeof(name), "overall");
+        }
+        printf("%-15s ", name);
+        for (size_t s = 0; s < SPDK_COUNTOF(g_idc_scale_us); s++) {
+            uint64_t window = g_idc_scale_us[s] * tsc_rate / 1000000;
+
+            /* fewer than 10 windows say little about the variance */
+            if (window == 0 || n < 2 || (t[n - 1] - t[0]) / window < 10) {
+                printf(" %10s", "-");
+            } else {
+                printf(" %10.3f", iat_idc(t, n, window));
+            }
+        }
+        printf("\n");
+    }
+
+    /* bursts: runs of windows whose rate is above k times the mean */
+    uint64_t window = spdk_max(g_burst_window_us * tsc_rate / 1000000, 1);
+    uint64_t windows = (tsc[cnt - 1] - tsc[0]) / window + 1;
+    double mean_per_window = (double)cnt / windows;
+    double limit = g_burst_k * mean_per_window;
+    uint64_t burst_windows = 0, burst_ios = 0, peak = 0;
+
+    /* bursts are apart by at least one quiet window and hold at least one I/O */
+    burst = (struct iat_burst *)calloc(spdk_min(windows / 2 + 1, cnt), sizeof(struct iat_burst));
+    if (burst == NULL) {
+        fprintf(stderr, "Fail to allocate memory for bursts\n");
+        rc = -ENOMEM;
+        goto out;
+    }
+    for (uint64_t j = 0; j < cnt;) {
+        uint64_t w = (tsc[j] - tsc[0]) / window, n = 0;
+
+        while (j < cnt && (tsc[j] - tsc[0]) / window == w) {
+            n++;
+            j++;
+        }
+        peak = spdk_max(peak, n);
+        if (n > limit) {
+            if (burst_cnt && burst[burst_cnt - 1].start + burst[burst_cnt - 1].windows == w) {
+                burst[burst_cnt - 1].windows++;
+                burst[burst_cnt - 1].ios += n;
+            } else {
+                burst[burst_cnt++] = (struct iat_burst) { w, 1, n };
+            }
+            burst_windows++;
+            burst_ios += n;
+        }
+    }
+
+    print_uline('=', printf("\nBursts (%ju us windows above %.2f x the mean rate, from the first submit)\n",
+                            g_burst_window_us, g_burst_k));
+    printf("Mean: %.1f IOPS  Peak window: %.1f IOPS (%.2f x mean)\n",
+            mean_per_window * 1000000 / g_burst_window_us, (double)peak * 1000000 / g_burst_window_us,
+            mean_per_window ? peak / mean_per_window : 0.0);
+    printf("Bursts: %ju  Time in bursts: %.3f %%  I/O in bursts: %.3f %%\n",
+            burst_cnt, pct(burst_windows, windows), pct(burst_ios, cnt));
+    qsort(burst, burst_cnt, sizeof(struct iat_burst), iat_burst_cmp);
+    for (uint64_t b = 0; b < spdk_min(burst_cnt, IAT_TOP_BURSTS); b++) {
+        printf("  at %12ju (us)  length %10ju (us)  I/O %-10ju %.1f IOPS\n",
+                burst[b].start * g_burst_window_us, burst[b].windows * g_burst_window_us,
+                burst[b].ios, (double)burst[b].ios * 1000000 / (burst[b].windows * g_burst_window_us));
+    }
+
+    print_uline('=', printf("\nToken bucket depth to pass every arrival\n"));
+    for (size_t m = 0; m < SPDK_COUNTOF(g_bucket_rate_mult); m++) {
+        double rate = g_bucket_rate_mult[m] * (cnt - 1) / (tsc[cnt - 1] - tsc[0]);
+
+        printf("rate %4.2f x mean  %12.1f IOPS  depth %.0f I/O\n", g_bucket_rate_mult[m],
+                rate * tsc_rate, iat_bucket_depth(tsc, cnt, rate));
+    }
+
+out:
+    spdk_histogram_data_free(total.h);
+    if (lcore) {
+        for (uint32_t l = 0; l <= max_lcore; l++) {
+            spdk_histogram_data_free(lcore[l].h);
+        }
+    }
+    free(lcore);
+    free(burst);
+    free(tsc);
+    free(lcore_tsc);
+    free(lcore_off);
+    return rc;
+}
+/* inter-arrival end */
+
+/* Get namespace data start */
+static uint64_t g_ns_capacity = 0; /* number of blocks in a namespace */
+static uint64_t g_ns_block = 0; /* blocks of the per-block R/W table, ZNS namespaces only */
+static size_t g_max_transfer_block = 0;
+static bool g_zone = false;
+static uint64_t g_zone_size_lba = 0;
+static uint64_t g_total_zones = 0;
+static uint32_t g_max_open_zone = 0; /* 0 = no limit */
+static uint32_t g_max_active_zone = 0;
+static void
+get_ns_info(void)
+{
+    struct ns_entry *ns_entry = TAILQ_FIRST(&g_namespaces);
+
+    if (ns_entry == NULL) {
+        return;
+    }
+    g_sector_size = spdk_nvme_ns_get_sector_size(ns_entry->ns);
+
+    const struct spdk_nvme_ns_data *ndata = spdk_nvme_ns_get_data(ns_entry->ns);
+    g_ns_capacity = ndata->ncap;
+    g_max_transfer_block = spdk_nvme_ns_get_max_io_xfer_size(ns_entry->ns);
+
+    if (spdk_nvme_ns_get_csi(ns_entry->ns) == SPDK_NVME_CSI_ZNS) {
+        /* a conventional namespace is too large to count every block of */
+        g_ns_block = g_ns_capacity;
+        g_zone = true;
+        g_zone_size_lba = spdk_nvme_zns_ns_get_zone_size_sectors(ns_entry->ns);
+        g_total_zones = spdk_nvme_zns_ns_get_num_zones(ns_entry->ns);
+        g_max_open_zone = spdk_nvme_zns_ns_get_max_open_zones(ns_entry->ns);
+        g_max_active_zone = spdk_nvme_zns_ns_get_max_active_zones(ns_entry->ns);
+    }
+
+}
+/* Get namespace data end */
+
+/* zone simulation start */
+#define ZONE_SIM_WINDOWS 20
+#define ZONE_SIM_TOP 10
+
+struct zone_sim {
+    uint64_t wp;        /* write pointer offset from the zone start */
+    uint64_t written;   /* blocks holding data, wp minus what FINISH skipped */
+    uint32_t resets;
+    uint32_t finishes;
+    uint8_t  state;
+};
+
+struct zone_sim_stat {
+    uint64_t open;
+    uint64_t active;
+    uint64_t peak_open;
+    uint64_t peak_active;
+    uint64_t last_tsc;
+    double   open_area;
+    double   active_area;
+    uint64_t tsc_at_max_open;
+    uint64_t tsc_at_max_active;
+    uint64_t implicit_closes;   /* implicitly opened zones closed to admit another */
+    uint64_t open_limit;        /* opens rejected with too many open zones */
+    uint64_t active_limit;      /* activations rejected with too many active zones */
+    uint64_t out_of_order;      /* WRITE not at the write pointer */
+    uint64_t boundary;          /* writes / appends past the zone capacity or to a full zone */
+    uint64_t invalid;           /* zone actions not allowed in the current state */
+    uint64_t wasted_blocks;     /* capacity left unwritten by FINISH */
+    uint64_t discarded_blocks;  /* written blocks thrown away by RESET */
+    uint64_t resets;
+    uint64_t finishes;
+    uint32_t last_win;          /* window holding last_tsc */
+    uint64_t win_open[ZONE_SIM_WINDOWS];
+    uint64_t win_active[ZONE_SIM_WINDOWS];
+};
+
+static bool g_zone_sim = false;
+static uint64_t g_zone_cap_lba = 0; /* writable blocks per zone, defaults to the zone size */
+
+static bool
+zone_is_open(uint8_t state)
+{
+    return state == SPDK_NVME_ZONE_STATE_IOPEN || state == SPDK_NVME_ZONE_STATE_EOPEN;
+}
+
+static bool
+zone_is_active(uint8_t state)
+{
+    return zone_is_open(state) || state == SPDK_NVME_ZONE_STATE_CLOSED;
+}
+
+/* Move a zone to a new state, keeping the open / active counters in step */
+static void
+zone_set_state(struct zone_sim_stat *st, struct zone_sim *z, uint8_t state)
+{
+    st->open -= zone_is_open(z->state);
+    st->active -= zone_is_active(z->state);
+    z->state = state;
+    st->open += zone_is_open(state);
+    st->active += zone_is_active(state);
+    st->peak_open = spdk_max(st->peak_open, st->open);
+    st->peak_active = spdk_max(st->peak_active, st->active);
+}
+
+/*
+ * Open a zone, implicitly (write to an empty / closed zone) or explicitly.
+ * Returns false when the device would fail the command for lack of resources.
+ */
+static bool
+zone_open(struct zone_sim_stat *st, struct zone_sim *zones, struct zone_sim *z, uint8_t state)
+{
+    if (zone_is_open(z->state)) {
+        if (state == SPDK_NVME_ZONE_STATE_EOPEN) {
+            zone_set_state(st, z, state);
+        }
+        return true;
+    }
+
+    if (!zone_is_active(z->state) && g_max_active_zone && st->active >= g_max_active_zone) {
+        st->active_limit++;
+        return false;
+    }
+
+    if (g_max_open_zone && st->open >= g_max_open_zone) {
+        /* the controller may close an implicitly opened zone to make room */
+        uint64_t victim = g_total_zones;
+        for (uint64_t i = 0; i < g_total_zones; i++) {
+            if (zones[i].state == SPDK_NVME_ZONE_STATE_IOPEN) {
+                victim = i;
+                break;
+            }
+        }
+        if (victim == g_total_zones) {
+            st->open_limit++;
+            return false;
+        }
+        zone_set_state(st, &zones[victim], SPDK_NVME_ZONE_STATE_CLOSED);
+        st->implicit_closes++;
+    }
+
+    zone_set_state(st, z, state);
+    return true;
+}
+
+static void
+zone_write(struct zone_sim_stat *st, struct zone_sim *zones, struct zone_sim *z, uint64_t zslba,
+           uint64_t slba, uint32_t nlb, bool append)
+{
+    if (z->state == SPDK_NVME_ZONE_STATE_FULL || z->state == SPDK_NVME_ZONE_STATE_RONLY ||
+        z->state == SPDK_NVME_ZONE_STATE_OFFLINE || z->wp + nlb > g_zone_cap_lba) {
+        st->boundary++;
+        return;
+    }
+    if (!append && slba != zslba + z->wp) {
+        st->out_of_order++;
+        return;
+    }
+    if (!zone_open(st, zones, z, SPDK_NVME_ZONE_STATE_IOPEN)) {
+        return;
+    }
+
+    z->wp += nlb;
+    z->written += nlb;
+    if (z->wp == g_zone_cap_lba) {
+        zone_set_state(st, z, SPDK_NVME_ZONE_STATE_FULL);
+    }
+}
+
+static void
+zone_action(struct zone_sim_stat *st, struct zone_sim *zones, struct zone_sim *z, uint8_t action,
+            bool select_all)
+{
+    uint8_t s = z->state;
+
+    switch (action) {
+    case SPDK_NVME_ZONE_OPEN:
+        if (select_all && s != SPDK_NVME_ZONE_STATE_CLOSED) {
+            return;
+        }
+        if (s == SPDK_NVME_ZONE_STATE_EMPTY || s == SPDK_NVME_ZONE_STATE_CLOSED || zone_is_open(s)) {
+            zone_open(st, zones, z, SPDK_NVME_ZONE_STATE_EOPEN);
+        } else {
+            st->invalid++;
+        }
+        break;
+    case SPDK_NVME_ZONE_CLOSE:
+        if (zone_is_open(s)) {
+            /* a zone closed before its first write goes straight back to empty */
+            zone_set_state(st, z, z->wp ? SPDK_NVME_ZONE_STATE_CLOSED : SPDK_NVME_ZONE_STATE_EMPTY);
+        } else if (s != SPDK_NVME_ZONE_STATE_CLOSED && !select_all) {
+            st->invalid++;
+        }
+        break;
+    case SPDK_NVME_ZONE_FINISH:
+        if (select_all && !zone_is_active(s)) {
+            return;
+        }
+        if (s == SPDK_NVME_ZONE_STATE_EMPTY || zone_is_active(s)) {
+            st->wasted_blocks += g_zone_cap_lba - z->wp;
+            st->finishes++;
+            z->finishes++;
+            z->wp = g_zone_cap_lba;
+            zone_set_state(st, z, SPDK_NVME_ZONE_STATE_FULL);
+        } else if (s != SPDK_NVME_ZONE_STATE_FULL) {
+            st->invalid++;
+        }
+        break;
+    case SPDK_NVME_ZONE_RESET:
+        if (select_all && (s == SPDK_NVME_ZONE_STATE_EMPTY || s == SPDK_NVME_ZONE_STATE_RONLY ||
+                           s == SPDK_NVME_ZONE_STATE_OFFLINE)) {
+            return;
+        }
+        if (s == SPDK_NVME_ZONE_STATE_EMPTY || zone_is_active(s) || s == SPDK_NVME_ZONE_STATE_FULL) {
+            st->resets++;
+            z->resets++;
+            st->discarded_blocks += z->written;
+            z->wp = 0;
+            z->written = 0;
+            zone_set_state(st, z, SPDK_NVME_ZONE_STATE_EMPTY);
+        } else {
+            st->invalid++;
+        }
+        break;
+    case SPDK_NVME_ZONE_OFFLINE:
+        if (s == SPDK_NVME_ZONE_STATE_RONLY) {
+            zone_set_state(st, z, SPDK_NVME_ZONE_STATE_OFFLINE);
+        } else if (!select_all) {
+            st->invalid++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Integrate the open / active counts up to tsc */
+static void
+zone_sim_account(struct zone_sim_stat *st, uint64_t tsc, uint64_t first_tsc, uint64_t span)
+{
+    uint64_t dt = tsc > st->last_tsc ? tsc - st->last_tsc : 0;
+    uint32_t w = span ? (uint32_t)((double)(tsc - first_tsc) * ZONE_SIM_WINDOWS / (span + 1)) : 0;
+
+    st->open_area += (double)st->open * dt;
+    st->active_area += (double)st->active * dt;
+    if (g_max_open_zone && st->open >= g_max_open_zone) {
+        st->tsc_at_max_open += dt;
+    }
+    if (g_max_active_zone && st->active >= g_max_active_zone) {
+        st->tsc_at_max_active += dt;
+    }
+    st->last_tsc = spdk_max(st->last_tsc, tsc);
+
+    /* the current counts held in every window since the previous event */
+    w = spdk_min(w, (uint32_t)ZONE_SIM_WINDOWS - 1);
+    for (uint32_t k = st->last_win; k <= w; k++) {
+        st->win_open[k] = spdk_max(st->win_open[k], st->open);
+        st->win_active[k] = spdk_max(st->win_active[k], st->active);
+    }
+    st->last_win = spdk_max(st->last_win, w);
+}
+
+static int
+zone_reset_cmp(const void *a, const void *b, void *arg)
+{
+    const struct zone_sim *zones = (const struct zone_sim *)arg;
+    uint32_t x = zones[*(const uint64_t *)a].resets;
+    uint32_t y = zones[*(const uint64_t *)b].resets;
+
+    return x == y ? 0 : (x < y ? 1 : -1);
+}
+
+static int
+process_zone_sim(const struct trace_table *trace)
+{
+    struct zone_sim_stat st = {};
+    struct zone_sim *zones;
+    uint64_t first_tsc, span;
+
+    print_uline('=', printf("\nZone simulation\n"));
+    if (!g_zone || !g_zone_size_lba || !g_total_zones) {
+        printf("Not a ZNS namespace\n");
+        return 0;
+    }
+    if (!g_zone_cap_lba || g_zone_cap_lba > g_zone_size_lba) {
+        g_zone_cap_lba = g_zone_size_lba;
+    }
+
+    zones = (struct zone_sim *)calloc(g_total_zones, sizeof(struct zone_sim));
+    if (zones == NULL) {
+        fprintf(stderr, "Fail to allocate memory for zone simulation\n");
+        return -ENOMEM;
+    }
+    /* the replay starts from all zones reset, and so does the capture we assume */
+    for (uint64_t i = 0; i < g_total_zones; i++) {
+        zones[i].state = SPDK_NVME_ZONE_STATE_EMPTY;
+    }
+
+    first_tsc = trace->cnt ? trace->tsc[0] : 0;
+    span = trace->cnt ? trace->tsc[trace->cnt - 1] - first_tsc : 0;
+    st.last_tsc = first_tsc;
+
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        uint32_t i = trace->sub[j];
+        uint8_t opc = trace->opc[i];
+
+        if (opc != SPDK_NVME_OPC_WRITE && opc != SPDK_NVME_OPC_ZONE_APPEND &&
+            opc != SPDK_NVME_OPC_WRITE_ZEROES && opc != SPDK_NVME_OPC_ZONE_MGMT_SEND) {
+            continue;
+        }
+
+        zone_sim_account(&st, trace->tsc[i], first_tsc, span);
+
+        uint64_t slba = trace->slba[i];
+        uint64_t zidx = slba / g_zone_size_lba;
+        if (zidx >= g_total_zones) {
+            st.boundary++;
+            continue;
+        }
+
+        if (opc == SPDK_NVME_OPC_ZONE_MGMT_SEND) {
+            bool select_all = (trace->cdw13[i] & (uint32_t)1 << 8) ? true : false;
+            uint8_t action = (uint8_t)(trace->cdw13[i] & UINT8BIT_MASK);
+
+            if (select_all) {
+                for (uint64_t z = 0; z < g_total_zones; z++) {
+                    zone_action(&st, zones, &zones[z], action, true);
+                }
+            } else {
+                zone_action(&st, zones, &zones[zidx], action, false);
+            }
+        } else {
+            zone_write(&st, zones, &zones[zidx], zidx * g_zone_size_lba, slba,
+                    trace->nlb[i], opc == SPDK_NVME_OPC_ZONE_APPEND);
+        }
+        zone_sim_account(&st, trace->tsc[i], first_tsc, span);
+    }
+    if (trace->cnt) {
+        zone_sim_account(&st, trace->tsc[trace->cnt - 1], first_tsc, span);
+    }
+
+    printf("Zones: %ju  Zone size: %ju  Zone capacity: %ju (blocks)  Max open: %u  Max active: %u\n",
+            g_total_zones, g_zone_size_lba, g_zone_cap_lba, g_max_open_zone, g_max_active_zone);
+    printf("%-15s  PEAK: %-8ju AVG: %-10.3f AT LIMIT: %7.3f %%\n", "Open zones", st.peak_open,
+            span ? st.open_area / span : 0.0, span ? (double)st.tsc_at_max_open * 100 / span : 0.0);
+    printf("%-15s  PEAK: %-8ju AVG: %-10.3f AT LIMIT: %7.3f %%\n", "Active zones", st.peak_active,
+            span ? st.active_area / span : 0.0, span ? (double)st.tsc_at_max_active * 100 / span : 0.0);
+    printf("Implicit closes: %ju  Rejected opens (too many open): %ju  Rejected activations (too many active): %ju\n",
+            st.implicit_closes, st.open_limit, st.active_limit);
+    printf("Out-of-order writes: %ju  Boundary / full zone errors: %ju  Invalid zone actions: %ju\n",
+            st.out_of_order, st.boundary, st.invalid);
+    printf("Finish: %ju  wasted by finish before full: %ju blocks (%.3f MiB)\n", st.finishes,
+            st.wasted_blocks, (double)st.wasted_blocks * g_sector_size / (1024 * 1024));
+    printf("Reset:  %ju  written data discarded by reset: %ju blocks (%.3f MiB)\n", st.resets,
+            st.discarded_blocks, (double)st.discarded_blocks * g_sector_size / (1024 * 1024));
+
+    print_uline('=', printf("\nOpen / active zones over time (max per window)\n"));
+    for (int w = 0; w < ZONE_SIM_WINDOWS; w++) {
+        printf("%12.3f (us)  open %-6ju active %-6ju\n",
+                get_us_from_tsc((double)span * w / ZONE_SIM_WINDOWS, trace->tsc_rate),
+                st.win_open[w], st.win_active[w]);
+    }
+
+    uint64_t *order = (uint64_t *)malloc(g_total_zones * sizeof(uint64_t));
+    if (order != NULL) {
+        uint64_t reset_zones = 0;
+
+        for (uint64_t i = 0; i < g_total_zones; i++) {
+            order[i] = i;
+            reset_zones += zones[i].resets ? 1 : 0;
+        }
+        qsort_r(order, g_total_zones, sizeof(uint64_t), zone_reset_cmp, zones);
+
+        print_uline('=', printf("\nResets per zone (%ju zones reset)\n", reset_zones));
+        for (uint64_t i = 0; i < g_total_zones && i < ZONE_SIM_TOP && zones[order[i]].resets; i++) {
+            printf("zone %-13ju  resets %-8u finishes %-8u\n", order[i], zones[order[i]].resets,
+                    zones[order[i]].finishes);
+        }
+        free(order);
+    }
+
+    free(zones);
+    return 0;
+}
+/* zone simulation end */
+
+/* deallocation start */
+/*
+ * The DSM range list lives in a host buffer, not in the command, so the
+ * trace only has it when the submitting thread logs one NVME_DSM_RANGE record
+ * per range (or a single one for the aggregate span) right before the DSM
+ * command. Each DSM submit owns the range records its lcore logged since that
+ * lcore's previous DSM submit.
+ */
+#define DSM_NONE UINT32_MAX
+#define DSM_ATTR_AD ((uint32_t)1 << 2)  /* cdw11: deallocate */
+#define DEALLOC_WINDOWS 20
+
+struct dsm_ranges {
+    uint32_t *first;        /* per row: first range of a DSM submit, DSM_NONE if it has none */
+    uint32_t *next;         /* per row: next range of the same command */
+    uint32_t *cnt;          /* per row: ranges of a DSM submit */
+    uint64_t range_cnt;
+    uint64_t orphan_cnt;    /* range records no DSM submit claimed */
+};
+
+static void
+dsm_ranges_free(struct dsm_ranges *r)
+{
+    free(r->first);
+    free(r->next);
+    free(r->cnt);
+    memset(r, 0, sizeof(*r));
+}
+
+/* Link range records to their DSM submit; a trace without any leaves first NULL */
+static int
+dsm_ranges_build(const struct trace_table *trace, struct dsm_ranges *r)
+{
+    struct page_map pending;    /* lcore -> range count << 32 | latest range row */
+
+    memset(r, 0, sizeof(*r));
+    r->range_cnt = trace_count_u8(trace->kind, trace->cnt, TRACE_KIND_DSM_RANGE);
+    if (r->range_cnt == 0) {
+        return 0;
+    }
+    r->first = (uint32_t *)malloc(trace->cnt * sizeof(uint32_t));
+    r->next = (uint32_t *)malloc(trace->cnt * sizeof(uint32_t));
+    r->cnt = (uint32_t *)calloc(trace->cnt, sizeof(uint32_t));
+    if (r->first == NULL || r->next == NULL || r->cnt == NULL ||
+        page_map_init(&pending, spdk_min(r->range_cnt, 4096))) {
+        dsm_ranges_free(r);
+        return -ENOMEM;
+    }
+    memset(r->first, 0xFF, trace->cnt * sizeof(uint32_t));
+
+    for (uint64_t i = 0; i < trace->cnt; i++) {
+        uint64_t *p;
+
+        if (trace->kind[i] == TRACE_KIND_DSM_RANGE) {
+            p = page_map_find(&pending, trace->lcore[i]);
+            r->next[i] = p ? (uint32_t)*p : DSM_NONE;
+            if (p == NULL && pending.cnt * 2 > pending.mask) {
+                /* more lcores than the map was sized for; their ranges stay unclaimed */
+                r->orphan_cnt++;
+                continue;
+            }
+            page_map_put(&pending, trace->lcore[i], ((p ? *p >> 32 : 0) + 1) << 32 | i);
+        } else if (trace->opc[i] == SPDK_NVME_OPC_DATASET_MANAGEMENT) {
+            p = page_map_find(&pending, trace->lcore[i]);
+            if (p != NULL) {
+                r->first[i] = (uint32_t)*p;
+                r->cnt[i] = (uint32_t)(*p >> 32);
+                page_map_del(&pending, trace->lcore[i]);
+            }
+        }
+    }
+    for (uint64_t s = 0; s <= pending.mask; s++) {
+        if (pending.key[s] != PAGE_MAP_EMPTY) {
+            r->orphan_cnt += pending.val[s] >> 32;
+        }
+    }
+    page_map_free(&pending);
+    return 0;
+}
+
+/*
+ * Mapped LBAs as a treap of disjoint, coalesced [slba, end) extents keyed by
+ * slba, so long sequential writes and trims stay a few nodes and random small
+ * ones cost O(log n). The namespace sits in the top byte of the key, as in the
+ * FTL model. Nodes live in one array; free ones are chained through l.
+ */
+#define EXT_NONE UINT32_MAX
+
+struct ext_node {
+    uint64_t slba;
+    uint64_t end;
+    uint32_t prio;
+    uint32_t l;
+    uint32_t r;
+};
+
+struct ext_tree {
+    struct ext_node *n;
+    uint32_t size;
+    uint32_t used;
+    uint32_t free_head;
+    uint32_t root;
+    uint64_t cnt;       /* extents */
+    uint64_t blocks;    /* blocks covered */
+    uint64_t seed;
+};
+
+static void
+ext_tree_init(struct ext_tree *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->free_head = EXT_NONE;
+    t->root = EXT_NONE;
+    t->seed = 0x9E3779B97F4A7C15ULL;
+}
+
+static void
+ext_tree_free(struct ext_tree *t)
+{
+    free(t->n);
+    t->n = NULL;
+}
+
+/* Make room for the two nodes one add or remove may need */
+static int
+ext_reserve(struct ext_tree *t)
+{
+    if (t->free_head != EXT_NONE && t->n[t->free_head].l != EXT_NONE) {
+        return 0;
+    }
+    if (t->used + 2 > t->size) {
+        uint32_t size = t->size ? t->size * 2 : 1024;
+        struct ext_node *n = (struct ext_node *)realloc(t->n, size * sizeof(struct ext_node));
+        if (n == NULL) {
+            return -ENOMEM;
+        }
+        t->n = n;
+        t->size = size;
+    }
+    return 0;
+}
+
+static uint32_t
+ext_node_new(struct ext_tree *t, uint64_t slba, uint64_t end)
+{
+    uint32_t x;
+
+    if (t->free_head != EXT_NONE) {
+        x = t->free_head;
+        t->free_head = t->n[x].l;
+    } else {
+        x = t->used++;
+    }
+    t->seed = t->seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    t->n[x] = (struct ext_node) { slba, end, (uint32_t)(t->seed >> 32), EXT_NONE, EXT_NONE };
+    t->cnt++;
+    return x;
+}
+
+static void
+ext_node_put(struct ext_tree *t, uint32_t x)
+{
+    t->n[x].l = t->free_head;
+    t->free_head = x;
+    t->cnt--;
+}
+
+/* Split x into the extents starting below key (*a) and the rest (*b) */
+static void
+ext_split(struct ext_tree *t, uint32_t x, uint64_t key, uint32_t *a, uint32_t *b)
+{
+    if (x == EXT_NONE) {
+        *a = *b = EXT_NONE;
+    } else if (t->n[x].slba < key) {
+        ext_split(t, t->n[x].r, key, &t->n[x].r, b);
+        *a = x;
+    } else {
+        ext_split(t, t->n[x].l, key, a, &t->n[x].l);
+        *b = x;
+    }
+}
+
+/* Join two trees where every key of a is below every key of b */
+static uint32_t
+ext_merge(struct ext_tree *t, uint32_t a, uint32_t b)
+{
+    if (a == EXT_NONE) {
+        return b;
+    }
+    if (b == EXT_NONE) {
+        return a;
+    }
+    if (t->n[a].prio > t->n[b].prio) {
+        uint32_t r = ext_merge(t, t->n[a].r, b);
+        t->n[a].r = r;
+        return a;
+    }
+    uint32_t l = ext_merge(t, a, t->n[b].l);
+    t->n[b].l = l;
+    return b;
+}
+
+static uint32_t
+ext_last(const struct ext_tree *t, uint32_t x)
+{
+    while (x != EXT_NONE && t->n[x].r != EXT_NONE) {
+        x = t->n[x].r;
+    }
+    return x;
+}
+
+static uint32_t
+ext_first(const struct ext_tree *t, uint32_t x)
+{
+    while (x != EXT_NONE && t->n[x].l != EXT_NONE) {
+        x = t->n[x].l;
+    }
+    return x;
+}
+
+/* Unlink and free the first extent of x, returning the new subtree root */
+static uint32_t
+ext_pop_first(struct ext_tree *t, uint32_t x)
+{
+    if (t->n[x].l == EXT_NONE) {
+        uint32_t r = t->n[x].r;
+        ext_node_put(t, x);
+        return r;
+    }
+    uint32_t l = ext_pop_first(t, t->n[x].l);
+    t->n[x].l = l;
+    return x;
+}
+
+/* Free a whole subtree, returning the blocks it covered */
+static uint64_t
+ext_drop(struct ext_tree *t, uint32_t x)
+{
+    uint64_t blocks;
+
+    if (x == EXT_NONE) {
+        return 0;
+    }
+    blocks = t->n[x].end - t->n[x].slba + ext_drop(t, t->n[x].l) + ext_drop(t, t->n[x].r);
+    ext_node_put(t, x);
+    return blocks;
+}
+
+/* Unmap [s, e), returning how many of its blocks were mapped */
+static uint64_t
+ext_remove(struct ext_tree *t, uint64_t s, uint64_t e)
+{
+    uint32_t l, m, r, p, tail = EXT_NONE;
+    uint64_t removed = 0;
+
+    ext_split(t, t->root, s, &l, &r);
+    p = ext_last(t, l);
+    if (p != EXT_NONE && t->n[p].end > s) {
+        /* an extent starting below s reaches into the range */
+        if (t->n[p].end > e) {
+            tail = ext_node_new(t, e, t->n[p].end);
+        }
+        removed += spdk_min(t->n[p].end, e) - s;
+        t->n[p].end = s;
+    }
+    ext_split(t, r, e, &m, &r);
+    p = ext_last(t, m);
+    if (p != EXT_NONE && t->n[p].end > e) {
+        tail = ext_node_new(t, e, t->n[p].end);
+        t->n[p].end = e;
+    }
+    removed += ext_drop(t, m);
+    t->blocks -= removed;
+    t->root = ext_merge(t, ext_merge(t, l, tail), r);
+    return removed;
+}
+
+/* Map [s, e), returning how many of its blocks were not mapped before */
+static uint64_t
+ext_add(struct ext_tree *t, uint64_t s, uint64_t e)
+{
+    uint64_t overlap = ext_remove(t, s, e);
+    uint32_t l, r, p, q;
+
+    ext_split(t, t->root, s, &l, &r);
+    p = ext_last(t, l);
+    q = ext_first(t, r);
+    if (p != EXT_NONE && t->n[p].end == s) {
+        t->n[p].end = e;
+        if (q != EXT_NONE && t->n[q].slba == e) {
+            t->n[p].end = t->n[q].end;
+            r = ext_pop_first(t, r);
+        }
+    } else if (q != EXT_NONE && t->n[q].slba == e) {
+        t->n[q].slba = s;
+    } else {
+        l = ext_merge(t, l, ext_node_new(t, s, e));
+    }
+    t->root = ext_merge(t, l, r);
+    t->blocks += e - s;
+    return e - s - overlap;
+}
+
+static inline uint64_t
+ext_key(uint32_t nsid, uint64_t lba)
+{
+    return lba | (uint64_t)(nsid & UINT8BIT_MASK) << 56;
+}
+
+struct dealloc_window {
+    uint64_t write_blocks;
+    uint64_t trim_blocks;
+    uint64_t live;
+    uint64_t extents;
+};
+
+static bool g_dealloc_report = false;
+
+static int
+process_dealloc(const struct trace_table *trace)
+{
+    struct dealloc_window win[DEALLOC_WINDOWS] = {};
+    struct dsm_ranges ranges;
+    struct ext_tree live;
+    uint64_t t0, width, w = 0;
+    uint64_t write_cmds = 0, write_blocks = 0, trim_blocks = 0, trim_live = 0;
+    uint64_t dsm_ad = 0, dsm_hint = 0, dsm_norange = 0, dsm_nr_mismatch = 0, dsm_range_used = 0;
+    uint64_t wz_deac = 0, appends = 0, peak = 0, peak_tsc = 0;
+    double mib = (double)g_sector_size / (1024 * 1024);
+    int rc;
+
+    print_uline('=', printf("\nDeallocation and live data\n"));
+    if (trace->sub_cnt == 0) {
+        printf("No I/O submitted\n");
+        return 0;
+    }
+    if (dsm_ranges_build(trace, &ranges)) {
+        fprintf(stderr, "Fail to allocate memory for DSM ranges\n");
+        return -ENOMEM;
+    }
+    ext_tree_init(&live);
+
+    t0 = trace->obj_start[trace->sub[0]];
+    width = (trace->obj_start[trace->sub[trace->sub_cnt - 1]] - t0) / DEALLOC_WINDOWS + 1;
+
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        uint32_t i = trace->sub[j];
+        uint8_t opc = trace->opc[i];
+        uint64_t tsc = trace->obj_start[i], key = ext_key(trace->nsid[i], trace->slba[i]);
+
+        for (; w < DEALLOC_WINDOWS - 1 && tsc >= t0 + (w + 1) * width; w++) {
+            win[w].live = live.blocks;
+            win[w].extents = live.cnt;
+        }
+        if (ext_reserve(&live)) {
+            fprintf(stderr, "Fail to allocate memory for live extents\n");
+            rc = -ENOMEM;
+            goto out;
+        }
+
+        switch (opc) {
+        case SPDK_NVME_OPC_WRITE:
+        case SPDK_NVME_OPC_WRITE_ZEROES:
+            if (opc == SPDK_NVME_OPC_WRITE_ZEROES && (trace->cdw12[i] & (uint32_t)1 << 25)) {
+                wz_deac++;
+                trim_live += ext_remove(&live, key, key + trace->nlb[i]);
+                trim_blocks += trace->nlb[i];
+                win[w].trim_blocks += trace->nlb[i];
+                break;
+            }
+            write_cmds++;
+            write_blocks += trace->nlb[i];
+            win[w].write_blocks += trace->nlb[i];
+            ext_add(&live, key, key + trace->nlb[i]);
+            break;
+        case SPDK_NVME_OPC_ZONE_APPEND:
+            /* the device picks the LBA, which the trace does not have */
+            appends++;
+            break;
+        case SPDK_NVME_OPC_DATASET_MANAGEMENT:
+            if (!((trace->slba[i] >> 32) & DSM_ATTR_AD)) {
+                dsm_hint++;
+                break;
+            }
+            dsm_ad++;
+            if (ranges.first == NULL || ranges.first[i] == DSM_NONE) {
+                dsm_norange++;
+                break;
+            }
+            dsm_nr_mismatch += ranges.cnt[i] != (trace->slba[i] & UINT8BIT_MASK) + 1;
+            for (uint32_t k = ranges.first[i]; k != DSM_NONE; k = ranges.next[k]) {
+                uint64_t s = ext_key(trace->nsid[i], trace->slba[k]);
+
+                if (ext_reserve(&live)) {
+                    fprintf(stderr, "Fail to allocate memory for live extents\n");
+                    rc = -ENOMEM;
+                    goto out;
+                }
+                trim_live += ext_remove(&live, s, s + trace->cdw12[k]);
+                trim_blocks += trace->cdw12[k];
+                win[w].trim_blocks += trace->cdw12[k];
+                dsm_range_used++;
+            }
+            break;
+        default:
+            break;
+        }
+        if (live.blocks > peak) {
+            peak = live.blocks;
+            peak_tsc = tsc - t0;
+        }
+    }
+    for (; w < DEALLOC_WINDOWS; w++) {
+        win[w].live = live.blocks;
+        win[w].extents = live.cnt;
+    }
+
+    printf("Live data counts the blocks written during the capture that are still mapped\n");
+    printf("Writes: %ju commands, %ju blocks (%.3f MiB)\n", write_cmds, write_blocks, write_blocks * mib);
+    printf("Deallocate: %ju DSM (%ju ranges), %ju write zeroes with DEAC, %ju blocks (%.3f MiB)\n",
+            dsm_ad, dsm_range_used, wz_deac, trim_blocks, trim_blocks * mib);
+    printf("  mapped when deallocated: %ju blocks (%.3f %%)  already unmapped: %ju blocks\n",
+            trim_live, pct(trim_live, trim_blocks), trim_blocks - trim_live);
+    printf("Trim to write ratio: %.3f  (mapped blocks freed per block written: %.3f)\n",
+            write_blocks ? (double)trim_blocks / write_blocks : 0.0,
+            write_blocks ? (double)trim_live / write_blocks : 0.0);
+    if (dsm_hint) {
+        printf("DSM without the deallocate attribute (hints only): %ju\n", dsm_hint);
+    }
+    if (dsm_norange) {
+        printf("DSM deallocate without range records (not counted): %ju\n", dsm_norange);
+    }
+    if (dsm_nr_mismatch) {
+        printf("DSM deallocate whose range records do not match NR: %ju\n", dsm_nr_mismatch);
+    }
+    if (ranges.orphan_cnt) {
+        printf("Range records no DSM command claimed: %ju\n", ranges.orphan_cnt);
+    }
+    if (appends) {
+        printf("Zone appends (LBA assigned by the device, not tracked): %ju\n", appends);
+    }
+    printf("Live data: %ju blocks (%.3f MiB) in %ju extents, peak %ju blocks (%.3f MiB) at %.3f ms\n",
+            live.blocks, live.blocks * mib, live.cnt, peak, peak * mib,
+            get_us_from_tsc(peak_tsc, trace->tsc_rate) / 1000);
+    if (g_ns_capacity) {
+        printf("Live data of the namespace capacity: %.3f %% (peak %.3f %%)\n",
+                pct(live.blocks, g_ns_capacity), pct(peak, g_ns_capacity));
+    }
+
+    printf("\n%-12s %12s %12s %11s %12s %9s %10s\n", "TIME(ms)", "WRITE(MiB)", "TRIM(MiB)", "TRIM/WRITE",
+            "LIVE(MiB)", "LIVE(%)", "EXTENTS");
+    for (w = 0; w < DEALLOC_WINDOWS; w++) {
+        printf("%-12.3f %12.3f %12.3f %11.3f %12.3f %9.3f %10ju\n",
+                get_us_from_tsc((w + 1) * width, trace->tsc_rate) / 1000,
+                win[w].write_blocks * mib, win[w].trim_blocks * mib,
+                win[w].write_blocks ? (double)win[w].trim_blocks / win[w].write_blocks : 0.0,
+                win[w].live * mib, g_ns_capacity ? pct(win[w].live, g_ns_capacity) : 0.0, win[w].extents);
+    }
+    rc = 0;
+
+out:
+    ext_tree_free(&live);
+    dsm_ranges_free(&ranges);
+    return rc;
+}
+/* deallocation end */
+
+/* ftl simulation start */
+#define FTL_OP_MAX 8
+#define FTL_NONE UINT32_MAX
+#define FTL_TRIM (1u << 31)         /* op flag: deallocate instead of write */
+#define FTL_HOT (1u << 30)          /* op flag: page rewritten recently */
+#define FTL_LPN_MASK (FTL_HOT - 1)
+#define FTL_MAX_PASSES 64
+
+enum ftl_gc {
+    FTL_GC_GREEDY,
+    FTL_GC_COST_BENEFIT,
+    FTL_GC_POLICIES,
+};
+
+static const char *g_ftl_gc_name[FTL_GC_POLICIES] = {"greedy", "cost-benefit"};
+
+/* How host and GC writes are steered into open blocks */
+enum ftl_layout {
+    FTL_SINGLE,     /* one open block for everything */
+    FTL_SEP_GC,     /* host writes and GC relocations apart */
+    FTL_HOT_COLD,   /* hot host, cold host and GC relocations apart */
+    FTL_LAYOUTS,
+};
+
+static const char *g_ftl_layout_name[FTL_LAYOUTS] = {"single", "host/gc", "hot/cold/gc"};
+static const uint32_t g_ftl_streams[FTL_LAYOUTS] = {1, 2, 3};
+
+enum ftl_blk_state {
+    FTL_BLK_FREE,
+    FTL_BLK_OPEN,
+    FTL_BLK_CLOSED,
+};
+
+struct ftl_sim {
+    enum ftl_gc gc;
+    enum ftl_layout layout;
+    uint32_t ppb;               /* pages per erase block */
+    uint32_t nblocks;
+    uint32_t reserve;           /* free blocks kept back for relocation */
+    uint32_t *l2p;
+    uint32_t *p2l;
+    uint32_t *valid;            /* valid pages per block */
+    uint64_t *stamp;            /* host write count when the block was closed */
+    uint8_t *state;
+    /* closed blocks bucketed by valid count, for greedy victim selection */
+    uint32_t *bucket;
+    uint32_t *prev;
+    uint32_t *next;
+    uint32_t *free_blk;
+    uint32_t free_cnt;
+    uint32_t open_blk[3];
+    uint32_t open_off[3];
+    uint64_t now;
+    uint64_t host_writes;
+    uint64_t nand_writes;
+    uint64_t erases;
+    uint64_t relocated;
+    uint64_t stalls;            /* GC found no block with invalid pages */
+};
+
+static bool g_ftl_sim = false;
+static uint32_t g_ftl_page_bytes = 4096;
+static uint32_t g_ftl_block_pages = 1024;
+static uint32_t g_ftl_op[FTL_OP_MAX]; /* over-provisioning in percent of the logical space */
+static int g_ftl_op_cnt = 0;
+static int g_ftl_gc = -1; /* -1 = run every policy */
+
+static void
+ftl_sim_free(struct ftl_sim *f)
+{
+    free(f->l2p);
+    free(f->p2l);
+    free(f->valid);
+    free(f->stamp);
+    free(f->state);
+    free(f->bucket);
+    free(f->prev);
+    free(f->next);
+    free(f->free_blk);
+}
+
+static int
+ftl_sim_init(struct ftl_sim *f, enum ftl_gc gc, enum ftl_layout layout, uint32_t lpages, uint32_t op)
+{
+    uint32_t streams = g_ftl_streams[layout];
+    uint64_t ppages = (uint64_t)lpages * (100 + op) / 100;
+
+    memset(f, 0, sizeof(*f));
+    f->gc = gc;
+    f->layout = layout;
+    f->ppb = g_ftl_block_pages;
+    f->reserve = streams + 1;
+    /* the open blocks and the GC reserve come out of the spare area, never the logical space */
+    f->nblocks = (uint32_t)spdk_max((ppages + f->ppb - 1) / f->ppb,
+            ((uint64_t)lpages + f->ppb - 1) / f->ppb + f->reserve + streams);
+    if ((uint64_t)f->nblocks * f->ppb >= FTL_NONE) {
+        return -EINVAL;
+    }
+
+    f->l2p = (uint32_t *)malloc((uint64_t)lpages * sizeof(uint32_t));
+    f->p2l = (uint32_t *)malloc((uint64_t)f->nblocks * f->ppb * sizeof(uint32_t));
+    f->valid = (uint32_t *)calloc(f->nblocks, sizeof(uint32_t));
+    f->stamp = (uint64_t *)calloc(f->nblocks, sizeof(uint64_t));
+    f->state = (uint8_t *)calloc(f->nblocks, sizeof(uint8_t));
+    f->bucket = (uint32_t *)malloc((f->ppb + 1) * sizeof(uint32_t));
+    f->prev = (uint32_t *)malloc(f->nblocks * sizeof(uint32_t));
+    f->next = (uint32_t *)malloc(f->nblocks * sizeof(uint32_t));
+    f->free_blk = (uint32_t *)malloc(f->nblocks * sizeof(uint32_t));
+    if (!f->l2p || !f->p2l || !f->valid || !f->stamp || !f->state || !f->bucket || !f->prev ||
+        !f->next || !f->free_blk) {
+        ftl_sim_free(f);
+        return -ENOMEM;
+    }
+
+    memset(f->l2p, 0xff, (uint64_t)lpages * sizeof(uint32_t));
+    memset(f->p2l, 0xff, (uint64_t)f->nblocks * f->ppb * sizeof(uint32_t));
+    memset(f->bucket, 0xff, (f->ppb + 1) * sizeof(uint32_t));
+    /* lowest block numbers are handed out first */
+    for (uint32_t i = 0; i < f->nblocks; i++) {
+        f->free_blk[i] = f->nblocks - 1 - i;
+    }
+    f->free_cnt = f->nblocks;
+    for (uint32_t s = 0; s < 3; s++) {
+        f->open_blk[s] = FTL_NONE;
+    }
+    return 0;
+}
+
+static inline void
+ftl_bucket_del(struct ftl_sim *f, uint32_t blk)
+{
+    uint32_t p = f->prev[blk], n = f->next[blk];
+
+    if (p == FTL_NONE) {
+        f->bucket[f->valid[blk]] = n;
+    } else {
+        f->next[p] = n;
+    }
+    if (n != FTL_NONE) {
+        f->prev[n] = p;
+    }
+}
+
+static inline void
+ftl_bucket_add(struct ftl_sim *f, uint32_t blk)
+{
+    uint32_t h = f->bucket[f->valid[blk]];
+
+    f->prev[blk] = FTL_NONE;
+    f->next[blk] = h;
+    if (h != FTL_NONE) {
+        f->prev[h] = blk;
+    }
+    f->bucket[f->valid[blk]] = blk;
+}
+
+static inline void
+ftl_invalidate(struct ftl_sim *f, uint32_t lpn)
+{
+    uint32_t ppn = f->l2p[lpn], blk;
+
+    if (ppn == FTL_NONE) {
+        return;
+    }
+    blk = ppn / f->ppb;
+    f->p2l[ppn] = FTL_NONE;
+    f->l2p[lpn] = FTL_NONE;
+    if (f->state[blk] == FTL_BLK_CLOSED) {
+        ftl_bucket_del(f, blk);
+        f->valid[blk]--;
+        ftl_bucket_add(f, blk);
+    } else {
+        f->valid[blk]--;
+    }
+}
+
+/* Program lpn at the next page of a stream's open block */
+static inline void
+ftl_program(struct ftl_sim *f, uint32_t s, uint32_t lpn)
+{
+    uint32_t blk = f->open_blk[s], ppn;
+
+    if (blk == FTL_NONE || f->open_off[s] == f->ppb) {
+        if (blk != FTL_NONE) {
+            f->state[blk] = FTL_BLK_CLOSED;
+            f->stamp[blk] = f->now;
+            ftl_bucket_add(f, blk);
+        }
+        /* the GC reserve guarantees a free block here */
+        blk = f->free_blk[--f->free_cnt];
+        f->state[blk] = FTL_BLK_OPEN;
+        f->open_blk[s] = blk;
+        f->open_off[s] = 0;
+    }
+
+    ppn = blk * f->ppb + f->open_off[s]++;
+    f->l2p[lpn] = ppn;
+    f->p2l[ppn] = lpn;
+    f->valid[blk]++;
+    f->nand_writes++;
+}
+
+static uint32_t
+ftl_victim(struct ftl_sim *f)
+{
+    uint32_t victim = FTL_NONE;
+
+    if (f->gc == FTL_GC_GREEDY) {
+        for (uint32_t v = 0; v <= f->ppb; v++) {
+            if (f->bucket[v] != FTL_NONE) {
+                return f->bucket[v];
+            }
+        }
+        return FTL_NONE;
+    }
+
+    /* cost-benefit (Rosenblum & Ousterhout): (1 - u) * age / (1 + u) */
+    double best = -1.0;
+    for (uint32_t blk = 0; blk < f->nblocks; blk++) {
+        if (f->state[blk] != FTL_BLK_CLOSED) {
+            continue;
+        }
+        double u = (double)f->valid[blk] / f->ppb;
+        double score = (1.0 - u) * (double)(f->now - f->stamp[blk] + 1) / (1.0 + u);
+        if (score > best) {
+            best = score;
+            victim = blk;
+        }
+    }
+    return victim;
+}
+
+static void
+ftl_gc(struct ftl_sim *f)
+{
+    uint32_t gs = g_ftl_streams[f->layout] - 1;
+
+    while (f->free_cnt < f->reserve) {
+        uint32_t victim = ftl_victim(f);
+
+        if (victim == FTL_NONE || f->valid[victim] == f->ppb) {
+            f->stalls++;
+            return;
+        }
+        ftl_bucket_del(f, victim);
+        /* open while relocating, so programming cannot pick it up again */
+        f->state[victim] = FTL_BLK_OPEN;
+        for (uint32_t i = 0, ppn = victim * f->ppb; i < f->ppb && f->valid[victim]; i++, ppn++) {
+            uint32_t lpn = f->p2l[ppn];
+
+            if (lpn == FTL_NONE) {
+                continue;
+            }
+            f->p2l[ppn] = FTL_NONE;
+            f->valid[victim]--;
+            ftl_program(f, gs, lpn);
+            f->relocated++;
+        }
+        f->state[victim] = FTL_BLK_FREE;
+        f->free_blk[f->free_cnt++] = victim;
+        f->erases++;
+    }
+}
+
+static void
+ftl_sim_run(struct ftl_sim *f, const uint32_t *ops, uint64_t op_cnt)
+{
+    for (uint64_t i = 0; i < op_cnt; i++) {
+        uint32_t op = ops[i], lpn = op & FTL_LPN_MASK;
+
+        ftl_invalidate(f, lpn);
+        if (op & FTL_TRIM) {
+            continue;
+        }
+        f->now++;
+        f->host_writes++;
+        /* only the hot/cold layout steers host writes; GC always uses the last stream */
+        ftl_program(f, (f->layout == FTL_HOT_COLD && !(op & FTL_HOT)) ? 1 : 0, lpn);
+        if (f->free_cnt < f->reserve) {
+            ftl_gc(f);
+        }
+    }
+}
+
+/*
+ * Turn the trace into a stream of page operations over a dense logical space:
+ * the pages the capture writes or deallocates, so the modelled drive is full
+ * of exactly this workload's data. DSM ranges only deallocate pages of that
+ * space they cover fully: a trim of the whole drive must not grow the model,
+ * and a page-mapped FTL cannot drop a page that is still partly valid.
+ */
+static int
+ftl_build_ops(const struct trace_table *trace, uint32_t **ops_out, uint64_t *op_cnt_out,
+              uint32_t *lpages_out, uint64_t *dsm_out)
+{
+    uint32_t page_blocks = g_ftl_page_bytes / g_sector_size;
+    struct dsm_ranges ranges;
+    struct page_map map;
+    uint64_t total = 0, op_cnt = 0, dsm = 0;
+    uint8_t *trimmed;   /* per lpn: deallocated since its last write */
+    uint64_t *lpn_key;  /* per lpn: its map key, namespace and page */
+    uint32_t *ops;
+
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        uint32_t i = trace->sub[j];
+
+        if (trace->opc[i] != SPDK_NVME_OPC_WRITE && trace->opc[i] != SPDK_NVME_OPC_WRITE_ZEROES) {
+            continue;
+        }
+        uint64_t slba = trace->slba[i];
+        uint64_t elba = slba + trace->nlb[i] - 1;
+        total += elba / page_blocks - slba / page_blocks + 1;
+    }
+
+    /* a DSM trim is only emitted for a page written since its last trim, so at most one per write */
+    ops = (uint32_t *)malloc(spdk_max(2 * total, 1) * sizeof(uint32_t));
+    trimmed = (uint8_t *)calloc(spdk_max(total, 1), 1);
+    lpn_key = (uint64_t *)malloc(spdk_max(total, 1) * sizeof(uint64_t));
+    if (ops == NULL || trimmed == NULL || lpn_key == NULL || page_map_init(&map, total)) {
+        free(ops);
+        free(trimmed);
+        free(lpn_key);
+        return -ENOMEM;
+    }
+    if (dsm_ranges_build(trace, &ranges)) {
+        page_map_free(&map);
+        free(ops);
+        free(trimmed);
+        free(lpn_key);
+        return -ENOMEM;
+    }
+
+    for (uint64_t j = 0; j < trace->sub_cnt; j++) {
+        uint32_t i = trace->sub[j];
+        uint8_t opc = trace->opc[i];
+        uint32_t flag = 0;
+
+        if (opc == SPDK_NVME_OPC_DATASET_MANAGEMENT) {
+            if (!((trace->slba[i] >> 32) & DSM_ATTR_AD)) {
+                continue;
+            }
+            if (ranges.first == NULL || ranges.first[i] == DSM_NONE) {
+                /* no NVME_DSM_RANGE records for this command */
+                dsm++;
+                continue;
+            }
+            for (uint32_t k = ranges.first[i]; k != DSM_NONE; k = ranges.next[k]) {
+                uint64_t first = (trace->slba[k] + page_blocks - 1) / page_blocks;
+                uint64_t last = (trace->slba[k] + trace->cdw12[k]) / page_blocks;
+                uint64_t ns = (uint64_t)(trace->nsid[i] & UINT8BIT_MASK) << 56;
+
+                if (last <= first) {
+                    continue;
+                }
+                if (last - first > map.cnt) {
+                    /* walk the pages mapped so far rather than the range */
+                    for (uint64_t lpn = 0; lpn < map.cnt; lpn++) {
+                        uint64_t page = lpn_key[lpn] & ~((uint64_t)UINT8BIT_MASK << 56);
+                        if ((lpn_key[lpn] & ((uint64_t)UINT8BIT_MASK << 56)) == ns &&
+                            page >= first && page < last && !trimmed[lpn]) {
+                            trimmed[lpn] = 1;
+                            ops[op_cnt++] = (uint32_t)lpn | FTL_TRIM;
+                        }
+                    }
+                    continue;
+                }
+                for (uint64_t page = first; page < last; page++) {
+                    uint64_t *lpn = page_map_find(&map, page | ns);
+                    if (lpn != NULL && !trimmed[*lpn]) {
+                        trimmed[*lpn] = 1;
+                        ops[op_cnt++] = (uint32_t)*lpn | FTL_TRIM;
+                    }
+                }
+            }
+            continue;
+        }
+        if (opc != SPDK_NVME_OPC_WRITE && opc != SPDK_NVME_OPC_WRITE_ZEROES) {
+            continue;
+        }
+        /* write zeroes with DEAC deallocates */
+        if (opc == SPDK_NVME_OPC_WRITE_ZEROES && (trace->cdw12[i] & (uint32_t)1 << 25)) {
+            flag = FTL_TRIM;
+        }
+
+        uint64_t slba = trace->slba[i];
+        uint64_t elba = slba + trace->nlb[i] - 1;
+        for (uint64_t page = slba / page_blocks; page <= elba / page_blocks; page++) {
+            uint64_t key = page | (uint64_t)(trace->nsid[i] & UINT8BIT_MASK) << 56;
+            uint64_t *lpn = page_map_find(&map, key);
+
+            if (lpn == NULL) {
+                if (map.cnt > FTL_LPN_MASK) {
+                    fprintf(stderr, "Too many distinct pages for the FTL model\n");
+                    page_map_free(&map);
+                    dsm_ranges_free(&ranges);
+                    free(ops);
+                    free(trimmed);
+                    free(lpn_key);
+                    return -E2BIG;
+                }
+                lpn_key[map.cnt] = key;
+                page_map_put(&map, key, map.cnt);
+                lpn = page_map_find(&map, key);
+            }
+            /* partial pages are read-modify-written, so they count as whole page writes */
+            ops[op_cnt++] = (uint32_t)*lpn | flag;
+            trimmed[*lpn] = flag ? 1 : 0;
+        }
+    }
+
+    *lpages_out = (uint32_t)map.cnt;
+    page_map_free(&map);
+    dsm_ranges_free(&ranges);
+    free(trimmed);
+    free(lpn_key);
+    *ops_out = ops;
+    *op_cnt_out = op_cnt;
+    *dsm_out = dsm;
+    return 0;
+}
+
+/*
+ * Mark writes whose page was rewritten within a quarter of the footprint's
+ * worth of writes as hot. The stream is replayed in a loop, so the last write
+ * of the previous loop counts: classify over two laps and keep the second.
+ */
+static int
+ftl_classify(uint32_t *ops, uint64_t op_cnt, uint32_t lpages, uint64_t *hot_out)
+{
+    uint64_t *last = (uint64_t *)malloc(spdk_max(lpages, 1) * sizeof(uint64_t));
+    uint64_t window = spdk_max(lpages / 4, 1), hot = 0;
+
+    if (last == NULL) {
+        return -ENOMEM;
+    }
+    memset(last, 0xff, (uint64_t)lpages * sizeof(uint64_t));
+
+    for (uint64_t lap = 0, n = 0; lap < 2; lap++) {
+        for (uint64_t i = 0; i < op_cnt; i++) {
+            uint32_t lpn = ops[i] & FTL_LPN_MASK;
+
+            if (ops[i] & FTL_TRIM) {
+                last[lpn] = UINT64_MAX;
+                continue;
+            }
+            if (lap == 1) {
+                if (last[lpn] != UINT64_MAX && n - last[lpn] <= window) {
+                    ops[i] |= FTL_HOT;
+                    hot++;
+                } else {
+                    ops[i] &= ~FTL_HOT;
+                }
+            }
+            last[lpn] = n++;
+        }
+    }
+
+    free(last);
+    *hot_out = hot;
+    return 0;
+}
+
+static int
+process_ftl_sim(const struct trace_table *trace)
+{
+    uint32_t *ops = NULL, lpages = 0;
+    uint64_t op_cnt = 0, dsm = 0, hot = 0, host = 0;
+    int rc;
+
+    print_uline('=', printf("\nFTL write amplification\n"));
+    if (g_zone) {
+        printf("ZNS namespace: the host places data, see zone simulation (-z)\n");
+        return 0;
+    }
+    if (g_ftl_page_bytes < g_sector_size || g_ftl_page_bytes % g_sector_size) {
+        fprintf(stderr, "FTL page size %u is not a multiple of the %u byte sector\n",
+                g_ftl_page_bytes, g_sector_size);
+        return -EINVAL;
+    }
+    if (g_ftl_op_cnt == 0) {
+        g_ftl_op[g_ftl_op_cnt++] = 7;
+        g_ftl_op[g_ftl_op_cnt++] = 14;
+        g_ftl_op[g_ftl_op_cnt++] = 28;
+    }
+
+    rc = ftl_build_ops(trace, &ops, &op_cnt, &lpages, &dsm);
+    if (rc) {
+        if (rc == -ENOMEM) {
+            fprintf(stderr, "Fail to allocate memory for FTL page stream\n");
+        }
+        return rc;
+    }
+    if (ftl_classify(ops, op_cnt, lpages, &hot)) {
+        fprintf(stderr, "Fail to allocate memory for FTL page stream\n");
+        free(ops);
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < op_cnt; i++) {
+        host += (ops[i] & FTL_TRIM) ? 0 : 1;
+    }
+
+    printf("Page: %u bytes  Erase block: %u pages (%.3f MiB)\n", g_ftl_page_bytes, g_ftl_block_pages,
+            (double)g_ftl_page_bytes * g_ftl_block_pages / (1024 * 1024));
+    printf("Logical space (pages written or deallocated): %u (%.3f MiB)\n", lpages,
+            (double)lpages * g_ftl_page_bytes / (1024 * 1024));
+    printf("Host page writes per pass: %ju  hot: %.3f %%  deallocated pages: %ju\n", host,
+            pct(hot, host), op_cnt - host);
+    if (dsm) {
+        printf("DSM deallocate without range records (not modelled): %ju\n", dsm);
+    }
+    if (host == 0) {
+        free(ops);
+        return 0;
+    }
+
+    /* loop the capture until the drive has been overwritten twice, then measure one pass */
+    if (lpages < 64 * (uint64_t)g_ftl_block_pages) {
+        printf("Logical space is only %u erase blocks, open blocks eat into the spare area (try a smaller -E)\n",
+                (lpages + g_ftl_block_pages - 1) / g_ftl_block_pages);
+    }
+    printf("\n%-8s %-8s %-13s %-12s %8s %8s %14s %12s %9s\n", "OP(%)", "EFF(%)", "GC", "LAYOUT", "WA",
+            "WA(1st)", "ERASE/GiB", "VICTIM(%)", "PASSES");
+    for (int o = 0; o < g_ftl_op_cnt; o++) {
+        double wa[FTL_GC_POLICIES][FTL_LAYOUTS] = {};
+
+        for (int g = 0; g < FTL_GC_POLICIES; g++) {
+            if (g_ftl_gc >= 0 && g != g_ftl_gc) {
+                continue;
+            }
+            for (int l = 0; l < FTL_LAYOUTS; l++) {
+                struct ftl_sim f;
+                uint64_t passes = 0, h0, n0, e0, r0;
+                double wa_first;
+
+                rc = ftl_sim_init(&f, (enum ftl_gc)g, (enum ftl_layout)l, lpages, g_ftl_op[o]);
+                if (rc) {
+                    fprintf(stderr, "Fail to allocate memory for FTL model\n");
+                    free(ops);
+                    return rc;
+                }
+                ftl_sim_run(&f, ops, op_cnt);
+                passes++;
+                wa_first = (double)f.nand_writes / f.host_writes;
+                while (f.host_writes < 2 * (uint64_t)f.nblocks * f.ppb && passes < FTL_MAX_PASSES) {
+                    ftl_sim_run(&f, ops, op_cnt);
+                    passes++;
+                }
+                h0 = f.host_writes;
+                n0 = f.nand_writes;
+                e0 = f.erases;
+                r0 = f.relocated;
+                ftl_sim_run(&f, ops, op_cnt);
+                passes++;
+
+                double gib = (double)(f.host_writes - h0) * g_ftl_page_bytes / (1024 * 1024 * 1024);
+                uint64_t erases = f.erases - e0;
+                wa[g][l] = (double)(f.nand_writes - n0) / (f.host_writes - h0);
+                printf("%-8u %-8.1f %-13s %-12s %8.3f %8.3f %14.3f %12.3f %9ju%s\n", g_ftl_op[o],
+                        pct((double)f.nblocks * f.ppb - lpages, lpages), g_ftl_gc_name[g], g_ftl_layout_name[l], wa[g][l], wa_first,
+                        gib ? erases / gib : 0.0,
+                        erases ? pct((double)(f.relocated - r0) / erases, f.ppb) : 0.0,
+                        passes, f.stalls ? "  (GC stalled: spare area too small)" : "");
+                ftl_sim_free(&f);
+            }
+        }
+        for (int g = 0; g < FTL_GC_POLICIES; g++) {
+            if (wa[g][FTL_SINGLE] == 0.0) {
+                continue;
+            }
+            printf("%-8u %-8s %-13s hot/cold separation: %+.3f %% NAND writes vs single stream\n",
+                    g_ftl_op[o], "", g_ftl_gc_name[g],
+                    pct(wa[g][FTL_HOT_COLD] - wa[g][FTL_SINGLE], wa[g][FTL_SINGLE]));
+        }
+    }
+
+    free(ops);
+    return 0;
+}
+/* ftl simulation end */
+
+/* incremental cache start */
+/*
+ * The base report (latency, R/W counts, I/O sizes, R/W per block) only
+ * needs per-record counters, so it can be carried over between runs on a
+ * growing capture.  The totals are kept in a sidecar file next to the
+ * trace together with how far into the trace they reach; a rerun loads
+ * only the records after that offset and adds the cached totals back.
+ * The sidecar is trusted only for the same file (device, inode, the bytes
+ * at the start and just before the offset) and the same namespace geometry.
+ */
+#define SIDECAR_MAGIC "TIOAGG01"
+#define SIDECAR_HASH_BYTES 4096
+
+struct sidecar_hdr {
+    char     magic[8];
+    uint32_t rec_size;
+    uint32_t rsvd;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t offset;        /* bytes of the trace covered by the totals */
+    uint64_t head_hash;     /* first SIDECAR_HASH_BYTES of the trace */
+    uint64_t tail_hash;     /* SIDECAR_HASH_BYTES before offset */
+    uint64_t tsc_rate;
+    uint64_t ns_block;
+    uint64_t max_transfer_block;
+    uint64_t read_cnt;
+    uint64_t write_cnt;
+    uint64_t lat_cnt;
+    uint64_t lat_sum;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t iosize_cnt;
+    uint64_t extent_cnt;
+};
+
+struct sidecar_iosize {
+    uint32_t idx;           /* number of blocks - 1 */
+    uint32_t r;
+    uint32_t w;
+};
+
+/* run of blocks with the same R/W counts */
+struct sidecar_extent {
+    uint64_t slba;
+    uint64_t len;
+    uint16_t r;
+    uint16_t w;
+    uint32_t rsvd;
+};
+
+struct sidecar {
+    struct sidecar_hdr hdr;
+    struct sidecar_iosize *iosize;
+    struct sidecar_extent *extent;
+    bool valid;
+};
+
+static bool g_sidecar = false;
+static char g_sidecar_file[1024];
+
+static uint64_t
+sidecar_hash(FILE *fptr, uint64_t from, uint64_t len)
+{
+    uint8_t buf[SIDECAR_HASH_BYTES];
+    uint64_t hash = 0xcbf29ce484222325ULL;  /* FNV-1a */
+    size_t n;
+
+    len = spdk_min(len, sizeof(buf));
+    if (fseeko(fptr, (off_t)from, SEEK_SET) != 0) {
+        return 0;
+    }
+    n = fread(buf, 1, (size_t)len, fptr);
+    for (size_t i = 0; i < n; i++) {
+        hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void
+sidecar_identity(FILE *fptr, uint64_t offset, struct sidecar_hdr *hdr)
+{
+    struct stat st;
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, SIDECAR_MAGIC, sizeof(hdr->magic));
+    hdr->rec_size = sizeof(struct bin_file_data);
+    if (fstat(fileno(fptr), &st) == 0) {
+        hdr->dev = st.st_dev;
+        hdr->ino = st.st_ino;
+    }
+    hdr->offset = offset;
+    hdr->head_hash = sidecar_hash(fptr, 0, spdk_min(offset, SIDECAR_HASH_BYTES));
+    hdr->tail_hash = sidecar_hash(fptr, offset - spdk_min(offset, SIDECAR_HASH_BYTES),
+                                  spdk_min(offset, SIDECAR_HASH_BYTES));
+}
+
+static void
+sidecar_free(struct sidecar *sc)
+{
+    free(sc->iosize);
+    free(sc->extent);
+    memset(sc, 0, sizeof(*sc));
+}
+
+/*
+ * Load the sidecar of an open trace of file_size bytes; returns the trace
+ * offset the cached totals reach, 0 when there is nothing usable.
+ */
+static uint64_t
+sidecar_load(struct sidecar *sc, FILE *fptr, uint64_t file_size)
+{
+    struct sidecar_hdr now;
+    FILE *f = fopen(g_sidecar_file, "rb");
+    bool ok;
+
+    memset(sc, 0, sizeof(*sc));
+    if (f == NULL) {
+        return 0;
+    }
+    ok = fread(&sc->hdr, sizeof(sc->hdr), 1, f) == 1 &&
+         memcmp(sc->hdr.magic, SIDECAR_MAGIC, sizeof(sc->hdr.magic)) == 0 &&
+         sc->hdr.rec_size == sizeof(struct bin_file_data) &&
+         sc->hdr.offset <= file_size && sc->hdr.offset % sizeof(struct bin_file_data) == 0;
+    if (ok) {
+        sc->iosize = (struct sidecar_iosize *)calloc(sc->hdr.iosize_cnt + 1, sizeof(struct sidecar_iosize));
+        sc->extent = (struct sidecar_extent *)calloc(sc->hdr.extent_cnt + 1, sizeof(struct sidecar_extent));
+        ok = sc->iosize && sc->extent &&
+             fread(sc->iosize, sizeof(struct sidecar_iosize), sc->hdr.iosize_cnt, f) == sc->hdr.iosize_cnt &&
+             fread(sc->extent, sizeof(struct sidecar_extent), sc->hdr.extent_cnt, f) == sc->hdr.extent_cnt;
+    }
+    fclose(f);
+
+    if (ok) {
+        sidecar_identity(fptr, sc->hdr.offset, &now);
+        ok = now.dev == sc->hdr.dev && now.ino == sc->hdr.ino &&
+             now.head_hash == sc->hdr.head_hash && now.tail_hash == sc->hdr.tail_hash;
+    }
+    rewind(fptr);
+    if (!ok) {
+        printf("Sidecar %s does not match the trace, rescanning\n", g_sidecar_file);
+        sidecar_free(sc);
+        return 0;
+    }
+    sc->valid = true;
+    return sc->hdr.offset;
+}
+
+/* The per-block and I/O size totals are only valid for the same namespace geometry */
+static bool
+sidecar_geometry_ok(const struct sidecar *sc)
 {
-    switch (opc) {
-    case SPDK_NVME_OPC_ZONE_MGMT_RECV:
-        *cdw10 = true;
-        *cdw11 = true;
-        *cdw12 = true;
-        *cdw13 = true; 
-        break;
-    case SPDK_NVME_OPC_WRITE:
-    case SPDK_NVME_OPC_READ:
-    case SPDK_NVME_OPC_WRITE_UNCORRECTABLE:
-    case SPDK_NVME_OPC_COMPARE:
-    case SPDK_NVME_OPC_WRITE_ZEROES:
-    case SPDK_NVME_OPC_VERIFY:
-    case SPDK_NVME_OPC_COPY:
-    case SPDK_NVME_OPC_ZONE_APPEND:
-        *cdw10 = true;
-        *cdw11 = true;
-        *cdw12 = true;
-        break;
-    case SPDK_NVME_OPC_DATASET_MANAGEMENT:
-        *cdw10 = true;
-        break;
-    case SPDK_NVME_OPC_ZONE_MGMT_SEND:
-        *cdw10 = true;
-        *cdw11 = true;
-        *cdw13 = true;
-        break;
-    case SPDK_NVME_OPC_FLUSH:
-    case SPDK_NVME_OPC_RESERVATION_REGISTER: 
-    case SPDK_NVME_OPC_RESERVATION_REPORT:
-    case SPDK_NVME_OPC_RESERVATION_ACQUIRE:
-    case SPDK_NVME_OPC_RESERVATION_RELEASE:
-        break;
-    default:
-        break;
+    if (sc->hdr.ns_block == g_ns_block && sc->hdr.max_transfer_block == g_max_transfer_block) {
+        return true;
     }
+    printf("Sidecar %s was built for another namespace, rescanning\n", g_sidecar_file);
+    return false;
 }
 
+/* Add the cached totals to the new records' ones, then keep the sum for saving */
 static int
-process_print_trace(struct bin_file_data *d)
+sidecar_merge_iosize(struct sidecar *sc, uint32_t *r_iosize, uint32_t *w_iosize)
 {
-    int     rc = 0;
-    const char *opc_name;
-    const char *zone_act_name;
-    bool cdw10 = false;
-    bool cdw11 = false;
-    bool cdw12 = false;
-    bool cdw13 = false;
-    uint64_t slba = 0;
-
-    /* print lcore & tsc_base (us) & tpoint name & object id */
-    float timestamp_us = get_us_from_tsc(d->tsc_timestamp, d->tsc_rate);
-    printf("core%2d: %16.3f  ", d->lcore, timestamp_us);
-    
-    if (g_print_tsc) {
-        printf("(%10ju)  ", d->tsc_timestamp);
-    }
-    printf("%-20s ", d->tpoint_name);
-    print_ptr("object", d->obj_id);
+    struct sidecar_iosize *iosize;
+    uint64_t cnt = 0;
 
-    
-    /* print process nvme submit / complete */
-    if (strcmp(d->tpoint_name, "NVME_IO_SUBMIT") && strcmp(d->tpoint_name, "NVME_IO_COMPLETE")) {
-        rc = 1;
+    if (sc->valid) {
+        for (uint64_t i = 0; i < sc->hdr.iosize_cnt; i++) {
+            if (sc->iosize[i].idx < g_max_transfer_block) {
+                r_iosize[sc->iosize[i].idx] += sc->iosize[i].r;
+                w_iosize[sc->iosize[i].idx] += sc->iosize[i].w;
+            }
+        }
+        if (sc->hdr.lat_cnt) {
+            g_latency_tsc_min = g_latency_cnt ? spdk_min(g_latency_tsc_min, sc->hdr.lat_min) : sc->hdr.lat_min;
+            g_latency_tsc_max = spdk_max(g_latency_tsc_max, sc->hdr.lat_max);
+        }
+        g_read_cnt += sc->hdr.read_cnt;
+        g_write_cnt += sc->hdr.write_cnt;
+        g_latency_cnt += sc->hdr.lat_cnt;
+        g_latency_tsc_sum += sc->hdr.lat_sum;
+        g_latency_tsc_avg = g_latency_cnt ? g_latency_tsc_sum / g_latency_cnt : 0;
+        if (!g_tsc_rate) {
+            g_tsc_rate = sc->hdr.tsc_rate;
+        }
+        if (g_tsc_rate) {
+            g_latency_us_min = get_us_from_tsc(g_latency_tsc_min, g_tsc_rate);
+            g_latency_us_max = get_us_from_tsc(g_latency_tsc_max, g_tsc_rate);
+            g_latency_us_avg = get_us_from_tsc(g_latency_tsc_avg, g_tsc_rate);
+        }
     }
 
-    if (strcmp(d->tpoint_name, "NVME_IO_SUBMIT") == 0) {
-        set_opc_name(d->opc, &opc_name);
-        set_opc_flags(d->opc, &cdw10, &cdw11, &cdw12, &cdw13);
-        printf("%-20s ", opc_name);
-        print_uint64("cid", d->cid);
-        print_ptr("nsid", d->nsid);
-
-        if (cdw10) { /* slba_l64b | nr_8b (dataset_mgmt) */
-            if (d->opc != SPDK_NVME_OPC_DATASET_MANAGEMENT)
-                slba = (uint64_t)d->cdw10;
-            else 
-                print_ptr("nr", d->cdw10 & UINT8BIT_MASK);
-        }
-
-        if (cdw11) { /* slba_h64b */
-            slba |= ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32;
-            
-            if (d->opc != SPDK_NVME_OPC_ZONE_APPEND) {
-                print_ptr("slba", slba);
-            } else {
-                print_ptr("zslba", slba);
-            }
+    for (uint64_t i = 0; i < g_max_transfer_block; i++) {
+        cnt += r_iosize[i] || w_iosize[i];
+    }
+    iosize = (struct sidecar_iosize *)calloc(cnt + 1, sizeof(struct sidecar_iosize));
+    if (iosize == NULL) {
+        fprintf(stderr, "Fail to allocate memory for sidecar I/O sizes\n");
+        return -ENOMEM;
+    }
+    cnt = 0;
+    for (uint64_t i = 0; i < g_max_transfer_block; i++) {
+        if (r_iosize[i] || w_iosize[i]) {
+            iosize[cnt++] = (struct sidecar_iosize) { (uint32_t)i, r_iosize[i], w_iosize[i] };
         }
+    }
+    free(sc->iosize);
+    sc->iosize = iosize;
+    sc->hdr.iosize_cnt = cnt;
+    sc->hdr.read_cnt = g_read_cnt;
+    sc->hdr.write_cnt = g_write_cnt;
+    sc->hdr.lat_cnt = g_latency_cnt;
+    sc->hdr.lat_sum = g_latency_tsc_sum;
+    sc->hdr.lat_min = g_latency_tsc_min;
+    sc->hdr.lat_max = g_latency_tsc_max;
+    sc->hdr.tsc_rate = g_tsc_rate;
+    return 0;
+}
+
+static int
+sidecar_merge_blk(struct sidecar *sc, uint16_t *r_blk, uint16_t *w_blk)
+{
+    struct sidecar_extent *extent;
+    uint64_t cnt = 0;
 
-        if (cdw12) { /* nlb_16b | nr_8b (copy) | ndw_32b (z_mgmt_recv) */
-            if (d->opc == SPDK_NVME_OPC_COPY)
-                print_uint64("range", (d->cdw12 & UINT8BIT_MASK) + 1);
-            else if (d->opc == SPDK_NVME_OPC_ZONE_MGMT_RECV)
-                print_uint64("dword", (d->cdw12 & UINT32BIT_MASK) + 1);
-            else
-                print_uint64("block", (d->cdw12 & UINT16BIT_MASK) + 1);
+    if (sc->valid) {
+        for (uint64_t i = 0; i < sc->hdr.extent_cnt; i++) {
+            const struct sidecar_extent *e = &sc->extent[i];
+
+            for (uint64_t b = e->slba; b < e->slba + e->len && b < g_ns_block; b++) {
+                r_blk[b] += e->r;
+                w_blk[b] += e->w;
+            }
         }
+    }
 
-        if (cdw13) { /* zsa_8b || zra_8b */
-            set_zone_act_name(d->opc, d->cdw13 & UINT8BIT_MASK, &zone_act_name);
-            printf("%-20.20s ", zone_act_name);
+    for (uint64_t i = 0; i < g_ns_block; i++) {
+        if ((r_blk[i] || w_blk[i]) &&
+            (i == 0 || r_blk[i] != r_blk[i - 1] || w_blk[i] != w_blk[i - 1])) {
+            cnt++;
         }
-        printf("\n");
     }
-    
-    if (strcmp(d->tpoint_name, "NVME_IO_COMPLETE") == 0) {
-        if (d->tsc_sc_time) {
-            float sctime_us = get_us_from_tsc(d->tsc_sc_time, d->tsc_rate);
-            print_float("time", sctime_us);
+    extent = (struct sidecar_extent *)calloc(cnt + 1, sizeof(struct sidecar_extent));
+    if (extent == NULL) {
+        fprintf(stderr, "Fail to allocate memory for sidecar extents\n");
+        return -ENOMEM;
+    }
+    cnt = 0;
+    for (uint64_t i = 0; i < g_ns_block; i++) {
+        if (!r_blk[i] && !w_blk[i]) {
+            continue;
+        }
+        if (cnt && extent[cnt - 1].slba + extent[cnt - 1].len == i &&
+            extent[cnt - 1].r == r_blk[i] && extent[cnt - 1].w == w_blk[i]) {
+            extent[cnt - 1].len++;
+        } else {
+            extent[cnt++] = (struct sidecar_extent) { i, 1, r_blk[i], w_blk[i], 0 };
         }
-
-        print_uint64("cid", d->cid);
-        print_ptr("comp", d->cpl & (uint64_t)0x1);
-        print_ptr("status", (d->cpl >> 1) & (uint64_t)0x7FFF);
-        printf("\n");
     }
-
-    return rc;
+    free(sc->extent);
+    sc->extent = extent;
+    sc->hdr.extent_cnt = cnt;
+    return 0;
 }
-/* print trace end */
 
-/* Get namespace data start */
-static uint64_t g_ns_block = 0; /* number of blocks in a namespace */
-static size_t g_max_transfer_block = 0;
-static bool g_zone = false;
-static uint64_t g_zone_size_lba = 0;
-static uint64_t g_total_zones = 0;
-static void
-get_ns_info(void)
+/* Write the merged totals covering the first offset bytes of the trace, replacing the old sidecar atomically */
+static int
+sidecar_save(struct sidecar *sc, FILE *fptr, uint64_t offset)
 {
-    struct ns_entry *ns_entry = TAILQ_FIRST(&g_namespaces);
-    
-    if (spdk_nvme_ns_get_csi(ns_entry->ns) != SPDK_NVME_CSI_ZNS) {
-        return;
-    }
+    struct sidecar_hdr hdr;
+    char tmp[sizeof(g_sidecar_file) + 8];
+    FILE *f;
+    bool ok;
 
-    const struct spdk_nvme_ns_data *ndata = spdk_nvme_ns_get_data(ns_entry->ns);
-    g_ns_block = ndata->ncap;
-    g_max_transfer_block = spdk_nvme_ns_get_max_io_xfer_size(ns_entry->ns);
+    sidecar_identity(fptr, offset, &hdr);
+    sc->hdr.dev = hdr.dev;
+    sc->hdr.ino = hdr.ino;
+    sc->hdr.offset = hdr.offset;
+    sc->hdr.head_hash = hdr.head_hash;
+    sc->hdr.tail_hash = hdr.tail_hash;
+    memcpy(sc->hdr.magic, hdr.magic, sizeof(hdr.magic));
+    sc->hdr.rec_size = hdr.rec_size;
+    sc->hdr.ns_block = g_ns_block;
+    sc->hdr.max_transfer_block = g_max_transfer_block;
 
-    if (spdk_nvme_ns_get_csi(ns_entry->ns) == SPDK_NVME_CSI_ZNS) {
-        g_zone = true;
-        g_zone_size_lba = spdk_nvme_zns_ns_get_zone_size_sectors(ns_entry->ns);
-        g_total_zones = spdk_nvme_zns_ns_get_num_zones(ns_entry->ns);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_sidecar_file);
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open sidecar %s\n", tmp);
+        return -errno;
     }
-
+    ok = fwrite(&sc->hdr, sizeof(sc->hdr), 1, f) == 1 &&
+         fwrite(sc->iosize, sizeof(struct sidecar_iosize), sc->hdr.iosize_cnt, f) == sc->hdr.iosize_cnt &&
+         fwrite(sc->extent, sizeof(struct sidecar_extent), sc->hdr.extent_cnt, f) == sc->hdr.extent_cnt;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, g_sidecar_file) != 0) {
+        fprintf(stderr, "Failed to write sidecar %s\n", g_sidecar_file);
+        unlink(tmp);
+        return -EIO;
+    }
+    return 0;
 }
-/* Get namespace data end */
+/* incremental cache end */
 
 static void
 usage(const char *program_name)
@@ -634,14 +6522,78 @@ usage(const char *program_name)
     printf("         '-f' specify the input file which generated by trace_io_record\n");
     printf("         '-d' to display each event\n");
     printf("         '-t' to display TSC for each event\n");
+    printf("         '--fields' to select the fields '-d' displays, comma separated:\n");
+    printf("              core, time, tsc, event, object, opc, cid, nsid, lba, nlb, zone_action,\n");
+    printf("              latency, comp, status or all (default: all but tsc)\n");
+    printf("         '-Q' to report queue depth over time (histogram, Little's law, latency by QD)\n");
+    printf("         '-g' to report count, bytes, latency and I/O size mix per lcore, namespace and opcode\n");
+    printf("         '-s' to classify reads / writes as sequential, strided or random,\n");
+    printf("              tracking the given number of concurrent streams per lcore / namespace\n");
+    printf("         '-c' to simulate a host cache with the given page size in bytes:\n");
+    printf("              reuse distance histogram and LRU hit ratio vs capacity\n");
+    printf("         '-C' to also simulate LRU, ARC and 2Q at the given cache size in pages\n");
+    printf("              (may be repeated, implies -c 4096 if -c is not given)\n");
+    printf("         '-z' to simulate zone states and write pointers of a ZNS namespace\n");
+    printf("         '-Z' to specify the zone capacity in blocks (default: zone size)\n");
+    printf("         '-A' to report inter-arrival times, index of dispersion, bursts and token bucket depth\n");
+    printf("         '--burst-k' to specify the rate over the mean that makes a burst (default: 2)\n");
+    printf("         '--burst-window' to specify the burst detection window in us (default: 1000)\n");
+    printf("         '-k' to list the K slowest I/Os with the I/Os submitted just before them (K up to %d)\n", OUTLIER_K_MAX);
+    printf("         '-w' to specify the window in us before an outlier to list (default: 100)\n");
+    printf("         '-D' to report deallocated blocks, trim to write ratio and live data over time\n");
+    printf("              (DSM ranges need NVME_DSM_RANGE records in the capture)\n");
+    printf("         '-W' to estimate FTL write amplification of a conventional namespace\n");
+    printf("         '-P' to specify the FTL page size in bytes (default: 4096)\n");
+    printf("         '-E' to specify the FTL erase block size in pages (default: 1024)\n");
+    printf("         '-O' to specify an FTL over-provisioning in percent (may be repeated, default: 7, 14, 28)\n");
+    printf("         '-G' to specify the FTL GC policy: greedy or cb (default: both)\n");
+    printf("         '--compare A B' to compare the latency of two traces per opcode and I/O size,\n");
+    printf("              exits with 2 when B regresses beyond the gate\n");
+    printf("         '--threshold' to specify the p99 increase in percent that fails the gate (default: 10)\n");
+    printf("         '--alpha' to specify the KS test significance level of the gate (default: 0.01)\n");
+    printf("         '--sector-size' to specify the sector size in bytes when no device is probed (default: 512)\n");
+    printf("         '-q' to run a query instead of the reports, e.g.\n");
+    printf("              \"where opc=read and lat>500us group by lcore, size_bucket select count, p99(lat), sum(bytes)\"\n");
+    printf("              where: opc, lcore, nsid, status, size_bucket, slba, time, nlb, bytes, lat joined by and / or\n");
+    printf("              group by: opc, lcore, nsid, status, size_bucket\n");
+    printf("              select: count, sum / avg / min / max / pNN of lat, bytes or nlb\n");
+    printf("         '--csv' to print the query result as CSV\n");
+    printf("         '--incremental[=file]' to keep the base report totals in a sidecar file (default: <trace>.agg)\n");
+    printf("              and only scan records appended since the last run\n");
 }
 
+enum long_opt {
+    LONG_OPT_COMPARE = 256,
+    LONG_OPT_THRESHOLD,
+    LONG_OPT_ALPHA,
+    LONG_OPT_SECTOR_SIZE,
+    LONG_OPT_CSV,
+    LONG_OPT_INCREMENTAL,
+    LONG_OPT_FIELDS,
+    LONG_OPT_BURST_K,
+    LONG_OPT_BURST_WINDOW,
+};
+
+static const struct option g_long_options[] = {
+    {"compare", required_argument, NULL, LONG_OPT_COMPARE},
+    {"threshold", required_argument, NULL, LONG_OPT_THRESHOLD},
+    {"alpha", required_argument, NULL, LONG_OPT_ALPHA},
+    {"sector-size", required_argument, NULL, LONG_OPT_SECTOR_SIZE},
+    {"csv", no_argument, NULL, LONG_OPT_CSV},
+    {"incremental", optional_argument, NULL, LONG_OPT_INCREMENTAL},
+    {"fields", required_argument, NULL, LONG_OPT_FIELDS},
+    {"burst-k", required_argument, NULL, LONG_OPT_BURST_K},
+    {"burst-window", required_argument, NULL, LONG_OPT_BURST_WINDOW},
+    {NULL, 0, NULL, 0},
+};
+
 static int
 parse_args(int argc, char **argv, char *file_name, size_t file_name_size)
 {
+    long long val;
     int op;
 
-    while ((op = getopt(argc, argv, "f:dt")) != -1) {
+    while ((op = getopt_long(argc, argv, "f:dtQgADs:c:C:k:w:zZ:WP:E:O:G:q:", g_long_options, NULL)) != -1) {
         switch (op) {
         case 'f':
             g_input_file = true;
@@ -653,12 +6605,184 @@ parse_args(int argc, char **argv, char *file_name, size_t file_name_size)
         case 't':
             g_print_tsc = true;
             break;
+        case 'Q':
+            g_qd_report = true;
+            break;
+        case 'A':
+            g_iat_report = true;
+            break;
+        case 'D':
+            g_dealloc_report = true;
+            break;
+        case 'g':
+            g_group_report = true;
+            break;
+        case 's':
+            val = spdk_strtol(optarg, 10);
+            if (val <= 0 || val > UINT16_MAX) {
+                fprintf(stderr, "-s must be between 1 and %d\n", UINT16_MAX);
+                usage(argv[0]);
+                return 1;
+            }
+            g_seq_streams = (uint32_t)val;
+            break;
+        case 'c':
+            g_cache_page_bytes = atoi(optarg);
+            if (g_cache_page_bytes == 0) {
+                fprintf(stderr, "-c must be a page size in bytes\n");
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'C':
+            if (g_cache_size_cnt == CACHE_SIZES_MAX) {
+                fprintf(stderr, "-C may be given at most %d times\n", CACHE_SIZES_MAX);
+                return 1;
+            }
+            g_cache_sizes[g_cache_size_cnt] = strtoull(optarg, NULL, 10);
+            if (g_cache_sizes[g_cache_size_cnt] == 0) {
+                fprintf(stderr, "-C must be a cache size in pages\n");
+                usage(argv[0]);
+                return 1;
+            }
+            g_cache_size_cnt++;
+            break;
+        case 'k':
+            val = spdk_strtol(optarg, 10);
+            if (val <= 0 || val > OUTLIER_K_MAX) {
+                fprintf(stderr, "-k must be a number of I/Os between 1 and %d\n", OUTLIER_K_MAX);
+                usage(argv[0]);
+                return 1;
+            }
+            g_outlier_k = (uint32_t)val;
+            break;
+        case 'w':
+            val = spdk_strtoll(optarg, 10);
+            if (val < 0) {
+                fprintf(stderr, "-w must be a time in us\n");
+                usage(argv[0]);
+                return 1;
+            }
+            g_outlier_window_us = (uint64_t)val;
+            break;
+        case 'z':
+            g_zone_sim = true;
+            break;
+        case 'Z':
+            val = spdk_strtoll(optarg, 10);
+            if (val <= 0) {
+                fprintf(stderr, "-Z must be a zone capacity in blocks\n");
+                usage(argv[0]);
+                return 1;
+            }
+            g_zone_cap_lba = (uint64_t)val;
+            break;
+        case 'W':
+            g_ftl_sim = true;
+            break;
+        case 'P':
+            g_ftl_page_bytes = (uint32_t)strtoul(optarg, NULL, 10);
+            if (g_ftl_page_bytes == 0) {
+                fprintf(stderr, "-P must be a page size in bytes\n");
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'E':
+            g_ftl_block_pages = (uint32_t)strtoul(optarg, NULL, 10);
+            if (g_ftl_block_pages == 0) {
+                fprintf(stderr, "-E must be an erase block size in pages\n");
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'O':
+            if (g_ftl_op_cnt == FTL_OP_MAX) {
+                fprintf(stderr, "-O may be given at most %d times\n", FTL_OP_MAX);
+                return 1;
+            }
+            g_ftl_op[g_ftl_op_cnt++] = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'G':
+            if (strcmp(optarg, "greedy") == 0) {
+                g_ftl_gc = FTL_GC_GREEDY;
+            } else if (strcmp(optarg, "cb") == 0) {
+                g_ftl_gc = FTL_GC_COST_BENEFIT;
+            } else {
+                fprintf(stderr, "-G must be greedy or cb\n");
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'q':
+            snprintf(g_query, sizeof(g_query), "%s", optarg);
+            break;
+        case LONG_OPT_CSV:
+            g_query_csv = true;
+            break;
+        case LONG_OPT_BURST_K:
+            g_burst_k = strtod(optarg, NULL);
+            if (g_burst_k <= 1) {
+                fprintf(stderr, "--burst-k must be above 1\n");
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case LONG_OPT_BURST_WINDOW:
+            g_burst_window_us = strtoull(optarg, NULL, 10);
+            if (g_burst_window_us == 0) {
+                fprintf(stderr, "--burst-window must be a time in us\n");
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case LONG_OPT_FIELDS:
+            g_dump_fields_set = true;
+            if (parse_dump_fields(optarg) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case LONG_OPT_INCREMENTAL:
+            g_sidecar = true;
+            if (optarg) {
+                snprintf(g_sidecar_file, sizeof(g_sidecar_file), "%s", optarg);
+            }
+            break;
+        case LONG_OPT_COMPARE:
+            g_compare = true;
+            snprintf(g_compare_file[0], sizeof(g_compare_file[0]), "%s", optarg);
+            break;
+        case LONG_OPT_THRESHOLD:
+            g_compare_threshold = strtod(optarg, NULL);
+            break;
+        case LONG_OPT_ALPHA:
+            g_compare_alpha = strtod(optarg, NULL);
+            break;
+        case LONG_OPT_SECTOR_SIZE:
+            g_sector_size = (uint32_t)strtoul(optarg, NULL, 10);
+            if (g_sector_size == 0) {
+                fprintf(stderr, "--sector-size must be a size in bytes\n");
+                usage(argv[0]);
+                return 1;
+            }
+            break;
         default:
             usage(argv[0]);
             return 1;
         }
     }
 
+    /* --compare takes the second trace as the next argument */
+    if (g_compare) {
+        if (optind >= argc) {
+            fprintf(stderr, "--compare needs two trace files\n");
+            usage(argv[0]);
+            return 1;
+        }
+        snprintf(g_compare_file[1], sizeof(g_compare_file[1]), "%s", argv[optind]);
+    }
+
     return 0;
 }
 
@@ -677,6 +6801,16 @@ main(int argc, char **argv)
         exit(1);
     }
 
+    if (!g_print_trace && g_dump_fields_set) {
+        fprintf(stderr, "--fields must be used with -d\n");
+        exit(1);
+    }
+
+    /* comparing two captures needs no device */
+    if (g_compare) {
+        return process_compare();
+    }
+
     if (input_file_name == NULL || !g_input_file) {
         fprintf(stderr, "-f input file must be specified\n");
         exit(1);
@@ -689,19 +6823,41 @@ main(int argc, char **argv)
         return 1;  
     }   
 
-    fseek(fptr, 0, SEEK_END);
-    int file_size = ftell(fptr);
+    fseeko(fptr, 0, SEEK_END);
+    off_t file_size = ftello(fptr);
     rewind(fptr);
-    int entry_cnt = file_size / sizeof(struct bin_file_data);
+    uint64_t entry_cnt = (uint64_t)file_size / sizeof(struct bin_file_data);
 
-    struct bin_file_data buffer[entry_cnt]; 
- 
-    size_t read_val = fread(&buffer, sizeof(struct bin_file_data), entry_cnt, fptr);
-    if (read_val != (size_t)entry_cnt) {
-        fprintf(stderr, "Fail to read input file\n");
+    /* with a sidecar only the records after its offset are loaded, unless a pass needs them all */
+    struct sidecar sidecar = {};
+    uint64_t cached_cnt = 0;
+    bool full_trace = g_print_trace || g_qd_report || g_iat_report || g_group_report || g_seq_streams || g_cache_page_bytes ||
+                      g_cache_size_cnt || g_zone_sim || g_ftl_sim || g_outlier_k || g_query[0] || g_dealloc_report;
+    if (g_sidecar && !g_sidecar_file[0]) {
+        snprintf(g_sidecar_file, sizeof(g_sidecar_file), "%s.agg", input_file_name);
+    }
+    if (g_sidecar && !full_trace) {
+        cached_cnt = sidecar_load(&sidecar, fptr, entry_cnt * sizeof(struct bin_file_data)) /
+                     sizeof(struct bin_file_data);
+        fseeko(fptr, (off_t)(cached_cnt * sizeof(struct bin_file_data)), SEEK_SET);
+    }
+
+    struct trace_table trace;
+    trace_kernels_init();
+    rc = trace_table_load(&trace, fptr, entry_cnt - cached_cnt);
+    if (!g_sidecar) {
+        fclose(fptr);
+    }
+    if (rc != 0) {
         return 1;
-    }   
-    fclose(fptr);
+    }
+
+    /* a query replaces the reports and needs no device */
+    if (g_query[0]) {
+        rc = process_query(&trace);
+        trace_table_free(&trace);
+        return rc ? 1 : 0;
+    }
 
     /* Initialize env */
     struct spdk_env_opts env_opts;
@@ -716,12 +6872,10 @@ main(int argc, char **argv)
     /* print trace */
     if (g_print_trace) {
         print_uline('=', printf("\nPrint I/O Trace\n"));
-        for (int i = 0; i < entry_cnt; i++) {
-            rc = process_print_trace(&buffer[i]);
-            if (rc != 0) {
-                fprintf(stderr, "Parse error\n");
-                return rc;
-            }
+        rc = process_dump_trace(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Parse error\n");
+            return rc;
         }
     }
     printf("\n");
@@ -749,9 +6903,23 @@ main(int argc, char **argv)
     /* Get namespace data */
     get_ns_info();
     cleanup();
-    printf("Number of blocks per namespace = 0x%lx\n", g_ns_block);
+    printf("Number of blocks per namespace = 0x%lx\n", g_ns_capacity);
     printf("Namespace max transfer block: %lu\n", g_max_transfer_block);
 
+    if (sidecar.valid && !sidecar_geometry_ok(&sidecar)) {
+        sidecar_free(&sidecar);
+        trace_table_free(&trace);
+        cached_cnt = 0;
+        rewind(fptr);
+        if (trace_table_load(&trace, fptr, entry_cnt) != 0) {
+            fclose(fptr);
+            return 1;
+        }
+    }
+    if (g_sidecar) {
+        printf("Sidecar %s: %ju records cached, %ju new\n", g_sidecar_file, cached_cnt, entry_cnt - cached_cnt);
+    }
+
     /*
      * Trace analysis: 
      * 1. Latency in tsc (time stamp counter) and in us
@@ -775,18 +6943,20 @@ main(int argc, char **argv)
     memset(r_iosize, 0, g_max_transfer_block * sizeof(uint32_t));
     memset(w_iosize, 0, g_max_transfer_block * sizeof(uint32_t));
     
-    for (int i = 0; i < entry_cnt; i++) {
-        rc = process_latency_iosize(&buffer[i], r_iosize, w_iosize);
-        if (rc != 0) {
-            fprintf(stderr, "Parse error\n");
-            free(r_iosize);
-            free(w_iosize);
-            return rc;
-        }
+    rc = process_latency_iosize(&trace, r_iosize, w_iosize);
+    if (rc != 0) {
+        fprintf(stderr, "Parse error\n");
+        free(r_iosize);
+        free(w_iosize);
+        return rc;
+    }
+    if (g_sidecar && sidecar_merge_iosize(&sidecar, r_iosize, w_iosize) != 0) {
+        free(r_iosize);
+        free(w_iosize);
+        return 1;
     }
 
     print_uline('=', printf("\nTrace Analysis\n"));
-    latency_avg(entry_cnt >> 1);
     printf("%-15s  ", "Latency (tsc)");
     printf("MIN:   %-20ld MAX:   %-20ld AVG: %-20ld\n",
             g_latency_tsc_min, g_latency_tsc_max, g_latency_tsc_avg);
@@ -833,12 +7003,21 @@ main(int argc, char **argv)
     memset(r_blk, 0, g_ns_block * sizeof(uint16_t));
     memset(w_blk, 0, g_ns_block * sizeof(uint16_t)); 
 
-    uint16_t r_zone[g_total_zones], w_zone[g_total_zones];
-    memset(r_zone, 0, g_total_zones * sizeof(uint16_t));
-    memset(w_zone, 0, g_total_zones * sizeof(uint16_t));
+    uint32_t *r_zone = (uint32_t *)calloc(g_total_zones + 1, sizeof(uint32_t));
+    uint32_t *w_zone = (uint32_t *)calloc(g_total_zones + 1, sizeof(uint32_t));
+    if (!r_zone || !w_zone) {
+        fprintf(stderr, "Fall to allocate memory for r_zone / w_zone\n");
+        free(r_zone);
+        free(w_zone);
+        free(r_blk);
+        free(w_blk);
+        rc = 1;
+        return rc;
+    }
 
-    for (int i = 0; i < entry_cnt; i++) {
-        rc = process_num_rw(&buffer[i], r_blk, w_blk);
+    /* the per-block table is only kept for a ZNS namespace, g_ns_block is 0 otherwise */
+    for (uint64_t j = 0; g_ns_block && j < trace.sub_cnt; j++) {
+        rc = process_num_rw(&trace, trace.sub[j], r_blk, w_blk);
         if (rc != 0) {
             fprintf(stderr, "Parse error\n");
             free(r_blk);
@@ -846,6 +7025,15 @@ main(int argc, char **argv)
         }
     }
 
+    /* the per-block counts complete the totals; the sidecar now covers the whole trace */
+    if (g_sidecar) {
+        if (sidecar_merge_blk(&sidecar, r_blk, w_blk) == 0) {
+            sidecar_save(&sidecar, fptr, entry_cnt * sizeof(struct bin_file_data));
+        }
+        sidecar_free(&sidecar);
+        fclose(fptr);
+    }
+
     print_uline('=', printf("\nNumber of R/W in a block\n"));    
     for (uint64_t i = 0, cnt = 0, zidx = 0; i < g_ns_block; i++) {
         if (!r_blk[i] && !w_blk[i])
@@ -874,9 +7062,9 @@ main(int argc, char **argv)
                 continue;
             cnt++;
             printf("zone %-13ld  ", i); 
-            printf("r %-5d ", r_zone[i]);
-            printf("w %-5d ", w_zone[i]);
-            printf("r+w %-5d ", r_zone[i] + w_zone[i]);
+            printf("r %-5u ", r_zone[i]);
+            printf("w %-5u ", w_zone[i]);
+            printf("r+w %-5u ", r_zone[i] + w_zone[i]);
             if (cnt % 4 == 0)
                 printf("\n");
         }
@@ -885,6 +7073,112 @@ main(int argc, char **argv)
 
     free(r_blk);
     free(w_blk);
+    free(r_zone);
+    free(w_zone);
+
+    /*
+     * Trace analysis:
+     * 6. Outstanding I/O over time (queue depth)
+     */
+    if (g_qd_report) {
+        rc = process_queue_depth(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Queue depth analysis failed\n");
+        }
+    }
+
+    /*
+     * Trace analysis:
+     * 7. Breakdown per lcore, namespace and opcode, plus cross-tabs
+     */
+    if (g_group_report) {
+        rc = process_group_by(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Group by analysis failed\n");
+        }
+    }
+
+    /*
+     * Trace analysis:
+     * 8. Sequential / strided / random access per stream
+     */
+    if (g_seq_streams) {
+        rc = process_sequentiality(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Sequentiality analysis failed\n");
+        }
+    }
+
+    /*
+     * Trace analysis:
+     * 9. Host cache simulation: reuse distance, LRU curve, ARC / 2Q
+     */
+    if (g_cache_size_cnt && !g_cache_page_bytes) {
+        g_cache_page_bytes = 4096;
+    }
+    if (g_cache_page_bytes) {
+        rc = process_cache_sim(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Cache simulation failed\n");
+        }
+    }
+
+    /*
+     * Trace analysis:
+     * 10. Zone state / write pointer simulation (if the block device is ZNS SSD)
+     */
+    if (g_zone_sim) {
+        rc = process_zone_sim(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Zone simulation failed\n");
+        }
+    }
+
+    /*
+     * Trace analysis:
+     * 11. FTL write amplification (if the block device is a conventional SSD)
+     */
+    if (g_ftl_sim) {
+        rc = process_ftl_sim(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "FTL simulation failed\n");
+        }
+    }
+
+    /*
+     * Trace analysis:
+     * 12. Top-K latency outliers with what was submitted just before them
+     */
+    if (g_outlier_k) {
+        rc = process_outliers(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Latency outlier report failed\n");
+        }
+    }
+
+    /*
+     * Trace analysis:
+     * 13. Inter-arrival time distribution and burstiness
+     */
+    if (g_iat_report) {
+        rc = process_inter_arrival(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Inter-arrival analysis failed\n");
+        }
+    }
+
+    /*
+     * Trace analysis:
+     * 14. Deallocated extents, trim to write ratio and live data over time
+     */
+    if (g_dealloc_report) {
+        rc = process_dealloc(&trace);
+        if (rc != 0) {
+            fprintf(stderr, "Deallocation analysis failed\n");
+        }
+    }
+
+    trace_table_free(&trace);
     spdk_env_fini();
     return rc;
 }
@@ -4,6 +4,7 @@
 #include "spdk/string.h"
 #include "spdk/util.h"
 #include "spdk/file.h"
+#include "spdk/nvme_spec.h"
 #include "../include/trace_io.h"
 
 #include <map>
@@ -51,7 +52,7 @@ process_output_file(struct spdk_trace_parser_entry *entry, FILE *fptr)
 {
     struct spdk_trace_entry *e = entry->entry;
     const struct spdk_trace_tpoint *d = &g_flags->tpoint[e->tpoint_id];
-    struct bin_file_data buffer; 
+    struct bin_file_data buffer = {};
     buffer.lcore = entry->lcore;
     buffer.tsc_rate = g_tsc_rate;
     buffer.tsc_timestamp = e->tsc - g_tsc_base;    
@@ -97,6 +98,24 @@ process_output_file(struct spdk_trace_parser_entry *entry, FILE *fptr)
                 continue;
             }
         }
+    } else if (strcmp(buffer.tpoint_name, "NVME_DSM_RANGE") == 0) {
+        /* one DSM range (or the aggregate span), logged before its dataset management command */
+        buffer.opc = SPDK_NVME_OPC_DATASET_MANAGEMENT;
+        buffer.obj_start = buffer.tsc_timestamp;
+        for (size_t i = 0; i < d->num_args; ++i) {
+            if (strcmp(d->args[i].name, "slba") == 0) {
+                buffer.cdw10 = (uint32_t)(entry->args[i].integer & UINT32BIT_MASK);
+                buffer.cdw11 = (uint32_t)(entry->args[i].integer >> 32);
+            } else if (strcmp(d->args[i].name, "nlb") == 0) {
+                buffer.cdw12 = (uint32_t)entry->args[i].integer;
+            } else if (strcmp(d->args[i].name, "nsid") == 0) {
+                buffer.nsid = (uint32_t)entry->args[i].integer;
+            } else if (strcmp(d->args[i].name, "cattr") == 0) {
+                buffer.cdw13 = (uint32_t)entry->args[i].integer;
+            } else {
+                continue;
+            }
+        }
     }
     
     fwrite(&buffer, sizeof(struct bin_file_data), 1, fptr);
@@ -236,7 +255,9 @@ main(int argc, char **argv)
     while (spdk_trace_parser_next_entry(g_parser, &entry)) {
         d = &g_flags->tpoint[entry.entry->tpoint_id];
     
-        if (strcmp(d->name, "NVME_IO_SUBMIT") != 0 && strcmp(d->name, "NVME_IO_COMPLETE") != 0) {
+        if (strcmp(d->name, "NVME_DSM_RANGE") == 0) {
+            /* carries no I/O object, only the range of the next DSM on this lcore */
+        } else if (strcmp(d->name, "NVME_IO_SUBMIT") != 0 && strcmp(d->name, "NVME_IO_COMPLETE") != 0) {
             continue;
         } else if (entry.args[0].integer) { 
             continue;   
@@ -9,9 +9,21 @@
 #include "spdk/nvme_zns.h"
 #include "spdk/nvme_spec.h"
 #include "spdk/log.h"
+#include "spdk/histogram_data.h"
+#include "spdk/fd.h"
+#include "spdk/event.h"
+#include "spdk/bdev.h"
+#include "spdk/bdev_zone.h"
+#include "spdk/thread.h"
 #include "../include/trace_io.h"
 #include "../include/spdk_trace.h"
 
+#include <math.h>
+#include <libaio.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
 struct ctrlr_entry {
     struct spdk_nvme_ctrlr *ctrlr;
     TAILQ_ENTRY(ctrlr_entry) link;
@@ -28,6 +40,8 @@ struct ns_entry {
 static TAILQ_HEAD(, ctrlr_entry) g_controllers = TAILQ_HEAD_INITIALIZER(g_controllers);
 static TAILQ_HEAD(, ns_entry) g_namespaces = TAILQ_HEAD_INITIALIZER(g_namespaces);
 static struct spdk_nvme_transport_id g_trid = {};
+static bool g_trid_set = false;
+static uint32_t g_nsid = 0;     /* 0: the first active namespace attached */
 static bool g_input_file = false;
 static bool g_report_zone = false;
 static bool g_spdk_trace = false;
@@ -116,6 +130,20 @@ attach_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
     }
 }
 
+/* Namespace to replay to and report on */
+static struct ns_entry *
+select_ns(void)
+{
+    struct ns_entry *entry;
+
+    TAILQ_FOREACH(entry, &g_namespaces, link) {
+        if (g_nsid == 0 || spdk_nvme_ns_get_id(entry->ns) == g_nsid) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
 static void
 cleanup(void)
 {
@@ -223,7 +251,7 @@ static void report_zone(void)
 {
     int rc = 0;
    
-    struct ns_entry *ns_entry = TAILQ_FIRST(&g_namespaces);
+    struct ns_entry *ns_entry = select_ns();
     
     if (spdk_nvme_ns_get_csi(ns_entry->ns) != SPDK_NVME_CSI_ZNS) {
         return;
@@ -301,294 +329,3735 @@ static void report_zone(void)
 }
 /* report zone end */
 
-/* replay workload start */
+/* replay stats start */
+#define REPLAY_SIZE_BUCKETS 8
+
+enum replay_opc {
+    REPLAY_OPC_READ,
+    REPLAY_OPC_WRITE,
+    REPLAY_OPC_WRITE_ZEROES,
+    REPLAY_OPC_DEALLOCATE,
+    REPLAY_OPC_ZONE_MGMT,
+    REPLAY_OPC_CLASSES,
+};
+
+static const char *g_replay_opc_name[REPLAY_OPC_CLASSES] = {"READ", "WRITE", "WRITE ZEROES", "DEALLOCATE", "ZONE MGMT"};
+static const char *g_size_bucket_name[REPLAY_SIZE_BUCKETS] = {
+    "<4K", "4K", "8K", "16K", "32K", "64K", "128K", ">128K"
+};
+
+struct replay_lat {
+    struct spdk_histogram_data *h;  /* latency in ticks */
+    uint64_t ios;
+    uint64_t bytes;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+};
+
+/* Where one replayed command came from and when it ran */
+struct replay_time {
+    uint64_t submit;
+    uint64_t complete;
+    uint32_t src;       /* index of its record in the capture */
+};
+
+/* Latency of one replay thread by opcode class and I/O size, merged at the end */
+struct replay_stats {
+    struct replay_lat lat[REPLAY_OPC_CLASSES][REPLAY_SIZE_BUCKETS];
+    uint32_t lcore;
+    uint64_t tsc_rate;
+    uint64_t seq;           /* commands submitted, numbers the per-I/O records */
+    uint64_t errors;
+    uint64_t first_tsc;     /* first submit */
+    uint64_t last_tsc;      /* last completion */
+    uint32_t epoch;         /* bumped when the warm-up is dropped */
+    uint64_t done;          /* completions, not reset by the warm-up */
+    uint64_t done_lat;      /* their latency sum */
+    /* per command timing for the fidelity report, indexed by seq */
+    const struct bin_file_data *base;
+    struct replay_time *timing;
+    uint64_t timing_cnt;
+};
+
+/* A command in flight */
+struct replay_io {
+    struct replay_stats *stats;
+    const struct bin_file_data *d;
+    uint64_t submit_tsc;
+    uint64_t seq;
+    uint64_t bytes;
+    uint32_t epoch;
+    uint8_t cls;
+    bool inflight;
+    bool failed;
+};
+
+static FILE *g_io_log = NULL;   /* per-I/O records in the trace_io_record format */
+static bool g_replay_unmap = false; /* deallocating DSMs are replayed as unmaps (bdev mode) */
+static uint32_t g_block_size = 512;
+static char g_io_log_name[68];
+static uint64_t g_replay_start_tsc;
+
+/* Power of two size class a transfer of the given bytes rounds up to */
+static uint32_t
+size_bucket(uint64_t bytes)
+{
+    if (bytes < 4096) {
+        return 0;
+    }
+    return spdk_min((uint32_t)(64 - __builtin_clzll(bytes - 1)) - 11, (uint32_t)REPLAY_SIZE_BUCKETS - 1);
+}
+
 static void
-reset_zone_complete(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+replay_stats_free(struct replay_stats *s)
 {
-    if (spdk_nvme_cpl_is_error(cpl)) {
-        printf("Reset all zones failed\n");
+    free(s->timing);
+    s->timing = NULL;
+    for (int c = 0; c < REPLAY_OPC_CLASSES; c++) {
+        for (int b = 0; b < REPLAY_SIZE_BUCKETS; b++) {
+            spdk_histogram_data_free(s->lat[c][b].h);
+            s->lat[c][b].h = NULL;
+        }
     }
-    outstanding_commands--;
 }
 
+/* Drop what was measured so far, the report then starts at the next submit */
 static void
-reset_all_zone(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair)
+replay_stats_reset(struct replay_stats *s)
 {
-    outstanding_commands = 0;
-    int rc = spdk_nvme_zns_reset_zone(ns, qpair, 0, true, reset_zone_complete, NULL);
-	if (rc) {
-            fprintf(stderr, "Reset all zones failed\n");
-            exit(1);
-    } else {
-        outstanding_commands++;
+    for (int c = 0; c < REPLAY_OPC_CLASSES; c++) {
+        for (int b = 0; b < REPLAY_SIZE_BUCKETS; b++) {
+            struct replay_lat *l = &s->lat[c][b];
+
+            spdk_histogram_data_reset(l->h);
+            l->ios = 0;
+            l->bytes = 0;
+            l->sum = 0;
+            l->max = 0;
+            l->min = UINT64_MAX;
+        }
     }
-    while (outstanding_commands) {
-        spdk_nvme_qpair_process_completions(qpair, 0);
+    s->errors = 0;
+    s->first_tsc = 0;
+    s->last_tsc = 0;
+    s->epoch++;
+}
+
+static int
+replay_stats_init(struct replay_stats *s)
+{
+    memset(s, 0, sizeof(*s));
+    for (int c = 0; c < REPLAY_OPC_CLASSES; c++) {
+        for (int b = 0; b < REPLAY_SIZE_BUCKETS; b++) {
+            s->lat[c][b].h = spdk_histogram_data_alloc();
+            s->lat[c][b].min = UINT64_MAX;
+            if (s->lat[c][b].h == NULL) {
+                replay_stats_free(s);
+                return -ENOMEM;
+            }
+        }
     }
+    s->lcore = spdk_env_get_current_core();
+    s->tsc_rate = spdk_get_ticks_hz();
+    return 0;
 }
 
 static void
-replay_complete(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+replay_log_record(const struct replay_io *io, bool complete, uint64_t tsc, uint16_t status)
 {
-    if (spdk_nvme_cpl_is_error(cpl)) {
-        printf("Reset all zones failed\n");
+    struct bin_file_data b = {};
+
+    if (complete) {
+        snprintf(b.tpoint_name, sizeof(b.tpoint_name), "NVME_IO_COMPLETE");
+        b.tsc_sc_time = tsc - io->submit_tsc;
+        b.cid = io->d->cid;
+        b.cpl = status;
+    } else {
+        b = *io->d;
+        b.tsc_sc_time = 0;
+        b.cpl = 0;
     }
-    outstanding_commands--;
+    b.lcore = io->stats->lcore;
+    b.tsc_rate = io->stats->tsc_rate;
+    b.tsc_timestamp = tsc - g_replay_start_tsc;
+    b.obj_id = io->seq;
+    b.obj_start = io->submit_tsc - g_replay_start_tsc;
+    fwrite(&b, sizeof(b), 1, g_io_log);
 }
 
-static int
-process_zns_replay(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair, struct bin_file_data *d)
+/* Stamp a command right before it goes to the device */
+static void
+replay_io_start(struct replay_io *io, struct replay_stats *stats, const struct bin_file_data *d,
+                uint8_t cls, uint64_t bytes)
 {
-    int rc = 0;
-    uint64_t slba = (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32;
-    uint32_t nlb = (uint32_t)(d->cdw12 & UINT16BIT_MASK) + 1;
+    io->stats = stats;
+    io->d = d;
+    io->cls = cls;
+    io->bytes = bytes;
+    io->seq = stats->seq++;
+    io->epoch = stats->epoch;
+    io->inflight = true;
+    io->submit_tsc = spdk_get_ticks();
+    if (stats->first_tsc == 0) {
+        stats->first_tsc = io->submit_tsc;
+    }
+    if (io->seq < stats->timing_cnt) {
+        stats->timing[io->seq].submit = io->submit_tsc;
+        stats->timing[io->seq].src = (uint32_t)(d - stats->base);
+    }
+    if (g_io_log) {
+        replay_log_record(io, false, io->submit_tsc, 0);
+    }
+}
 
-    /* allocate data buffers for SPDK NVMe I/O operations */
-    uint32_t block_size = spdk_nvme_ns_get_sector_size(ns); 
-    char *replay_buf = (char *)spdk_zmalloc(nlb * block_size, block_size,
-                             NULL, SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
-    if (!replay_buf) {
-        perror("Fail to malloc replay_buf");
-        exit(1);
-    }   
-    /* read write replay */
-    outstanding_commands = 0;
+static void
+replay_io_done(struct replay_io *io, const struct spdk_nvme_cpl *cpl)
+{
+    uint64_t tsc = spdk_get_ticks(), lat = tsc - io->submit_tsc;
+    struct replay_lat *l = &io->stats->lat[io->cls][size_bucket(io->bytes)];
 
-    switch (d->opc) {
-    case SPDK_NVME_OPC_READ:
-    case SPDK_NVME_OPC_COMPARE:
-        rc = spdk_nvme_ns_cmd_read(ns, qpair, replay_buf, slba, nlb, replay_complete, NULL, 0);
-        break;
-    case SPDK_NVME_OPC_WRITE:
-    case SPDK_NVME_OPC_ZONE_APPEND:
-        memset(replay_buf, 1, (size_t)nlb * block_size);
-        rc = spdk_nvme_zns_zone_append(ns, qpair, replay_buf, slba, nlb, replay_complete, NULL, 0);
-        break;
-    case SPDK_NVME_OPC_WRITE_ZEROES:
-        rc = spdk_nvme_ns_cmd_write_zeroes(ns, qpair, slba, nlb, replay_complete, NULL, 0);
-        break;
-    case SPDK_NVME_OPC_ZONE_MGMT_SEND:
-        bool select_all = (d->cdw13 & (uint32_t)1 << 8) ? true : false;
-        uint8_t zone_action = (uint8_t)(d->cdw13 & UINT8BIT_MASK);
-        if (zone_action == SPDK_NVME_ZONE_OPEN)
-            rc = spdk_nvme_zns_open_zone(ns, qpair, slba, select_all, replay_complete, NULL);
-        else if (zone_action == SPDK_NVME_ZONE_CLOSE)
-            rc = spdk_nvme_zns_close_zone(ns, qpair, slba, select_all, replay_complete, NULL);
-        else if (zone_action == SPDK_NVME_ZONE_FINISH)
-            rc = spdk_nvme_zns_finish_zone(ns, qpair, slba, select_all, replay_complete, NULL);
-        else if (zone_action == SPDK_NVME_ZONE_RESET)
-            rc = spdk_nvme_zns_reset_zone(ns, qpair, slba, select_all, replay_complete, NULL);
-        else if (zone_action == SPDK_NVME_ZONE_OFFLINE)
-            rc = spdk_nvme_zns_offline_zone(ns, qpair, slba, select_all, replay_complete, NULL);
-        else {
-            outstanding_commands--;
+    io->stats->done++;
+    io->stats->done_lat += lat;
+    if (io->seq < io->stats->timing_cnt) {
+        io->stats->timing[io->seq].complete = tsc;
+    }
+    /* a command submitted during the warm-up is not measured */
+    if (io->epoch == io->stats->epoch) {
+        spdk_histogram_data_tally(l->h, lat);
+        l->ios++;
+        l->bytes += io->bytes;
+        l->sum += lat;
+        l->min = spdk_min(l->min, lat);
+        l->max = spdk_max(l->max, lat);
+        io->stats->last_tsc = tsc;
+        if (spdk_nvme_cpl_is_error(cpl)) {
+            io->stats->errors++;
         }
-        break;
-    default:
-        outstanding_commands--;
     }
+    if (g_io_log) {
+        replay_log_record(io, true, tsc, cpl->status_raw);
+    }
+    io->failed = spdk_nvme_cpl_is_error(cpl);
+    io->inflight = false;
+}
 
-    if (rc) {
-            fprintf(stderr, "Replay failed\n");
-    } else {
-            outstanding_commands++;
+struct percentile_ctx {
+    double   cutoff;
+    uint64_t val;
+    bool     found;
+};
+
+static void
+check_cutoff(void *ctx, uint64_t start, uint64_t end, uint64_t count,
+             uint64_t total, uint64_t so_far)
+{
+    struct percentile_ctx *p = (struct percentile_ctx *)ctx;
+
+    if (p->found || count == 0) {
+        return;
+    }
+    if ((double)so_far / total >= p->cutoff) {
+        p->val = end;
+        p->found = true;
     }
+}
 
-    while (outstanding_commands) {
-        spdk_nvme_qpair_process_completions(qpair, 0);
+static uint64_t
+histogram_percentile(const struct spdk_histogram_data *h, double pct)
+{
+    struct percentile_ctx ctx = { .cutoff = pct / 100, .val = 0, .found = false };
+
+    spdk_histogram_data_iterate(h, check_cutoff, &ctx);
+    return ctx.val;
+}
+
+/* Percentile of a latency row; bucket ends can lie past the largest sample */
+static uint64_t
+replay_lat_percentile(const struct replay_lat *l, double pct)
+{
+    return spdk_min(histogram_percentile(l->h, pct), l->max);
+}
+
+static void
+replay_print_lat(const char *opc, const char *size, const struct replay_lat *l, double sec, uint64_t tsc_rate)
+{
+    double us = 1000.0 * 1000 / tsc_rate;
+
+    printf("%-14s %-7s %10ju %11.1f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", opc, size,
+            l->ios, l->ios / sec, l->bytes / sec / (1024 * 1024), l->min * us, (double)l->sum / l->ios * us,
+            replay_lat_percentile(l, 50) * us, replay_lat_percentile(l, 90) * us,
+            replay_lat_percentile(l, 99) * us, replay_lat_percentile(l, 99.9) * us, l->max * us);
+}
+
+static void
+replay_stats_report(const struct replay_stats *s)
+{
+    uint64_t ios = 0, bytes = 0;
+    double sec;
+
+    print_uline('=', printf("\nReplay latency\n"));
+    for (int c = 0; c < REPLAY_OPC_CLASSES; c++) {
+        for (int b = 0; b < REPLAY_SIZE_BUCKETS; b++) {
+            ios += s->lat[c][b].ios;
+            bytes += c == REPLAY_OPC_READ || c == REPLAY_OPC_WRITE ? s->lat[c][b].bytes : 0;
+        }
+    }
+    if (ios == 0) {
+        printf("No I/O replayed\n");
+        return;
+    }
+    sec = (double)(s->last_tsc - s->first_tsc) / s->tsc_rate;
+    sec = sec > 0 ? sec : 1.0 / s->tsc_rate;
+    printf("I/Os: %ju  errors: %ju  time: %.3f s  IOPS: %.1f  bandwidth: %.3f MiB/s\n", ios, s->errors, sec,
+            ios / sec, bytes / sec / (1024 * 1024));
+
+    printf("\n%-14s %-7s %10s %11s %10s %10s %10s %10s %10s %10s %10s %10s\n", "OPC", "SIZE", "IOS", "IOPS",
+            "MiB/s", "MIN(us)", "AVG(us)", "P50(us)", "P90(us)", "P99(us)", "P99.9(us)", "MAX(us)");
+    for (int c = 0; c < REPLAY_OPC_CLASSES; c++) {
+        struct replay_lat all = { .min = UINT64_MAX };
+        int rows = 0;
+
+        all.h = spdk_histogram_data_alloc();
+        if (all.h == NULL) {
+            fprintf(stderr, "Fail to allocate memory for latency histogram\n");
+            return;
+        }
+        for (int b = 0; b < REPLAY_SIZE_BUCKETS; b++) {
+            const struct replay_lat *l = &s->lat[c][b];
+
+            if (l->ios == 0) {
+                continue;
+            }
+            /* zone management moves no data */
+            replay_print_lat(g_replay_opc_name[c], c == REPLAY_OPC_ZONE_MGMT ? "-" : g_size_bucket_name[b], l, sec,
+                             s->tsc_rate);
+            spdk_histogram_data_merge(all.h, l->h);
+            all.ios += l->ios;
+            all.bytes += l->bytes;
+            all.sum += l->sum;
+            all.min = spdk_min(all.min, l->min);
+            all.max = spdk_max(all.max, l->max);
+            rows++;
+        }
+        if (rows > 1) {
+            replay_print_lat(g_replay_opc_name[c], "all", &all, sec, s->tsc_rate);
+        }
+        spdk_histogram_data_free(all.h);
     }
-    
-    spdk_free(replay_buf);
-    return rc;
 }
+/* replay stats end */
+
+/* fidelity start */
+struct fid_key {
+    uint64_t obj_id;
+    uint64_t obj_start;
+    uint32_t idx;
+};
 
 static int
-process_replay(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair, struct bin_file_data *d)
+fid_key_cmp(const void *a, const void *b)
 {
-    int rc = 0;
-    uint64_t slba = (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32;
-    uint32_t nlb = (uint32_t)(d->cdw12 & UINT16BIT_MASK) + 1;
+    const struct fid_key *x = (const struct fid_key *)a;
+    const struct fid_key *y = (const struct fid_key *)b;
 
-    /* allocate data buffers for SPDK NVMe I/O operations */
-    uint32_t block_size = spdk_nvme_ns_get_sector_size(ns);
-    char *replay_buf = (char *)spdk_zmalloc(nlb * block_size, block_size,
-                             NULL, SPDK_ENV_SOCKET_ID_ANY, SPDK_MALLOC_DMA);
-    if (!replay_buf) {
-        perror("Fail to malloc replay_buf");
-        exit(1);                                                                                                                                                                                           
+    if (x->obj_id != y->obj_id) {
+        return x->obj_id < y->obj_id ? -1 : 1;
     }
-    /* read write replay */
-    outstanding_commands = 0;
+    if (x->obj_start != y->obj_start) {
+        return x->obj_start < y->obj_start ? -1 : 1;
+    }
+    return 0;
+}
+
+static int
+double_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
 
+/* Opcode class a capture record is replayed as, REPLAY_OPC_CLASSES if it is not replayed */
+static int
+replay_opc_class(const struct bin_file_data *d, bool zns)
+{
     switch (d->opc) {
     case SPDK_NVME_OPC_READ:
     case SPDK_NVME_OPC_COMPARE:
-        rc = spdk_nvme_ns_cmd_read(ns, qpair, replay_buf, slba, nlb, replay_complete, NULL, 0);
-        break;
+        return REPLAY_OPC_READ;
     case SPDK_NVME_OPC_WRITE:
-        memset(replay_buf, 1, (size_t)nlb * block_size);
-        rc = spdk_nvme_ns_cmd_write(ns, qpair, replay_buf, slba, nlb, replay_complete, NULL, 0);
-        break;
+        return REPLAY_OPC_WRITE;
+    case SPDK_NVME_OPC_ZONE_APPEND:
+        return zns ? REPLAY_OPC_WRITE : REPLAY_OPC_CLASSES;
     case SPDK_NVME_OPC_WRITE_ZEROES:
-        rc = spdk_nvme_ns_cmd_write_zeroes(ns, qpair, slba, nlb, replay_complete, NULL, 0);
-        break;
+        return REPLAY_OPC_WRITE_ZEROES;
+    case SPDK_NVME_OPC_DATASET_MANAGEMENT:
+        return g_replay_unmap && (d->cdw11 & SPDK_NVME_DSM_ATTR_DEALLOCATE) ? REPLAY_OPC_DEALLOCATE :
+               REPLAY_OPC_CLASSES;
+    case SPDK_NVME_OPC_ZONE_MGMT_SEND:
+        return zns ? REPLAY_OPC_ZONE_MGMT : REPLAY_OPC_CLASSES;
     default:
-        outstanding_commands--; 
+        return REPLAY_OPC_CLASSES;
     }
+}
 
-    if (rc) {
-            fprintf(stderr, "Replay failed\n");
-    } else {
-            outstanding_commands++;
-    }
+/* Value at the given percentile of a sorted array */
+static double
+sorted_percentile(const double *v, uint64_t n, double pct)
+{
+    uint64_t idx = (uint64_t)ceil(pct / 100 * n);
 
-    while (outstanding_commands) {
-        spdk_nvme_qpair_process_completions(qpair, 0);
-    }
-    
-    spdk_free(replay_buf);
-    return rc;
+    return n ? v[spdk_max(idx, 1) - 1] : 0.0;
 }
 
-static void
-process_entry(struct bin_file_data *b, int entry_cnt)
+/* Kolmogorov-Smirnov distance between two sorted samples */
+static double
+ks_distance(const double *a, uint64_t na, const double *b, uint64_t nb)
 {
-    struct ns_entry *ns_entry;
-    int rc;
-    
-    /* specify namespace and allocate io qpair for the namespace */
-    ns_entry = TAILQ_FIRST(&g_namespaces);
-    ns_entry->qpair = spdk_nvme_ctrlr_alloc_io_qpair(ns_entry->ctrlr, NULL, 0);
-    if (ns_entry->qpair == NULL) {
-        printf("ERROR: spdk_nvme_ctrlr_alloc_io_qpair() failed\n");
-        return;
-    }
+    uint64_t i = 0, j = 0;
+    double d = 0;
 
-    if (spdk_nvme_ns_get_csi(ns_entry->ns) == SPDK_NVME_CSI_ZNS) {
-        /* reset zone before write */
-        reset_all_zone(ns_entry->ns, ns_entry->qpair);
-        printf("Reset all zone complete.\n");
-        for (int i = 0; i < entry_cnt; i++) {
-            if (strcmp(b[i].tpoint_name, "NVME_IO_COMPLETE") == 0) {
-                continue;
-            }
+    if (na == 0 || nb == 0) {
+        return na == nb ? 0.0 : 1.0;
+    }
+    while (i < na && j < nb) {
+        double x = spdk_min(a[i], b[j]);
 
-            rc = process_zns_replay(ns_entry->ns, ns_entry->qpair, &b[i]);
-            if (rc != 0) {
-                fprintf(stderr, "process_zns_replay() failed\n");
-                goto free_qpair;
-            }
-            //printf("process_zns_replay() success\n");
+        while (i < na && a[i] <= x) {
+            i++;
         }
-    } else {
-        printf("Not ZNS namespace\n");
-        for (int i = 0; i < entry_cnt; i++) {
-            if (strcmp(b[i].tpoint_name, "NVME_IO_COMPLETE") == 0) {
-                continue;
-            }
-            
-            rc = process_replay(ns_entry->ns, ns_entry->qpair, &b[i]);
-            if (rc != 0) {
-                fprintf(stderr, "process_replay() failed\n");
-                goto free_qpair;
-            }
-            //printf("process_replay() success\n");
+        while (j < nb && b[j] <= x) {
+            j++;
         }
-    } 
+        d = spdk_max(d, fabs((double)i / na - (double)j / nb));
+    }
+    return d;
+}
 
-    free_qpair:
-    spdk_nvme_ctrlr_free_io_qpair(ns_entry->qpair);
+/* Peak number of [start[i], end[i]) intervals open at once; both arrays get sorted */
+static uint64_t
+peak_overlap(double *start, double *end, uint64_t n)
+{
+    uint64_t i = 0, j = 0, cur = 0, peak = 0;
+
+    qsort(start, n, sizeof(double), double_cmp);
+    qsort(end, n, sizeof(double), double_cmp);
+    while (i < n) {
+        /* retire completions before new submissions at the same instant */
+        if (j < n && end[j] <= start[i]) {
+            cur--;
+            j++;
+        } else {
+            cur++;
+            i++;
+            peak = spdk_max(peak, cur);
+        }
+    }
+    return peak;
 }
-/* replay workload end */
+
+/* Timing of one side of the comparison, times in us */
+struct fid_side {
+    uint64_t ios;
+    uint64_t mix[REPLAY_OPC_CLASSES + 1][REPLAY_SIZE_BUCKETS];
+    double *submit;
+    double *end;
+    double *lat;
+    double *gap;
+    uint64_t lat_cnt;
+    double span;
+    double mean_qd;
+    uint64_t peak_qd;
+};
 
 static void
-usage(const char *program_name)
+fid_side_free(struct fid_side *f)
 {
-    printf("usage:\n");
-    printf("%s <options>\n", program_name);
-    printf("\n");
-    printf(" -f, specify the input file which generated by trace_io_record\n");
-    printf(" -z, to display zone\n");
-    printf(" -n, to specify the number of displayed zone\n");
-    printf("     (-n must be used with -z)\n");
-    //printf(" -e, enable spdk tracepoint\n");
-    spdk_trace_mask_usage(stdout, "-e");
+    free(f->submit);
+    free(f->end);
+    free(f->lat);
+    free(f->gap);
 }
 
 static int
-parse_args(int argc, char **argv, char *file_name, size_t file_name_size)
+fid_side_alloc(struct fid_side *f, uint64_t n)
 {
-    int op;
-
-    while ((op = getopt(argc, argv, "f:zn:e:")) != -1) {
-        switch (op) {
-        case 'f':
-            g_input_file = true;
-            snprintf(file_name, file_name_size, "%s", optarg);
-            break;
-        case 'z':
-            g_report_zone = true;
-            break;
-        case 'n':
-            g_zone_report_limit = atoi(optarg);
-            break;
-        case 'e':
-            g_spdk_trace = true;
-            g_tpoint_group_name = optarg;
-            break;
-        default:
-            usage(argv[0]);
-            return 1;
-        }
+    memset(f, 0, sizeof(*f));
+    f->submit = (double *)calloc(n + 1, sizeof(double));
+    f->end = (double *)calloc(n + 1, sizeof(double));
+    f->lat = (double *)calloc(n + 1, sizeof(double));
+    f->gap = (double *)calloc(n + 1, sizeof(double));
+    if (!f->submit || !f->end || !f->lat || !f->gap) {
+        fid_side_free(f);
+        return -ENOMEM;
     }
-
     return 0;
 }
 
-int
-main(int argc, char **argv)
+/* Sort the samples and derive gaps, span and queue depth; submit[] must be in submit order */
+static void
+fid_side_finish(struct fid_side *f, uint64_t sub_cnt)
 {
-    struct spdk_env_opts env_opts;
-    char input_file_name[68];
+    double *start;
 
-    /* Get the input file name */
-    int rc = parse_args(argc, argv, input_file_name, sizeof(input_file_name));
-    if (rc != 0) {
-        return rc;
+    for (uint64_t i = 1; i < sub_cnt; i++) {
+        f->gap[i - 1] = f->submit[i] - f->submit[i - 1];
     }
+    qsort(f->gap, sub_cnt ? sub_cnt - 1 : 0, sizeof(double), double_cmp);
 
-    if (input_file_name == NULL || !g_input_file) {
-        fprintf(stderr, "-f input file must be specified\n");
-        exit(1);
+    /* completed I/Os only: their submit times were packed next to end[] */
+    start = f->submit + sub_cnt;
+    f->span = sub_cnt ? f->submit[sub_cnt - 1] - f->submit[0] : 0;
+    for (uint64_t i = 0; i < f->lat_cnt; i++) {
+        f->span = spdk_max(f->span, f->end[i] - f->submit[0]);
+        f->mean_qd += f->lat[i];
     }
+    f->mean_qd = f->span > 0 ? f->mean_qd / f->span : 0;
+    f->peak_qd = peak_overlap(start, f->end, f->lat_cnt);
+    qsort(f->lat, f->lat_cnt, sizeof(double), double_cmp);
+}
 
-    FILE *fptr = fopen(input_file_name, "rb");
-    if (fptr == NULL) {
-        fprintf(stderr, "Failed to open input file %s\n", input_file_name);
-        return -1; 
+/* Capture side: every submit, latency from its completion record */
+static int
+fid_capture(struct fid_side *f, const struct bin_file_data *b, int entry_cnt, bool zns)
+{
+    uint64_t sub_cnt = 0, tsc_rate = 0;
+    struct fid_key *keys;
+
+    for (int i = 0; i < entry_cnt; i++) {
+        sub_cnt += strcmp(b[i].tpoint_name, "NVME_IO_SUBMIT") == 0;
+        tsc_rate = tsc_rate ? tsc_rate : b[i].tsc_rate;
+    }
+    keys = (struct fid_key *)calloc(sub_cnt + 1, sizeof(struct fid_key));
+    if (keys == NULL || fid_side_alloc(f, 2 * sub_cnt)) {
+        free(keys);
+        return -ENOMEM;
+    }
+    if (tsc_rate == 0) {
+        tsc_rate = 1;
     }
 
-    fseek(fptr, 0, SEEK_END);
-    int file_size = ftell(fptr);
-    rewind(fptr);
-    int entry_cnt = file_size / sizeof(struct bin_file_data);
+    for (int i = 0; i < entry_cnt; i++) {
+        if (strcmp(b[i].tpoint_name, "NVME_IO_SUBMIT") != 0) {
+            continue;
+        }
+        uint32_t nlb = (b[i].cdw12 & UINT16BIT_MASK) + 1;
+        int cls = replay_opc_class(&b[i], zns);
 
-    struct bin_file_data buffer[entry_cnt];    
- 
-    size_t read_val = fread(&buffer, sizeof(struct bin_file_data), entry_cnt, fptr);
+        f->mix[cls][size_bucket(cls == REPLAY_OPC_ZONE_MGMT ? 0 : (uint64_t)nlb * g_block_size)]++;
+        f->submit[f->ios] = (double)b[i].tsc_timestamp * 1000 * 1000 / tsc_rate;
+        keys[f->ios] = (struct fid_key) { b[i].obj_id, b[i].obj_start, (uint32_t)f->ios };
+        f->ios++;
+    }
+    qsort(keys, f->ios, sizeof(struct fid_key), fid_key_cmp);
+
+    for (int i = 0; i < entry_cnt; i++) {
+        struct fid_key key, *found;
+
+        if (strcmp(b[i].tpoint_name, "NVME_IO_COMPLETE") != 0 || b[i].tsc_sc_time == 0) {
+            continue;
+        }
+        key.obj_id = b[i].obj_id;
+        key.obj_start = b[i].obj_start;
+        found = (struct fid_key *)bsearch(&key, keys, f->ios, sizeof(struct fid_key), fid_key_cmp);
+        if (found == NULL) {
+            continue;
+        }
+        f->lat[f->lat_cnt] = (double)b[i].tsc_sc_time * 1000 * 1000 / tsc_rate;
+        f->submit[f->ios + f->lat_cnt] = f->submit[found->idx];
+        f->end[f->lat_cnt] = f->submit[found->idx] + f->lat[f->lat_cnt];
+        f->lat_cnt++;
+    }
+    free(keys);
+    fid_side_finish(f, f->ios);
+    return 0;
+}
+
+/* Replay side: the commands that went out, timed by the replay thread */
+static int
+fid_replay(struct fid_side *f, const struct replay_stats *s, const struct bin_file_data *b, bool zns)
+{
+    uint64_t n = spdk_min(s->seq, s->timing_cnt);
+    double us = 1000.0 * 1000 / s->tsc_rate;
+
+    if (fid_side_alloc(f, 2 * n)) {
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        const struct replay_time *t = &s->timing[i];
+        const struct bin_file_data *d = &b[t->src];
+        int cls = replay_opc_class(d, zns);
+
+        f->mix[cls][size_bucket(cls == REPLAY_OPC_ZONE_MGMT ? 0 :
+                                (uint64_t)((d->cdw12 & UINT16BIT_MASK) + 1) * g_block_size)]++;
+        f->submit[f->ios++] = (t->submit - g_replay_start_tsc) * us;
+        if (t->complete) {
+            f->lat[f->lat_cnt] = (t->complete - t->submit) * us;
+            f->submit[n + f->lat_cnt] = (t->submit - g_replay_start_tsc) * us;
+            f->end[f->lat_cnt] = (t->complete - g_replay_start_tsc) * us;
+            f->lat_cnt++;
+        }
+    }
+    fid_side_finish(f, f->ios);
+    return 0;
+}
+
+static double
+pct_delta(double a, double b)
+{
+    return a ? (b - a) * 100 / a : 0.0;
+}
+
+static void
+fid_print_row(const char *name, int prec, double cap, double rep)
+{
+    printf("%-24s %14.*f %14.*f %+10.1f %%\n", name, prec, cap, prec, rep, pct_delta(cap, rep));
+}
+
+/*
+ * Side-by-side comparison of the capture with what the replay did, scored
+ * as the mean of four similarities in [0, 1]: opcode / size mix (1 - total
+ * variation distance), inter-arrival and latency distributions (1 - KS
+ * distance) and mean queue depth (smaller over larger).
+ */
+static void
+replay_fidelity_report(const struct replay_stats *s, const struct bin_file_data *b, int entry_cnt, bool zns)
+{
+    struct fid_side cap, rep;
+    double tvd = 0, ks_gap, ks_lat, qd_sim, score;
+    double cap_iops, rep_iops;
+
+    if (s->timing == NULL || s->seq == 0) {
+        return;
+    }
+    if (fid_capture(&cap, b, entry_cnt, zns)) {
+        fprintf(stderr, "Fail to allocate memory for fidelity report\n");
+        return;
+    }
+    if (fid_replay(&rep, s, b, zns)) {
+        fprintf(stderr, "Fail to allocate memory for fidelity report\n");
+        fid_side_free(&cap);
+        return;
+    }
+
+    print_uline('=', printf("\nReplay fidelity\n"));
+    printf("%-24s %14s %14s %12s\n", "", "CAPTURE", "REPLAY", "DELTA");
+    cap_iops = cap.span > 0 ? cap.ios / cap.span * 1000 * 1000 : 0;
+    rep_iops = rep.span > 0 ? rep.ios / rep.span * 1000 * 1000 : 0;
+    fid_print_row("I/Os", 0, cap.ios, rep.ios);
+    fid_print_row("Duration (ms)", 3, cap.span / 1000, rep.span / 1000);
+    fid_print_row("IOPS", 3, cap_iops, rep_iops);
+    fid_print_row("Mean QD (Little)", 3, cap.mean_qd, rep.mean_qd);
+    fid_print_row("Peak QD", 0, cap.peak_qd, rep.peak_qd);
+    fid_print_row("Inter-arrival p50 (us)", 3, sorted_percentile(cap.gap, cap.ios - 1, 50),
+                  sorted_percentile(rep.gap, rep.ios - 1, 50));
+    fid_print_row("Inter-arrival p90 (us)", 3, sorted_percentile(cap.gap, cap.ios - 1, 90),
+                  sorted_percentile(rep.gap, rep.ios - 1, 90));
+    fid_print_row("Inter-arrival p99 (us)", 3, sorted_percentile(cap.gap, cap.ios - 1, 99),
+                  sorted_percentile(rep.gap, rep.ios - 1, 99));
+    fid_print_row("Latency p50 (us)", 3, sorted_percentile(cap.lat, cap.lat_cnt, 50),
+                  sorted_percentile(rep.lat, rep.lat_cnt, 50));
+    fid_print_row("Latency p90 (us)", 3, sorted_percentile(cap.lat, cap.lat_cnt, 90),
+                  sorted_percentile(rep.lat, rep.lat_cnt, 90));
+    fid_print_row("Latency p99 (us)", 3, sorted_percentile(cap.lat, cap.lat_cnt, 99),
+                  sorted_percentile(rep.lat, rep.lat_cnt, 99));
+    fid_print_row("Latency p99.9 (us)", 3, sorted_percentile(cap.lat, cap.lat_cnt, 99.9),
+                  sorted_percentile(rep.lat, rep.lat_cnt, 99.9));
+
+    printf("\n%-14s %-7s %10s %10s\n", "OPC", "SIZE", "CAPTURE(%)", "REPLAY(%)");
+    for (int c = 0; c <= REPLAY_OPC_CLASSES; c++) {
+        for (int k = 0; k < REPLAY_SIZE_BUCKETS; k++) {
+            double p = cap.ios ? (double)cap.mix[c][k] / cap.ios : 0;
+            double q = rep.ios ? (double)rep.mix[c][k] / rep.ios : 0;
+
+            tvd += fabs(p - q) / 2;
+            if (cap.mix[c][k] == 0 && rep.mix[c][k] == 0) {
+                continue;
+            }
+            printf("%-14s %-7s %10.3f %10.3f\n", c == REPLAY_OPC_CLASSES ? "not replayed" : g_replay_opc_name[c],
+                    c == REPLAY_OPC_ZONE_MGMT ? "-" : g_size_bucket_name[k],
+                    p * 100, q * 100);
+        }
+    }
+
+    ks_gap = ks_distance(cap.gap, cap.ios ? cap.ios - 1 : 0, rep.gap, rep.ios ? rep.ios - 1 : 0);
+    ks_lat = ks_distance(cap.lat, cap.lat_cnt, rep.lat, rep.lat_cnt);
+    qd_sim = spdk_max(cap.mean_qd, rep.mean_qd) > 0 ?
+             spdk_min(cap.mean_qd, rep.mean_qd) / spdk_max(cap.mean_qd, rep.mean_qd) : 1.0;
+    score = 100 * ((1 - tvd) + (1 - ks_gap) + qd_sim + (1 - ks_lat)) / 4;
+    printf("\nSimilarity: mix %.3f  inter-arrival %.3f  queue depth %.3f  latency %.3f\n",
+            1 - tvd, 1 - ks_gap, qd_sim, 1 - ks_lat);
+    printf("Fidelity score: %.1f / 100\n", score);
+
+    /* the replayer is the bottleneck when it issues slower and shallower than the capture */
+    if (rep_iops < cap_iops * 0.9 && rep.mean_qd < cap.mean_qd * 0.9) {
+        printf("Replay issued below the captured rate and queue depth: the replayer did not keep up\n");
+    } else if (sorted_percentile(rep.lat, rep.lat_cnt, 99) > sorted_percentile(cap.lat, cap.lat_cnt, 99) * 1.1) {
+        printf("Replay kept the captured load but latency is higher: the device is slower\n");
+    }
+
+    fid_side_free(&cap);
+    fid_side_free(&rep);
+}
+/* fidelity end */
+
+/* payload start */
+/*
+ * Data of the replayed writes. A pool of 4K blocks is generated once before the replay
+ * with the configured compressibility and share of duplicate blocks, and every write
+ * sends the next slice of it. Nothing is generated or copied per I/O, the pool repeats
+ * once it has been written through.
+ */
+#define PAYLOAD_BLOCK 4096
+#define PAYLOAD_SEGMENT 512     /* compressible unit: random bytes first, zeroes after */
+
+struct payload_pool {
+    char *buf;
+    uint64_t size;
+    uint64_t off;               /* next slice */
+};
+
+static struct payload_pool g_payload;
+static double g_payload_compress = 1.0; /* compression ratio x:1 */
+static uint32_t g_payload_dupe = 0;     /* percent of the blocks that repeat an earlier one */
+static uint64_t g_payload_mb = 64;
+
+/* xorshift64* */
+static inline uint64_t
+replay_rand(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Bytes the pool needs so the largest write of max_bytes fits twice */
+static uint64_t
+payload_pool_size(uint64_t max_bytes)
+{
+    return SPDK_ALIGN_CEIL(spdk_max(g_payload_mb * 1024 * 1024, 2 * max_bytes), PAYLOAD_BLOCK);
+}
+
+/* Generate the pool in g_payload.buf of g_payload.size bytes; the same seed every run */
+static void
+payload_fill(void)
+{
+    uint64_t rng = 0x9E3779B97F4A7C15ULL, blocks = g_payload.size / PAYLOAD_BLOCK;
+    uint32_t random_bytes = (uint32_t)(PAYLOAD_SEGMENT / g_payload_compress) & ~7U;
+
+    for (uint64_t i = 0; i < blocks; i++) {
+        char *blk = g_payload.buf + i * PAYLOAD_BLOCK;
+
+        if (i > 0 && replay_rand(&rng) % 100 < g_payload_dupe) {
+            memcpy(blk, g_payload.buf + replay_rand(&rng) % i * PAYLOAD_BLOCK, PAYLOAD_BLOCK);
+            continue;
+        }
+        for (uint32_t seg = 0; seg < PAYLOAD_BLOCK; seg += PAYLOAD_SEGMENT) {
+            uint64_t *w = (uint64_t *)(blk + seg);
+
+            for (uint32_t j = 0; j < random_bytes / 8; j++) {
+                w[j] = replay_rand(&rng);
+            }
+            memset(blk + seg + random_bytes, 0, PAYLOAD_SEGMENT - random_bytes);
+        }
+    }
+    g_payload.off = 0;
+    printf("Write payload: %ju MiB pool, %.2f:1 compressible, %u %% duplicate 4K blocks\n",
+           g_payload.size / (1024 * 1024), g_payload_compress, g_payload_dupe);
+}
+
+/* Data for a write of the given bytes; writes in flight may share the pool, it is never written to */
+static inline char *
+payload_get(uint64_t bytes)
+{
+    char *buf;
+
+    if (g_payload.off + bytes > g_payload.size) {
+        g_payload.off = 0;
+    }
+    buf = g_payload.buf + g_payload.off;
+    g_payload.off += SPDK_ALIGN_CEIL(bytes, PAYLOAD_BLOCK);
+    return buf;
+}
+/* payload end */
+
+/* kernel backend start */
+/*
+ * Replays through the kernel block layer instead of the SPDK NVMe driver, against a
+ * regular file or a block device such as /dev/nvme0n1: slba/nlb become byte offsets
+ * at g_kdev_sector_size. io_uring with registered buffers and file (SQPOLL optional)
+ * is preferred, libaio is the fallback when io_uring is missing or refused.
+ */
+#define KDEV_DEPTH 128
+#define KDEV_BUF_BUDGET (256ULL << 20)  /* cap of the data buffer pool */
+
+enum kdev_engine {
+    KDEV_ENGINE_URING,
+    KDEV_ENGINE_AIO,
+};
+
+enum kdev_op {
+    KDEV_OP_READ,
+    KDEV_OP_WRITE,
+    KDEV_OP_WRITE_ZEROES,
+};
+
+static const char *g_kdev_engine_name[] = {"io_uring", "libaio"};
+
+typedef void (*kdev_cb)(void *cb_arg, const struct spdk_nvme_cpl *cpl);
+
+/* A command the kernel backend has in flight */
+struct kdev_cmd {
+    kdev_cb cb;
+    void *cb_arg;
+    int res;
+    struct kdev_cmd *next;  /* free list, or completed without the engine */
+    struct iocb iocb;
+};
+
+struct kdev {
+    int fd;
+    bool blkdev;
+    bool direct;
+    uint32_t sector_size;
+    uint64_t size;          /* bytes, 0 if unknown */
+    enum kdev_engine engine;
+    /* data buffers, one slot per command in flight */
+    char *buf;
+    size_t buf_size;
+    uint32_t buf_cnt;
+    uint32_t *buf_free;
+    uint32_t buf_free_cnt;
+    struct kdev_cmd cmds[KDEV_DEPTH];
+    struct kdev_cmd *cmd_free;
+    struct kdev_cmd *done_head;
+    struct kdev_cmd *done_tail;
+    uint64_t errors;
+    bool ready;             /* engine set up */
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    bool fixed_file;
+    uint32_t fixed_bufs;    /* registered: 1 the pool, 2 the pool and the write payload */
+#endif
+    io_context_t aio_ctx;
+};
+
+static char g_kdev_path[256];
+static enum kdev_engine g_kdev_engine = KDEV_ENGINE_URING;
+static bool g_kdev_sqpoll = false;
+static uint32_t g_kdev_sector_size = 0;    /* 0: logical block size of the device, 512 for a file */
+
+static void *
+kdev_buf_get(struct kdev *k)
+{
+    if (k->buf_free_cnt == 0) {
+        return NULL;
+    }
+    return k->buf + (size_t)k->buf_free[--k->buf_free_cnt] * k->buf_size;
+}
+
+static void
+kdev_buf_put(struct kdev *k, void *buf)
+{
+    k->buf_free[k->buf_free_cnt++] = (uint32_t)(((char *)buf - k->buf) / k->buf_size);
+}
+
+#ifdef HAVE_LIBURING
+static int
+kdev_uring_init(struct kdev *k)
+{
+    struct io_uring_params p = {};
+    struct iovec iov[2] = {
+        {.iov_base = k->buf, .iov_len = k->buf_size * k->buf_cnt},
+        {.iov_base = g_payload.buf, .iov_len = g_payload.size},
+    };
+    int rc;
+
+    if (g_kdev_sqpoll) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = 1000;
+    }
+    rc = io_uring_queue_init_params(KDEV_DEPTH, &k->ring, &p);
+    if (rc < 0) {
+        return rc;
+    }
+    /* both are optimizations, replay still works without them */
+    k->fixed_file = io_uring_register_files(&k->ring, &k->fd, 1) == 0;
+    rc = io_uring_register_buffers(&k->ring, iov, g_payload.buf ? 2 : 1);
+    if (rc == 0) {
+        k->fixed_bufs = g_payload.buf ? 2 : 1;
+    } else if (g_payload.buf && io_uring_register_buffers(&k->ring, iov, 1) == 0) {
+        /* the payload is the larger one, writes from it go unregistered */
+        k->fixed_bufs = 1;
+    }
+    if (!k->fixed_bufs) {
+        printf("io_uring: buffers not registered (%s), check RLIMIT_MEMLOCK\n", spdk_strerror(-rc));
+    }
+    return 0;
+}
+
+static int
+kdev_uring_submit(struct kdev *k, struct kdev_cmd *cmd, enum kdev_op op, void *buf,
+                  uint64_t offset, uint64_t len)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&k->ring);
+    int fd = k->fixed_file ? 0 : k->fd;
+    int rc;
+
+    if (sqe == NULL) {
+        return -EAGAIN;
+    }
+    switch (op) {
+    case KDEV_OP_READ:
+        if (k->fixed_bufs) {
+            io_uring_prep_read_fixed(sqe, fd, buf, (unsigned)len, offset, 0);
+        } else {
+            io_uring_prep_read(sqe, fd, buf, (unsigned)len, offset);
+        }
+        break;
+    case KDEV_OP_WRITE:
+        if ((char *)buf >= g_payload.buf && (char *)buf < g_payload.buf + g_payload.size) {
+            if (k->fixed_bufs == 2) {
+                io_uring_prep_write_fixed(sqe, fd, buf, (unsigned)len, offset, 1);
+            } else {
+                io_uring_prep_write(sqe, fd, buf, (unsigned)len, offset);
+            }
+        } else if (k->fixed_bufs) {
+            io_uring_prep_write_fixed(sqe, fd, buf, (unsigned)len, offset, 0);
+        } else {
+            io_uring_prep_write(sqe, fd, buf, (unsigned)len, offset);
+        }
+        break;
+    case KDEV_OP_WRITE_ZEROES:
+        io_uring_prep_fallocate(sqe, fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, offset, len);
+        break;
+    }
+    if (k->fixed_file) {
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    }
+    io_uring_sqe_set_data(sqe, cmd);
+    rc = io_uring_submit(&k->ring);
+    return rc < 0 ? rc : 0;
+}
+#endif
+
+static int
+kdev_aio_submit(struct kdev *k, struct kdev_cmd *cmd, enum kdev_op op, void *buf,
+                uint64_t offset, uint64_t len)
+{
+    struct iocb *iocb = &cmd->iocb;
+    int rc;
+
+    switch (op) {
+    case KDEV_OP_READ:
+        io_prep_pread(iocb, k->fd, buf, len, (long long)offset);
+        break;
+    case KDEV_OP_WRITE:
+        io_prep_pwrite(iocb, k->fd, buf, len, (long long)offset);
+        break;
+    case KDEV_OP_WRITE_ZEROES:
+        /* libaio has no fallocate; run it inline and complete it on the next poll */
+        rc = fallocate(k->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)len);
+        cmd->res = rc ? -errno : 0;
+        cmd->next = NULL;
+        if (k->done_tail) {
+            k->done_tail->next = cmd;
+        } else {
+            k->done_head = cmd;
+        }
+        k->done_tail = cmd;
+        return 0;
+    }
+    iocb->data = cmd;
+    rc = io_submit(k->aio_ctx, 1, &iocb);
+    return rc == 1 ? 0 : (rc < 0 ? rc : -EAGAIN);
+}
+
+/* Queue one command; cb runs from kdev_process_completions() like an NVMe completion */
+static int
+kdev_submit(struct kdev *k, enum kdev_op op, void *buf, uint64_t slba, uint32_t nlb,
+            kdev_cb cb, void *cb_arg)
+{
+    struct kdev_cmd *cmd = k->cmd_free;
+    uint64_t offset = slba * k->sector_size, len = (uint64_t)nlb * k->sector_size;
+    int rc;
+
+    if (cmd == NULL) {
+        return -EAGAIN;
+    }
+    cmd->cb = cb;
+    cmd->cb_arg = cb_arg;
+#ifdef HAVE_LIBURING
+    if (k->engine == KDEV_ENGINE_URING) {
+        rc = kdev_uring_submit(k, cmd, op, buf, offset, len);
+    } else {
+        rc = kdev_aio_submit(k, cmd, op, buf, offset, len);
+    }
+#else
+    rc = kdev_aio_submit(k, cmd, op, buf, offset, len);
+#endif
+    if (rc == 0) {
+        k->cmd_free = cmd->next;
+    }
+    return rc;
+}
+
+static void
+kdev_complete(struct kdev *k, struct kdev_cmd *cmd, int res)
+{
+    struct spdk_nvme_cpl cpl = {};
+
+    if (res < 0) {
+        cpl.status.sct = SPDK_NVME_SCT_GENERIC;
+        switch (res) {
+        case -EINVAL:
+        case -ENOSPC:
+        case -ENXIO:
+            cpl.status.sc = SPDK_NVME_SC_LBA_OUT_OF_RANGE;
+            break;
+        case -EOPNOTSUPP:
+            cpl.status.sc = SPDK_NVME_SC_INVALID_OPCODE;
+            break;
+        default:
+            cpl.status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
+        }
+        if (k->errors++ == 0) {
+            fprintf(stderr, "%s: %s\n", g_kdev_path, spdk_strerror(-res));
+        }
+    }
+    cmd->next = k->cmd_free;
+    k->cmd_free = cmd;
+    cmd->cb(cmd->cb_arg, &cpl);
+}
+
+static int
+kdev_process_completions(struct kdev *k)
+{
+    struct kdev_cmd *cmd;
+    int n = 0;
+
+    while ((cmd = k->done_head) != NULL) {
+        k->done_head = cmd->next;
+        if (k->done_head == NULL) {
+            k->done_tail = NULL;
+        }
+        kdev_complete(k, cmd, cmd->res);
+        n++;
+    }
+#ifdef HAVE_LIBURING
+    if (k->engine == KDEV_ENGINE_URING) {
+        struct io_uring_cqe *cqe;
+
+        while (io_uring_peek_cqe(&k->ring, &cqe) == 0) {
+            cmd = (struct kdev_cmd *)io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+
+            io_uring_cqe_seen(&k->ring, cqe);
+            kdev_complete(k, cmd, res);
+            n++;
+        }
+        return n;
+    }
+#endif
+    struct io_event events[KDEV_DEPTH];
+    struct timespec timeout = {};
+    int cnt = io_getevents(k->aio_ctx, 0, KDEV_DEPTH, events, &timeout);
+
+    for (int i = 0; i < cnt; i++) {
+        kdev_complete(k, (struct kdev_cmd *)events[i].data, (int)(long)events[i].res);
+        n++;
+    }
+    return n;
+}
+
+static void
+kdev_close(struct kdev *k)
+{
+    if (k->ready) {
+#ifdef HAVE_LIBURING
+        if (k->engine == KDEV_ENGINE_URING) {
+            io_uring_queue_exit(&k->ring);
+        }
+#endif
+        if (k->engine == KDEV_ENGINE_AIO) {
+            io_destroy(k->aio_ctx);
+        }
+        k->ready = false;
+    }
+    if (k->fd >= 0) {
+        close(k->fd);
+    }
+    free(k->buf);
+    free(k->buf_free);
+    k->buf = NULL;
+    k->buf_free = NULL;
+    k->fd = -1;
+}
+
+/* Open the target and size the buffer pool for the largest transfer of max_nlb blocks */
+static int
+kdev_open(struct kdev *k, const char *path, uint64_t max_nlb)
+{
+    struct stat st;
+    uint64_t pool;
+    uint32_t lbs;
+    int rc;
+
+    memset(k, 0, sizeof(*k));
+    k->fd = open(path, O_RDWR | O_DIRECT);
+    k->direct = k->fd >= 0;
+    if (k->fd < 0 && errno == EINVAL) {
+        /* e.g. tmpfs; the page cache will be in the measurements */
+        k->fd = open(path, O_RDWR);
+    }
+    if (k->fd < 0) {
+        rc = -errno;
+        fprintf(stderr, "Failed to open %s: %s\n", path, spdk_strerror(-rc));
+        return rc;
+    }
+    if (fstat(k->fd, &st) != 0) {
+        rc = -errno;
+        fprintf(stderr, "Failed to stat %s: %s\n", path, spdk_strerror(-rc));
+        goto err;
+    }
+    k->blkdev = S_ISBLK(st.st_mode);
+    if (!k->blkdev && !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "%s is neither a regular file nor a block device\n", path);
+        rc = -EINVAL;
+        goto err;
+    }
+    k->size = spdk_fd_get_size(k->fd);
+    lbs = k->blkdev ? spdk_fd_get_blocklen(k->fd) : 0;
+    k->sector_size = g_kdev_sector_size ? g_kdev_sector_size : (lbs ? lbs : 512);
+    if (k->sector_size < lbs) {
+        fprintf(stderr, "Sector size %u is below the logical block size %u of %s\n",
+                k->sector_size, lbs, path);
+        rc = -EINVAL;
+        goto err;
+    }
+
+    k->buf_size = SPDK_ALIGN_CEIL(spdk_max(max_nlb, 1ULL) * k->sector_size, 4096);
+    pool = spdk_max(KDEV_BUF_BUDGET / k->buf_size, 1ULL);
+    k->buf_cnt = (uint32_t)spdk_min(pool, (uint64_t)KDEV_DEPTH);
+    k->buf_free = (uint32_t *)calloc(k->buf_cnt, sizeof(uint32_t));
+    if (k->buf_free == NULL || posix_memalign((void **)&k->buf, 4096, k->buf_size * k->buf_cnt) != 0) {
+        fprintf(stderr, "Fail to allocate memory for kernel replay buffers\n");
+        k->buf = NULL;
+        rc = -ENOMEM;
+        goto err;
+    }
+    memset(k->buf, 0, k->buf_size * k->buf_cnt);
+    for (uint32_t i = 0; i < k->buf_cnt; i++) {
+        k->buf_free[k->buf_free_cnt++] = k->buf_cnt - 1 - i;
+    }
+    for (int i = KDEV_DEPTH - 1; i >= 0; i--) {
+        k->cmds[i].next = k->cmd_free;
+        k->cmd_free = &k->cmds[i];
+    }
+
+    k->engine = g_kdev_engine;
+#ifdef HAVE_LIBURING
+    if (k->engine == KDEV_ENGINE_URING) {
+        rc = kdev_uring_init(k);
+        if (rc < 0) {
+            printf("io_uring unavailable (%s), falling back to libaio\n", spdk_strerror(-rc));
+            k->engine = KDEV_ENGINE_AIO;
+        }
+    }
+#else
+    if (k->engine == KDEV_ENGINE_URING) {
+        printf("Built without liburing, falling back to libaio\n");
+        k->engine = KDEV_ENGINE_AIO;
+    }
+#endif
+    if (k->engine == KDEV_ENGINE_AIO) {
+        rc = io_setup(KDEV_DEPTH, &k->aio_ctx);
+        if (rc < 0) {
+            fprintf(stderr, "io_setup() failed: %s\n", spdk_strerror(-rc));
+            goto err;
+        }
+    }
+    k->ready = true;
+
+    printf("Replaying to %s: %s, %s, sector size %u, %s I/O", path,
+           k->blkdev ? "block device" : "file", g_kdev_engine_name[k->engine], k->sector_size,
+           k->direct ? "direct" : "buffered");
+#ifdef HAVE_LIBURING
+    if (k->engine == KDEV_ENGINE_URING) {
+        printf("%s%s%s", k->fixed_bufs == 2 ? ", registered buffers and payload" :
+               k->fixed_bufs ? ", registered buffers" : "",
+               k->fixed_file ? ", registered file" : "", g_kdev_sqpoll ? ", SQPOLL" : "");
+    }
+#endif
+    printf("\n");
+    return 0;
+
+err:
+    kdev_close(k);
+    return rc;
+}
+/* kernel backend end */
+
+/* replay engine start */
+/*
+ * Drives the replay for every backend. Each stream walks the whole capture with at most
+ * one command in flight, ZNS zone appends aside (REPLAY_ASYNC), so one stream is the
+ * plain QD1 replay and -c N runs N copies concurrently, each shifted to its own LBA
+ * range. Submissions are paced by token buckets on IOPS and MB/s checked against
+ * spdk_get_ticks().
+ *
+ * A stream starts over at the end of the capture until the loop count or the duration
+ * is reached, moving its LBAs on by the loop shift each time. What completes during the
+ * warm-up, fixed or until steady state is detected, is left out of the report.
+ */
+#define REPLAY_MAX_COPIES 128
+#define REPLAY_SKIP 1   /* a backend submit function did not replay the record */
+#define REPLAY_ASYNC 2  /* in flight without holding the stream, counted in s->async */
+#define REPLAY_PREP 3   /* sent a command the record needs first on s->io, retry it after that */
+#define REPLAY_BUSY 4   /* the record cannot go out yet, retry it on a later step */
+#define REPLAY_STEADY_WINDOWS 5
+
+/* Token bucket; the balance may go negative so an I/O larger than the burst still goes out */
+struct token_bucket {
+    double rate;        /* tokens per tick, 0 when unlimited */
+    double burst;
+    double tokens;
+    uint64_t last_tsc;
+};
+
+struct replay_engine;
+
+/* One copy of the capture being replayed */
+struct replay_stream {
+    struct replay_io io;
+    struct replay_engine *engine;
+    int next;               /* next record to look at */
+    uint64_t shift;         /* blocks added to every LBA of this copy */
+    uint64_t loop;          /* passes over the capture done */
+    char *buf;              /* read data */
+    char *wbuf;             /* write data of the command in flight, a slice of the payload */
+    bool done;
+    uint32_t async;         /* REPLAY_ASYNC commands in flight */
+    /* preconditioning: the write this slot generated and, zoned, the zone it fills */
+    struct bin_file_data rec;
+    uint64_t zslba;
+    uint64_t zone_fill;
+    /* ZNS mode: pieces of a read split where its blocks were appended, and their status */
+    uint32_t parts;
+    struct spdk_nvme_cpl part_cpl;
+    /* bdev mode: the NVME_DSM_RANGE records of the DSM in flight, one unmap each */
+    struct spdk_bdev_io_wait_entry wait;
+    int ranges[SPDK_DATASET_MANAGEMENT_MAX_RANGES];
+    uint32_t range_cnt;
+    uint32_t range_idx;
+    bool range_failed;
+};
+
+/* Send d for stream s: 0 once it is in flight on s->io, REPLAY_* or a negative errno */
+typedef int (*replay_submit_fn)(void *dev, struct replay_stream *s, const struct bin_file_data *d);
+
+/* IOPS and mean latency of one steady state window */
+struct replay_window {
+    double iops;
+    double lat;
+};
+
+struct replay_engine {
+    struct bin_file_data *b;
+    int entry_cnt;
+    bool zns;
+    uint64_t num_blocks;
+    uint64_t loop_shift;
+    struct replay_stats *stats;
+    struct replay_stream *streams;
+    uint32_t stream_cnt;
+    struct token_bucket iops;
+    struct token_bucket bw;
+    replay_submit_fn submit;
+    void *dev;
+    int rc;
+    /* phases, in ticks from start_tsc */
+    uint64_t start_tsc;
+    uint64_t end_tsc;       /* 0: no duration */
+    uint64_t warmup_tsc;    /* fixed warm-up end, 0: none */
+    bool warm;              /* warm-up over, the stats are measured */
+    /* steady state detection */
+    uint64_t window_tsc;    /* current window start */
+    uint64_t window_done;
+    uint64_t window_lat;
+    struct replay_window windows[REPLAY_STEADY_WINDOWS];
+    uint32_t window_cnt;
+};
+
+static uint64_t g_rate_iops = 0;
+static uint64_t g_rate_mbps = 0;        /* 10^6 bytes per second */
+static uint32_t g_copies = 1;
+static uint64_t g_copy_shift = 0;       /* blocks between copies, 0: spread them over the namespace */
+static uint64_t g_loops = 1;            /* passes over the capture, 0: until the duration is up */
+static uint64_t g_duration_sec = 0;
+static uint64_t g_loop_shift = 0;       /* blocks every stream moves on by per pass */
+static uint64_t g_warmup_sec = 0;
+static bool g_steady_state = false;     /* the warm-up lasts until steady state */
+static uint64_t g_window_ms = 1000;
+static double g_steady_tolerance = 0.05; /* max coefficient of variation over the windows */
+
+static void
+token_bucket_init(struct token_bucket *tb, uint64_t per_sec, uint64_t tsc_rate)
+{
+    tb->rate = (double)per_sec / tsc_rate;
+    /* 1 ms worth of tokens, so pacing stays smooth at any rate */
+    tb->burst = spdk_max((double)per_sec / 1000, 1.0);
+    tb->tokens = tb->burst;
+    tb->last_tsc = spdk_get_ticks();
+}
+
+static inline bool
+token_bucket_ready(struct token_bucket *tb, uint64_t now)
+{
+    if (tb->rate == 0) {
+        return true;
+    }
+    tb->tokens = spdk_min(tb->burst, tb->tokens + (double)(now - tb->last_tsc) * tb->rate);
+    tb->last_tsc = now;
+    return tb->tokens >= 0;
+}
+
+static inline void
+token_bucket_take(struct token_bucket *tb, double n)
+{
+    if (tb->rate != 0) {
+        tb->tokens -= n;
+    }
+}
+
+/* LBA of a record in stream s, wrapped to stay on the namespace */
+static inline uint64_t
+replay_stream_lba(const struct replay_stream *s, uint64_t slba, uint32_t nlb)
+{
+    uint64_t lba, n = s->engine->num_blocks;
+
+    if (n == 0) {
+        return slba + s->shift;
+    }
+    lba = (slba + s->shift) % n;
+    return lba + nlb > n ? n - spdk_min((uint64_t)nlb, n) : lba;
+}
+
+static void
+replay_engine_free(struct replay_engine *e)
+{
+    free(e->streams);
+    e->streams = NULL;
+}
+
+/*
+ * Set up g_copies streams over the capture; zone_size (blocks) keeps the copy shift zone
+ * aligned on a zoned namespace. The caller gives each stream its data buffer.
+ */
+static int
+replay_engine_init(struct replay_engine *e, struct bin_file_data *b, int entry_cnt, bool zns,
+                   uint64_t num_blocks, uint64_t zone_size, struct replay_stats *stats,
+                   replay_submit_fn submit, void *dev)
+{
+    uint64_t shift = g_copy_shift, align = zone_size ? zone_size : spdk_max(4096 / g_block_size, 1U);
+
+    memset(e, 0, sizeof(*e));
+    e->b = b;
+    e->entry_cnt = entry_cnt;
+    e->zns = zns;
+    e->num_blocks = num_blocks;
+    e->stats = stats;
+    e->submit = submit;
+    e->dev = dev;
+    e->stream_cnt = g_copies;
+    e->streams = (struct replay_stream *)calloc(e->stream_cnt, sizeof(struct replay_stream));
+    if (e->streams == NULL) {
+        fprintf(stderr, "Fail to allocate memory for replay streams\n");
+        return -ENOMEM;
+    }
+    if (shift == 0 && e->stream_cnt > 1 && num_blocks != 0) {
+        shift = num_blocks / e->stream_cnt;
+    } else if (shift == 0 && e->stream_cnt > 1) {
+        /* no end to wrap at (a file): lay the copies out one after the other */
+        for (int i = 0; i < entry_cnt; i++) {
+            if (strcmp(b[i].tpoint_name, "NVME_IO_SUBMIT") == 0) {
+                shift = spdk_max(shift, ((uint64_t)b[i].cdw10 | ((uint64_t)b[i].cdw11 & UINT32BIT_MASK) << 32) +
+                                 (b[i].cdw12 & UINT16BIT_MASK) + 1);
+            }
+        }
+        shift += align - 1;
+    }
+    shift = shift / align * align;
+    e->loop_shift = g_loop_shift / align * align;
+    for (uint32_t i = 0; i < e->stream_cnt; i++) {
+        e->streams[i].engine = e;
+        e->streams[i].shift = shift * i;
+    }
+    token_bucket_init(&e->iops, g_rate_iops, spdk_get_ticks_hz());
+    token_bucket_init(&e->bw, g_rate_mbps * 1000 * 1000, spdk_get_ticks_hz());
+    if (e->stream_cnt > 1 || g_rate_iops || g_rate_mbps) {
+        printf("Replay: %u cop%s", e->stream_cnt, e->stream_cnt > 1 ? "ies" : "y");
+        if (e->stream_cnt > 1) {
+            printf(" %ju blocks apart", shift);
+        }
+        if (g_rate_iops) {
+            printf(", at most %ju IOPS", g_rate_iops);
+        }
+        if (g_rate_mbps) {
+            printf(", at most %ju MB/s", g_rate_mbps);
+        }
+        printf("\n");
+    }
+    if (g_loops != 1 || g_duration_sec) {
+        if (g_loops == 0) {
+            printf("Replay: looping the trace");
+        } else {
+            printf("Replay: %ju pass%s", g_loops, g_loops == 1 ? "" : "es");
+        }
+        if (g_duration_sec) {
+            printf(", at most %ju s", g_duration_sec);
+        }
+        if (e->loop_shift) {
+            printf(", %ju blocks further every pass", e->loop_shift);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+/* Everything from here on is measured */
+static void
+replay_engine_warm(struct replay_engine *e, uint64_t now)
+{
+    e->warm = true;
+    replay_stats_reset(e->stats);
+    printf("Warm-up done after %.3f s, measuring from here\n",
+           (double)(now - e->start_tsc) / spdk_get_ticks_hz());
+}
+
+static void
+window_cv(const struct replay_window *w, uint32_t cnt, double *iops_cv, double *lat_cv)
+{
+    double iops = 0, lat = 0, iops_var = 0, lat_var = 0;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        iops += w[i].iops / cnt;
+        lat += w[i].lat / cnt;
+    }
+    for (uint32_t i = 0; i < cnt; i++) {
+        iops_var += (w[i].iops - iops) * (w[i].iops - iops) / cnt;
+        lat_var += (w[i].lat - lat) * (w[i].lat - lat) / cnt;
+    }
+    *iops_cv = iops > 0 ? sqrt(iops_var) / iops : 0;
+    *lat_cv = lat > 0 ? sqrt(lat_var) / lat : 0;
+}
+
+/*
+ * Close a window: steady state is reached once the IOPS and the mean latency of the last
+ * REPLAY_STEADY_WINDOWS windows both vary by at most the tolerance around their mean.
+ */
+static bool
+replay_engine_window(struct replay_engine *e, uint64_t now, double *iops_cv, double *lat_cv)
+{
+    struct replay_window *w = &e->windows[e->window_cnt++ % REPLAY_STEADY_WINDOWS];
+    uint64_t done = e->stats->done - e->window_done;
+
+    w->iops = (double)done * spdk_get_ticks_hz() / (now - e->window_tsc);
+    w->lat = done ? (double)(e->stats->done_lat - e->window_lat) / done : 0;
+    e->window_tsc = now;
+    e->window_done = e->stats->done;
+    e->window_lat = e->stats->done_lat;
+    if (e->window_cnt < REPLAY_STEADY_WINDOWS) {
+        return false;
+    }
+    window_cv(e->windows, REPLAY_STEADY_WINDOWS, iops_cv, lat_cv);
+    return *iops_cv <= g_steady_tolerance && *lat_cv <= g_steady_tolerance;
+}
+
+/* Phase changes due at now: warm-up end, steady state window, end of the duration */
+static void
+replay_engine_clock(struct replay_engine *e, uint64_t now)
+{
+    uint64_t hz = spdk_get_ticks_hz();
+
+    if (e->start_tsc == 0) {
+        e->start_tsc = now;
+        e->window_tsc = now;
+        e->end_tsc = g_duration_sec ? now + g_duration_sec * hz : 0;
+        e->warmup_tsc = g_warmup_sec ? now + g_warmup_sec * hz : 0;
+        e->warm = !g_warmup_sec && !g_steady_state;
+        return;
+    }
+    if (!e->warm && e->warmup_tsc && now >= e->warmup_tsc) {
+        replay_engine_warm(e, now);
+    }
+    if (g_steady_state && now - e->window_tsc >= g_window_ms * hz / 1000) {
+        double iops_cv, lat_cv;
+
+        if (replay_engine_window(e, now, &iops_cv, &lat_cv) && !e->warm) {
+            printf("Steady state: IOPS varies by %.1f %% and latency by %.1f %% over the last %u windows\n",
+                   iops_cv * 100, lat_cv * 100, REPLAY_STEADY_WINDOWS);
+            replay_engine_warm(e, now);
+        }
+    }
+}
+
+/* The end of the capture: start stream s over unless the loops or the time are up */
+static bool
+replay_stream_rewind(struct replay_stream *s, uint64_t now)
+{
+    struct replay_engine *e = s->engine;
+
+    if (++s->loop == g_loops || (e->end_tsc && now >= e->end_tsc)) {
+        return false;
+    }
+    s->next = 0;
+    s->shift += e->loop_shift;
+    return true;
+}
+
+/*
+ * Submit the next record of every idle stream, as far as the rate limits allow.
+ * Returns false once every stream has finished and nothing is in flight.
+ */
+static bool
+replay_engine_step(struct replay_engine *e)
+{
+    uint64_t now = spdk_get_ticks();
+    bool running = false;
+
+    replay_engine_clock(e, now);
+    for (uint32_t i = 0; i < e->stream_cnt; i++) {
+        struct replay_stream *s = &e->streams[i];
+
+        while (!s->done && !s->io.inflight) {
+            const struct bin_file_data *d;
+            int rc;
+
+            if (e->rc != 0 || (e->end_tsc && now >= e->end_tsc) ||
+                (s->next >= e->entry_cnt && !replay_stream_rewind(s, now))) {
+                s->done = true;
+                break;
+            }
+            d = &e->b[s->next];
+            if (strcmp(d->tpoint_name, "NVME_IO_SUBMIT") != 0) {
+                s->next++;
+                continue;
+            }
+            if (!token_bucket_ready(&e->iops, now) || !token_bucket_ready(&e->bw, now)) {
+                break;
+            }
+            rc = e->submit(e->dev, s, d);
+            if (rc < 0) {
+                fprintf(stderr, "Replay failed: %s\n", spdk_strerror(-rc));
+                /* no completion follows a command that was not submitted */
+                s->io.inflight = false;
+                e->rc = rc;
+                continue;
+            }
+            if (rc == REPLAY_PREP) {
+                continue;
+            }
+            if (rc == REPLAY_BUSY) {
+                break;
+            }
+            s->next++;
+            if (rc == 0) {
+                token_bucket_take(&e->iops, 1);
+                token_bucket_take(&e->bw, (double)s->io.bytes);
+            } else if (rc == REPLAY_ASYNC) {
+                token_bucket_take(&e->iops, 1);
+                token_bucket_take(&e->bw, (double)((d->cdw12 & UINT16BIT_MASK) + 1) * g_block_size);
+            }
+        }
+        running |= !s->done || s->io.inflight || s->async;
+    }
+    if (!running && !e->warm) {
+        printf("%s not reached, the report covers the whole replay\n",
+               g_steady_state ? "Steady state" : "End of the warm-up");
+    }
+    return running;
+}
+/* replay engine end */
+
+/* precondition start */
+/*
+ * Brings the target to a known, written state before the replay. Every queue slot is an
+ * engine stream sending generated writes through the submit function of the replay:
+ *  seq      write the whole namespace once, sequentially
+ *  rand     seq, then random 4K overwrites of -R times the capacity; once the capacity
+ *           was overwritten once, steady state ends it early
+ *  capture  write every block the capture reads or writes, in every copy
+ * A zoned namespace gets every zone filled, one zone per slot, and is left full for the
+ * replay to reset zone by zone as it appends; a zoned bdev is not preconditioned.
+ */
+enum precond_mode {
+    PRECOND_NONE,
+    PRECOND_SEQ,
+    PRECOND_RAND,
+    PRECOND_CAPTURE,
+};
+
+enum precond_phase {
+    PRECOND_PHASE_FILL,
+    PRECOND_PHASE_RAND,
+};
+
+#define PRECOND_CHUNK_BYTES (128 * 1024)
+
+static const char *g_precond_phase_name[] = {"fill", "random overwrite"};
+
+struct precond_extent {
+    uint64_t slba;
+    uint64_t nlb;
+};
+
+struct precond {
+    struct replay_engine e;         /* one stream per queue slot */
+    struct replay_stats stats;
+    enum precond_phase phase;
+    uint64_t num_blocks;
+    uint64_t zone_size;             /* 0: not zoned */
+    const uint64_t *zone_cap;       /* writable blocks per zone, NULL: the zone size */
+    uint64_t chunk;                 /* blocks per fill write */
+    uint64_t align;                 /* blocks per random write */
+    uint64_t lba;                   /* fill: next block or zone, capture: offset in the extent */
+    struct precond_extent *ext;     /* capture fill */
+    uint64_t ext_cnt;
+    uint64_t ext_idx;
+    uint64_t total;                 /* blocks the phase writes */
+    uint64_t written;
+    uint64_t window_written;
+    uint64_t rng;
+    uint64_t start_tsc;
+    FILE *io_log;                   /* held back, the preconditioning is not logged */
+};
+
+static enum precond_mode g_precond_mode = PRECOND_NONE;
+static uint64_t g_precond_passes = 2;
+static uint32_t g_precond_qd = 32;
+
+static int
+precond_extent_cmp(const void *a, const void *b)
+{
+    const struct precond_extent *x = (const struct precond_extent *)a;
+    const struct precond_extent *y = (const struct precond_extent *)b;
+
+    return x->slba < y->slba ? -1 : x->slba > y->slba;
+}
+
+/* Every block the capture reads or writes, in every copy of the replay, as sorted extents */
+static int
+precond_capture_extents(struct precond *p, const struct replay_engine *replay)
+{
+    const struct bin_file_data *b = replay->b;
+    uint64_t cnt = 0, n = 0;
+
+    for (int i = 0; i < replay->entry_cnt; i++) {
+        cnt += strcmp(b[i].tpoint_name, "NVME_IO_SUBMIT") == 0 &&
+               replay_opc_class(&b[i], false) <= REPLAY_OPC_WRITE;
+    }
+    p->ext = (struct precond_extent *)calloc(spdk_max(cnt * replay->stream_cnt, 1), sizeof(struct precond_extent));
+    if (p->ext == NULL) {
+        fprintf(stderr, "Fail to allocate memory for precondition extents\n");
+        return -ENOMEM;
+    }
+    for (uint32_t c = 0; c < replay->stream_cnt; c++) {
+        for (int i = 0; i < replay->entry_cnt; i++) {
+            uint32_t nlb = (uint32_t)(b[i].cdw12 & UINT16BIT_MASK) + 1;
+
+            if (strcmp(b[i].tpoint_name, "NVME_IO_SUBMIT") != 0 || replay_opc_class(&b[i], false) > REPLAY_OPC_WRITE) {
+                continue;
+            }
+            p->ext[n].slba = replay_stream_lba(&replay->streams[c],
+                                               (uint64_t)b[i].cdw10 | ((uint64_t)b[i].cdw11 & UINT32BIT_MASK) << 32, nlb);
+            p->ext[n++].nlb = nlb;
+        }
+    }
+    qsort(p->ext, n, sizeof(struct precond_extent), precond_extent_cmp);
+    /* merge what overlaps or touches */
+    for (uint64_t i = 0; i < n; i++) {
+        struct precond_extent *last = p->ext_cnt ? &p->ext[p->ext_cnt - 1] : NULL;
+
+        if (last && p->ext[i].slba <= last->slba + last->nlb) {
+            last->nlb = spdk_max(last->slba + last->nlb, p->ext[i].slba + p->ext[i].nlb) - last->slba;
+        } else {
+            p->ext[p->ext_cnt++] = p->ext[i];
+        }
+    }
+    return 0;
+}
+
+static void
+precond_phase(struct precond *p, enum precond_phase phase, uint64_t now)
+{
+    struct replay_engine *e = &p->e;
+
+    p->phase = phase;
+    p->lba = 0;
+    p->ext_idx = 0;
+    p->written = 0;
+    p->window_written = 0;
+    if (phase == PRECOND_PHASE_RAND) {
+        p->total = g_precond_passes * (p->num_blocks / p->align * p->align);
+    } else if (p->ext) {
+        p->total = 0;
+        for (uint64_t i = 0; i < p->ext_cnt; i++) {
+            p->total += p->ext[i].nlb;
+        }
+    } else if (p->zone_cap) {
+        p->total = 0;
+        for (uint64_t i = 0; i < p->num_blocks / p->zone_size; i++) {
+            p->total += p->zone_cap[i];
+        }
+    } else {
+        p->total = p->num_blocks;
+    }
+    e->window_tsc = now;
+    e->window_cnt = 0;
+    e->window_done = p->stats.done;
+    e->window_lat = p->stats.done_lat;
+    for (uint32_t i = 0; i < e->stream_cnt; i++) {
+        e->streams[i].done = false;
+    }
+    printf("Precondition %s: %ju MB at QD %u\n", g_precond_phase_name[phase],
+           p->total * g_block_size / (1000 * 1000), e->stream_cnt);
+}
+
+/*
+ * Set up the preconditioning of num_blocks blocks (zone_size: zoned, each zone filled up to
+ * zone_cap when given) with qd slots sending writes of up to chunk blocks through submit.
+ * The data comes from the write payload, the slots need no buffer of their own.
+ */
+static int
+precond_init(struct precond *p, const struct replay_engine *replay, replay_submit_fn submit, void *dev,
+             uint64_t num_blocks, uint64_t zone_size, const uint64_t *zone_cap, uint64_t chunk, uint32_t qd)
+{
+    struct replay_engine *e = &p->e;
+    int rc;
+
+    memset(p, 0, sizeof(*p));
+    if (replay_stats_init(&p->stats) != 0) {
+        fprintf(stderr, "Fail to allocate memory for precondition stats\n");
+        return -ENOMEM;
+    }
+    p->num_blocks = num_blocks;
+    p->zone_size = zone_size;
+    p->zone_cap = zone_size ? zone_cap : NULL;
+    p->chunk = spdk_max(chunk, 1);
+    p->align = spdk_max(4096 / g_block_size, 1U);
+    p->rng = spdk_get_ticks() | 1;
+    e->b = replay->b;
+    e->entry_cnt = replay->entry_cnt;
+    e->zns = replay->zns;
+    e->num_blocks = replay->num_blocks;
+    e->stats = &p->stats;
+    e->submit = submit;
+    e->dev = dev;
+    e->warm = true;
+    e->stream_cnt = spdk_max(qd, 1U);
+    e->streams = (struct replay_stream *)calloc(e->stream_cnt, sizeof(struct replay_stream));
+    if (e->streams == NULL) {
+        fprintf(stderr, "Fail to allocate memory for precondition slots\n");
+        replay_stats_free(&p->stats);
+        return -ENOMEM;
+    }
+    for (uint32_t i = 0; i < e->stream_cnt; i++) {
+        e->streams[i].engine = e;
+    }
+
+    if (zone_size && g_precond_mode != PRECOND_SEQ) {
+        printf("Precondition: a zoned target is only filled, zone by zone\n");
+    }
+    if (g_precond_mode == PRECOND_CAPTURE && zone_size == 0) {
+        rc = precond_capture_extents(p, replay);
+    } else if (num_blocks < p->align) {
+        fprintf(stderr, "Precondition: the size of the target is unknown\n");
+        rc = -EINVAL;
+    } else {
+        rc = 0;
+    }
+    if (rc != 0) {
+        free(p->ext);
+        replay_engine_free(e);
+        replay_stats_free(&p->stats);
+        return rc;
+    }
+    p->io_log = g_io_log;
+    g_io_log = NULL;
+    p->start_tsc = spdk_get_ticks();
+    precond_phase(p, PRECOND_PHASE_FILL, p->start_tsc);
+    return 0;
+}
+
+static inline uint64_t
+precond_zone_cap(const struct precond *p, uint64_t zslba)
+{
+    return p->zone_cap ? p->zone_cap[zslba / p->zone_size] : p->zone_size;
+}
+
+/* Next write of slot s in the current phase, false once the slot has nothing left */
+static bool
+precond_next(struct precond *p, struct replay_stream *s)
+{
+    uint64_t slba, nlb;
+
+    if (p->zone_size) {
+        /* a zone is filled up to its capacity, one whose append failed is left as it is */
+        if (s->zone_fill == 0 || s->zone_fill >= precond_zone_cap(p, s->zslba) || s->io.failed) {
+            s->io.failed = false;
+            do {
+                if (p->lba >= p->num_blocks) {
+                    return false;
+                }
+                s->zslba = p->lba;
+                p->lba += p->zone_size;
+            } while (precond_zone_cap(p, s->zslba) == 0);
+            s->zone_fill = 0;
+        }
+        slba = s->zslba;
+        nlb = spdk_min(p->chunk, precond_zone_cap(p, s->zslba) - s->zone_fill);
+        s->zone_fill += nlb;
+    } else if (p->phase == PRECOND_PHASE_RAND) {
+        if (p->written >= p->total) {
+            return false;
+        }
+        slba = replay_rand(&p->rng) % (p->num_blocks / p->align) * p->align;
+        nlb = p->align;
+    } else if (p->ext) {
+        if (p->ext_idx >= p->ext_cnt) {
+            return false;
+        }
+        slba = p->ext[p->ext_idx].slba + p->lba;
+        nlb = spdk_min(p->chunk, p->ext[p->ext_idx].nlb - p->lba);
+        p->lba += nlb;
+        if (p->lba == p->ext[p->ext_idx].nlb) {
+            p->ext_idx++;
+            p->lba = 0;
+        }
+    } else {
+        if (p->lba >= p->num_blocks) {
+            return false;
+        }
+        slba = p->lba;
+        nlb = spdk_min(p->chunk, p->num_blocks - p->lba);
+        p->lba += nlb;
+    }
+    memset(&s->rec, 0, sizeof(s->rec));
+    snprintf(s->rec.tpoint_name, sizeof(s->rec.tpoint_name), "NVME_IO_SUBMIT");
+    s->rec.opc = SPDK_NVME_OPC_WRITE;
+    s->rec.cdw10 = (uint32_t)slba;
+    s->rec.cdw11 = (uint32_t)(slba >> 32);
+    s->rec.cdw12 = (uint32_t)(nlb - 1);
+    p->written += nlb;
+    return true;
+}
+
+/* Progress once per window; the random overwrite ends at steady state */
+static void
+precond_window(struct precond *p, uint64_t now)
+{
+    struct replay_engine *e = &p->e;
+    double sec = (double)(now - e->window_tsc) / spdk_get_ticks_hz();
+    double mbps = (double)(p->written - p->window_written) * g_block_size / sec / (1000 * 1000);
+    double iops_cv, lat_cv;
+    bool steady = replay_engine_window(e, now, &iops_cv, &lat_cv);
+
+    p->window_written = p->written;
+    printf("Precondition %s: %5.1f %%  %10.0f IOPS  %8.1f MB/s\n", g_precond_phase_name[p->phase],
+           100.0 * spdk_min(p->written, p->total) / spdk_max(p->total, 1),
+           e->windows[(e->window_cnt - 1) % REPLAY_STEADY_WINDOWS].iops, mbps);
+    if (steady && p->phase == PRECOND_PHASE_RAND && p->written >= p->num_blocks && p->written < p->total) {
+        printf("Precondition steady state after %.2f overwrites: IOPS varies by %.1f %% and latency by %.1f %%\n",
+               (double)p->written / p->num_blocks, iops_cv * 100, lat_cv * 100);
+        p->total = p->written;
+    }
+}
+
+/* Keep every slot busy; false once the preconditioning is over */
+static bool
+precond_step(struct precond *p)
+{
+    struct replay_engine *e = &p->e;
+    uint64_t now = spdk_get_ticks();
+    bool running = false;
+
+    if (now - e->window_tsc >= g_window_ms * spdk_get_ticks_hz() / 1000) {
+        precond_window(p, now);
+    }
+    for (uint32_t i = 0; i < e->stream_cnt; i++) {
+        struct replay_stream *s = &e->streams[i];
+
+        while (!s->done && !s->io.inflight) {
+            int rc;
+
+            if (e->rc != 0 || !precond_next(p, s)) {
+                s->done = true;
+                break;
+            }
+            rc = e->submit(e->dev, s, &s->rec);
+            if (rc < 0) {
+                fprintf(stderr, "Precondition failed: %s\n", spdk_strerror(-rc));
+                s->io.inflight = false;
+                e->rc = rc;
+            }
+        }
+        running |= !s->done || s->io.inflight;
+    }
+    if (!running && e->rc == 0 && p->phase == PRECOND_PHASE_FILL && g_precond_mode == PRECOND_RAND &&
+        p->zone_size == 0) {
+        precond_phase(p, PRECOND_PHASE_RAND, now);
+        running = true;
+    }
+    return running;
+}
+
+/* Report and release the preconditioning, the replay starts from here */
+static int
+precond_free(struct precond *p)
+{
+    uint64_t tsc_diff = spdk_get_ticks() - p->start_tsc;
+    uint64_t ios = p->stats.done;
+    int rc = p->e.rc;
+
+    printf("Precondition done: %ju I/Os in %.3f s, %ju failed\n", ios, (double)tsc_diff / spdk_get_ticks_hz(),
+           p->stats.errors);
+    free(p->ext);
+    replay_engine_free(&p->e);
+    replay_stats_free(&p->stats);
+    g_io_log = p->io_log;
+    g_replay_start_tsc = spdk_get_ticks();
+    return rc;
+}
+/* precondition end */
+
+/* replay workload start */
+static void
+reset_zone_complete(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+{
+    if (spdk_nvme_cpl_is_error(cpl)) {
+        printf("Reset all zones failed\n");
+    }
+    outstanding_commands--;
+}
+
+static void
+reset_all_zone(struct spdk_nvme_ns *ns, struct spdk_nvme_qpair *qpair)
+{
+    outstanding_commands = 0;
+    int rc = spdk_nvme_zns_reset_zone(ns, qpair, 0, true, reset_zone_complete, NULL);
+	if (rc) {
+            fprintf(stderr, "Reset all zones failed\n");
+            exit(1);
+    } else {
+        outstanding_commands++;
+    }
+    while (outstanding_commands) {
+        spdk_nvme_qpair_process_completions(qpair, 0);
+    }
+}
+
+static void
+replay_complete(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+{
+    struct replay_io *io = (struct replay_io *)cb_arg;
+
+    replay_io_done(io, cpl);
+    if (spdk_nvme_cpl_is_error(cpl)) {
+        printf("Replay command failed\n");
+    }
+}
+
+/*
+ * ZNS replay. Writes and appends of the capture all go out as zone appends, several per
+ * zone at a time, and the LBA the device assigned to each one is kept against where the
+ * capture had the blocks: the slba of a write, the zone's write pointer for an append.
+ * Reads of those blocks are sent where the data is. Zones are opened explicitly and the
+ * least recently used idle zone is closed or finished to stay within the open and active
+ * limits. A zone without room for an append, full in the capture or finished here, is
+ * reset first. A read is split where its blocks went to different places.
+ */
+#define ZNS_APPEND_DEPTH 256    /* zone appends in flight over all streams */
+#define ZNS_LBA_PENDING UINT64_MAX
+
+enum zns_zone_state {
+    ZNS_ZONE_EMPTY,
+    ZNS_ZONE_OPEN,
+    ZNS_ZONE_CLOSED,
+    ZNS_ZONE_FULL,
+};
+
+/* Blocks of one replayed append, offsets in the zone */
+struct zns_extent {
+    uint64_t rec;           /* where the capture had them */
+    uint64_t lba;           /* where the device put them, ZNS_LBA_PENDING until the append completes */
+    uint32_t nlb;           /* 0: the append failed */
+};
+
+struct zns_zone {
+    struct zns_extent *ext; /* ordered by rec */
+    uint32_t ext_cnt;
+    uint32_t ext_size;
+    uint64_t wp;            /* write pointer of the capture */
+    uint64_t fill;          /* blocks appended on the device since its last reset */
+    uint64_t cap;           /* zone capacity, no append goes past it */
+    uint32_t pending;       /* appends in flight */
+    uint8_t state;
+    bool claimed;           /* opened here for an append not sent yet, not to be closed before it */
+    uint64_t last_use;
+};
+
+struct zns_replay;
+
+struct zns_append {
+    struct replay_io io;
+    struct zns_replay *z;
+    struct replay_stream *s;
+    struct zns_zone *zone;
+    uint32_t ext;
+    struct zns_append *next;
+};
+
+struct zns_replay {
+    struct ns_entry *ns_entry;
+    uint64_t zone_size;
+    uint64_t num_zones;
+    uint32_t max_open;      /* 0: no limit */
+    uint32_t max_active;
+    uint32_t open_cnt;
+    uint32_t active_cnt;
+    uint32_t pending;
+    uint64_t tick;
+    struct zns_zone *zones;
+    struct zns_append appends[ZNS_APPEND_DEPTH];
+    struct zns_append *free;
+    /* report */
+    uint64_t moved;         /* appends placed elsewhere than in the capture */
+    uint64_t remapped;      /* reads sent where an append put their blocks */
+    uint64_t split;         /* remapped reads sent as several pieces */
+    uint64_t unmapped;      /* reads of blocks no append of the replay wrote */
+    uint64_t opens;
+    uint64_t closes;
+    uint64_t finishes;
+    uint64_t recycled;
+    uint64_t zone_errors;
+};
+
+static void
+zns_report_complete(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+{
+    *(int *)cb_arg = spdk_nvme_cpl_is_error(cpl) ? -EIO : 1;
+}
+
+/* Zone capacities from a zone report; the zone size stands in for what cannot be reported */
+static int
+zns_replay_capacity(struct zns_replay *z)
+{
+    struct spdk_nvme_ns *ns = z->ns_entry->ns;
+    struct spdk_nvme_qpair *qpair = z->ns_entry->qpair;
+    size_t size = spdk_nvme_ns_get_max_io_xfer_size(ns);
+    struct spdk_nvme_zns_zone_report *report;
+    uint64_t zi = 0;
+
+    for (uint64_t i = 0; i < z->num_zones; i++) {
+        z->zones[i].cap = z->zone_size;
+    }
+    report = (struct spdk_nvme_zns_zone_report *)spdk_zmalloc(size, 4096, NULL, SPDK_ENV_SOCKET_ID_ANY,
+                                                              SPDK_MALLOC_DMA);
+    if (report == NULL) {
+        fprintf(stderr, "Fail to allocate memory for the zone report\n");
+        return -ENOMEM;
+    }
+    while (zi < z->num_zones) {
+        int status = 0;
+
+        if (spdk_nvme_zns_report_zones(ns, qpair, report, size, zi * z->zone_size, SPDK_NVME_ZRA_LIST_ALL, true,
+                                       zns_report_complete, &status) != 0) {
+            break;
+        }
+        while (status == 0) {
+            spdk_nvme_qpair_process_completions(qpair, 0);
+        }
+        if (status < 0 || report->nr_zones == 0) {
+            break;
+        }
+        for (uint64_t i = 0; i < report->nr_zones && zi < z->num_zones; i++, zi++) {
+            z->zones[zi].cap = spdk_min(report->descs[i].zcap, z->zone_size);
+        }
+    }
+    if (zi < z->num_zones) {
+        printf("Zone report failed at zone %ju, zone capacity taken as the zone size from there\n", zi);
+    }
+    spdk_free(report);
+    return 0;
+}
+
+static int
+zns_replay_init(struct zns_replay *z, struct ns_entry *ns_entry)
+{
+    memset(z, 0, sizeof(*z));
+    z->ns_entry = ns_entry;
+    z->zone_size = spdk_nvme_zns_ns_get_zone_size_sectors(ns_entry->ns);
+    z->num_zones = spdk_nvme_zns_ns_get_num_zones(ns_entry->ns);
+    z->max_open = spdk_nvme_zns_ns_get_max_open_zones(ns_entry->ns);
+    z->max_active = spdk_nvme_zns_ns_get_max_active_zones(ns_entry->ns);
+    z->zones = (struct zns_zone *)calloc(z->num_zones, sizeof(struct zns_zone));
+    if (z->zones == NULL) {
+        fprintf(stderr, "Fail to allocate memory for the zone map\n");
+        return -ENOMEM;
+    }
+    if (zns_replay_capacity(z) != 0) {
+        free(z->zones);
+        z->zones = NULL;
+        return -ENOMEM;
+    }
+    for (uint32_t i = 0; i < ZNS_APPEND_DEPTH; i++) {
+        z->appends[i].z = z;
+        z->appends[i].next = z->free;
+        z->free = &z->appends[i];
+    }
+    return 0;
+}
+
+static void
+zns_replay_free(struct zns_replay *z)
+{
+    for (uint64_t i = 0; i < z->num_zones; i++) {
+        free(z->zones[i].ext);
+    }
+    free(z->zones);
+    z->zones = NULL;
+}
+
+static void
+zns_replay_report(const struct zns_replay *z)
+{
+    print_uline('=', printf("\nZNS replay\n"));
+    printf("Appends placed elsewhere than in the capture: %ju\n", z->moved);
+    printf("Reads remapped: %ju  split across appends: %ju  not written by the replay: %ju\n", z->remapped,
+           z->split, z->unmapped);
+    printf("Zones opened: %ju  closed: %ju  finished: %ju  reset to start over: %ju\n", z->opens, z->closes,
+           z->finishes, z->recycled);
+    if (z->zone_errors) {
+        printf("Zone commands failed: %ju\n", z->zone_errors);
+    }
+}
+
+/* Track the state the device has zone in, with the open and active counts */
+static void
+zns_zone_set(struct zns_replay *z, struct zns_zone *zone, uint8_t state)
+{
+    z->open_cnt -= zone->state == ZNS_ZONE_OPEN;
+    z->active_cnt -= zone->state == ZNS_ZONE_OPEN || zone->state == ZNS_ZONE_CLOSED;
+    zone->state = state;
+    z->open_cnt += state == ZNS_ZONE_OPEN;
+    z->active_cnt += state == ZNS_ZONE_OPEN || state == ZNS_ZONE_CLOSED;
+    if (state == ZNS_ZONE_EMPTY) {
+        zone->ext_cnt = 0;
+        zone->fill = 0;
+    } else if (state == ZNS_ZONE_FULL) {
+        zone->fill = zone->cap;
+    }
+}
+
+/* Every zone was filled by the preconditioning */
+static void
+zns_replay_filled(struct zns_replay *z)
+{
+    for (uint64_t i = 0; i < z->num_zones; i++) {
+        zns_zone_set(z, &z->zones[i], ZNS_ZONE_FULL);
+    }
+}
+
+/* A zone command sent to make room for the record of s, which is retried after it */
+static void
+zns_zone_complete(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+{
+    struct replay_stream *s = (struct replay_stream *)cb_arg;
+    struct zns_replay *z = (struct zns_replay *)s->engine->dev;
+
+    if (spdk_nvme_cpl_is_error(cpl)) {
+        z->zone_errors++;
+    }
+    s->io.inflight = false;
+}
+
+static int
+zns_zone_send(struct zns_replay *z, struct replay_stream *s, struct zns_zone *zone, uint8_t action)
+{
+    struct spdk_nvme_ns *ns = z->ns_entry->ns;
+    struct spdk_nvme_qpair *qpair = z->ns_entry->qpair;
+    uint64_t zslba = (uint64_t)(zone - z->zones) * z->zone_size;
+    uint64_t *cnt;
+    uint8_t state;
+    int rc;
+
+    switch (action) {
+    case SPDK_NVME_ZONE_OPEN:
+        rc = spdk_nvme_zns_open_zone(ns, qpair, zslba, false, zns_zone_complete, s);
+        cnt = &z->opens;
+        state = ZNS_ZONE_OPEN;
+        break;
+    case SPDK_NVME_ZONE_CLOSE:
+        rc = spdk_nvme_zns_close_zone(ns, qpair, zslba, false, zns_zone_complete, s);
+        cnt = &z->closes;
+        state = ZNS_ZONE_CLOSED;
+        break;
+    case SPDK_NVME_ZONE_FINISH:
+        rc = spdk_nvme_zns_finish_zone(ns, qpair, zslba, false, zns_zone_complete, s);
+        cnt = &z->finishes;
+        state = ZNS_ZONE_FULL;
+        break;
+    default:
+        rc = spdk_nvme_zns_reset_zone(ns, qpair, zslba, false, zns_zone_complete, s);
+        cnt = &z->recycled;
+        state = ZNS_ZONE_EMPTY;
+        break;
+    }
+    if (rc != 0) {
+        return rc;
+    }
+    (*cnt)++;
+    zns_zone_set(z, zone, state);
+    zone->claimed = state == ZNS_ZONE_OPEN;
+    zone->last_use = ++z->tick;
+    s->io.inflight = true;
+    return REPLAY_PREP;
+}
+
+/* Least recently used zone other than skip in one of the states of mask, idle and not claimed */
+static struct zns_zone *
+zns_zone_idle(struct zns_replay *z, const struct zns_zone *skip, uint32_t mask)
+{
+    struct zns_zone *victim = NULL;
+
+    for (uint64_t i = 0; i < z->num_zones; i++) {
+        struct zns_zone *zone = &z->zones[i];
+
+        if (zone != skip && zone->pending == 0 && !zone->claimed && (mask & 1U << zone->state) &&
+            (victim == NULL || zone->last_use < victim->last_use)) {
+            victim = zone;
+        }
+    }
+    return victim;
+}
+
+/* Close or finish another zone if opening zone would go over the open or active limit */
+static int
+zns_zone_room(struct zns_replay *z, struct replay_stream *s, struct zns_zone *zone)
+{
+    struct zns_zone *victim;
+
+    if (z->max_open && z->open_cnt >= z->max_open) {
+        victim = zns_zone_idle(z, zone, 1U << ZNS_ZONE_OPEN);
+        return victim ? zns_zone_send(z, s, victim, SPDK_NVME_ZONE_CLOSE) : REPLAY_BUSY;
+    }
+    if (zone->state == ZNS_ZONE_EMPTY && z->max_active && z->active_cnt >= z->max_active) {
+        victim = zns_zone_idle(z, zone, 1U << ZNS_ZONE_OPEN | 1U << ZNS_ZONE_CLOSED);
+        return victim ? zns_zone_send(z, s, victim, SPDK_NVME_ZONE_FINISH) : REPLAY_BUSY;
+    }
+    return 0;
+}
+
+/* Get zone open with room for nlb more blocks; 0 once it is, REPLAY_PREP or REPLAY_BUSY before */
+static int
+zns_zone_prepare(struct zns_replay *z, struct replay_stream *s, struct zns_zone *zone, uint32_t nlb)
+{
+    int rc;
+
+    if (zone->fill + nlb > zone->cap) {
+        return zone->pending ? REPLAY_BUSY : zns_zone_send(z, s, zone, SPDK_NVME_ZONE_RESET);
+    }
+    if (zone->state == ZNS_ZONE_OPEN) {
+        return 0;
+    }
+    rc = zns_zone_room(z, s, zone);
+    if (rc != 0) {
+        return rc;
+    }
+    return zns_zone_send(z, s, zone, SPDK_NVME_ZONE_OPEN);
+}
+
+static void
+zns_append_complete(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+{
+    struct zns_append *a = (struct zns_append *)cb_arg;
+    struct zns_replay *z = a->z;
+    struct zns_zone *zone = a->zone;
+    struct zns_extent *ext = &zone->ext[a->ext];
+
+    if (spdk_nvme_cpl_is_error(cpl)) {
+        ext->nlb = 0;
+        printf("Replay command failed\n");
+    } else {
+        /* the assigned LBA comes back in dwords 0 and 1 */
+        ext->lba = (uint64_t)cpl->cdw1 << 32 | cpl->cdw0;
+        z->moved += ext->lba != (uint64_t)(zone - z->zones) * z->zone_size + ext->rec;
+    }
+    z->pending--;
+    a->s->async--;
+    if (--zone->pending == 0 && zone->fill >= zone->cap && zone->state == ZNS_ZONE_OPEN) {
+        zns_zone_set(z, zone, ZNS_ZONE_FULL);
+    }
+    replay_io_done(&a->io, cpl);
+    a->next = z->free;
+    z->free = a;
+}
+
+/* Append the blocks of a write or append of the capture to their zone */
+static int
+zns_append(struct zns_replay *z, struct replay_stream *s, const struct bin_file_data *d, uint64_t slba,
+           uint32_t nlb)
+{
+    struct zns_zone *zone = &z->zones[slba / z->zone_size];
+    uint64_t zslba = slba - slba % z->zone_size;
+    uint64_t bytes = (uint64_t)nlb * g_block_size;
+    struct zns_extent *ext;
+    struct zns_append *a;
+    uint64_t rec;
+    int rc;
+
+    if (z->free == NULL) {
+        return REPLAY_BUSY;
+    }
+    rc = zns_zone_prepare(z, s, zone, nlb);
+    if (rc != 0) {
+        return rc;
+    }
+    if (d->opc == SPDK_NVME_OPC_WRITE) {
+        rec = slba - zslba;
+    } else {
+        /* past the end the capture's zone was reset in between, a later pass of the loop */
+        rec = zone->wp + nlb > zone->cap ? 0 : zone->wp;
+    }
+    /* blocks the capture writes over are dropped from the map */
+    while (zone->ext_cnt && zone->ext[zone->ext_cnt - 1].rec + zone->ext[zone->ext_cnt - 1].nlb > rec) {
+        if (zone->ext[zone->ext_cnt - 1].lba == ZNS_LBA_PENDING && zone->ext[zone->ext_cnt - 1].nlb) {
+            return REPLAY_BUSY;
+        }
+        zone->ext_cnt--;
+    }
+    if (zone->ext_cnt == zone->ext_size) {
+        uint32_t size = spdk_max(zone->ext_size * 2, 16U);
+
+        ext = (struct zns_extent *)realloc(zone->ext, size * sizeof(struct zns_extent));
+        if (ext == NULL) {
+            fprintf(stderr, "Fail to allocate memory for the zone map\n");
+            return -ENOMEM;
+        }
+        zone->ext = ext;
+        zone->ext_size = size;
+    }
+    ext = &zone->ext[zone->ext_cnt];
+    ext->rec = rec;
+    ext->lba = ZNS_LBA_PENDING;
+    ext->nlb = nlb;
+
+    a = z->free;
+    a->s = s;
+    a->zone = zone;
+    a->ext = zone->ext_cnt;
+    replay_io_start(&a->io, s->engine->stats, d, REPLAY_OPC_WRITE, bytes);
+    rc = spdk_nvme_zns_zone_append(z->ns_entry->ns, z->ns_entry->qpair, payload_get(bytes), zslba, nlb,
+                                   zns_append_complete, a, 0);
+    if (rc != 0) {
+        return rc;
+    }
+    z->free = a->next;
+    zone->ext_cnt++;
+    zone->wp = rec + nlb;
+    zone->fill += nlb;
+    zone->pending++;
+    zone->claimed = false;
+    zone->last_use = ++z->tick;
+    z->pending++;
+    s->async++;
+    return REPLAY_ASYNC;
+}
+
+/*
+ * Where the block at offset off of zone is on the device, and for how many blocks, at most
+ * left, that holds; ZNS_LBA_PENDING while their append is in flight
+ */
+static uint64_t
+zns_read_piece(const struct zns_zone *zone, uint64_t zslba, uint64_t off, uint64_t left, uint64_t *len,
+               bool *mapped)
+{
+    uint32_t lo = 0, hi = zone->ext_cnt;
+
+    /* last extent starting at or before off */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (zone->ext[mid].rec <= off) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0 && off < zone->ext[lo - 1].rec + zone->ext[lo - 1].nlb) {
+        const struct zns_extent *ext = &zone->ext[lo - 1];
+
+        *len = spdk_min(left, ext->rec + ext->nlb - off);
+        *mapped = true;
+        return ext->lba == ZNS_LBA_PENDING ? ZNS_LBA_PENDING : ext->lba + off - ext->rec;
+    }
+    /* not written by the replay up to the next extent, read where the capture did */
+    *len = lo < zone->ext_cnt ? spdk_min(left, zone->ext[lo].rec - off) : left;
+    *mapped = false;
+    return zslba + off;
+}
+
+/* A read of the capture walked as runs of blocks contiguous on the device */
+struct zns_read_iter {
+    const struct zns_zone *zone;
+    uint64_t zslba;
+    uint64_t off;
+    uint64_t end;
+};
+
+static bool
+zns_read_next(struct zns_read_iter *it, uint64_t *lba, uint64_t *len, bool *mapped)
+{
+    uint64_t next, next_len;
+    bool next_mapped;
+
+    if (it->off >= it->end) {
+        return false;
+    }
+    *lba = zns_read_piece(it->zone, it->zslba, it->off, it->end - it->off, len, mapped);
+    it->off += *len;
+    while (*lba != ZNS_LBA_PENDING && it->off < it->end) {
+        next = zns_read_piece(it->zone, it->zslba, it->off, it->end - it->off, &next_len, &next_mapped);
+        if (next != *lba + *len) {
+            break;
+        }
+        *len += next_len;
+        *mapped |= next_mapped;
+        it->off += next_len;
+    }
+    return true;
+}
+
+static void
+zns_read_complete(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+{
+    struct replay_stream *s = (struct replay_stream *)cb_arg;
+
+    if (spdk_nvme_cpl_is_error(cpl)) {
+        s->part_cpl = *cpl;
+    }
+    if (--s->parts == 0) {
+        replay_complete(&s->io, &s->part_cpl);
+    }
+}
+
+/*
+ * Read the blocks of a read of the capture where the replay put them, one command per
+ * contiguous run; REPLAY_BUSY while the append of one of them is in flight
+ */
+static int
+zns_read(struct zns_replay *z, struct replay_stream *s, const struct bin_file_data *d, uint64_t slba,
+         uint32_t nlb)
+{
+    uint64_t zslba = slba - slba % z->zone_size;
+    uint64_t first = slba - zslba;
+    struct zns_read_iter it = {&z->zones[slba / z->zone_size], zslba, first, first + nlb};
+    uint64_t lba, len, start;
+    uint32_t parts = 0, sent = 0;
+    bool mapped, remapped = false;
+    int rc = 0;
+
+    while (zns_read_next(&it, &lba, &len, &mapped)) {
+        if (lba == ZNS_LBA_PENDING) {
+            return REPLAY_BUSY;
+        }
+        remapped |= mapped;
+        parts++;
+    }
+
+    replay_io_start(&s->io, s->engine->stats, d, REPLAY_OPC_READ, (uint64_t)nlb * g_block_size);
+    memset(&s->part_cpl, 0, sizeof(s->part_cpl));
+    s->parts = parts;
+    it.off = first;
+    for (start = it.off; zns_read_next(&it, &lba, &len, &mapped); start = it.off) {
+        rc = spdk_nvme_ns_cmd_read(z->ns_entry->ns, z->ns_entry->qpair, s->buf + (start - first) * g_block_size, lba,
+                                   (uint32_t)len, zns_read_complete, s, 0);
+        if (rc != 0) {
+            break;
+        }
+        sent++;
+    }
+    if (rc != 0) {
+        if (sent == 0) {
+            return rc;
+        }
+        /* the pieces in flight complete the read, as failed */
+        s->parts = sent;
+        s->part_cpl.status.sct = SPDK_NVME_SCT_GENERIC;
+        s->part_cpl.status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
+    }
+    if (remapped) {
+        z->remapped++;
+        z->split += parts > 1;
+    } else {
+        z->unmapped++;
+    }
+    return 0;
+}
+
+/* Zone management of the capture, once the appends to the zones it covers have landed */
+static int
+zns_zone_mgmt(struct zns_replay *z, struct replay_stream *s, const struct bin_file_data *d, uint64_t slba)
+{
+    struct spdk_nvme_ns *ns = z->ns_entry->ns;
+    struct spdk_nvme_qpair *qpair = z->ns_entry->qpair;
+    bool select_all = (d->cdw13 & (uint32_t)1 << 8) ? true : false;
+    uint8_t zone_action = (uint8_t)(d->cdw13 & UINT8BIT_MASK);
+    uint64_t first = select_all ? 0 : slba / z->zone_size;
+    uint64_t last = select_all ? z->num_zones : first + 1;
+    struct replay_io *io = &s->io;
+    int rc;
+
+    if (zone_action < SPDK_NVME_ZONE_CLOSE || zone_action > SPDK_NVME_ZONE_OFFLINE) {
+        return REPLAY_SKIP;
+    }
+    if (select_all ? z->pending : z->zones[first].pending) {
+        return REPLAY_BUSY;
+    }
+    if (zone_action == SPDK_NVME_ZONE_OPEN && !select_all && z->zones[first].state != ZNS_ZONE_OPEN) {
+        rc = zns_zone_room(z, s, &z->zones[first]);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    replay_io_start(io, s->engine->stats, d, REPLAY_OPC_ZONE_MGMT, 0);
+    if (zone_action == SPDK_NVME_ZONE_OPEN)
+        rc = spdk_nvme_zns_open_zone(ns, qpair, slba, select_all, replay_complete, io);
+    else if (zone_action == SPDK_NVME_ZONE_CLOSE)
+        rc = spdk_nvme_zns_close_zone(ns, qpair, slba, select_all, replay_complete, io);
+    else if (zone_action == SPDK_NVME_ZONE_FINISH)
+        rc = spdk_nvme_zns_finish_zone(ns, qpair, slba, select_all, replay_complete, io);
+    else if (zone_action == SPDK_NVME_ZONE_RESET)
+        rc = spdk_nvme_zns_reset_zone(ns, qpair, slba, select_all, replay_complete, io);
+    else
+        rc = spdk_nvme_zns_offline_zone(ns, qpair, slba, select_all, replay_complete, io);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* with select all, only the zones in a state the action applies to change */
+    for (uint64_t i = first; i < last; i++) {
+        struct zns_zone *zone = &z->zones[i];
+        bool active = zone->state == ZNS_ZONE_OPEN || zone->state == ZNS_ZONE_CLOSED;
+
+        if (zone_action == SPDK_NVME_ZONE_OPEN && (!select_all || zone->state == ZNS_ZONE_CLOSED)) {
+            zns_zone_set(z, zone, ZNS_ZONE_OPEN);
+            zone->last_use = ++z->tick;
+        } else if (zone_action == SPDK_NVME_ZONE_CLOSE && zone->state == ZNS_ZONE_OPEN) {
+            zns_zone_set(z, zone, ZNS_ZONE_CLOSED);
+        } else if (zone_action == SPDK_NVME_ZONE_FINISH && (!select_all || active)) {
+            zns_zone_set(z, zone, ZNS_ZONE_FULL);
+            zone->wp = zone->cap;
+        } else if (zone_action == SPDK_NVME_ZONE_RESET) {
+            zns_zone_set(z, zone, ZNS_ZONE_EMPTY);
+            zone->wp = 0;
+        }
+    }
+    return 0;
+}
+
+static int
+process_zns_replay(void *dev, struct replay_stream *s, const struct bin_file_data *d)
+{
+    struct zns_replay *z = (struct zns_replay *)dev;
+    struct spdk_nvme_ns *ns = z->ns_entry->ns;
+    struct spdk_nvme_qpair *qpair = z->ns_entry->qpair;
+    uint32_t nlb = (uint32_t)(d->cdw12 & UINT16BIT_MASK) + 1;
+    uint64_t slba = replay_stream_lba(s, (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32, nlb);
+    uint64_t bytes = (uint64_t)nlb * g_block_size;
+    struct replay_io *io = &s->io;
+
+    if (slba / z->zone_size >= z->num_zones) {
+        return REPLAY_SKIP;
+    }
+    switch (d->opc) {
+    case SPDK_NVME_OPC_READ:
+    case SPDK_NVME_OPC_COMPARE:
+        return zns_read(z, s, d, slba, nlb);
+    case SPDK_NVME_OPC_WRITE:
+    case SPDK_NVME_OPC_ZONE_APPEND:
+        return zns_append(z, s, d, slba, nlb);
+    case SPDK_NVME_OPC_WRITE_ZEROES:
+        replay_io_start(io, s->engine->stats, d, REPLAY_OPC_WRITE_ZEROES, bytes);
+        return spdk_nvme_ns_cmd_write_zeroes(ns, qpair, slba, nlb, replay_complete, io, 0);
+    case SPDK_NVME_OPC_ZONE_MGMT_SEND:
+        return zns_zone_mgmt(z, s, d, slba);
+    default:
+        return REPLAY_SKIP;
+    }
+}
+
+/* Precondition writes on a zoned namespace: appends at QD1 per slot, each slot fills its own zone */
+static int
+process_zns_fill(void *dev, struct replay_stream *s, const struct bin_file_data *d)
+{
+    struct ns_entry *ns_entry = (struct ns_entry *)dev;
+    uint32_t nlb = (uint32_t)(d->cdw12 & UINT16BIT_MASK) + 1;
+    uint64_t slba = replay_stream_lba(s, (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32, nlb);
+    uint64_t bytes = (uint64_t)nlb * g_block_size;
+
+    replay_io_start(&s->io, s->engine->stats, d, REPLAY_OPC_WRITE, bytes);
+    return spdk_nvme_zns_zone_append(ns_entry->ns, ns_entry->qpair, payload_get(bytes), slba, nlb, replay_complete,
+                                     &s->io, 0);
+}
+
+static int
+process_replay(void *dev, struct replay_stream *s, const struct bin_file_data *d)
+{
+    struct ns_entry *ns_entry = (struct ns_entry *)dev;
+    struct spdk_nvme_ns *ns = ns_entry->ns;
+    struct spdk_nvme_qpair *qpair = ns_entry->qpair;
+    uint32_t nlb = (uint32_t)(d->cdw12 & UINT16BIT_MASK) + 1;
+    uint64_t slba = replay_stream_lba(s, (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32, nlb);
+    uint64_t bytes = (uint64_t)nlb * g_block_size;
+    char *replay_buf = s->buf;
+    struct replay_io *io = &s->io;
+
+    switch (d->opc) {
+    case SPDK_NVME_OPC_READ:
+    case SPDK_NVME_OPC_COMPARE:
+        replay_io_start(io, s->engine->stats, d, REPLAY_OPC_READ, bytes);
+        return spdk_nvme_ns_cmd_read(ns, qpair, replay_buf, slba, nlb, replay_complete, io, 0);
+    case SPDK_NVME_OPC_WRITE:
+        replay_io_start(io, s->engine->stats, d, REPLAY_OPC_WRITE, bytes);
+        return spdk_nvme_ns_cmd_write(ns, qpair, payload_get(bytes), slba, nlb, replay_complete, io, 0);
+    case SPDK_NVME_OPC_WRITE_ZEROES:
+        replay_io_start(io, s->engine->stats, d, REPLAY_OPC_WRITE_ZEROES, bytes);
+        return spdk_nvme_ns_cmd_write_zeroes(ns, qpair, slba, nlb, replay_complete, io, 0);
+    default:
+        return REPLAY_SKIP;
+    }
+}
+
+static int
+process_kernel_replay(void *dev, struct replay_stream *s, const struct bin_file_data *d)
+{
+    struct kdev *k = (struct kdev *)dev;
+    uint32_t nlb = (uint32_t)(d->cdw12 & UINT16BIT_MASK) + 1;
+    uint64_t slba = replay_stream_lba(s, (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32, nlb);
+    uint64_t bytes = (uint64_t)nlb * k->sector_size;
+    struct replay_io *io = &s->io;
+
+    switch (d->opc) {
+    case SPDK_NVME_OPC_READ:
+    case SPDK_NVME_OPC_COMPARE:
+        replay_io_start(io, s->engine->stats, d, REPLAY_OPC_READ, bytes);
+        return kdev_submit(k, KDEV_OP_READ, s->buf, slba, nlb, replay_complete, io);
+    case SPDK_NVME_OPC_WRITE:
+        replay_io_start(io, s->engine->stats, d, REPLAY_OPC_WRITE, bytes);
+        return kdev_submit(k, KDEV_OP_WRITE, payload_get(bytes), slba, nlb, replay_complete, io);
+    case SPDK_NVME_OPC_WRITE_ZEROES:
+        replay_io_start(io, s->engine->stats, d, REPLAY_OPC_WRITE_ZEROES, bytes);
+        return kdev_submit(k, KDEV_OP_WRITE_ZEROES, NULL, slba, nlb, replay_complete, io);
+    default:
+        return REPLAY_SKIP;
+    }
+}
+
+/* Largest read or write of the capture in blocks, what one stream buffer must hold */
+static uint64_t
+replay_max_nlb(const struct bin_file_data *b, int entry_cnt, bool zns)
+{
+    uint64_t max_nlb = 1;
+
+    for (int i = 0; i < entry_cnt; i++) {
+        if (strcmp(b[i].tpoint_name, "NVME_IO_SUBMIT") == 0 &&
+            replay_opc_class(&b[i], zns) <= REPLAY_OPC_WRITE) {
+            max_nlb = spdk_max(max_nlb, (uint64_t)(b[i].cdw12 & UINT16BIT_MASK) + 1);
+        }
+    }
+    return max_nlb;
+}
+
+/*
+ * One slot per command of the first pass of every copy, later passes are not compared
+ * with the capture; without them the fidelity report is skipped
+ */
+static void
+replay_timing_alloc(struct replay_stats *stats, struct bin_file_data *b, int entry_cnt)
+{
+    uint64_t cnt = 0;
+
+    for (int i = 0; i < entry_cnt; i++) {
+        cnt += strcmp(b[i].tpoint_name, "NVME_IO_SUBMIT") == 0;
+    }
+    cnt *= g_copies;
+
+    stats->base = b;
+    stats->timing = (struct replay_time *)calloc(cnt + 1, sizeof(struct replay_time));
+    stats->timing_cnt = stats->timing ? cnt : 0;
+}
+
+/*
+ * Precondition the namespace, zr: zoned. The zones are reset first and each is filled up to
+ * its capacity; they are left full instead of being reset before the replay.
+ */
+static int
+nvme_precondition(struct ns_entry *ns_entry, const struct replay_engine *replay, const struct zns_replay *zr)
+{
+    uint64_t chunk = PRECOND_CHUNK_BYTES / g_block_size;
+    uint32_t qd = g_precond_qd;
+    uint64_t *zone_cap = NULL;
+    struct precond p;
+    int rc;
+
+    if (zr) {
+        zone_cap = (uint64_t *)calloc(spdk_max(zr->num_zones, 1), sizeof(uint64_t));
+        if (zone_cap == NULL) {
+            fprintf(stderr, "Fail to allocate memory for the zone capacities\n");
+            return -ENOMEM;
+        }
+        for (uint64_t i = 0; i < zr->num_zones; i++) {
+            zone_cap[i] = zr->zones[i].cap;
+        }
+        /* an earlier run may have left zones written, the first append to them would fail */
+        reset_all_zone(ns_entry->ns, ns_entry->qpair);
+
+        /* a zone append cannot be split */
+        if (spdk_nvme_zns_ctrlr_get_max_zone_append_size(ns_entry->ctrlr)) {
+            chunk = spdk_min(chunk, spdk_nvme_zns_ctrlr_get_max_zone_append_size(ns_entry->ctrlr) / g_block_size);
+        }
+        if (spdk_nvme_zns_ns_get_max_open_zones(ns_entry->ns)) {
+            qd = spdk_min(qd, spdk_nvme_zns_ns_get_max_open_zones(ns_entry->ns));
+        }
+    }
+    rc = precond_init(&p, replay, zr ? process_zns_fill : process_replay, ns_entry,
+                      zr ? zr->num_zones * zr->zone_size : spdk_nvme_ns_get_num_sectors(ns_entry->ns),
+                      zr ? zr->zone_size : 0, zone_cap, chunk, qd);
+    if (rc != 0) {
+        free(zone_cap);
+        return rc;
+    }
+    /* after a failure, precond_step() only waits for what is in flight */
+    while (precond_step(&p)) {
+        spdk_nvme_qpair_process_completions(ns_entry->qpair, 0);
+    }
+    rc = precond_free(&p);
+    free(zone_cap);
+    return rc;
+}
+
+static void
+process_entry(struct bin_file_data *b, int entry_cnt)
+{
+    struct ns_entry *ns_entry;
+    struct spdk_nvme_io_qpair_opts qpair_opts;
+    struct replay_stats stats;
+    struct replay_engine engine;
+    struct zns_replay zr;
+    uint64_t zone_size = 0;
+    size_t buf_size;
+    bool zns;
+
+    /* specify namespace and allocate io qpair for the namespace */
+    ns_entry = select_ns();
+    zns = spdk_nvme_ns_get_csi(ns_entry->ns) == SPDK_NVME_CSI_ZNS;
+    spdk_nvme_ctrlr_get_default_io_qpair_opts(ns_entry->ctrlr, &qpair_opts, sizeof(qpair_opts));
+    qpair_opts.io_queue_requests = spdk_max(qpair_opts.io_queue_requests,
+                                            (g_precond_mode ? spdk_max(g_copies, g_precond_qd) : g_copies) * 2 +
+                                            (zns ? ZNS_APPEND_DEPTH : 0));
+    ns_entry->qpair = spdk_nvme_ctrlr_alloc_io_qpair(ns_entry->ctrlr, &qpair_opts, sizeof(qpair_opts));
+    if (ns_entry->qpair == NULL) {
+        printf("ERROR: spdk_nvme_ctrlr_alloc_io_qpair() failed\n");
+        return;
+    }
+    if (replay_stats_init(&stats) != 0) {
+        fprintf(stderr, "Fail to allocate memory for replay stats\n");
+        spdk_nvme_ctrlr_free_io_qpair(ns_entry->qpair);
+        return;
+    }
+    g_block_size = spdk_nvme_ns_get_sector_size(ns_entry->ns);
+    if (zns) {
+        zone_size = spdk_nvme_zns_ns_get_zone_size_sectors(ns_entry->ns);
+        if (zns_replay_init(&zr, ns_entry) != 0) {
+            goto free_qpair;
+        }
+    }
+    replay_timing_alloc(&stats, b, entry_cnt);
+    if (replay_engine_init(&engine, b, entry_cnt, zns, spdk_nvme_ns_get_num_sectors(ns_entry->ns), zone_size,
+                           &stats, zns ? process_zns_replay : process_replay, zns ? (void *)&zr : ns_entry) != 0) {
+        goto free_qpair;
+    }
+
+    /* allocate data buffers for SPDK NVMe I/O operations, one per stream */
+    buf_size = replay_max_nlb(b, entry_cnt, zns) * g_block_size;
+    for (uint32_t i = 0; i < engine.stream_cnt; i++) {
+        engine.streams[i].buf = (char *)spdk_zmalloc(buf_size, g_block_size, NULL, SPDK_ENV_SOCKET_ID_ANY,
+                                                     SPDK_MALLOC_DMA);
+        if (engine.streams[i].buf == NULL) {
+            perror("Fail to malloc replay_buf");
+            goto free_bufs;
+        }
+    }
+    g_payload.size = payload_pool_size(buf_size);
+    g_payload.buf = (char *)spdk_zmalloc(g_payload.size, PAYLOAD_BLOCK, NULL, SPDK_ENV_SOCKET_ID_ANY,
+                                        SPDK_MALLOC_DMA);
+    if (g_payload.buf == NULL) {
+        fprintf(stderr, "Fail to allocate memory for the write payload\n");
+        goto free_bufs;
+    }
+    payload_fill();
+
+    if (g_precond_mode != PRECOND_NONE && nvme_precondition(ns_entry, &engine, zns ? &zr : NULL) != 0) {
+        goto free_bufs;
+    }
+    if (zns && g_precond_mode != PRECOND_NONE) {
+        /* keep what the preconditioning wrote, a zone is reset when the replay first appends to it */
+        zns_replay_filled(&zr);
+        printf("Zones left full after preconditioning\n");
+    } else if (zns) {
+        /* reset zone before write */
+        reset_all_zone(ns_entry->ns, ns_entry->qpair);
+        printf("Reset all zone complete.\n");
+    } else {
+        printf("Not ZNS namespace\n");
+    }
+    while (replay_engine_step(&engine)) {
+        spdk_nvme_qpair_process_completions(ns_entry->qpair, 0);
+    }
+    if (engine.rc != 0) {
+        fprintf(stderr, "%s() failed\n", zns ? "process_zns_replay" : "process_replay");
+    }
+
+free_bufs:
+    for (uint32_t i = 0; i < engine.stream_cnt; i++) {
+        spdk_free(engine.streams[i].buf);
+    }
+    spdk_free(g_payload.buf);
+    g_payload.buf = NULL;
+    replay_engine_free(&engine);
+free_qpair:
+    spdk_nvme_ctrlr_free_io_qpair(ns_entry->qpair);
+    replay_stats_report(&stats);
+    replay_fidelity_report(&stats, b, entry_cnt, zns);
+    replay_stats_free(&stats);
+    if (zns && zr.zones != NULL) {
+        zns_replay_report(&zr);
+        zns_replay_free(&zr);
+    }
+}
+
+/* Precondition a file or block device; a file is only written up to its current size */
+static int
+kdev_precondition(struct kdev *k, const struct replay_engine *replay)
+{
+    struct precond p;
+    int rc;
+
+    rc = precond_init(&p, replay, replay->submit, replay->dev, k->size / k->sector_size, 0, NULL, PRECOND_CHUNK_BYTES / k->sector_size,
+                      spdk_min(g_precond_qd, (uint32_t)KDEV_DEPTH));
+    if (rc != 0) {
+        return rc;
+    }
+    while (precond_step(&p)) {
+        kdev_process_completions(k);
+    }
+    return precond_free(&p);
+}
+
+/* Same replay as process_entry() through the kernel backend; zoned targets are not handled */
+static void
+process_kernel_entry(struct bin_file_data *b, int entry_cnt)
+{
+    uint64_t max_nlb = replay_max_nlb(b, entry_cnt, false);
+    struct replay_stats stats;
+    struct replay_engine engine;
+    struct kdev k;
+
+    /* the payload goes first, kdev_open() registers it with io_uring; up to 4K blocks unless -b */
+    g_payload.size = payload_pool_size(max_nlb * (g_kdev_sector_size ? g_kdev_sector_size : 4096));
+    if (posix_memalign((void **)&g_payload.buf, PAYLOAD_BLOCK, g_payload.size) != 0) {
+        fprintf(stderr, "Fail to allocate memory for the write payload\n");
+        g_payload.buf = NULL;
+        return;
+    }
+    payload_fill();
+    if (kdev_open(&k, g_kdev_path, max_nlb) != 0) {
+        goto free_payload;
+    }
+    if (payload_pool_size(max_nlb * k.sector_size) > g_payload.size) {
+        fprintf(stderr, "Logical block size %u of %s is above 4096, give it with -b\n", k.sector_size, g_kdev_path);
+        kdev_close(&k);
+        goto free_payload;
+    }
+    g_block_size = k.sector_size;
+    if (replay_stats_init(&stats) != 0) {
+        fprintf(stderr, "Fail to allocate memory for replay stats\n");
+        kdev_close(&k);
+        goto free_payload;
+    }
+    replay_timing_alloc(&stats, b, entry_cnt);
+    /* a file grows as needed, a device wraps copies at its end */
+    if (replay_engine_init(&engine, b, entry_cnt, false, k.blkdev ? k.size / k.sector_size : 0, 0, &stats,
+                           process_kernel_replay, &k) != 0) {
+        goto close;
+    }
+    for (uint32_t i = 0; i < engine.stream_cnt; i++) {
+        engine.streams[i].buf = (char *)kdev_buf_get(&k);
+        if (engine.streams[i].buf == NULL) {
+            fprintf(stderr, "Only %u kernel replay buffers for %u copies\n", k.buf_cnt, engine.stream_cnt);
+            goto free_engine;
+        }
+    }
+
+    if (g_precond_mode != PRECOND_NONE && kdev_precondition(&k, &engine) != 0) {
+        goto free_engine;
+    }
+    while (replay_engine_step(&engine)) {
+        kdev_process_completions(&k);
+    }
+    if (engine.rc != 0) {
+        fprintf(stderr, "process_kernel_replay() failed\n");
+    }
+
+free_engine:
+    for (uint32_t i = 0; i < engine.stream_cnt; i++) {
+        if (engine.streams[i].buf != NULL) {
+            kdev_buf_put(&k, engine.streams[i].buf);
+        }
+    }
+    replay_engine_free(&engine);
+close:
+    kdev_close(&k);
+    replay_stats_report(&stats);
+    replay_fidelity_report(&stats, b, entry_cnt, false);
+    replay_stats_free(&stats);
+free_payload:
+    free(g_payload.buf);
+    g_payload.buf = NULL;
+}
+/* replay workload end */
+
+/* bdev replay start */
+/*
+ * Replays through the bdev layer inside the SPDK application framework, to any bdev the
+ * JSON config creates (malloc, AIO, NVMe, crypto, RAID, ...). A poller on the app thread
+ * runs the replay engine; completions arrive through the bdev callbacks.
+ */
+struct bdev_replay {
+    struct spdk_bdev *bdev;
+    struct spdk_bdev_desc *desc;
+    struct spdk_io_channel *ch;
+    struct spdk_bdev_io_wait_entry wait;
+    struct spdk_poller *poller;
+    struct bin_file_data *b;
+    int entry_cnt;
+    uint32_t block_size;
+    bool zoned;
+    uint64_t zone;          /* next zone to reset before the replay */
+    struct replay_stats stats;
+    struct replay_engine engine;
+    struct precond precond;
+    int rc;
+};
+
+static const enum spdk_bdev_zone_action g_bdev_zone_action[] = {
+    [SPDK_NVME_ZONE_CLOSE] = SPDK_BDEV_ZONE_CLOSE,
+    [SPDK_NVME_ZONE_FINISH] = SPDK_BDEV_ZONE_FINISH,
+    [SPDK_NVME_ZONE_OPEN] = SPDK_BDEV_ZONE_OPEN,
+    [SPDK_NVME_ZONE_RESET] = SPDK_BDEV_ZONE_RESET,
+    [SPDK_NVME_ZONE_OFFLINE] = SPDK_BDEV_ZONE_OFFLINE,
+};
+
+static char g_bdev_name[64];
+static char g_bdev_json[256];
+static struct bdev_replay g_bdev_replay;
+
+static void
+bdev_event_cb(enum spdk_bdev_event_type type, struct spdk_bdev *bdev, void *event_ctx)
+{
+    if (type == SPDK_BDEV_EVENT_REMOVE) {
+        fprintf(stderr, "bdev %s was removed during replay\n", spdk_bdev_get_name(bdev));
+    }
+}
+
+static void
+bdev_replay_close(struct bdev_replay *r)
+{
+    for (uint32_t i = 0; r->engine.streams && i < r->engine.stream_cnt; i++) {
+        spdk_dma_free(r->engine.streams[i].buf);
+    }
+    replay_engine_free(&r->engine);
+    spdk_dma_free(g_payload.buf);
+    g_payload.buf = NULL;
+    if (r->ch) {
+        spdk_put_io_channel(r->ch);
+        r->ch = NULL;
+    }
+    if (r->desc) {
+        spdk_bdev_close(r->desc);
+        r->desc = NULL;
+    }
+}
+
+static void
+bdev_replay_finish(struct bdev_replay *r)
+{
+    uint64_t tsc_diff = spdk_get_ticks() - g_replay_start_tsc;
+
+    r->rc = r->rc ? r->rc : r->engine.rc;
+    bdev_replay_close(r);
+    replay_stats_report(&r->stats);
+    replay_fidelity_report(&r->stats, r->b, r->entry_cnt, r->zoned);
+    replay_stats_free(&r->stats);
+    printf("Total time: %15ju (tsc) %15.3f (us)\n", tsc_diff,
+           (double)tsc_diff * 1000 * 1000 / spdk_get_ticks_hz());
+    spdk_app_stop(r->rc);
+}
+
+static void
+bdev_replay_done(struct replay_stream *s, struct spdk_bdev_io *bdev_io, bool success)
+{
+    struct spdk_nvme_cpl cpl = {};
+    uint32_t cdw0;
+    int sct = 0, sc = 0;
+
+    if (bdev_io) {
+        spdk_bdev_io_get_nvme_status(bdev_io, &cdw0, &sct, &sc);
+        spdk_bdev_free_io(bdev_io);
+    }
+    if (!success && sct == SPDK_NVME_SCT_GENERIC && sc == SPDK_NVME_SC_SUCCESS) {
+        sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
+    }
+    cpl.status.sct = sct;
+    cpl.status.sc = sc;
+    replay_io_done(&s->io, &cpl);
+    if (!success) {
+        printf("Replay command failed\n");
+    }
+}
+
+static void
+bdev_replay_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    bdev_replay_done((struct replay_stream *)cb_arg, bdev_io, success);
+}
+
+static void bdev_replay_issue(void *arg);
+
+static void
+bdev_replay_unmap_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct replay_stream *s = (struct replay_stream *)cb_arg;
+
+    spdk_bdev_free_io(bdev_io);
+    s->range_failed |= !success;
+    if (++s->range_idx < s->range_cnt) {
+        bdev_replay_issue(s);
+        return;
+    }
+    bdev_replay_done(s, NULL, !s->range_failed);
+}
+
+/* Ranges the app logged right before the DSM d, on the same lcore */
+static uint64_t
+bdev_replay_dsm_ranges(struct replay_stream *s, const struct bin_file_data *d)
+{
+    const struct bin_file_data *b = s->engine->b;
+    uint64_t blocks = 0;
+
+    s->range_cnt = 0;
+    s->range_idx = 0;
+    s->range_failed = false;
+    for (int i = (int)(d - b) - 1; i >= 0 && s->range_cnt < SPDK_DATASET_MANAGEMENT_MAX_RANGES; i--) {
+        if (b[i].lcore != d->lcore) {
+            continue;
+        }
+        if (strcmp(b[i].tpoint_name, "NVME_DSM_RANGE") != 0) {
+            break;
+        }
+        if (b[i].cdw12 != 0) {
+            s->ranges[s->range_cnt++] = i;
+            blocks += b[i].cdw12;
+        }
+    }
+    return blocks;
+}
+
+/* Send the command of stream s, or the current range of its DSM, to the bdev */
+static int
+bdev_replay_submit(struct replay_stream *s)
+{
+    struct bdev_replay *r = (struct bdev_replay *)s->engine->dev;
+    const struct bin_file_data *d = s->io.d;
+    uint32_t nlb = (uint32_t)(d->cdw12 & UINT16BIT_MASK) + 1;
+    uint64_t slba = replay_stream_lba(s, (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32, nlb);
+    uint8_t zone_action = (uint8_t)(d->cdw13 & UINT8BIT_MASK);
+
+    switch (d->opc) {
+    case SPDK_NVME_OPC_READ:
+    case SPDK_NVME_OPC_COMPARE:
+        return spdk_bdev_read_blocks(r->desc, r->ch, s->buf, slba, nlb, bdev_replay_complete, s);
+    case SPDK_NVME_OPC_WRITE:
+    case SPDK_NVME_OPC_ZONE_APPEND:
+        if (r->zoned) {
+            return spdk_bdev_zone_append(r->desc, r->ch, s->wbuf, spdk_bdev_get_zone_id(r->bdev, slba), nlb,
+                                         bdev_replay_complete, s);
+        }
+        return spdk_bdev_write_blocks(r->desc, r->ch, s->wbuf, slba, nlb, bdev_replay_complete, s);
+    case SPDK_NVME_OPC_WRITE_ZEROES:
+        return spdk_bdev_write_zeroes_blocks(r->desc, r->ch, slba, nlb, bdev_replay_complete, s);
+    case SPDK_NVME_OPC_DATASET_MANAGEMENT:
+        d = &s->engine->b[s->ranges[s->range_idx]];
+        slba = replay_stream_lba(s, (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32, d->cdw12);
+        return spdk_bdev_unmap_blocks(r->desc, r->ch, slba, d->cdw12, bdev_replay_unmap_complete, s);
+    case SPDK_NVME_OPC_ZONE_MGMT_SEND:
+        return spdk_bdev_zone_management(r->desc, r->ch, spdk_bdev_get_zone_id(r->bdev, slba),
+                                         g_bdev_zone_action[zone_action], bdev_replay_complete, s);
+    default:
+        return -EINVAL;
+    }
+}
+
+static void
+bdev_replay_issue(void *arg)
+{
+    struct replay_stream *s = (struct replay_stream *)arg;
+    struct bdev_replay *r = (struct bdev_replay *)s->engine->dev;
+    int rc = bdev_replay_submit(s);
+
+    if (rc == -ENOMEM) {
+        /* the bdev ran out of spdk_bdev_io; the wait counts as latency */
+        s->wait.bdev = r->bdev;
+        s->wait.cb_fn = bdev_replay_issue;
+        s->wait.cb_arg = s;
+        spdk_bdev_queue_io_wait(r->bdev, r->ch, &s->wait);
+    } else if (rc != 0) {
+        struct spdk_nvme_cpl cpl = {};
+
+        fprintf(stderr, "Replay failed: %s\n", spdk_strerror(-rc));
+        s->engine->rc = rc;
+        cpl.status.sc = SPDK_NVME_SC_INTERNAL_DEVICE_ERROR;
+        replay_io_done(&s->io, &cpl);
+    }
+}
+
+/* Engine submit function of the bdev mode */
+static int
+process_bdev_replay(void *dev, struct replay_stream *s, const struct bin_file_data *d)
+{
+    struct bdev_replay *r = (struct bdev_replay *)dev;
+    uint64_t bytes = (uint64_t)((d->cdw12 & UINT16BIT_MASK) + 1) * r->block_size;
+    uint8_t zone_action = (uint8_t)(d->cdw13 & UINT8BIT_MASK);
+    int cls = replay_opc_class(d, r->zoned);
+
+    switch (cls) {
+    case REPLAY_OPC_CLASSES:
+        return REPLAY_SKIP;
+    case REPLAY_OPC_ZONE_MGMT:
+        /* the bdev zone API works on one zone at a time */
+        if (zone_action < SPDK_NVME_ZONE_CLOSE || zone_action > SPDK_NVME_ZONE_OFFLINE ||
+            (d->cdw13 & (uint32_t)1 << 8)) {
+            return REPLAY_SKIP;
+        }
+        bytes = 0;
+        break;
+    case REPLAY_OPC_DEALLOCATE:
+        bytes = bdev_replay_dsm_ranges(s, d) * r->block_size;
+        if (s->range_cnt == 0) {
+            return REPLAY_SKIP;
+        }
+        break;
+    case REPLAY_OPC_WRITE:
+        s->wbuf = payload_get(bytes);
+        break;
+    }
+    replay_io_start(&s->io, s->engine->stats, d, (uint8_t)cls, bytes);
+    bdev_replay_issue(s);
+    return 0;
+}
+
+static int
+bdev_replay_poll(void *arg)
+{
+    struct bdev_replay *r = (struct bdev_replay *)arg;
+
+    if (replay_engine_step(&r->engine)) {
+        return SPDK_POLLER_BUSY;
+    }
+    spdk_poller_unregister(&r->poller);
+    bdev_replay_finish(r);
+    return SPDK_POLLER_BUSY;
+}
+
+static void
+bdev_replay_begin(struct bdev_replay *r)
+{
+    g_replay_start_tsc = spdk_get_ticks();
+    r->poller = SPDK_POLLER_REGISTER(bdev_replay_poll, r, 0);
+    if (r->poller == NULL) {
+        fprintf(stderr, "Could not register the replay poller\n");
+        r->rc = -ENOMEM;
+        bdev_replay_finish(r);
+    }
+}
+
+static void bdev_reset_zones(void *arg);
+
+static void
+bdev_reset_zone_complete(struct spdk_bdev_io *bdev_io, bool success, void *cb_arg)
+{
+    struct bdev_replay *r = (struct bdev_replay *)cb_arg;
+
+    spdk_bdev_free_io(bdev_io);
+    if (!success) {
+        printf("Reset zone %ju failed\n", r->zone);
+    }
+    r->zone++;
+    bdev_reset_zones(r);
+}
+
+/* Reset every zone, one after the other, then start the replay */
+static void
+bdev_reset_zones(void *arg)
+{
+    struct bdev_replay *r = (struct bdev_replay *)arg;
+    int rc;
+
+    if (r->zone == spdk_bdev_get_num_zones(r->bdev)) {
+        printf("Reset all zone complete.\n");
+        bdev_replay_begin(r);
+        return;
+    }
+    rc = spdk_bdev_zone_management(r->desc, r->ch, r->zone * spdk_bdev_get_zone_size(r->bdev),
+                                   SPDK_BDEV_ZONE_RESET, bdev_reset_zone_complete, r);
+    if (rc == -ENOMEM) {
+        r->wait.bdev = r->bdev;
+        r->wait.cb_fn = bdev_reset_zones;
+        r->wait.cb_arg = r;
+        spdk_bdev_queue_io_wait(r->bdev, r->ch, &r->wait);
+    } else if (rc != 0) {
+        fprintf(stderr, "Reset all zones failed\n");
+        r->rc = rc;
+        bdev_replay_finish(r);
+    }
+}
+
+/* Reset the zones of a zoned bdev, then replay */
+static void
+bdev_replay_ready(struct bdev_replay *r)
+{
+    if (r->zoned) {
+        /* reset zone before write */
+        r->zone = 0;
+        bdev_reset_zones(r);
+    } else {
+        bdev_replay_begin(r);
+    }
+}
+
+static int
+bdev_precond_poll(void *arg)
+{
+    struct bdev_replay *r = (struct bdev_replay *)arg;
+
+    if (precond_step(&r->precond)) {
+        return SPDK_POLLER_BUSY;
+    }
+    spdk_poller_unregister(&r->poller);
+    r->rc = precond_free(&r->precond);
+    if (r->rc != 0) {
+        bdev_replay_finish(r);
+    } else {
+        bdev_replay_ready(r);
+    }
+    return SPDK_POLLER_BUSY;
+}
+
+/* Precondition the bdev from a poller, then go on with bdev_replay_ready() */
+static void
+bdev_precondition(struct bdev_replay *r)
+{
+    uint64_t chunk = PRECOND_CHUNK_BYTES / r->block_size;
+    uint32_t qd = g_precond_qd;
+    int rc;
+
+    if (r->zoned) {
+        /* a zone append cannot be split */
+        if (spdk_bdev_get_max_zone_append_size(r->bdev)) {
+            chunk = spdk_min(chunk, spdk_bdev_get_max_zone_append_size(r->bdev));
+        }
+        if (spdk_bdev_get_max_open_zones(r->bdev)) {
+            qd = spdk_min(qd, spdk_bdev_get_max_open_zones(r->bdev));
+        }
+    }
+    rc = precond_init(&r->precond, &r->engine, r->engine.submit, r->engine.dev,
+                      spdk_bdev_get_num_blocks(r->bdev), r->zoned ? spdk_bdev_get_zone_size(r->bdev) : 0, NULL,
+                      chunk, qd);
+    if (rc != 0) {
+        r->rc = rc;
+        bdev_replay_finish(r);
+        return;
+    }
+    r->poller = SPDK_POLLER_REGISTER(bdev_precond_poll, r, 0);
+    if (r->poller == NULL) {
+        fprintf(stderr, "Could not register the precondition poller\n");
+        precond_free(&r->precond);
+        r->rc = -ENOMEM;
+        bdev_replay_finish(r);
+    }
+}
+
+/* App start callback: the JSON config has been loaded and the bdevs exist */
+static void
+bdev_replay_start(void *arg)
+{
+    struct bdev_replay *r = (struct bdev_replay *)arg;
+    size_t buf_size;
+    int rc;
+
+    rc = spdk_bdev_open_ext(g_bdev_name, true, bdev_event_cb, NULL, &r->desc);
+    if (rc != 0) {
+        fprintf(stderr, "Could not open bdev %s: %s\n", g_bdev_name, spdk_strerror(-rc));
+        spdk_app_stop(rc);
+        return;
+    }
+    r->bdev = spdk_bdev_desc_get_bdev(r->desc);
+    r->ch = spdk_bdev_get_io_channel(r->desc);
+    if (r->ch == NULL) {
+        fprintf(stderr, "Could not get an I/O channel for bdev %s\n", g_bdev_name);
+        rc = -ENOMEM;
+        goto err;
+    }
+    r->block_size = spdk_bdev_get_block_size(r->bdev);
+    r->zoned = spdk_bdev_is_zoned(r->bdev);
+    g_block_size = r->block_size;
+    g_replay_unmap = spdk_bdev_io_type_supported(r->bdev, SPDK_BDEV_IO_TYPE_UNMAP);
+    if (r->zoned && g_precond_mode != PRECOND_NONE) {
+        /* its zones are reset before the replay, which would undo the preconditioning */
+        fprintf(stderr, "-P is not supported on a zoned bdev\n");
+        rc = -EINVAL;
+        goto err;
+    }
+
+    if (replay_stats_init(&r->stats) != 0) {
+        fprintf(stderr, "Fail to allocate memory for replay stats\n");
+        rc = -ENOMEM;
+        goto err;
+    }
+    replay_timing_alloc(&r->stats, r->b, r->entry_cnt);
+    printf("Replaying to bdev %s: %ju blocks of %u bytes%s%s\n", g_bdev_name,
+           spdk_bdev_get_num_blocks(r->bdev), r->block_size, r->zoned ? ", zoned" : "",
+           g_replay_unmap ? ", unmap" : "");
+    rc = replay_engine_init(&r->engine, r->b, r->entry_cnt, r->zoned, spdk_bdev_get_num_blocks(r->bdev),
+                            r->zoned ? spdk_bdev_get_zone_size(r->bdev) : 0, &r->stats, process_bdev_replay, r);
+    if (rc != 0) {
+        goto free_stats;
+    }
+    buf_size = replay_max_nlb(r->b, r->entry_cnt, r->zoned) * r->block_size;
+    for (uint32_t i = 0; i < r->engine.stream_cnt; i++) {
+        r->engine.streams[i].buf = (char *)spdk_dma_zmalloc(buf_size, spdk_bdev_get_buf_align(r->bdev), NULL);
+        if (r->engine.streams[i].buf == NULL) {
+            fprintf(stderr, "Fail to allocate memory for replay_buf\n");
+            rc = -ENOMEM;
+            goto free_stats;
+        }
+    }
+    g_payload.size = payload_pool_size(buf_size);
+    g_payload.buf = (char *)spdk_dma_zmalloc(g_payload.size, PAYLOAD_BLOCK, NULL);
+    if (g_payload.buf == NULL) {
+        fprintf(stderr, "Fail to allocate memory for the write payload\n");
+        rc = -ENOMEM;
+        goto free_stats;
+    }
+    payload_fill();
+
+    if (g_precond_mode != PRECOND_NONE) {
+        bdev_precondition(r);
+    } else {
+        bdev_replay_ready(r);
+    }
+    return;
+
+free_stats:
+    replay_stats_free(&r->stats);
+err:
+    bdev_replay_close(r);
+    spdk_app_stop(rc);
+}
+
+static int
+bdev_replay_run(struct bin_file_data *b, int entry_cnt)
+{
+    struct spdk_app_opts opts = {};
+    int rc;
+
+    spdk_app_opts_init(&opts, sizeof(opts));
+    opts.name = "trace_io_replay";
+    opts.json_config_file = g_bdev_json;
+    if (g_spdk_trace) {
+        opts.tpoint_group_mask = g_tpoint_group_name;
+    }
+    g_bdev_replay.b = b;
+    g_bdev_replay.entry_cnt = entry_cnt;
+
+    rc = spdk_app_start(&opts, bdev_replay_start, &g_bdev_replay);
+    spdk_app_fini();
+    return rc;
+}
+/* bdev replay end */
+
+static void
+usage(const char *program_name)
+{
+    printf("usage:\n");
+    printf("%s <options>\n", program_name);
+    printf("\n");
+    printf(" -f, specify the input file which generated by trace_io_record\n");
+    printf(" -z, to display zone\n");
+    printf(" -n, to specify the number of displayed zone\n");
+    printf("     (-n must be used with -z)\n");
+    printf(" -o, to write every replayed I/O to the given file in the trace_io_record format\n");
+    printf("     (compare with the capture: trace_io_analysis --compare <capture> <file>)\n");
+    printf(" -k, replay through the kernel to the given file or block device (e.g. /dev/nvme0n1)\n");
+    printf("     instead of the SPDK NVMe driver; no hugepages or vfio needed\n");
+    printf(" -K, kernel I/O engine: uring (default, falls back to libaio) or aio\n");
+    printf(" -S, use an io_uring SQPOLL kernel thread for submission\n");
+    printf(" -b, sector size in bytes slba/nlb are scaled by for -k\n");
+    printf("     (default: logical block size of the device, 512 for a file)\n");
+    printf(" -r, transport ID of the NVMe controller to replay to, e.g.\n");
+    printf("     'trtype:TCP adrfam:IPv4 traddr:192.168.0.10 trsvcid:4420 subnqn:nqn.2016-06.io.spdk:cnode1'\n");
+    printf("     or a PCIe BDF such as 0000:04:00.0 (default: every local PCIe controller)\n");
+    printf(" -N, namespace ID to replay to (default: the first active namespace)\n");
+    printf(" -B, replay through the SPDK bdev layer to the named bdev\n");
+    printf(" -j, JSON config that creates the bdev (must be used with -B)\n");
+    printf(" -I, limit the replay to the given IOPS\n");
+    printf(" -M, limit the replay to the given MB/s\n");
+    printf(" -c, replay the given number of copies of the trace concurrently, as fast as possible\n");
+    printf(" -L, blocks between the LBAs of two copies (default: the namespace divided by -c)\n");
+    printf(" -i, passes over the trace (default: 1, 0: until -t is up)\n");
+    printf(" -t, stop the replay after the given seconds\n");
+    printf(" -s, blocks the LBAs move on by every pass\n");
+    printf(" -w, leave the first given seconds out of the report\n");
+    printf(" -W, leave everything before steady state out of the report, checked every given ms\n");
+    printf(" -V, steady state tolerance: max variation of IOPS and latency in percent (default: 5)\n");
+    printf(" -P, precondition the target before the replay:\n");
+    printf("     seq: write it once sequentially, rand: seq plus random 4K overwrites until steady state,\n");
+    printf("     checked every -W ms (default: 1000), capture: write every block the trace reads or writes;\n");
+    printf("     zoned targets are filled and left full, each zone is reset when first appended to\n");
+    printf(" -R, capacity the random overwrite of -P rand writes at most, in passes (default: 2)\n");
+    printf(" -Q, queue depth of the preconditioning (default: 32)\n");
+    printf(" -C, compression ratio of the write data, e.g. 2 for 2:1 (default: 1, incompressible)\n");
+    printf(" -D, percent of the written 4K blocks that duplicate another (default: 0)\n");
+    printf(" -p, MiB of write data generated up front and rotated through (default: 64)\n");
+    //printf(" -e, enable spdk tracepoint\n");
+    spdk_trace_mask_usage(stdout, "-e");
+}
+
+static int
+parse_args(int argc, char **argv, char *file_name, size_t file_name_size)
+{
+    struct spdk_pci_addr pci_addr;
+    long nsid, copies;
+    long long val;
+    char *end;
+    bool loops_set = false;
+    int op;
+
+    while ((op = getopt(argc, argv, "f:zn:e:o:k:K:Sb:B:j:r:N:I:M:c:L:i:t:s:w:W:V:P:R:Q:C:D:p:")) != -1) {
+        switch (op) {
+        case 'f':
+            g_input_file = true;
+            snprintf(file_name, file_name_size, "%s", optarg);
+            break;
+        case 'z':
+            g_report_zone = true;
+            break;
+        case 'n':
+            g_zone_report_limit = atoi(optarg);
+            break;
+        case 'e':
+            g_spdk_trace = true;
+            g_tpoint_group_name = optarg;
+            break;
+        case 'o':
+            snprintf(g_io_log_name, sizeof(g_io_log_name), "%s", optarg);
+            break;
+        case 'k':
+            snprintf(g_kdev_path, sizeof(g_kdev_path), "%s", optarg);
+            break;
+        case 'K':
+            if (strcmp(optarg, "uring") == 0) {
+                g_kdev_engine = KDEV_ENGINE_URING;
+            } else if (strcmp(optarg, "aio") == 0) {
+                g_kdev_engine = KDEV_ENGINE_AIO;
+            } else {
+                fprintf(stderr, "Unknown kernel I/O engine %s\n", optarg);
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'S':
+            g_kdev_sqpoll = true;
+            break;
+        case 'r':
+            if (spdk_pci_addr_parse(&pci_addr, optarg) == 0) {
+                spdk_nvme_trid_populate_transport(&g_trid, SPDK_NVME_TRANSPORT_PCIE);
+                spdk_pci_addr_fmt(g_trid.traddr, sizeof(g_trid.traddr), &pci_addr);
+            } else if (spdk_nvme_transport_id_parse(&g_trid, optarg) != 0) {
+                fprintf(stderr, "Invalid transport ID %s\n", optarg);
+                return 1;
+            }
+            g_trid_set = true;
+            break;
+        case 'N':
+            nsid = spdk_strtol(optarg, 10);
+            if (nsid <= 0 || nsid > UINT32_MAX) {
+                fprintf(stderr, "Invalid namespace ID %s\n", optarg);
+                return 1;
+            }
+            g_nsid = (uint32_t)nsid;
+            break;
+        case 'B':
+            snprintf(g_bdev_name, sizeof(g_bdev_name), "%s", optarg);
+            break;
+        case 'j':
+            snprintf(g_bdev_json, sizeof(g_bdev_json), "%s", optarg);
+            break;
+        case 'I':
+        case 'M':
+            val = spdk_strtoll(optarg, 10);
+            if (val <= 0) {
+                fprintf(stderr, "Invalid rate limit %s\n", optarg);
+                return 1;
+            }
+            if (op == 'I') {
+                g_rate_iops = (uint64_t)val;
+            } else {
+                g_rate_mbps = (uint64_t)val;
+            }
+            break;
+        case 'c':
+            copies = spdk_strtol(optarg, 10);
+            if (copies < 1 || copies > REPLAY_MAX_COPIES) {
+                fprintf(stderr, "Copies must be between 1 and %d\n", REPLAY_MAX_COPIES);
+                return 1;
+            }
+            g_copies = (uint32_t)copies;
+            break;
+        case 'L':
+        case 'i':
+        case 's':
+        case 'w':
+            val = spdk_strtoll(optarg, 10);
+            if (val < 0) {
+                fprintf(stderr, "Invalid -%c value %s\n", op, optarg);
+                return 1;
+            }
+            if (op == 'L') {
+                g_copy_shift = (uint64_t)val;
+            } else if (op == 'i') {
+                g_loops = (uint64_t)val;
+                loops_set = true;
+            } else if (op == 's') {
+                g_loop_shift = (uint64_t)val;
+            } else {
+                g_warmup_sec = (uint64_t)val;
+            }
+            break;
+        case 't':
+        case 'W':
+            val = spdk_strtoll(optarg, 10);
+            if (val <= 0) {
+                fprintf(stderr, "Invalid -%c value %s\n", op, optarg);
+                return 1;
+            }
+            if (op == 't') {
+                g_duration_sec = (uint64_t)val;
+            } else {
+                g_steady_state = true;
+                g_window_ms = (uint64_t)val;
+            }
+            break;
+        case 'P':
+            if (strcmp(optarg, "seq") == 0) {
+                g_precond_mode = PRECOND_SEQ;
+            } else if (strcmp(optarg, "rand") == 0) {
+                g_precond_mode = PRECOND_RAND;
+            } else if (strcmp(optarg, "capture") == 0) {
+                g_precond_mode = PRECOND_CAPTURE;
+            } else {
+                fprintf(stderr, "Unknown precondition %s\n", optarg);
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'R':
+            val = spdk_strtoll(optarg, 10);
+            if (val <= 0) {
+                fprintf(stderr, "Invalid -%c value %s\n", op, optarg);
+                return 1;
+            }
+            g_precond_passes = (uint64_t)val;
+            break;
+        case 'Q':
+            val = spdk_strtoll(optarg, 10);
+            if (val <= 0 || val > REPLAY_MAX_COPIES) {
+                fprintf(stderr, "Precondition queue depth must be between 1 and %d\n", REPLAY_MAX_COPIES);
+                return 1;
+            }
+            g_precond_qd = (uint32_t)val;
+            break;
+        case 'C':
+            g_payload_compress = strtod(optarg, &end);
+            if (*end != '\0' || !(g_payload_compress >= 1 && g_payload_compress <= PAYLOAD_SEGMENT / 8)) {
+                fprintf(stderr, "Compression ratio must be between 1 and %d\n", PAYLOAD_SEGMENT / 8);
+                return 1;
+            }
+            break;
+        case 'D':
+            val = spdk_strtoll(optarg, 10);
+            if (val < 0 || val >= 100) {
+                fprintf(stderr, "Duplicate blocks must be between 0 and 99 percent\n");
+                return 1;
+            }
+            g_payload_dupe = (uint32_t)val;
+            break;
+        case 'p':
+            val = spdk_strtoll(optarg, 10);
+            if (val <= 0) {
+                fprintf(stderr, "Invalid -%c value %s\n", op, optarg);
+                return 1;
+            }
+            g_payload_mb = (uint64_t)val;
+            break;
+        case 'V':
+            val = spdk_strtoll(optarg, 10);
+            if (val <= 0 || val >= 100) {
+                fprintf(stderr, "Steady state tolerance must be between 1 and 99 percent\n");
+                return 1;
+            }
+            g_steady_tolerance = (double)val / 100;
+            break;
+        case 'b':
+            g_kdev_sector_size = (uint32_t)spdk_strtol(optarg, 10);
+            if (g_kdev_sector_size < 512 || !spdk_u32_is_pow2(g_kdev_sector_size)) {
+                fprintf(stderr, "Sector size must be a power of two of at least 512\n");
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (g_loops == 0 && g_duration_sec == 0) {
+        fprintf(stderr, "Looping until the duration is up (-i 0) needs -t\n");
+        return 1;
+    }
+    if (g_duration_sec && !loops_set) {
+        /* -t alone loops the trace for the whole duration */
+        g_loops = 0;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct spdk_env_opts env_opts;
+    struct ns_entry *ns_entry;
+    char input_file_name[68];
+
+    /* Get the input file name */
+    int rc = parse_args(argc, argv, input_file_name, sizeof(input_file_name));
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (input_file_name == NULL || !g_input_file) {
+        fprintf(stderr, "-f input file must be specified\n");
+        exit(1);
+    }
+
+    FILE *fptr = fopen(input_file_name, "rb");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open input file %s\n", input_file_name);
+        return -1; 
+    }
+
+    fseek(fptr, 0, SEEK_END);
+    int file_size = ftell(fptr);
+    rewind(fptr);
+    int entry_cnt = file_size / sizeof(struct bin_file_data);
+
+    struct bin_file_data buffer[entry_cnt];    
+ 
+    size_t read_val = fread(&buffer, sizeof(struct bin_file_data), entry_cnt, fptr);
     if (read_val != (size_t)entry_cnt) {
         fprintf(stderr, "Fail to read input file\n");
         return -1;
     }
     fclose(fptr);
 
+    if ((g_kdev_path[0] || g_bdev_name[0]) && g_report_zone) {
+        fprintf(stderr, "-z needs the SPDK NVMe driver and cannot be used with -k or -B\n");
+        return 1;
+    }
+    if (g_kdev_path[0] && g_bdev_name[0]) {
+        fprintf(stderr, "-k and -B cannot be used together\n");
+        return 1;
+    }
+    if ((g_kdev_path[0] || g_bdev_name[0]) && (g_trid_set || g_nsid)) {
+        fprintf(stderr, "-r and -N select an NVMe controller and cannot be used with -k or -B\n");
+        return 1;
+    }
+    if (!g_bdev_name[0] != !g_bdev_json[0]) {
+        fprintf(stderr, "-B and -j must be used together\n");
+        return 1;
+    }
+
+    if (g_io_log_name[0]) {
+        g_io_log = fopen(g_io_log_name, "wb");
+        if (g_io_log == NULL) {
+            fprintf(stderr, "Failed to open output file %s\n", g_io_log_name);
+            return 1;
+        }
+        setvbuf(g_io_log, NULL, _IOFBF, 1 << 20);
+    }
+
+    /* The bdev mode runs inside the app framework, which sets up the env itself */
+    if (g_bdev_name[0]) {
+        rc = bdev_replay_run(buffer, entry_cnt);
+        if (g_io_log) {
+            fclose(g_io_log);
+            printf("Per-I/O records: %s\n", g_io_log_name);
+        }
+        return rc;
+    }
+
     /* Get trid */
-    spdk_nvme_trid_populate_transport(&g_trid, SPDK_NVME_TRANSPORT_PCIE);
-    snprintf(g_trid.subnqn, sizeof(g_trid.subnqn), "%s", SPDK_NVMF_DISCOVERY_NQN);
+    if (!g_trid_set) {
+        spdk_nvme_trid_populate_transport(&g_trid, SPDK_NVME_TRANSPORT_PCIE);
+    }
+    if (g_trid.subnqn[0] == '\0') {
+        /* over fabrics, attach every subsystem the discovery service reports */
+        snprintf(g_trid.subnqn, sizeof(g_trid.subnqn), "%s", SPDK_NVMF_DISCOVERY_NQN);
+    }
 
     /* Initialize env */
     spdk_env_opts_init(&env_opts);
     env_opts.name = "trace_io_replay";
+    if (g_kdev_path[0]) {
+        /* the kernel backend only needs the env for ticks and trace */
+        env_opts.no_pci = true;
+        env_opts.no_huge = true;
+        env_opts.mem_size = 64;
+    }
     if (spdk_env_init(&env_opts) < 0) {
         fprintf(stderr, "Unable to initialize SPDK env\n");
         return 1;
@@ -604,25 +4073,50 @@ main(int argc, char **argv)
     }
 
     /* Register ctrlr & register ns */
-    printf("Initializing NVMe Controllers\n");
-    
-    rc = spdk_nvme_probe(&g_trid, NULL, probe_cb, attach_cb, NULL);
-    if (rc != 0) {
-        fprintf(stderr, "spdk_nvme_probe() failed\n");
-        goto exit;
-    }
-    
-    if (TAILQ_EMPTY(&g_controllers)) {
-        fprintf(stderr, "no NVMe controllers found\n");
-        goto exit;
+    if (!g_kdev_path[0]) {
+        printf("Initializing NVMe Controllers\n");
+
+        rc = spdk_nvme_probe(&g_trid, NULL, probe_cb, attach_cb, NULL);
+        if (rc != 0) {
+            fprintf(stderr, "spdk_nvme_probe() failed\n");
+            goto exit;
+        }
+
+        if (TAILQ_EMPTY(&g_controllers)) {
+            fprintf(stderr, "no NVMe controllers found\n");
+            goto exit;
+        }
+        ns_entry = select_ns();
+        if (ns_entry == NULL) {
+            if (g_nsid) {
+                fprintf(stderr, "Namespace %u not found\n", g_nsid);
+            } else {
+                fprintf(stderr, "no active namespace found\n");
+            }
+            rc = 1;
+            goto exit;
+        }
+        printf("Initialization complete.\n");
+        printf("Replaying to %s %s namespace %u\n",
+               spdk_nvme_transport_id_trtype_str(spdk_nvme_ctrlr_get_transport_id(ns_entry->ctrlr)->trtype),
+               spdk_nvme_ctrlr_get_transport_id(ns_entry->ctrlr)->traddr, spdk_nvme_ns_get_id(ns_entry->ns));
     }
-    printf("Initialization complete.\n");
-    
+
     /* Start trace repaly procedure */
     uint64_t tsc_rate = spdk_get_ticks_hz();
     uint64_t start_tsc = spdk_get_ticks();
+    g_replay_start_tsc = start_tsc;
    
-    process_entry(buffer, entry_cnt);
+    if (g_kdev_path[0]) {
+        process_kernel_entry(buffer, entry_cnt);
+    } else {
+        process_entry(buffer, entry_cnt);
+    }
+
+    if (g_io_log) {
+        fclose(g_io_log);
+        printf("Per-I/O records: %s\n", g_io_log_name);
+    }
 
     uint64_t end_tsc = spdk_get_ticks();
     uint64_t tsc_diff = end_tsc - start_tsc;
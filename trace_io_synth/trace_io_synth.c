@@ -0,0 +1,1151 @@
+#include "spdk/stdinc.h"
+#include "spdk/util.h"
+#include "spdk/nvme_spec.h"
+#include "../include/trace_io.h"
+
+#include <pthread.h>
+
+/*
+ * trace_io_synth fits a small statistical model to a trace written by
+ * trace_io_record and generates synthetic traces in the same format from it:
+ *
+ *   trace_io_synth -f capture.bin -m model.txt          (fit)
+ *   trace_io_synth -m model.txt -o synth.bin -r 4 -D 10 (generate)
+ *
+ * The model is plain text and holds no LBA or time of any single I/O, only
+ * distributions per lcore: opcode mix, transfer sizes, LBA regions,
+ * sequential run probability, inter-arrival and latency quantiles, and the
+ * queue depth the lcore reached.
+ */
+
+#define MODEL_VERSION 1
+#define MODEL_QUANTILES 64      /* inverse CDFs are kept as 65 points, 0 to 100 % */
+#define MODEL_REGIONS 64        /* LBA locality: I/O share of equal slices of the namespace */
+#define MODEL_SIZES 16          /* most common transfer sizes per opcode */
+#define MODEL_OPCS 16
+#define LOAD_CHUNK 65536
+
+#define SLICE_IOS 65536         /* expected submits per generated time slice */
+#define MAX_THREADS 64
+
+struct opc_model {
+    uint8_t  opc;
+    uint64_t cnt;
+    double   seq;               /* chance the I/O starts where the last one of this opcode ended */
+    uint32_t size_n;
+    uint32_t size_nlb[MODEL_SIZES];
+    uint64_t size_cnt[MODEL_SIZES];
+    uint64_t region_cnt[MODEL_REGIONS];
+    uint64_t lat_q[MODEL_QUANTILES + 1];
+};
+
+struct lcore_model {
+    uint32_t lcore;
+    uint32_t nsid;
+    uint64_t ios;
+    uint32_t qd_max;
+    double   qd_avg;
+    uint64_t gap_q[MODEL_QUANTILES + 1];
+    uint32_t opc_n;
+    struct opc_model opc[MODEL_OPCS];
+};
+
+struct model {
+    uint64_t tsc_rate;
+    uint64_t duration;          /* tsc from the first to the last submit */
+    uint64_t ns_blocks;
+    uint32_t lcore_n;
+    struct lcore_model *lcore;
+};
+
+static char g_input_file[1024];
+static char g_model_file[1024];
+static char g_output_file[1024];
+static double g_rate_mult = 1;
+static double g_duration_mult = 1;
+static uint64_t g_ns_blocks = 0;
+static uint32_t g_threads = 0;
+static uint64_t g_seed = 1;
+
+/* model fit start */
+struct io_rec {
+    uint64_t obj_id;
+    uint64_t obj_start;
+    uint64_t slba;
+    uint64_t lat;
+    uint32_t lcore;
+    uint32_t nsid;
+    uint32_t nlb;
+    uint8_t  opc;
+    bool     completed;
+};
+
+static int
+io_rec_key_cmp(const void *a, const void *b)
+{
+    const struct io_rec *x = (const struct io_rec *)a, *y = (const struct io_rec *)b;
+
+    if (x->obj_id != y->obj_id) {
+        return x->obj_id < y->obj_id ? -1 : 1;
+    }
+    return x->obj_start == y->obj_start ? 0 : (x->obj_start < y->obj_start ? -1 : 1);
+}
+
+/* lcore first, then submit time */
+static int
+io_rec_time_cmp(const void *a, const void *b)
+{
+    const struct io_rec *x = (const struct io_rec *)a, *y = (const struct io_rec *)b;
+
+    if (x->lcore != y->lcore) {
+        return x->lcore < y->lcore ? -1 : 1;
+    }
+    return x->obj_start == y->obj_start ? 0 : (x->obj_start < y->obj_start ? -1 : 1);
+}
+
+static int
+u64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x == y ? 0 : (x < y ? -1 : 1);
+}
+
+static bool
+opc_has_lba(uint8_t opc)
+{
+    switch (opc) {
+    case SPDK_NVME_OPC_WRITE:
+    case SPDK_NVME_OPC_READ:
+    case SPDK_NVME_OPC_WRITE_UNCORRECTABLE:
+    case SPDK_NVME_OPC_COMPARE:
+    case SPDK_NVME_OPC_WRITE_ZEROES:
+    case SPDK_NVME_OPC_VERIFY:
+    case SPDK_NVME_OPC_ZONE_APPEND:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Sort v and keep MODEL_QUANTILES + 1 evenly spaced order statistics */
+static void
+fit_quantiles(uint64_t *v, uint64_t n, uint64_t *q)
+{
+    if (n == 0) {
+        memset(q, 0, (MODEL_QUANTILES + 1) * sizeof(uint64_t));
+        return;
+    }
+    qsort(v, n, sizeof(uint64_t), u64_cmp);
+    for (uint32_t i = 0; i <= MODEL_QUANTILES; i++) {
+        q[i] = v[(n - 1) * i / MODEL_QUANTILES];
+    }
+}
+
+static struct opc_model *
+opc_model_get(struct lcore_model *lm, uint8_t opc)
+{
+    for (uint32_t i = 0; i < lm->opc_n; i++) {
+        if (lm->opc[i].opc == opc) {
+            return &lm->opc[i];
+        }
+    }
+    if (lm->opc_n == MODEL_OPCS) {
+        return NULL;
+    }
+    lm->opc[lm->opc_n].opc = opc;
+    return &lm->opc[lm->opc_n++];
+}
+
+/*
+ * Keep the MODEL_SIZES most common sizes of the sorted nlb list; I/O of
+ * the other sizes are counted to the closest kept size.
+ */
+static int
+fit_sizes(struct opc_model *om, const uint64_t *nlb, uint64_t n)
+{
+    uint64_t *packed;   /* count << 32 | nlb */
+    uint64_t distinct = 0;
+
+    packed = (uint64_t *)malloc((n + 1) * sizeof(uint64_t));
+    if (packed == NULL) {
+        fprintf(stderr, "Fail to allocate memory for size distribution\n");
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < n;) {
+        uint64_t j = i;
+
+        while (j < n && nlb[j] == nlb[i]) {
+            j++;
+        }
+        packed[distinct++] = (spdk_min(j - i, UINT32_MAX) << 32) | nlb[i];
+        i = j;
+    }
+    qsort(packed, distinct, sizeof(uint64_t), u64_cmp);
+
+    om->size_n = (uint32_t)spdk_min(distinct, MODEL_SIZES);
+    for (uint64_t d = 0; d < distinct; d++) {
+        uint64_t p = packed[distinct - 1 - d];
+        uint32_t best = 0;
+
+        if (d < MODEL_SIZES) {
+            om->size_nlb[d] = (uint32_t)p;
+            om->size_cnt[d] = p >> 32;
+            continue;
+        }
+        for (uint32_t k = 1; k < om->size_n; k++) {
+            if (llabs((int64_t)om->size_nlb[k] - (int64_t)(uint32_t)p) <
+                llabs((int64_t)om->size_nlb[best] - (int64_t)(uint32_t)p)) {
+                best = k;
+            }
+        }
+        om->size_cnt[best] += p >> 32;
+    }
+    free(packed);
+    return 0;
+}
+
+/* Queue depth of one lcore from its completed I/O: time-weighted average and peak */
+static int
+fit_qd(struct lcore_model *lm, const struct io_rec *io, uint64_t n)
+{
+    uint64_t *ev = (uint64_t *)malloc((2 * n + 1) * sizeof(uint64_t));
+    uint64_t cnt = 0, cur = 0, area = 0;
+
+    if (ev == NULL) {
+        fprintf(stderr, "Fail to allocate memory for queue depth events\n");
+        return -ENOMEM;
+    }
+    /* tsc << 1 | is_submit: at the same tick completions retire first */
+    for (uint64_t i = 0; i < n; i++) {
+        if (io[i].completed) {
+            ev[cnt++] = io[i].obj_start << 1 | 1;
+            ev[cnt++] = (io[i].obj_start + io[i].lat) << 1;
+        }
+    }
+    qsort(ev, cnt, sizeof(uint64_t), u64_cmp);
+    for (uint64_t i = 0; i < cnt; i++) {
+        if (i) {
+            area += cur * ((ev[i] >> 1) - (ev[i - 1] >> 1));
+        }
+        cur = (ev[i] & 1) ? cur + 1 : cur - 1;
+        lm->qd_max = (uint32_t)spdk_max(lm->qd_max, cur);
+    }
+    if (cnt > 1 && (ev[cnt - 1] >> 1) > (ev[0] >> 1)) {
+        lm->qd_avg = (double)area / ((ev[cnt - 1] >> 1) - (ev[0] >> 1));
+    }
+    free(ev);
+    return 0;
+}
+
+/* io holds the submits of one lcore in time order */
+static int
+fit_lcore(struct model *m, struct lcore_model *lm, struct io_rec *io, uint64_t n)
+{
+    uint64_t *v = (uint64_t *)malloc((n + 1) * sizeof(uint64_t));
+    uint64_t prev_end[MODEL_OPCS] = {}, seq[MODEL_OPCS] = {}, runs[MODEL_OPCS] = {};
+    int rc = 0;
+
+    if (v == NULL) {
+        fprintf(stderr, "Fail to allocate memory for lcore model\n");
+        return -ENOMEM;
+    }
+    lm->lcore = io[0].lcore;
+    lm->nsid = io[0].nsid;
+    lm->ios = n;
+
+    for (uint64_t i = 1; i < n; i++) {
+        v[i - 1] = io[i].obj_start - io[i - 1].obj_start;
+    }
+    fit_quantiles(v, n - 1, lm->gap_q);
+
+    for (uint64_t i = 0; i < n; i++) {
+        struct opc_model *om = opc_model_get(lm, io[i].opc);
+        uint32_t k;
+
+        if (om == NULL) {
+            continue;
+        }
+        k = (uint32_t)(om - lm->opc);
+        om->cnt++;
+        if (!opc_has_lba(io[i].opc)) {
+            continue;
+        }
+        if (runs[k]++ && io[i].slba == prev_end[k]) {
+            seq[k]++;
+        }
+        prev_end[k] = io[i].slba + io[i].nlb;
+        om->region_cnt[spdk_min(io[i].slba * MODEL_REGIONS / m->ns_blocks, MODEL_REGIONS - 1)]++;
+    }
+
+    for (uint32_t k = 0; k < lm->opc_n && !rc; k++) {
+        struct opc_model *om = &lm->opc[k];
+        uint64_t cnt = 0;
+
+        om->seq = runs[k] > 1 ? (double)seq[k] / (runs[k] - 1) : 0;
+        for (uint64_t i = 0; i < n; i++) {
+            if (io[i].opc == om->opc && opc_has_lba(om->opc)) {
+                v[cnt++] = io[i].nlb;
+            }
+        }
+        qsort(v, cnt, sizeof(uint64_t), u64_cmp);
+        rc = fit_sizes(om, v, cnt);
+
+        cnt = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            if (io[i].opc == om->opc && io[i].completed) {
+                v[cnt++] = io[i].lat;
+            }
+        }
+        fit_quantiles(v, cnt, om->lat_q);
+    }
+    free(v);
+    return rc ? rc : fit_qd(lm, io, n);
+}
+
+static int
+fit_model(struct model *m)
+{
+    struct bin_file_data *chunk = NULL;
+    struct io_rec *sub = NULL;
+    uint64_t entry_cnt, sub_cnt = 0, first = UINT64_MAX, last = 0, done = 0;
+    FILE *fptr;
+    int rc = 0;
+
+    fptr = fopen(g_input_file, "rb");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open input file %s\n", g_input_file);
+        return -ENOENT;
+    }
+    fseeko(fptr, 0, SEEK_END);
+    entry_cnt = (uint64_t)ftello(fptr) / sizeof(struct bin_file_data);
+    rewind(fptr);
+
+    memset(m, 0, sizeof(*m));
+    chunk = (struct bin_file_data *)malloc(LOAD_CHUNK * sizeof(struct bin_file_data));
+    sub = (struct io_rec *)calloc(entry_cnt + 1, sizeof(struct io_rec));
+    if (chunk == NULL || sub == NULL) {
+        fprintf(stderr, "Fail to allocate memory for trace\n");
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    /* submits first, completions are joined in a second pass over the file */
+    for (int pass = 0; pass < 2; pass++) {
+        rewind(fptr);
+        for (done = 0; done < entry_cnt;) {
+            size_t want = (size_t)spdk_min(entry_cnt - done, LOAD_CHUNK);
+
+            if (fread(chunk, sizeof(struct bin_file_data), want, fptr) != want) {
+                fprintf(stderr, "Fail to read input file\n");
+                rc = -EIO;
+                goto out;
+            }
+            for (size_t i = 0; i < want; i++) {
+                const struct bin_file_data *d = &chunk[i];
+
+                m->tsc_rate = m->tsc_rate ? m->tsc_rate : d->tsc_rate;
+                if (pass == 0 && strcmp(d->tpoint_name, "NVME_IO_SUBMIT") == 0) {
+                    struct io_rec *r = &sub[sub_cnt++];
+
+                    r->obj_id = d->obj_id;
+                    r->obj_start = d->obj_start;
+                    r->lcore = d->lcore;
+                    r->nsid = d->nsid;
+                    r->opc = (uint8_t)d->opc;
+                    r->slba = (uint64_t)d->cdw10 | ((uint64_t)d->cdw11 & UINT32BIT_MASK) << 32;
+                    r->nlb = (d->cdw12 & UINT16BIT_MASK) + 1;
+                    if (opc_has_lba(r->opc)) {
+                        m->ns_blocks = spdk_max(m->ns_blocks, r->slba + r->nlb);
+                    }
+                    first = spdk_min(first, r->obj_start);
+                    last = spdk_max(last, r->obj_start);
+                } else if (pass == 1 && strcmp(d->tpoint_name, "NVME_IO_COMPLETE") == 0) {
+                    struct io_rec key = { .obj_id = d->obj_id, .obj_start = d->obj_start };
+                    struct io_rec *r = (struct io_rec *)bsearch(&key, sub, sub_cnt, sizeof(struct io_rec),
+                                       io_rec_key_cmp);
+
+                    if (r) {
+                        r->lat = d->tsc_sc_time;
+                        r->completed = true;
+                    }
+                }
+            }
+            done += want;
+        }
+        if (pass == 0) {
+            qsort(sub, sub_cnt, sizeof(struct io_rec), io_rec_key_cmp);
+        }
+    }
+
+    if (sub_cnt < 2 || !m->tsc_rate) {
+        fprintf(stderr, "Too few submissions to fit a model\n");
+        rc = -EINVAL;
+        goto out;
+    }
+    m->duration = last - first;
+    m->ns_blocks = g_ns_blocks ? g_ns_blocks : spdk_max(m->ns_blocks, 1);
+
+    qsort(sub, sub_cnt, sizeof(struct io_rec), io_rec_time_cmp);
+    for (uint64_t i = 0; i < sub_cnt;) {
+        uint64_t j = i;
+
+        while (j < sub_cnt && sub[j].lcore == sub[i].lcore) {
+            j++;
+        }
+        m->lcore_n += j - i > 1;
+        i = j;
+    }
+    m->lcore = (struct lcore_model *)calloc(m->lcore_n + 1, sizeof(struct lcore_model));
+    if (m->lcore == NULL) {
+        fprintf(stderr, "Fail to allocate memory for lcore models\n");
+        rc = -ENOMEM;
+        goto out;
+    }
+    for (uint64_t i = 0, l = 0; i < sub_cnt && !rc;) {
+        uint64_t j = i;
+
+        while (j < sub_cnt && sub[j].lcore == sub[i].lcore) {
+            j++;
+        }
+        /* one submit has no arrival process to fit */
+        if (j - i > 1) {
+            rc = fit_lcore(m, &m->lcore[l++], &sub[i], j - i);
+        }
+        i = j;
+    }
+
+out:
+    free(chunk);
+    free(sub);
+    fclose(fptr);
+    return rc;
+}
+/* model fit end */
+
+/* model file start */
+static void
+write_u64_list(FILE *f, const char *name, const uint64_t *v, uint32_t n)
+{
+    fprintf(f, "%s", name);
+    for (uint32_t i = 0; i < n; i++) {
+        fprintf(f, " %ju", v[i]);
+    }
+    fprintf(f, "\n");
+}
+
+static int
+write_model(const struct model *m)
+{
+    FILE *f = fopen(g_model_file, "w");
+
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open model file %s\n", g_model_file);
+        return -errno;
+    }
+    fprintf(f, "trace_io_synth_model %d\n", MODEL_VERSION);
+    fprintf(f, "tsc_rate %ju\nduration %ju\nns_blocks %ju\nlcores %u\n",
+            m->tsc_rate, m->duration, m->ns_blocks, m->lcore_n);
+    for (uint32_t l = 0; l < m->lcore_n; l++) {
+        const struct lcore_model *lm = &m->lcore[l];
+
+        fprintf(f, "lcore %u nsid %u ios %ju qd_max %u qd_avg %.3f opcs %u\n",
+                lm->lcore, lm->nsid, lm->ios, lm->qd_max, lm->qd_avg, lm->opc_n);
+        write_u64_list(f, "gap", lm->gap_q, MODEL_QUANTILES + 1);
+        for (uint32_t k = 0; k < lm->opc_n; k++) {
+            const struct opc_model *om = &lm->opc[k];
+
+            fprintf(f, "opc %u count %ju seq %.6f sizes %u", om->opc, om->cnt, om->seq, om->size_n);
+            for (uint32_t s = 0; s < om->size_n; s++) {
+                fprintf(f, " %u %ju", om->size_nlb[s], om->size_cnt[s]);
+            }
+            fprintf(f, "\n");
+            write_u64_list(f, "regions", om->region_cnt, MODEL_REGIONS);
+            write_u64_list(f, "lat", om->lat_q, MODEL_QUANTILES + 1);
+        }
+    }
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write model file %s\n", g_model_file);
+        return -EIO;
+    }
+    return 0;
+}
+
+static bool
+read_key(FILE *f, const char *key)
+{
+    char tok[64];
+
+    return fscanf(f, "%63s", tok) == 1 && strcmp(tok, key) == 0;
+}
+
+static bool
+read_u64_list(FILE *f, const char *name, uint64_t *v, uint32_t n)
+{
+    if (!read_key(f, name)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (fscanf(f, "%" SCNu64, &v[i]) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int
+read_model(struct model *m)
+{
+    FILE *f = fopen(g_model_file, "r");
+    int version = 0;
+    bool ok;
+
+    memset(m, 0, sizeof(*m));
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open model file %s\n", g_model_file);
+        return -ENOENT;
+    }
+    ok = read_key(f, "trace_io_synth_model") && fscanf(f, "%d", &version) == 1 && version == MODEL_VERSION &&
+         read_key(f, "tsc_rate") && fscanf(f, "%" SCNu64, &m->tsc_rate) == 1 &&
+         read_key(f, "duration") && fscanf(f, "%" SCNu64, &m->duration) == 1 &&
+         read_key(f, "ns_blocks") && fscanf(f, "%" SCNu64, &m->ns_blocks) == 1 &&
+         read_key(f, "lcores") && fscanf(f, "%u", &m->lcore_n) == 1;
+    if (ok) {
+        m->lcore = (struct lcore_model *)calloc(m->lcore_n + 1, sizeof(struct lcore_model));
+        ok = m->lcore != NULL;
+    }
+    for (uint32_t l = 0; ok && l < m->lcore_n; l++) {
+        struct lcore_model *lm = &m->lcore[l];
+        uint64_t opc_cnt = 0;
+
+        ok = read_key(f, "lcore") && fscanf(f, "%u", &lm->lcore) == 1 &&
+             read_key(f, "nsid") && fscanf(f, "%u", &lm->nsid) == 1 &&
+             read_key(f, "ios") && fscanf(f, "%" SCNu64, &lm->ios) == 1 &&
+             read_key(f, "qd_max") && fscanf(f, "%u", &lm->qd_max) == 1 &&
+             read_key(f, "qd_avg") && fscanf(f, "%lf", &lm->qd_avg) == 1 &&
+             read_key(f, "opcs") && fscanf(f, "%u", &lm->opc_n) == 1 && lm->opc_n <= MODEL_OPCS &&
+             read_u64_list(f, "gap", lm->gap_q, MODEL_QUANTILES + 1);
+        for (uint32_t k = 0; ok && k < lm->opc_n; k++) {
+            struct opc_model *om = &lm->opc[k];
+            uint64_t size_cnt = 0;
+            unsigned opc;
+
+            ok = read_key(f, "opc") && fscanf(f, "%u", &opc) == 1 &&
+                 read_key(f, "count") && fscanf(f, "%" SCNu64, &om->cnt) == 1 &&
+                 read_key(f, "seq") && fscanf(f, "%lf", &om->seq) == 1 &&
+                 read_key(f, "sizes") && fscanf(f, "%u", &om->size_n) == 1 && om->size_n <= MODEL_SIZES;
+            om->opc = (uint8_t)opc;
+            for (uint32_t s = 0; ok && s < om->size_n; s++) {
+                ok = fscanf(f, "%u %" SCNu64, &om->size_nlb[s], &om->size_cnt[s]) == 2;
+                size_cnt += om->size_cnt[s];
+            }
+            ok = ok && read_u64_list(f, "regions", om->region_cnt, MODEL_REGIONS) &&
+                 read_u64_list(f, "lat", om->lat_q, MODEL_QUANTILES + 1);
+            /* opcodes and sizes are drawn in proportion to their counts, some must be there */
+            if (ok && om->size_n && !size_cnt) {
+                fprintf(stderr, "Model: opc %u of lcore %u has sizes but no count for any\n", opc, lm->lcore);
+                ok = false;
+            }
+            opc_cnt += om->cnt;
+        }
+        if (ok && !opc_cnt) {
+            fprintf(stderr, "Model: lcore %u has no opcode with a count\n", lm->lcore);
+            ok = false;
+        }
+    }
+    fclose(f);
+    if (!ok || !m->tsc_rate || !m->ns_blocks) {
+        fprintf(stderr, "Model file %s is not valid\n", g_model_file);
+        free(m->lcore);
+        m->lcore = NULL;
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void
+print_model(const struct model *m)
+{
+    printf("Model: %u lcores  %.3f s  %ju blocks\n", m->lcore_n, (double)m->duration / m->tsc_rate,
+            m->ns_blocks);
+    for (uint32_t l = 0; l < m->lcore_n; l++) {
+        const struct lcore_model *lm = &m->lcore[l];
+
+        printf("  lcore %-4u I/O: %-12ju IOPS: %-12.1f QD avg: %-8.3f max: %-6u opcodes: %u\n",
+                lm->lcore, lm->ios, m->duration ? (double)lm->ios * m->tsc_rate / m->duration : 0.0,
+                lm->qd_avg, lm->qd_max, lm->opc_n);
+    }
+}
+/* model file end */
+
+/* generator start */
+/*
+ * The run is cut into time slices that are generated independently on the
+ * worker threads and written out in order.  Every lcore starts a slice
+ * with an empty queue and no sequential run, so slices share no state;
+ * with SLICE_IOS submits per slice the seams are negligible.  Within a
+ * slice records are in time order, only completions of the last I/O of a
+ * slice may land after the first records of the next one.
+ */
+static const char g_tpoint_submit[32] = "NVME_IO_SUBMIT";
+static const char g_tpoint_complete[32] = "NVME_IO_COMPLETE";
+
+struct gen_opc {
+    uint64_t cnt_cum;
+    uint64_t size_cum[MODEL_SIZES];
+    uint64_t region_cum[MODEL_REGIONS];
+};
+
+struct gen_lcore {
+    const struct lcore_model *lm;
+    struct gen_opc opc[MODEL_OPCS];
+    /* per slice */
+    uint64_t next;              /* time of the next submit */
+    uint32_t qd_cap;            /* 0 = no limit */
+    uint32_t outstanding;
+    bool     blocked;           /* at qd_cap, waits for a completion */
+    uint16_t cid;
+    uint64_t prev_end[MODEL_OPCS];
+};
+
+struct gen_cpl {
+    uint64_t tsc;
+    uint64_t obj_id;
+    uint64_t obj_start;
+    uint32_t lcore;             /* index into the lcore states */
+    uint16_t cid;
+};
+
+struct gen_slot {
+    struct bin_file_data *rec;
+    uint64_t cnt;
+    uint64_t size;
+    uint64_t slice;             /* slice held by the slot, UINT64_MAX while empty */
+    int      rc;
+};
+
+struct gen_ctx {
+    const struct model *m;
+    uint64_t slice_tsc;
+    uint64_t slice_cnt;
+    uint64_t end;               /* last submit time of the run */
+    uint64_t ns_blocks;
+    uint32_t thread_cnt;
+    uint32_t slot_cnt;
+    struct gen_slot *slot;
+    uint64_t written;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct gen_worker {
+    struct gen_ctx *ctx;
+    uint32_t id;
+};
+
+static inline uint64_t
+rng_next(uint64_t *s)
+{
+    /* splitmix64 */
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline double
+rng_unit(uint64_t *s)
+{
+    return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Index drawn from a cumulative count array */
+static inline uint32_t
+rng_pick(uint64_t *s, const uint64_t *cum, uint32_t n)
+{
+    uint64_t x = rng_next(s) % cum[n - 1];
+    uint32_t lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (cum[mid] > x) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/* Sample an inverse CDF, linear between the stored quantiles */
+static inline uint64_t
+rng_quantile(uint64_t *s, const uint64_t *q)
+{
+    double x = rng_unit(s) * MODEL_QUANTILES;
+    uint32_t i = (uint32_t)x;
+
+    return q[i] + (uint64_t)((double)(q[i + 1] - q[i]) * (x - i));
+}
+
+static void
+gen_cpl_push(struct gen_cpl *heap, uint64_t *n, struct gen_cpl c)
+{
+    uint64_t i = (*n)++;
+
+    while (i && heap[(i - 1) / 2].tsc > c.tsc) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = c;
+}
+
+static struct gen_cpl
+gen_cpl_pop(struct gen_cpl *heap, uint64_t *n)
+{
+    struct gen_cpl top = heap[0], last = heap[--(*n)];
+    uint64_t i = 0;
+
+    for (;;) {
+        uint64_t c = i * 2 + 1;
+
+        if (c >= *n) {
+            break;
+        }
+        if (c + 1 < *n && heap[c + 1].tsc < heap[c].tsc) {
+            c++;
+        }
+        if (heap[c].tsc >= last.tsc) {
+            break;
+        }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static int
+gen_emit(struct gen_slot *s, const struct bin_file_data *d)
+{
+    if (s->cnt == s->size) {
+        uint64_t size = s->size ? s->size * 2 : SLICE_IOS * 4;
+        struct bin_file_data *rec = (struct bin_file_data *)realloc(s->rec, size * sizeof(struct bin_file_data));
+
+        if (rec == NULL) {
+            fprintf(stderr, "Fail to allocate memory for generated records\n");
+            return -ENOMEM;
+        }
+        s->rec = rec;
+        s->size = size;
+    }
+    s->rec[s->cnt++] = *d;
+    return 0;
+}
+
+static int
+gen_slice(struct gen_ctx *ctx, uint64_t slice, struct gen_slot *s)
+{
+    const struct model *m = ctx->m;
+    struct gen_lcore *g = (struct gen_lcore *)calloc(m->lcore_n, sizeof(struct gen_lcore));
+    struct gen_cpl *heap = NULL;
+    uint64_t heap_n = 0, heap_size = 0, obj = 0;
+    uint64_t start = slice * ctx->slice_tsc, end = spdk_min(start + ctx->slice_tsc, ctx->end);
+    uint64_t rng = g_seed ^ (slice * 0xd1b54a32d192ed03ULL);
+    int rc = 0;
+
+    s->cnt = 0;
+    if (g == NULL) {
+        fprintf(stderr, "Fail to allocate memory for generator state\n");
+        return -ENOMEM;
+    }
+    for (uint32_t l = 0; l < m->lcore_n; l++) {
+        const struct lcore_model *lm = &m->lcore[l];
+
+        g[l].lm = lm;
+        /* Little's law: the same latency at N x the rate needs N x the queue depth */
+        g[l].qd_cap = (uint32_t)spdk_min(ceil(lm->qd_max * g_rate_mult), (double)UINT32_MAX);
+        g[l].next = start + (uint64_t)(rng_quantile(&rng, lm->gap_q) * rng_unit(&rng) / g_rate_mult);
+        for (uint32_t k = 0; k < lm->opc_n; k++) {
+            const struct opc_model *om = &lm->opc[k];
+
+            g[l].opc[k].cnt_cum = (k ? g[l].opc[k - 1].cnt_cum : 0) + om->cnt;
+            for (uint32_t i = 0; i < om->size_n; i++) {
+                g[l].opc[k].size_cum[i] = (i ? g[l].opc[k].size_cum[i - 1] : 0) + om->size_cnt[i];
+            }
+            for (uint32_t i = 0; i < MODEL_REGIONS; i++) {
+                g[l].opc[k].region_cum[i] = (i ? g[l].opc[k].region_cum[i - 1] : 0) + om->region_cnt[i];
+            }
+        }
+    }
+
+    for (;;) {
+        struct gen_lcore *due = NULL;
+        struct bin_file_data d = {};
+        uint32_t li = 0;
+
+        for (uint32_t l = 0; l < m->lcore_n; l++) {
+            if (!g[l].blocked && g[l].next < end && (due == NULL || g[l].next < due->next)) {
+                due = &g[l];
+                li = l;
+            }
+        }
+        if (due == NULL && heap_n == 0) {
+            break;
+        }
+
+        d.tsc_rate = m->tsc_rate;
+        if (heap_n && (due == NULL || heap[0].tsc <= due->next)) {
+            struct gen_cpl c = gen_cpl_pop(heap, &heap_n);
+            struct gen_lcore *cg = &g[c.lcore];
+
+            d.lcore = cg->lm->lcore;
+            d.tsc_timestamp = c.tsc;
+            d.obj_id = c.obj_id;
+            d.obj_start = c.obj_start;
+            d.tsc_sc_time = c.tsc - c.obj_start;
+            memcpy(d.tpoint_name, g_tpoint_complete, sizeof(d.tpoint_name));
+            d.cid = c.cid;
+            d.cpl = 1;  /* phase bit, success */
+            cg->outstanding--;
+            if (cg->blocked) {
+                cg->blocked = false;
+                cg->next = spdk_max(cg->next, c.tsc);
+            }
+            rc = gen_emit(s, &d);
+        } else if (due->qd_cap && due->outstanding >= due->qd_cap) {
+            due->blocked = true;
+        } else {
+            const struct lcore_model *lm = due->lm;
+            uint64_t cum[MODEL_OPCS];
+            uint32_t k, nlb = 1;
+            uint64_t slba = 0, lat;
+
+            for (k = 0; k < lm->opc_n; k++) {
+                cum[k] = due->opc[k].cnt_cum;
+            }
+            k = rng_pick(&rng, cum, lm->opc_n);
+            if (opc_has_lba(lm->opc[k].opc)) {
+                const struct opc_model *om = &lm->opc[k];
+
+                if (om->size_n) {
+                    nlb = om->size_nlb[rng_pick(&rng, due->opc[k].size_cum, om->size_n)];
+                }
+                nlb = (uint32_t)spdk_min(nlb, ctx->ns_blocks);
+                if (due->prev_end[k] && rng_unit(&rng) < om->seq && due->prev_end[k] + nlb <= ctx->ns_blocks) {
+                    slba = due->prev_end[k];
+                } else if (due->opc[k].region_cum[MODEL_REGIONS - 1]) {
+                    uint32_t r = rng_pick(&rng, due->opc[k].region_cum, MODEL_REGIONS);
+                    uint64_t lo = ctx->ns_blocks * r / MODEL_REGIONS;
+                    uint64_t hi = ctx->ns_blocks * (r + 1) / MODEL_REGIONS;
+
+                    slba = lo + rng_next(&rng) % spdk_max(hi - lo, 1);
+                }
+                slba = spdk_min(slba, ctx->ns_blocks - nlb);
+                due->prev_end[k] = slba + nlb;
+            }
+            lat = spdk_max(rng_quantile(&rng, lm->opc[k].lat_q), 1);
+
+            d.lcore = lm->lcore;
+            d.tsc_timestamp = due->next;
+            d.obj_id = slice << 32 | obj++;
+            d.obj_start = due->next;
+            memcpy(d.tpoint_name, g_tpoint_submit, sizeof(d.tpoint_name));
+            d.opc = lm->opc[k].opc;
+            d.cid = due->cid++;
+            d.nsid = lm->nsid;
+            d.cdw10 = (uint32_t)slba;
+            d.cdw11 = (uint32_t)(slba >> 32);
+            d.cdw12 = (nlb - 1) & UINT16BIT_MASK;
+            rc = gen_emit(s, &d);
+
+            if (heap_n == heap_size) {
+                uint64_t size = heap_size ? heap_size * 2 : 1024;
+                struct gen_cpl *tmp = (struct gen_cpl *)realloc(heap, size * sizeof(struct gen_cpl));
+
+                if (tmp == NULL) {
+                    fprintf(stderr, "Fail to allocate memory for generator state\n");
+                    rc = -ENOMEM;
+                    break;
+                }
+                heap = tmp;
+                heap_size = size;
+            }
+            gen_cpl_push(heap, &heap_n, (struct gen_cpl) { due->next + lat, d.obj_id, d.obj_start, li, d.cid });
+            due->outstanding++;
+            due->next += (uint64_t)(rng_quantile(&rng, lm->gap_q) / g_rate_mult);
+        }
+        if (rc) {
+            break;
+        }
+    }
+
+    free(heap);
+    free(g);
+    return rc;
+}
+
+static void *
+gen_worker_fn(void *arg)
+{
+    struct gen_worker *w = (struct gen_worker *)arg;
+    struct gen_ctx *ctx = w->ctx;
+
+    for (uint64_t c = w->id; c < ctx->slice_cnt; c += ctx->thread_cnt) {
+        struct gen_slot *s = &ctx->slot[c % ctx->slot_cnt];
+        int rc;
+
+        /* the slot is free once the slice slot_cnt before this one is out */
+        pthread_mutex_lock(&ctx->lock);
+        while (!ctx->stop && c >= ctx->written + ctx->slot_cnt) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+        if (ctx->stop) {
+            break;
+        }
+
+        rc = gen_slice(ctx, c, s);
+
+        pthread_mutex_lock(&ctx->lock);
+        s->rc = rc;
+        s->slice = c;
+        pthread_cond_broadcast(&ctx->cond);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    return NULL;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int
+generate(const struct model *m)
+{
+    struct gen_ctx ctx = {};
+    struct gen_worker worker[MAX_THREADS];
+    pthread_t tid[MAX_THREADS];
+    uint64_t ios = 0, records = 0;
+    uint32_t started = 0;
+    struct timespec t0, t1;
+    double rate, secs;
+    int fd, rc = 0;
+
+    for (uint32_t l = 0; l < m->lcore_n; l++) {
+        ios += m->lcore[l].ios;
+    }
+    if (!ios || !m->duration) {
+        fprintf(stderr, "Model has no arrival rate\n");
+        return -EINVAL;
+    }
+
+    /* submits per tsc of the whole run; slices hold SLICE_IOS of them */
+    rate = (double)ios / m->duration * g_rate_mult;
+    ctx.m = m;
+    ctx.end = (uint64_t)(m->duration * g_duration_mult);
+    ctx.slice_tsc = spdk_max((uint64_t)(SLICE_IOS / rate), 1);
+    ctx.slice_cnt = ctx.end / ctx.slice_tsc + 1;
+    ctx.ns_blocks = g_ns_blocks ? g_ns_blocks : m->ns_blocks;
+    ctx.thread_cnt = g_threads ? g_threads : (uint32_t)spdk_max(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    ctx.thread_cnt = (uint32_t)spdk_min(spdk_min(ctx.thread_cnt, MAX_THREADS), ctx.slice_cnt);
+    ctx.slot_cnt = ctx.thread_cnt * 2;
+    ctx.slot = (struct gen_slot *)calloc(ctx.slot_cnt, sizeof(struct gen_slot));
+    if (ctx.slot == NULL) {
+        fprintf(stderr, "Fail to allocate memory for generator slots\n");
+        return -ENOMEM;
+    }
+    for (uint32_t s = 0; s < ctx.slot_cnt; s++) {
+        ctx.slot[s].slice = UINT64_MAX;
+    }
+
+    fd = open(g_output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open output file %s\n", g_output_file);
+        free(ctx.slot);
+        return -errno;
+    }
+
+    printf("Generating %.3f s at %.2f x rate on %ju blocks, %u threads\n",
+            (double)ctx.end / m->tsc_rate, g_rate_mult, ctx.ns_blocks, ctx.thread_cnt);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+    for (uint32_t t = 0; t < ctx.thread_cnt; t++) {
+        worker[t] = (struct gen_worker) { &ctx, t };
+        if (pthread_create(&tid[t], NULL, gen_worker_fn, &worker[t]) != 0) {
+            fprintf(stderr, "Failed to start generator threads\n");
+            rc = -EAGAIN;
+            break;
+        }
+        started++;
+    }
+
+    for (uint64_t c = 0; rc == 0 && c < ctx.slice_cnt; c++) {
+        struct gen_slot *s = &ctx.slot[c % ctx.slot_cnt];
+
+        pthread_mutex_lock(&ctx.lock);
+        while (s->slice != c) {
+            pthread_cond_wait(&ctx.cond, &ctx.lock);
+        }
+        pthread_mutex_unlock(&ctx.lock);
+
+        rc = s->rc ? s->rc : write_all(fd, s->rec, s->cnt * sizeof(struct bin_file_data));
+        records += s->cnt;
+
+        pthread_mutex_lock(&ctx.lock);
+        ctx.written++;
+        pthread_cond_broadcast(&ctx.cond);
+        pthread_mutex_unlock(&ctx.lock);
+    }
+
+    if (rc) {
+        pthread_mutex_lock(&ctx.lock);
+        ctx.stop = true;
+        pthread_cond_broadcast(&ctx.cond);
+        pthread_mutex_unlock(&ctx.lock);
+    }
+    for (uint32_t t = 0; t < started; t++) {
+        pthread_join(tid[t], NULL);
+    }
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+    if (close(fd) != 0 && rc == 0) {
+        rc = -errno;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (rc == 0) {
+        printf("Wrote %ju records to %s in %.3f s (%.1f M records/s)\n",
+                records, g_output_file, secs, secs ? records / secs / 1e6 : 0.0);
+    } else {
+        fprintf(stderr, "Failed to generate %s\n", g_output_file);
+    }
+
+    for (uint32_t s = 0; s < ctx.slot_cnt; s++) {
+        free(ctx.slot[s].rec);
+    }
+    free(ctx.slot);
+    return rc;
+}
+/* generator end */
+
+static void
+usage(const char *program_name)
+{
+    printf("usage:\n");
+    printf("   %s <options>\n", program_name);
+    printf("\n");
+    printf("   fit:      %s -f <trace> -m <model>\n", program_name);
+    printf("   generate: %s -m <model> -o <trace> [-r N] [-D N] [-N blocks] [-T threads]\n", program_name);
+    printf("\n");
+    printf("         '-f' specify the input file which generated by trace_io_record\n");
+    printf("         '-m' specify the model file to write (with -f) or to read\n");
+    printf("         '-o' specify the synthetic trace to write\n");
+    printf("         '-r' to scale the arrival rate (default: 1)\n");
+    printf("         '-D' to scale the duration (default: 1)\n");
+    printf("         '-N' to specify the namespace size in blocks (default: the captured LBA span)\n");
+    printf("         '-T' to specify the number of generator threads (default: number of CPUs)\n");
+    printf("         '-S' to specify the random seed (default: 1)\n");
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+    int op;
+
+    while ((op = getopt(argc, argv, "f:m:o:r:D:N:T:S:")) != -1) {
+        switch (op) {
+        case 'f':
+            snprintf(g_input_file, sizeof(g_input_file), "%s", optarg);
+            break;
+        case 'm':
+            snprintf(g_model_file, sizeof(g_model_file), "%s", optarg);
+            break;
+        case 'o':
+            snprintf(g_output_file, sizeof(g_output_file), "%s", optarg);
+            break;
+        case 'r':
+            g_rate_mult = strtod(optarg, NULL);
+            break;
+        case 'D':
+            g_duration_mult = strtod(optarg, NULL);
+            break;
+        case 'N':
+            g_ns_blocks = strtoull(optarg, NULL, 0);
+            break;
+        case 'T':
+            g_threads = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            g_seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!g_model_file[0] || (!g_input_file[0] == !g_output_file[0])) {
+        fprintf(stderr, "-m and one of -f or -o must be specified\n");
+        usage(argv[0]);
+        return 1;
+    }
+    if (g_rate_mult <= 0 || g_duration_mult <= 0) {
+        fprintf(stderr, "-r and -D must be positive\n");
+        usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct model m;
+    int rc;
+
+    rc = parse_args(argc, argv);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (g_input_file[0]) {
+        rc = fit_model(&m);
+        if (rc == 0) {
+            rc = write_model(&m);
+        }
+        if (rc == 0) {
+            print_model(&m);
+            printf("Model written to %s\n", g_model_file);
+        }
+    } else {
+        rc = read_model(&m);
+        if (rc == 0) {
+            print_model(&m);
+            rc = generate(&m);
+        }
+    }
+
+    free(m.lcore);
+    return rc ? 1 : 0;
+}